@@ -0,0 +1,271 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Entry point for dcp-consolidate. A full run of dcp followed by incremental
+ * runs, each given the outputs before it with --input, leaves a chain of
+ * outputs that together describe the tree. dcp-consolidate merges the chain
+ * into the single output a full run would have written, to give to the next
+ * run instead of the whole chain.
+ *
+ *      dcp-consolidate [-s] [-m MIB] [-o FILE] OUTPUT...
+ *
+ * The outputs are given oldest first. Each is read in pathmd5 order, @see
+ * io_sort.h, and they are merged in a single pass: for every path the entry of
+ * the newest output wins, the last one when an output has several, and a path
+ * whose newest entry is DELETED is left out. The result is in pathmd5 order so
+ * it can be merged or compared again without sorting, @see dcp-diff.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io/io_metadata.h"
+#include "io/io_sort.h"
+#include "logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+#define USAGE "usage: dcp-consolidate [-s] [-m MIB] [-o FILE] OUTPUT...\n"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * one of the outputs of the chain and its next entry
+ */
+struct link {
+    const char *path;
+    io_sort_t *sort;
+    const entry_t *entry;
+    const char *line;
+    size_t len;
+};
+
+
+/**
+ * the outputs with an entry left, the one to take next first
+ */
+struct heap {
+    struct link *links;
+    size_t *order;
+    size_t count;
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Move the link on top of `heap` to its next entry.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int heap_next(struct heap *heap);
+
+
+/**
+ * restore the heap property below `i`
+ */
+static void sift_down(struct heap *heap, size_t i);
+
+
+/**
+ * @return          whether the entry of link `a` is taken before the one of `b`
+ */
+static int link_less(const struct heap *heap, size_t a, size_t b);
+
+
+/* Main ***********************************************************************/
+
+
+int main(int argc, char *argv[])
+{
+    struct heap heap;
+    struct link *link;
+    const char **paths;
+    const char *outpath;
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];
+    char *line;
+    size_t len;
+    size_t cap;
+    size_t memory;
+    size_t count;
+    size_t i;
+    int sorted;
+    int deleted;
+    int c;
+    int r;
+    char *end;
+    FILE *out;
+
+    outpath = NULL;
+    memory = IO_SORT_MEMORY;
+    sorted = 0;
+    while ((c = getopt(argc, argv, "sm:o:D")) != -1)
+    {
+        switch (c)
+        {
+        case 's': sorted = 1;                   break;
+        case 'o': outpath = optarg;             break;
+        case 'D': logging_debug_mode = 1;       break;
+        case 'm':
+            memory = strtoul(optarg, &end, 10) * 1024 * 1024;
+            if (*end != '\0' || memory == 0)
+                log_critx(EXIT_FAILURE, "invalid memory size: '%s'", optarg);
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    count = argc - optind;
+    if (count == 0)
+    {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+
+    heap.links = calloc(count, sizeof(struct link));
+    heap.order = calloc(count, sizeof(size_t));
+    paths = calloc(count, sizeof(char *));
+    if (heap.links == NULL || heap.order == NULL || paths == NULL)
+        log_critx(EXIT_FAILURE, "cannot allocate %zu outputs", count);
+
+    /* the first entry of each output, an empty one takes no part */
+    heap.count = 0;
+    for (i = 0; i < count; i++)
+    {
+        link = &heap.links[i];
+        link->path = paths[i] = argv[optind + i];
+        if (io_sort_open(&link->sort, link->path, memory, sorted) != 0)
+            return EXIT_FAILURE;
+        if ((r = io_sort_next(link->sort, &link->entry, &link->line,
+                &link->len)) == -1)
+            return EXIT_FAILURE;
+        if (r == 1)
+            heap.order[heap.count++] = i;
+    }
+    for (i = heap.count / 2; i > 0; i--)
+        sift_down(&heap, i - 1);
+
+    out = stdout;
+    if (outpath != NULL && (out = fopen(outpath, "w")) == NULL)
+        log_crit(EXIT_FAILURE, "cannot open '%s'", outpath);
+
+    io_metadata_put("File Generated by dcp-consolidate DO NOT EDIT", NULL, out);
+    io_metadata_put_json("chain      ", count, paths, out);
+
+    line = NULL;
+    cap = 0;
+    r = 0;
+    while (r == 0 && heap.count > 0)
+    {
+        /* the entries of a path come oldest first, the last one wins */
+        memcpy(pathmd5, heap.links[heap.order[0]].entry->pathmd5,
+                sizeof(pathmd5));
+        do {
+            link = &heap.links[heap.order[0]];
+            if (link->len > cap)
+            {
+                cap = link->len;
+                if ((line = realloc(line, cap)) == NULL)
+                    log_critx(EXIT_FAILURE, "cannot allocate a line of %zu "
+                            "bytes", cap);
+            }
+            memcpy(line, link->line, link->len);
+            len = link->len;
+            deleted = link->entry->deleted;
+
+            if (heap_next(&heap) != 0)
+                r = -1;
+        } while (r == 0 && heap.count > 0 && memcmp(pathmd5,
+                heap.links[heap.order[0]].entry->pathmd5, sizeof(pathmd5))
+                == 0);
+
+        if (r == 0 && !deleted && fwrite(line, 1, len, out) != len)
+        {
+            log_error("cannot write '%s'", outpath == NULL? "stdout" : outpath);
+            r = -1;
+        }
+    }
+
+    if (fclose(out) != 0 && r == 0)
+        log_crit(EXIT_FAILURE, "cannot write '%s'",
+                outpath == NULL? "stdout" : outpath);
+
+    for (i = 0; i < count; i++)
+        io_sort_close(heap.links[i].sort);
+    free(line);
+    free(paths);
+    free(heap.order);
+    free(heap.links);
+    return r == 0? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int heap_next(struct heap *heap)
+{
+    struct link *link;
+    int r;
+
+    link = &heap->links[heap->order[0]];
+    if ((r = io_sort_next(link->sort, &link->entry, &link->line, &link->len))
+            == -1)
+        return -1;
+
+    if (r == 0)
+        heap->order[0] = heap->order[--heap->count];
+    sift_down(heap, 0);
+    return 0;
+}
+
+
+void sift_down(struct heap *heap, size_t i)
+{
+    size_t least;
+    size_t child;
+    size_t tmp;
+
+    for (;;)
+    {
+        least = i;
+        child = 2 * i + 1;
+        if (child < heap->count &&
+                link_less(heap, heap->order[child], heap->order[least]))
+            least = child;
+        if (child + 1 < heap->count &&
+                link_less(heap, heap->order[child + 1], heap->order[least]))
+            least = child + 1;
+        if (least == i)
+            return;
+
+        tmp = heap->order[i];
+        heap->order[i] = heap->order[least];
+        heap->order[least] = tmp;
+        i = least;
+    }
+}
+
+
+int link_less(const struct heap *heap, size_t a, size_t b)
+{
+    int c;
+
+    c = memcmp(heap->links[a].entry->pathmd5, heap->links[b].entry->pathmd5,
+            MD5_DIGEST_LENGTH);
+
+    /* an older output first so the newest entry is taken last */
+    return c < 0 || (c == 0 && a < b);
+}
@@ -0,0 +1,355 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Entry point for dcp-diff. Compares two outputs of dcp, manifests of the same
+ * tree taken at different times, and reports what was added, removed or
+ * changed from OLD to NEW. Both are read in pathmd5 order, @see io_sort.h, and
+ * joined in a single pass, so only the sort buffers are held in memory however
+ * many entries they have. When a manifest has more than one entry for a path
+ * the last one is used, DELETED entries are taken as no entry.
+ *
+ *      dcp-diff [-s] [-m MIB] [-o FILE] OLD NEW
+ *
+ * Each difference is the entry's line, from NEW unless it was removed, with
+ * "diff" set to "ADDED", "REMOVED" or "CHANGED". A changed entry lists what
+ * changed in "changes": "type", "size", "mtime" and "digest". Digests are
+ * compared when both entries have the same one, sizes unless they are
+ * directories.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <jansson.h>
+
+#include "io/io_entry.h"
+#include "io/io_metadata.h"
+#include "io/io_sort.h"
+#include "logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+#define USAGE "usage: dcp-diff [-s] [-m MIB] [-o FILE] OLD NEW\n"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * what can differ between two entries of a path
+ */
+enum change {
+    CHANGE_TYPE   = 1 << 0,
+    CHANGE_SIZE   = 1 << 1,
+    CHANGE_MTIME  = 1 << 2,
+    CHANGE_DIGEST = 1 << 3
+};
+
+
+/**
+ * one of the manifests compared
+ */
+struct side {
+    const char *path;
+    io_sort_t *sort;
+    entry_t entry;          /**< the newest entry of the current path */
+    char *line;
+    size_t len;
+    size_t cap;
+    int ahead;              /**< io_sort_next of the entry after it */
+    entry_t next;
+    char *nline;
+    size_t nlen;
+    size_t ncap;
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Move `side` to its next path.
+ *
+ * @return          1 when there is one, 0 at the end, -1 on failure
+ */
+static int advance(struct side *side);
+
+
+/**
+ * read the entry after the current path of `side` into its `next`
+ *
+ * @return          @see io_sort_next
+ */
+static int read_ahead(struct side *side);
+
+
+/**
+ * @return          a mask of @see change between `old` and `new`
+ */
+static int compare(const entry_t *old, const entry_t *new);
+
+
+/**
+ * Write the entry on `line` with `diff` and the `changes`.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int report(const char *diff, int changes, const char *line, FILE *out);
+
+
+/* Main ***********************************************************************/
+
+
+int main(int argc, char *argv[])
+{
+    struct side old;
+    struct side new;
+    const char *outpath;
+    size_t memory;
+    int sorted;
+    int ro;
+    int rn;
+    int cmp;
+    int changes;
+    int c;
+    int r;
+    char *end;
+    FILE *out;
+
+    outpath = NULL;
+    memory = IO_SORT_MEMORY;
+    sorted = 0;
+    while ((c = getopt(argc, argv, "sm:o:D")) != -1)
+    {
+        switch (c)
+        {
+        case 's': sorted = 1;                   break;
+        case 'o': outpath = optarg;             break;
+        case 'D': logging_debug_mode = 1;       break;
+        case 'm':
+            memory = strtoul(optarg, &end, 10) * 1024 * 1024;
+            if (*end != '\0' || memory == 0)
+                log_critx(EXIT_FAILURE, "invalid memory size: '%s'", optarg);
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+
+    memset(&old, 0, sizeof(old));
+    memset(&new, 0, sizeof(new));
+    old.path = argv[optind];
+    new.path = argv[optind + 1];
+    if (io_sort_open(&old.sort, old.path, memory, sorted) != 0 ||
+            io_sort_open(&new.sort, new.path, memory, sorted) != 0)
+        return EXIT_FAILURE;
+
+    out = stdout;
+    if (outpath != NULL && (out = fopen(outpath, "w")) == NULL)
+        log_crit(EXIT_FAILURE, "cannot open '%s'", outpath);
+
+    io_metadata_put("File Generated by dcp-diff DO NOT EDIT", NULL, out);
+    io_metadata_put_json("old        ", 1, &old.path, out);
+    io_metadata_put_json("new        ", 1, &new.path, out);
+
+    /* both are in pathmd5 order, the smaller path is only on its side */
+    old.ahead = read_ahead(&old);
+    new.ahead = read_ahead(&new);
+    ro = advance(&old);
+    rn = advance(&new);
+    r = ro == -1 || rn == -1? -1 : 0;
+    while (r == 0 && (ro == 1 || rn == 1))
+    {
+        if (ro != 1)
+            cmp = 1;
+        else if (rn != 1)
+            cmp = -1;
+        else
+            cmp = memcmp(old.entry.pathmd5, new.entry.pathmd5,
+                    sizeof(old.entry.pathmd5));
+
+        if (cmp < 0 || (cmp == 0 && new.entry.deleted))
+        {
+            if (!old.entry.deleted)
+                r = report("REMOVED", 0, old.line, out);
+        }
+        else if (cmp > 0 || old.entry.deleted)
+        {
+            if (!new.entry.deleted)
+                r = report("ADDED", 0, new.line, out);
+        }
+        else if ((changes = compare(&old.entry, &new.entry)) != 0)
+            r = report("CHANGED", changes, new.line, out);
+
+        if (cmp <= 0)
+            ro = advance(&old);
+        if (cmp >= 0)
+            rn = advance(&new);
+        if (ro == -1 || rn == -1)
+            r = -1;
+    }
+
+    if (fclose(out) != 0 && r == 0)
+        log_crit(EXIT_FAILURE, "cannot write '%s'",
+                outpath == NULL? "stdout" : outpath);
+
+    io_sort_close(old.sort);
+    io_sort_close(new.sort);
+    free(old.line);
+    free(old.nline);
+    free(new.line);
+    free(new.nline);
+    return r == 0? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int advance(struct side *side)
+{
+    char *tmp;
+    size_t cap;
+
+    if (side->ahead != 1)
+        return side->ahead;
+
+    /* the entries of a path are in the order they were written, the last one
+     * is the newest */
+    do {
+        io_entry_copy(&side->entry, &side->next);
+        tmp = side->line;
+        cap = side->cap;
+        side->line = side->nline;
+        side->len = side->nlen;
+        side->cap = side->ncap;
+        side->nline = tmp;
+        side->ncap = cap;
+
+        side->ahead = read_ahead(side);
+    } while (side->ahead == 1 && memcmp(side->entry.pathmd5,
+            side->next.pathmd5, sizeof(side->next.pathmd5)) == 0);
+
+    return side->ahead == -1? -1 : 1;
+}
+
+
+int read_ahead(struct side *side)
+{
+    const entry_t *entry;
+    const char *line;
+    size_t len;
+    char *tmp;
+    int r;
+
+    if ((r = io_sort_next(side->sort, &entry, &line, &len)) != 1)
+        return r;
+
+    if (len + 1 > side->ncap)
+    {
+        if ((tmp = realloc(side->nline, len + 1)) == NULL)
+        {
+            log_error("malloc");
+            return -1;
+        }
+        side->nline = tmp;
+        side->ncap = len + 1;
+    }
+    memcpy(side->nline, line, len);
+    side->nline[len] = '\0';
+    side->nlen = len;
+    io_entry_copy(&side->next, entry);
+    return 1;
+}
+
+
+int compare(const entry_t *old, const entry_t *new)
+{
+    int changes;
+
+    changes = 0;
+    if ((old->mode & S_IFMT) != (new->mode & S_IFMT))
+        changes |= CHANGE_TYPE;
+    if (!S_ISDIR(new->mode) && old->size != new->size)
+        changes |= CHANGE_SIZE;
+    if (old->mtime.tv_sec != new->mtime.tv_sec ||
+            old->mtime.tv_nsec != new->mtime.tv_nsec)
+        changes |= CHANGE_MTIME;
+
+    if ((old->md5 != NULL && new->md5 != NULL &&
+                memcmp(old->md5, new->md5, MD5_DIGEST_LENGTH) != 0) ||
+            (old->sha1 != NULL && new->sha1 != NULL &&
+                memcmp(old->sha1, new->sha1, SHA_DIGEST_LENGTH) != 0) ||
+            (old->sha256 != NULL && new->sha256 != NULL &&
+                memcmp(old->sha256, new->sha256, SHA256_DIGEST_LENGTH) != 0) ||
+            (old->sha512 != NULL && new->sha512 != NULL &&
+                memcmp(old->sha512, new->sha512, SHA512_DIGEST_LENGTH) != 0))
+        changes |= CHANGE_DIGEST;
+
+    return changes;
+}
+
+
+int report(const char *diff, int changes, const char *line, FILE *out)
+{
+    json_t *obj;
+    json_t *list;
+    json_error_t jerr;
+    char *buf;
+    int r;
+
+    /* only the differences are parsed again */
+    if ((obj = json_loads(line, 0, &jerr)) == NULL)
+    {
+        log_errorx("cannot parse json: %s", jerr.text);
+        return -1;
+    }
+
+    r = json_object_set_new(obj, "diff", json_string(diff));
+    if (r == 0 && changes != 0)
+    {
+        list = json_array();
+        if (changes & CHANGE_TYPE)
+            json_array_append_new(list, json_string("type"));
+        if (changes & CHANGE_SIZE)
+            json_array_append_new(list, json_string("size"));
+        if (changes & CHANGE_MTIME)
+            json_array_append_new(list, json_string("mtime"));
+        if (changes & CHANGE_DIGEST)
+            json_array_append_new(list, json_string("digest"));
+        r = json_object_set_new(obj, "changes", list);
+    }
+
+    if (r != 0 || (buf = json_dumps(obj, JSON_COMPACT | JSON_PRESERVE_ORDER))
+            == NULL)
+    {
+        log_errorx("cannot write a %s entry", diff);
+        json_decref(obj);
+        return -1;
+    }
+
+    r = 0;
+    if (fprintf(out, "%s\n", buf) < 0)
+    {
+        log_error("cannot write a %s entry", diff);
+        r = -1;
+    }
+    free(buf);
+    json_decref(obj);
+    return r;
+}
@@ -69,7 +69,12 @@ int digest_fd(digest_t type, void *dest, int fd)
     if ((buf = malloc(32768)) == NULL)
         return -1;
 
-    d = digest_create(type);
+    if ((d = digest_create(type)) == NULL)
+    {
+        free(buf);
+        return -1;
+    }
+
     do {
         count = read(fd, buf, 32768);
         if (count < 0)
@@ -84,6 +89,7 @@ int digest_fd(digest_t type, void *dest, int fd)
     digest_finalize(d);
     digest_copy_value(d, dest);
     digest_free(d);
+    free(buf);
     return 0;
 }
 
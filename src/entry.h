@@ -65,6 +65,7 @@ typedef struct {
     struct timespec atime;                  /**< src's access time          */
     struct timespec mtime;                  /**< src's modification time    */
     struct timespec ctime;                  /**< src's ino change time      */
+    int deleted;                            /**< a DELETED record           */
 
 } entry_t;
 
@@ -7,12 +7,17 @@
  *
  * todo write description for fd.c
  */
+ /* for fallocate and O_TMPFILE */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#undef _GNU_SOURCE
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -30,6 +35,14 @@
 static ssize_t write_safe(int fd, const void *buf, size_t count);
 
 
+/**
+ * copy the directory part of `path` to `dir`, "." when there is none
+ *
+ * @return          the length of `dir`, -1 if it does not fit
+ */
+static int dir_of(char *dir, size_t len, const char *path);
+
+
 /* Public Impl ****************************************************************/
 
 
@@ -133,6 +146,91 @@ ssize_t fd_write_full(int fd, const void *buf, size_t count)
 }
 
 
+int fd_preallocate(int fd, off_t size)
+{
+    if (size < FD_PREALLOCATE_MIN)
+        return 0;
+
+    /* without it the writes allocate as they go, as they always did */
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == -1 &&
+            errno != EOPNOTSUPP && errno != ENOSYS)
+        return -1;
+    return 0;
+}
+
+
+int fd_trim(int fd, off_t size, off_t written)
+{
+    if (size < FD_PREALLOCATE_MIN || written >= size)
+        return 0;
+
+    return ftruncate(fd, written);
+}
+
+
+int fd_create(int dirfd, const char *path, int atomic)
+{
+    char dir[PATH_MAX];
+    int fd;
+
+    if (atomic && dir_of(dir, sizeof(dir), path) != -1)
+    {
+        if ((fd = openat(dirfd, dir, O_TMPFILE | O_WRONLY, 0666)) != -1)
+            return fd;
+
+        /* kernels before O_TMPFILE see O_DIRECTORY and fail with EISDIR */
+        if (errno != EOPNOTSUPP && errno != EISDIR)
+            return -1;
+    }
+
+    return openat(dirfd, path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+}
+
+
+int fd_publish(int fd, int dirfd, const char *path)
+{
+    char proc[64];
+    char tmp[PATH_MAX];
+    struct stat st;
+    int saved;
+    int n;
+
+    if (fstat(fd, &st) == -1)
+        return -1;
+    if (st.st_nlink > 0)
+        return 0;
+
+    /* linking the fd itself with AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH */
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    if (linkat(AT_FDCWD, proc, dirfd, path, AT_SYMLINK_FOLLOW) == 0)
+        return 0;
+    if (errno != EEXIST)
+        return -1;
+
+    /* unique while `fd` is open, one left by a crash is replaced */
+    if ((n = dir_of(tmp, sizeof(tmp), path)) == -1 ||
+            snprintf(tmp + n, sizeof(tmp) - n, "/.dcp.%ld.%d", (long) getpid(),
+                    fd) >= (int) (sizeof(tmp) - n))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (linkat(AT_FDCWD, proc, dirfd, tmp, AT_SYMLINK_FOLLOW) == -1 &&
+            (errno != EEXIST || unlinkat(dirfd, tmp, 0) == -1 ||
+            linkat(AT_FDCWD, proc, dirfd, tmp, AT_SYMLINK_FOLLOW) == -1))
+        return -1;
+
+    if (renameat(dirfd, tmp, dirfd, path) == -1)
+    {
+        saved = errno;
+        unlinkat(dirfd, tmp, 0);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+
 /* Private Impl ***************************************************************/
 
 
@@ -148,3 +246,23 @@ inline ssize_t write_safe(int fd, const void *buf, size_t count)
     }
     return -2; /* unreachable code, but compiler knows best! */
 }
+
+
+int dir_of(char *dir, size_t len, const char *path)
+{
+    const char *slash;
+    size_t n;
+
+    if ((slash = strrchr(path, '/')) == NULL)
+    {
+        dir[0] = '.';
+        dir[1] = '\0';
+        return 1;
+    }
+
+    if ((n = slash - path) >= len)
+        return -1;
+    memcpy(dir, path, n);
+    dir[n] = '\0';
+    return n;
+}
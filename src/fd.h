@@ -11,6 +11,15 @@
 #define FD_H__
 
 
+#include <sys/types.h>
+
+
+/**
+ * files smaller than this are left to be laid out by their first write
+ */
+#define FD_PREALLOCATE_MIN (1024 * 1024)
+
+
 /**
  * read all bytes from `src` and write them to `dest` using `buffer` of length
  * `blen` to store the bytes temporarily. Will continue to read from `src` until
@@ -71,4 +80,55 @@ ssize_t fd_read_full(int fd, void *dest, size_t len);
 ssize_t fd_write_full(int fd, const void *buf, size_t count);
 
 
+/**
+ * Reserve the blocks of a new file about to be written with `size` bytes, so
+ * the file system lays them out at once instead of a write at a time while
+ * other files are growing next to it. The file keeps its size, the writes
+ * extend it. Nothing is done for files smaller than FD_PREALLOCATE_MIN or on
+ * file systems without fallocate.
+ *
+ * @param fd        the new file, open for writing
+ * @param size      # of bytes that will be written to it
+ *
+ * @return          0 on success, -1 on error with errno set
+ */
+int fd_preallocate(int fd, off_t size);
+
+
+/**
+ * Give back the blocks fd_preallocate reserved past the end of a file that
+ * turned out shorter than expected, the source shrank while it was copied.
+ *
+ * @param fd        the file, open for writing
+ * @param size      # of bytes reserved
+ * @param written   # of bytes written
+ *
+ * @return          0 on success, -1 on error with errno set
+ */
+int fd_trim(int fd, off_t size, off_t written);
+
+
+/**
+ * Create the copy `path` relative to `dirfd`, open for writing. With `atomic`
+ * it is an unnamed O_TMPFILE in the directory `path` is in, given its name by
+ * fd_publish once complete, so a reader never sees it half written and a
+ * failed copy leaves nothing behind. File systems without O_TMPFILE get the
+ * named file as without `atomic`, created or truncated.
+ *
+ * @return          the new fd on success, -1 on error with errno set
+ */
+int fd_create(int dirfd, const char *path, int atomic);
+
+
+/**
+ * Give the copy fd_create made on `fd` its name `path` relative to `dirfd`.
+ * It is linked in place when nothing has that name, or linked next to it and
+ * renamed over what is there otherwise. A file that already has a name is
+ * left be.
+ *
+ * @return          0 on success, -1 on error with errno set
+ */
+int fd_publish(int fd, int dirfd, const char *path);
+
+
 #endif
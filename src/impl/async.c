@@ -0,0 +1,966 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the async.h API. Each file in flight owns a slot holding
+ * its descriptors, buffer and digests. Requests are tagged with their slot's
+ * index and the operation so a completion can be routed back to the state
+ * machine of the file it belongs to.
+ *
+ * A regular file goes through the same steps as process_regular:
+ *
+ *      without an index    open the source and destination, then read, digest
+ *                          and write each chunk until the end of the file
+ *      with an index       open the source, read and digest it caching what
+ *                          fits in the slot's buffer, look it up and when it
+ *                          is not in the index open the destination and write
+ *                          the cached bytes or read the file again
+ *
+ * --update=digest hashes first like an index, the copy already there is read
+ * and digested synchronously once the source's digest is known. With
+ * --update=time a current copy is found before the file is given a slot.
+ *
+ * fchown, fchmod and futimens have no io_uring operation and are done
+ * synchronously before the destination is closed. The destination's blocks
+ * are reserved with fallocate as soon as it is open, synchronously too, and
+ * given back if the source turns out shorter, @see fd_preallocate.
+ *
+ * With --sync=file the destination is fdatasync'd on the ring before it is
+ * closed, with batch it is handed to the sync thread instead of being closed,
+ * @see durable.h. With --atomic the destination is an O_TMPFILE opened through
+ * its directory, which the ring would need a path of its own for, so it is
+ * opened synchronously, and named right before it is closed.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "async.h"
+#include "process.h"
+#include "prefetch.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../index/index.h"
+#include "../logging.h"
+#include "../uring.h"
+#include "dcp.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * largest buffer given to a slot, files that do not fit are streamed through
+ */
+#define MAX_CHUNK (256 * 1024)
+
+
+/**
+ * descriptors kept back from the open file limit for the walk and the output
+ */
+#define RESERVED_FDS 64
+
+
+/**
+ * a request's tag is its slot's index and the operation in the low byte
+ */
+#define TAG(_slot, _op)     ((((uint64_t) (_slot)) << 8) | (_op))
+#define TAG_SLOT(_tag)      ((size_t) ((_tag) >> 8))
+#define TAG_OP(_tag)        ((int) ((_tag) & 0xff))
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * requests a slot can have in flight
+ */
+enum {
+    OP_OPEN_SRC,
+    OP_OPEN_DST,
+    OP_READ,
+    OP_WRITE,
+    OP_CLOSE_SRC,
+    OP_CLOSE_DST,
+    OP_SYNC_DST,
+    OP_SYMLINK
+};
+
+
+/**
+ * a file in flight
+ */
+struct slot {
+    work_t *work;           /**< the file, NULL when the slot is free */
+    int symlink;            /**< the file is a symlink */
+    int src;                /**< source fd, -1 when not open */
+    int dst;                /**< destination fd, -1 when not open */
+    int inflight;           /**< # of requests waiting on a completion */
+
+    unsigned char *buf;     /**< slot's buffer of `a->chunk` bytes */
+    size_t fill;            /**< bytes of `buf` holding the file's data */
+    int rolled;             /**< the file did not fit in `buf` */
+    int cached;             /**< the destination is written from `buf` */
+    off_t roff;             /**< source offset of the next read */
+    off_t woff;             /**< destination offset of the next write */
+    size_t wpos;            /**< first byte of `buf` left to write */
+    size_t wlen;            /**< end of the bytes of `buf` to write */
+
+    digesterset_t set;      /**< digests of the file */
+    int hashed;             /**< the digests are finalized */
+    int done;               /**< every byte made it to the destination */
+    int synced;             /**< the destination was trimmed, given its
+                                 attrs and synced if asked */
+    int failed;             /**< report the file as failed */
+    int skip;               /**< do not report the file at all */
+    int orphan;             /**< the destination was created for a source
+                                 that could not be opened */
+    uint64_t start;         /**< when the file was handed to the engine */
+
+    struct slot *next;      /**< next free slot */
+};
+
+
+struct async {
+    uring_t *ring;
+    file_t *newdir;                     /**< where new files are created */
+    const struct process_opts *opts;    /**< callback, index, digests... */
+    digest_t idxkeytype;                /**< digest the index is keyed by */
+    digest_t updtype;                   /**< digest copies are compared by */
+    int hashfirst;                      /**< files are hashed before their
+                                             destination is opened */
+    size_t chunk;                       /**< size of each slot's buffer */
+    size_t depth;                       /**< # of slots */
+    int symlinks;                       /**< the kernel can create symlinks */
+    struct slot *slots;
+    struct slot *free;                  /**< list of unused slots */
+    unsigned char *buffers;             /**< every slot's buffer */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * return a free slot, processing completions until one is available
+ */
+static struct slot *slot_get(async_t *a);
+
+
+/**
+ * release the slot's resources and put it back on the free list
+ */
+static void slot_put(async_t *a, struct slot *s);
+
+
+/**
+ * wait for one completion and advance the state of the file it belongs to
+ */
+static int reap(async_t *a);
+
+
+/**
+ * advance a regular file's state machine with the result of `op`
+ */
+static void regular_complete(async_t *a, struct slot *s, int op, int res);
+
+
+/**
+ * advance a symlink's state machine with the result of `op`
+ */
+static void symlink_complete(async_t *a, struct slot *s, int op, int res);
+
+
+/**
+ * queue the next read of the source, into the unused part of the buffer while
+ * hashing for an index or the start of it otherwise
+ */
+static void queue_read(async_t *a, struct slot *s);
+
+
+/**
+ * queue the write of the bytes of `buf` from `wpos` to `wlen`
+ */
+static void queue_write(async_t *a, struct slot *s);
+
+
+/**
+ * queue the closing of every open descriptor, the file is reported once they
+ * complete
+ */
+static void queue_close(async_t *a, struct slot *s);
+
+
+/**
+ * a request could not be queued, close what is open synchronously and report
+ * the file as failed
+ */
+static void abandon(async_t *a, struct slot *s);
+
+
+/**
+ * send the file's information to the callback, then free the slot
+ */
+static void report(async_t *a, struct slot *s);
+
+
+/**
+ * look the hashed file up in the index, compare it with the copy already there
+ * and decide if it needs copying
+ */
+static void lookup(async_t *a, struct slot *s);
+
+
+/**
+ * queue the opening of the destination, with --atomic it is opened at once
+ * and completed as if it came from the ring
+ *
+ * @return          0 on success, -1 if it could not be queued
+ */
+static int open_dst(async_t *a, struct slot *s);
+
+
+/* Public Impl ****************************************************************/
+
+
+int async_create(async_t **a, size_t depth, file_t *newdir,
+        const struct process_opts *opts)
+{
+    struct async *e;
+    struct rlimit lim;
+    size_t i;
+
+    /* every file in flight can hold two descriptors */
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY)
+    {
+        if (lim.rlim_cur <= RESERVED_FDS + 2)
+            return -1;
+        if (depth > (lim.rlim_cur - RESERVED_FDS) / 2)
+        {
+            depth = (lim.rlim_cur - RESERVED_FDS) / 2;
+            log_debugx("limiting the asynchronous engine to %zu files", depth);
+        }
+    }
+
+    if (depth == 0)
+        return -1;
+
+    if ((e = calloc(1, sizeof(*e))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    if (uring_create(&e->ring, depth * 2) != 0)
+    {
+        log_debug("io_uring_setup");
+        free(e);
+        return -1;
+    }
+
+    if (!uring_supports(e->ring, URING_OPENAT) ||
+            !uring_supports(e->ring, URING_READ) ||
+            !uring_supports(e->ring, URING_WRITE) ||
+            !uring_supports(e->ring, URING_CLOSE))
+    {
+        log_debugx("kernel lacks the io_uring operations to copy files");
+        uring_free(e->ring);
+        free(e);
+        return -1;
+    }
+
+    e->newdir     = newdir;
+    e->opts       = opts;
+    e->idxkeytype = opts->index == NULL? 0 :
+            index_get_digest_type(opts->index);
+    e->updtype    = opts->update != UPDATE_DIGEST? 0 :
+            update_digest_type(opts->digests);
+    e->hashfirst  = opts->index != NULL || e->updtype != 0;
+    e->chunk      = opts->buffer_size < MAX_CHUNK? opts->buffer_size:MAX_CHUNK;
+    e->depth      = depth;
+    e->symlinks   = uring_supports(e->ring, URING_SYMLINKAT);
+    e->slots      = calloc(depth, sizeof(struct slot));
+    e->buffers    = malloc(depth * e->chunk);
+
+    if (e->slots == NULL || e->buffers == NULL)
+    {
+        log_error("cannot allocate %zu asynchronous buffers", depth);
+        free(e->slots);
+        free(e->buffers);
+        uring_free(e->ring);
+        free(e);
+        return -1;
+    }
+
+    for (i = depth; i > 0; i--)
+    {
+        e->slots[i - 1].buf  = e->buffers + (i - 1) * e->chunk;
+        e->slots[i - 1].next = e->free;
+        e->free = &e->slots[i - 1];
+    }
+
+    *a = e;
+    return 0;
+}
+
+
+void async_free(async_t *a)
+{
+    if (a == NULL)
+        return;
+
+    async_drain(a);
+    uring_free(a->ring);
+    free(a->buffers);
+    free(a->slots);
+    free(a);
+}
+
+
+int async_regular(async_t *a, work_t *work)
+{
+    struct slot *s;
+    size_t i;
+
+    /* a current copy by time is found without opening the source */
+    if (a->opts->update == UPDATE_TIME &&
+            process_current(a->newdir, work->newpath, &work->st, a->opts, 0,
+                    NULL))
+    {
+        work_free(work);
+        return 0;
+    }
+
+    if ((s = slot_get(a)) == NULL)
+        return -1;
+
+    i = s - a->slots;
+    s->work  = work;
+    s->start = prefetch_clock();
+
+    /* ensure we create the hash needed for the index */
+    digesterset_create(&s->set,
+            a->opts->digests | a->idxkeytype | a->updtype);
+
+    /* without an index the destination is written while hashing */
+    if (uring_openat(a->ring, AT_FDCWD, work->accpath, O_RDONLY, 0,
+            TAG(i, OP_OPEN_SRC)) != 0)
+    {
+        abandon(a, s);
+        return 0;
+    }
+    s->inflight++;
+
+    if (!a->hashfirst && open_dst(a, s) != 0)
+        s->failed = 1;  /* closed once the source is open */
+
+    return 0;
+}
+
+
+int async_symlink(async_t *a, work_t *work)
+{
+    struct slot *s;
+    ssize_t r;
+
+    /* targets longer than a slot's buffer are rare, leave them to the caller */
+    if (!a->symlinks || work->st.st_size >= (off_t) a->chunk)
+        return -1;
+
+    if ((s = slot_get(a)) == NULL)
+        return -1;
+
+    s->work    = work;
+    s->symlink = 1;
+    s->buf[0]  = '\0';
+
+    if ((r = readlink(work->accpath, (char *) s->buf, a->chunk - 1)) == -1)
+    {
+        log_error("cannot read symlink '%s'", work->accpath);
+        s->failed = 1;
+        report(a, s);
+        return 0;
+    }
+    s->buf[r] = '\0';
+
+    if (uring_symlinkat(a->ring, (char *) s->buf, a->newdir->fd, work->newpath,
+            TAG(s - a->slots, OP_SYMLINK)) != 0)
+    {
+        log_error("cannot create symlink '%s'",
+                pathstr(a->newdir, work->newpath));
+        s->failed = 1;
+        report(a, s);
+        return 0;
+    }
+    s->inflight++;
+    return 0;
+}
+
+
+int async_drain(async_t *a)
+{
+    while (uring_pending(a->ring) > 0)
+        if (reap(a) != 0)
+            return -1;
+    return 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+struct slot *slot_get(async_t *a)
+{
+    struct slot *s;
+
+    while (a->free == NULL)
+        if (reap(a) != 0)
+            return NULL;
+
+    s = a->free;
+    a->free = s->next;
+
+    s->next     = NULL;
+    s->symlink  = 0;
+    s->src      = -1;
+    s->dst      = -1;
+    s->inflight = 0;
+    s->fill     = 0;
+    s->rolled   = 0;
+    s->cached   = 0;
+    s->roff     = 0;
+    s->woff     = 0;
+    s->wpos     = 0;
+    s->wlen     = 0;
+    s->hashed   = 0;
+    s->done     = 0;
+    s->synced   = 0;
+    s->failed   = 0;
+    s->skip     = 0;
+    s->orphan   = 0;
+    return s;
+}
+
+
+void slot_put(async_t *a, struct slot *s)
+{
+    if (!s->symlink)
+        digesterset_free(&s->set);
+    work_free(s->work);
+    s->work = NULL;
+    s->next = a->free;
+    a->free = s;
+}
+
+
+int reap(async_t *a)
+{
+    uint64_t tag;
+    int res;
+    struct slot *s;
+
+    if (uring_wait(a->ring, &tag, &res) != 0)
+    {
+        log_error("io_uring_enter");
+        return -1;
+    }
+
+    s = &a->slots[TAG_SLOT(tag)];
+    s->inflight--;
+
+    if (s->symlink)
+        symlink_complete(a, s, TAG_OP(tag), res);
+    else
+        regular_complete(a, s, TAG_OP(tag), res);
+    return 0;
+}
+
+
+void regular_complete(async_t *a, struct slot *s, int op, int res)
+{
+    const char *accpath = s->work->accpath;
+    const char *newpath = s->work->newpath;
+
+    switch (op)
+    {
+    case OP_OPEN_SRC:
+    {
+        if (res < 0)
+        {
+            errno = -res;
+            log_error("cannot open '%s'", accpath);
+            s->failed = 1;
+            s->orphan = 1;  /* process_regular never creates the copy */
+        }
+        else
+        {
+            s->src = res;
+            posix_fadvise(s->src, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        break;
+    }
+
+    case OP_OPEN_DST:
+    {
+        if (res < 0)
+        {
+            errno = -res;
+            log_debug("openat '%s'", newpath);
+            s->failed = 1;
+        }
+        else
+        {
+            s->dst = res;
+            if (fd_preallocate(s->dst, s->work->st.st_size) == -1)
+                log_debug("fd_preallocate '%s'", newpath);
+        }
+        break;
+    }
+
+    case OP_READ:
+    {
+        if (res < 0)
+        {
+            errno = -res;
+            log_debug("read '%s'", accpath);
+            s->failed = 1;
+            break;
+        }
+
+        /* end of file */
+        if (res == 0)
+        {
+            if (!s->hashed)
+            {
+                digesterset_finalize(&s->set);
+                s->hashed = 1;
+            }
+
+            /* hashed for the index, time to see if it must be copied */
+            if (s->dst == -1)
+            {
+                lookup(a, s);
+                return;
+            }
+
+            s->done = 1;
+            break;
+        }
+
+        /* while hashing for an index keep as much of the file as fits */
+        if (a->hashfirst && !s->hashed)
+        {
+            digesterset_update(&s->set, s->buf + s->fill, res);
+            s->roff += res;
+            s->fill += res;
+            if (s->fill == a->chunk)
+            {
+                s->fill = 0;
+                s->rolled = 1;
+            }
+            queue_read(a, s);
+            return;
+        }
+
+        if (!s->hashed)
+            digesterset_update(&s->set, s->buf, res);
+
+        s->roff += res;
+        s->wpos = 0;
+        s->wlen = res;
+        queue_write(a, s);
+        return;
+    }
+
+    case OP_WRITE:
+    {
+        if (res <= 0)
+        {
+            errno = res == 0? EIO : -res;
+            log_debug("fd_write");
+            s->failed = 1;
+            break;
+        }
+
+        s->woff += res;
+        s->wpos += res;
+        if (s->wpos < s->wlen)
+        {
+            queue_write(a, s);
+            return;
+        }
+
+        /* the cached copy was all there was to write */
+        if (s->cached)
+        {
+            s->done = 1;
+            break;
+        }
+
+        queue_read(a, s);
+        return;
+    }
+
+    case OP_CLOSE_SRC:
+        break;
+
+    case OP_SYNC_DST:
+    {
+        /* do not report success here because there can be data loss */
+        if (res < 0)
+        {
+            errno = -res;
+            log_error("cannot sync '%s', possible data loss", newpath);
+            s->failed = 1;
+        }
+        break;
+    }
+
+    case OP_CLOSE_DST:
+    {
+        /* do not report success here because there can be data loss */
+        if (res < 0)
+        {
+            errno = -res;
+            log_error("closing '%s' failed, possible data loss", newpath);
+            s->failed = 1;
+        }
+        break;
+    }
+    }
+
+    /* wait for the other requests of this file before moving on */
+    if (s->inflight > 0)
+        return;
+
+    /* every descriptor is closed */
+    if (s->src == -1 && s->dst == -1)
+    {
+        report(a, s);
+        return;
+    }
+
+    if (s->failed || s->done)
+    {
+        queue_close(a, s);
+        return;
+    }
+
+    /* both opens finished, the index's destination open or the first read */
+    if (s->cached && s->fill == 0)
+    {
+        s->done = 1;            /* empty file, nothing to write */
+        queue_close(a, s);
+    }
+    else if (s->cached)
+    {
+        s->wpos = 0;
+        s->wlen = s->fill;
+        queue_write(a, s);
+    }
+    else
+        queue_read(a, s);
+}
+
+
+void symlink_complete(async_t *a, struct slot *s, int op, int res)
+{
+    UNUSED(op);
+
+    /* replace whatever exists at the destination, like process_symlink */
+    if (res == -EEXIST)
+    {
+        if (unlinkat(a->newdir->fd, s->work->newpath, 0) == -1)
+        {
+            log_error("cannot unlink '%s'",
+                    pathstr(a->newdir, s->work->newpath));
+            s->failed = 1;
+        }
+        else if (uring_symlinkat(a->ring, (char *) s->buf, a->newdir->fd,
+                s->work->newpath, TAG(s - a->slots, OP_SYMLINK)) == 0)
+        {
+            s->inflight++;
+            return;
+        }
+        else
+            s->failed = 1;
+    }
+    else if (res < 0)
+    {
+        errno = -res;
+        log_error("cannot create symlink '%s'",
+                pathstr(a->newdir, s->work->newpath));
+        s->failed = 1;
+    }
+
+    report(a, s);
+}
+
+
+void queue_read(async_t *a, struct slot *s)
+{
+    unsigned char *pos;
+    size_t len;
+
+    pos = s->buf;
+    len = a->chunk;
+    if (a->hashfirst && !s->hashed)
+    {
+        pos += s->fill;
+        len -= s->fill;
+    }
+
+    if (uring_read(a->ring, s->src, pos, len, s->roff,
+            TAG(s - a->slots, OP_READ)) != 0)
+    {
+        abandon(a, s);
+        return;
+    }
+    s->inflight++;
+}
+
+
+void queue_write(async_t *a, struct slot *s)
+{
+    if (uring_write(a->ring, s->dst, s->buf + s->wpos, s->wlen - s->wpos,
+            s->woff, TAG(s - a->slots, OP_WRITE)) != 0)
+    {
+        abandon(a, s);
+        return;
+    }
+    s->inflight++;
+}
+
+
+void queue_close(async_t *a, struct slot *s)
+{
+    size_t i = s - a->slots;
+    durable_t *durable = a->opts->durable;
+    attrs_t attrs;
+
+    /* a copy written in full is finished before it is closed, the sync comes
+     * back here once it completes */
+    if (s->dst != -1 && s->done && !s->failed && !s->synced)
+    {
+        s->synced = 1;
+        if (fd_trim(s->dst, s->work->st.st_size, s->woff) == -1)
+            log_debug("fd_trim");
+
+        /* the report reads the xattrs again, only copying needs them here */
+        attrs_init(&attrs, &s->work->st, &a->opts->attrs);
+        if (a->opts->copy_xattrs)
+            process_file_xattrs(&attrs, s->src, s->work->accpath,
+                    &s->work->st, a->opts);
+        if (attrs_fd(s->dst, &attrs) == -1)
+        {
+            log_errorx("cannot set the xattrs of '%s'",
+                    pathstr(a->newdir, s->work->newpath));
+            s->failed = 1;
+        }
+
+        if (!s->failed && durable_mode(durable) == DURABLE_FILE)
+        {
+            if (uring_supports(a->ring, URING_FSYNC) &&
+                    uring_fdatasync(a->ring, s->dst, TAG(i, OP_SYNC_DST)) == 0)
+            {
+                s->inflight++;
+                return;
+            }
+            if (fdatasync(s->dst) == -1)
+            {
+                log_error("cannot sync '%s', possible data loss",
+                        s->work->newpath);
+                s->failed = 1;
+            }
+        }
+    }
+
+    /* the copy is named once synced, with batch by durable_close */
+    if (s->dst != -1 && s->done && !s->failed &&
+            durable_mode(durable) != DURABLE_BATCH &&
+            durable_publish(durable, s->dst, a->newdir->fd,
+                    s->work->newpath) == -1)
+    {
+        log_error("cannot name '%s'", pathstr(a->newdir, s->work->newpath));
+        s->failed = 1;
+    }
+
+    /* an atomic copy has no name to remove */
+    if (s->dst != -1 && s->orphan && !durable_atomic(durable))
+        unlinkat(a->newdir->fd, s->work->newpath, 0);
+
+    if (s->src != -1)
+    {
+        if (uring_close(a->ring, s->src, TAG(i, OP_CLOSE_SRC)) != 0)
+            close(s->src);
+        else
+            s->inflight++;
+        s->src = -1;
+    }
+
+    /* the thread closes it once synced */
+    if (s->dst != -1 && durable_mode(durable) == DURABLE_BATCH && s->done &&
+            !s->failed)
+    {
+        if (durable_close(durable, s->dst, a->newdir->fd,
+                s->work->newpath) == -1)
+            s->failed = 1;
+        s->dst = -1;
+    }
+
+    if (s->dst != -1)
+    {
+        if (uring_close(a->ring, s->dst, TAG(i, OP_CLOSE_DST)) != 0)
+        {
+            if (close(s->dst) == -1)
+                s->failed = 1;
+        }
+        else
+            s->inflight++;
+        s->dst = -1;
+    }
+
+    if (s->inflight == 0)
+        report(a, s);
+}
+
+
+void abandon(async_t *a, struct slot *s)
+{
+    log_error("cannot queue I/O for '%s'", s->work->accpath);
+    s->failed = 1;
+
+    /* other requests of this file finish it once they complete */
+    if (s->inflight > 0)
+        return;
+
+    if (s->src != -1)
+        close(s->src);
+    if (s->dst != -1)
+        close(s->dst);
+    s->src = -1;
+    s->dst = -1;
+    report(a, s);
+}
+
+
+void report(async_t *a, struct slot *s)
+{
+    const struct process_opts *opts = a->opts;
+    work_t *w = s->work;
+    unsigned long diff;
+    dcp_state_t state;
+    int digests;
+
+    if (s->symlink)
+    {
+        state = s->failed? DCP_FAILED : DCP_SYMLINK_CREATED;
+        opts->callback(state, NULL, 0, w->pathmd5, w->dapath, &w->st,
+                w->accpath, process_xattrs(a->newdir, w->newpath, w->accpath,
+                        -1, &w->st, state, NULL, opts),
+                (char *) s->buf, NULL, NULL, NULL, NULL, -1, -1,
+                opts->callback_ctx);
+        slot_put(a, s);
+        return;
+    }
+
+    if (s->skip)
+    {
+        slot_put(a, s);
+        return;
+    }
+
+    /* the process time is the wall clock while the file was in flight */
+    diff = (prefetch_clock() - s->start) / 1000000;
+
+    /* as process_regular, failing to copy an indexed file keeps its digests */
+    digests = !s->failed || (a->hashfirst && s->hashed);
+    if (s->failed && !digests)
+        opts->callback(DCP_FAILED, NULL, 0, w->pathmd5, w->dapath, &w->st,
+                w->accpath, NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                opts->callback_ctx);
+    else
+    {
+        state = s->failed? DCP_FAILED : DCP_FILE_COPIED;
+        opts->callback(state, NULL, 0, w->pathmd5, w->dapath, &w->st,
+                w->accpath, process_xattrs(a->newdir, w->newpath, w->accpath,
+                        -1, &w->st, state, NULL, opts), NULL,
+                digesterset_get_value(&s->set, DGST_MD5),
+                digesterset_get_value(&s->set, DGST_SHA1),
+                digesterset_get_value(&s->set, DGST_SHA256),
+                digesterset_get_value(&s->set, DGST_SHA512),
+                diff, -1, opts->callback_ctx);
+    }
+
+    slot_put(a, s);
+}
+
+
+void lookup(async_t *a, struct slot *s)
+{
+    switch (a->opts->index == NULL? INDEX_NO_ENTRY : index_lookup(
+            a->opts->index, s->work->pathmd5,
+            digesterset_get_value(&s->set, a->idxkeytype)))
+    {
+    case INDEX_FAILED:
+        log_debugx("error looking up entry in file index");
+        s->skip = 1;
+        queue_close(a, s);
+        return;
+
+    /* we have seen this file, skip it */
+    case INDEX_SUCCESS:
+        s->skip = 1;
+        queue_close(a, s);
+        return;
+
+    /* else continue with the copy */
+    case INDEX_NO_ENTRY: {}
+    }
+
+    /* the copy already there has the same bytes */
+    if (a->updtype != 0 && process_current(a->newdir, s->work->newpath,
+            &s->work->st, a->opts, a->updtype,
+            digesterset_get_value(&s->set, a->updtype)))
+    {
+        s->skip = 1;
+        queue_close(a, s);
+        return;
+    }
+
+    /* reuse the buffer when it holds the whole file, read it again if not */
+    s->cached = !s->rolled && (off_t) s->fill == s->work->st.st_size;
+    s->roff = 0;
+
+    if (open_dst(a, s) != 0)
+        abandon(a, s);
+}
+
+
+int open_dst(async_t *a, struct slot *s)
+{
+    int fd;
+
+    if (durable_atomic(a->opts->durable))
+    {
+        fd = durable_open(a->opts->durable, a->newdir->fd, s->work->newpath);
+        regular_complete(a, s, OP_OPEN_DST, fd == -1? -errno : fd);
+        return 0;
+    }
+
+    if (uring_openat(a->ring, a->newdir->fd, s->work->newpath,
+            O_WRONLY | O_CREAT | O_TRUNC, 0666,
+            TAG(s - a->slots, OP_OPEN_DST)) != 0)
+        return -1;
+    s->inflight++;
+    return 0;
+}
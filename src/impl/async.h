@@ -0,0 +1,86 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Asynchronous engine for workloads made of many small files. Instead of
+ * copying one file at a time the walk hands regular files and symlinks to the
+ * engine which keeps up to `depth` of them in flight on a single io_uring.
+ * Each file is a small state machine moved along by the completions of its
+ * openat, read, write and close requests, so the latency of one file's I/O is
+ * hidden behind the others while a single thread does all the hashing.
+ *
+ * Every file produces the same callback it would have from process_regular or
+ * process_symlink, only the order of the callbacks changes.
+ */
+#ifndef ASYNC_H__
+#define ASYNC_H__
+
+
+#include <stddef.h>
+
+#include "process.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the ring, the in flight files and their buffers
+ */
+typedef struct async async_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Create an engine that copies at most `depth` files at once into `newdir`.
+ * The depth is lowered if the open file limit cannot accommodate it. Both
+ * `newdir` and `opts` must stay valid until the engine is freed.
+ *
+ * @param a         where to store the new engine
+ * @param depth     max # of files in flight
+ * @param newdir    destination root every new path is relative to
+ * @param opts      parameters shared with the process functions
+ *
+ * @return          0 on success, -1 if io_uring is unavailable or on failure
+ */
+int async_create(async_t **a, size_t depth, file_t *newdir,
+        const struct process_opts *opts);
+
+
+/**
+ * Wait for every file in flight then release the engine, NULL is ignored.
+ */
+void async_free(async_t *a);
+
+
+/**
+ * Start copying the regular file described by `work`, taking ownership of it.
+ * When every slot is in use completions are processed until one frees up.
+ * The destination must already have been prepared with preprocess.
+ *
+ * @return          0 on success, -1 on failure in which case the caller still
+ *                  owns `work`
+ */
+int async_regular(async_t *a, work_t *work);
+
+
+/**
+ * Same as async_regular for the symlink described by `work`.
+ */
+int async_symlink(async_t *a, work_t *work);
+
+
+/**
+ * process completions until no file is in flight
+ *
+ * @return          0 on success, -1 if the ring failed
+ */
+int async_drain(async_t *a);
+
+
+#endif
@@ -0,0 +1,245 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the attrs.h API. The paths of the directories recorded
+ * are kept one after the other in a single buffer that only grows.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "attrs.h"
+#include "../logging.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * a directory recorded, its path is at `off` in the paths buffer
+ */
+struct dir {
+    size_t off;
+    attrs_t attrs;
+};
+
+
+struct attrs_dirs {
+    struct dir *dirs;
+    size_t count;
+    size_t cap;
+    char *paths;        /**< '\0' terminated paths of `dirs` */
+    size_t used;        /**< # of bytes of `paths` in use */
+    size_t pcap;        /**< # of bytes `paths` can hold */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Leave out of `a` the owner and mode `st` already has.
+ */
+static void trim(attrs_t *a, const struct stat *st);
+
+
+/* Public Impl ****************************************************************/
+
+
+void attrs_policy_init(attrs_policy_t *p, uid_t uid, gid_t gid, int preserve)
+{
+    p->uid      = uid;
+    p->gid      = gid;
+    p->preserve = preserve;
+}
+
+
+void attrs_init(attrs_t *a, const struct stat *st, const attrs_policy_t *p)
+{
+    a->uid  = p->uid == (uid_t) -1? st->st_uid : p->uid;
+    a->gid  = p->gid == (gid_t) -1? st->st_gid : p->gid;
+    a->mode = p->preserve? st->st_mode & 07777 : ATTRS_KEEP_MODE;
+
+    a->times[0].tv_sec  = 0;
+    a->times[0].tv_nsec = UTIME_OMIT;
+    a->times[1]         = a->times[0];
+    if (p->preserve)
+    {
+        a->times[0] = st->st_atim;
+        a->times[1] = st->st_mtim;
+    }
+
+    a->xattrs   = NULL;
+    a->filters  = NULL;
+    a->nfilters = 0;
+}
+
+
+int attrs_fd(int fd, const attrs_t *given)
+{
+    struct stat st;
+    attrs_t need;
+    const attrs_t *a;
+    int r;
+
+    /* without a stat everything is set */
+    a = given;
+    if (fstat(fd, &st) == 0)
+    {
+        need = *given;
+        trim(&need, &st);
+        a = &need;
+    }
+
+    if ((a->uid != (uid_t) -1 || a->gid != (gid_t) -1) &&
+            fchown(fd, a->uid, a->gid) == -1)
+        log_debug("fchown");
+
+    /* a mode without write permission would keep the user xattrs out */
+    r = 0;
+    if (a->xattrs != NULL &&
+            xattrs_fd(a->xattrs, fd, a->filters, a->nfilters) != 0)
+        r = -1;
+
+    if (a->mode != ATTRS_KEEP_MODE && fchmod(fd, a->mode) == -1)
+        log_debug("fchmod");
+    if (a->times[1].tv_nsec != UTIME_OMIT && futimens(fd, a->times) == -1)
+        log_debug("futimens");
+    return r;
+}
+
+
+int attrs_at(int dirfd, const char *path, const attrs_t *given)
+{
+    struct stat st;
+    attrs_t need;
+    const attrs_t *a;
+    int r;
+
+    a = given;
+    if (fstatat(dirfd, path, &st, AT_SYMLINK_NOFOLLOW) == 0)
+    {
+        need = *given;
+        trim(&need, &st);
+        a = &need;
+    }
+
+    r = 0;
+    if ((a->uid != (uid_t) -1 || a->gid != (gid_t) -1) &&
+            fchownat(dirfd, path, a->uid, a->gid, AT_SYMLINK_NOFOLLOW) == -1)
+        r = -1;
+    if (a->mode != ATTRS_KEEP_MODE && fchmodat(dirfd, path, a->mode, 0) == -1)
+        r = -1;
+    if (a->times[1].tv_nsec != UTIME_OMIT && utimensat(dirfd, path, a->times,
+            AT_SYMLINK_NOFOLLOW) == -1)
+        r = -1;
+    return r;
+}
+
+
+int attrs_dirs_create(attrs_dirs_t **d)
+{
+    if ((*d = calloc(1, sizeof(attrs_dirs_t))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+    return 0;
+}
+
+
+void attrs_dirs_free(attrs_dirs_t *d)
+{
+    if (d == NULL)
+        return;
+
+    free(d->dirs);
+    free(d->paths);
+    free(d);
+}
+
+
+int attrs_dirs_add(attrs_dirs_t *d, const char *path, const attrs_t *a)
+{
+    struct dir *dirs;
+    char *paths;
+    size_t len;
+    size_t want;
+
+    if (d->count == d->cap)
+    {
+        want = d->cap == 0? 256 : d->cap * 2;
+        if ((dirs = realloc(d->dirs, want * sizeof(struct dir))) == NULL)
+        {
+            log_error("cannot record more than %zu directories", d->count);
+            return -1;
+        }
+        d->dirs = dirs;
+        d->cap  = want;
+    }
+
+    len = strlen(path) + 1;
+    if (d->used + len > d->pcap)
+    {
+        for (want = d->pcap == 0? 16384 : d->pcap; want < d->used + len;)
+            want *= 2;
+        if ((paths = realloc(d->paths, want)) == NULL)
+        {
+            log_error("cannot record more than %zu directories", d->count);
+            return -1;
+        }
+        d->paths = paths;
+        d->pcap  = want;
+    }
+
+    memcpy(d->paths + d->used, path, len);
+    d->dirs[d->count].off   = d->used;
+    d->dirs[d->count].attrs = *a;
+    d->used += len;
+    d->count++;
+    return 0;
+}
+
+
+size_t attrs_dirs_count(const attrs_dirs_t *d)
+{
+    return d->count;
+}
+
+
+const char *attrs_dirs_get(const attrs_dirs_t *d, size_t i, const attrs_t **a)
+{
+    *a = &d->dirs[i].attrs;
+    return d->paths + d->dirs[i].off;
+}
+
+
+void attrs_dirs_clear(attrs_dirs_t *d)
+{
+    d->count = 0;
+    d->used  = 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void trim(attrs_t *a, const struct stat *st)
+{
+    if (a->uid == st->st_uid)
+        a->uid = (uid_t) -1;
+    if (a->gid == st->st_gid)
+        a->gid = (gid_t) -1;
+
+    /* a chown left to do may clear the set-id bits the copy has now */
+    if (a->mode == (st->st_mode & 07777) && ((a->uid == (uid_t) -1 &&
+            a->gid == (gid_t) -1) || (a->mode & (S_ISUID | S_ISGID)) == 0))
+        a->mode = ATTRS_KEEP_MODE;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * The metadata given to a copy once its data is written: the owner, and with
+ * --preserve the mode and times of its source. What a copy is given is worked
+ * out from the source's stat information up front. Right before the owner or
+ * mode is set the copy is stat'ed and calls that would change nothing are
+ * left out. A new copy usually already has the effective user and group and
+ * its created mode less the umask, but a setgid parent gives it the parent's
+ * group and a default ACL its own mode, so neither is assumed.
+ *
+ * Files are given theirs through the fd they were written with, right before
+ * it is closed, along with the xattrs of their source when those are copied.
+ * Directories are still being filled when the walk leaves them, files in
+ * flight or held back would change their times afterwards, so theirs are
+ * recorded and set once the walk is done, @see attrs_dirs_t.
+ */
+#ifndef ATTRS_H__
+#define ATTRS_H__
+
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "xattr.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * the mode of an attrs_t when it is left as created
+ */
+#define ATTRS_KEEP_MODE ((mode_t) -1)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * what every copy of a run is given
+ */
+typedef struct {
+    uid_t uid;          /**< owner, -1 for the source's */
+    gid_t gid;          /**< group, -1 for the source's */
+    int preserve;       /**< give copies the mode and times of the source */
+} attrs_policy_t;
+
+
+/**
+ * what one copy is given, -1, ATTRS_KEEP_MODE and UTIME_OMIT leave it be
+ */
+typedef struct {
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    struct timespec times[2];   /**< access and modification times */
+    const xattrs_t *xattrs;     /**< NULL or what attrs_fd sets */
+    const char *const *filters; /**< which of `xattrs`, @see xattr.h */
+    size_t nfilters;            /**< # of `filters`, 0 sets them all */
+} attrs_t;
+
+
+/**
+ * directories whose metadata is set later, in the order they were left
+ */
+typedef struct attrs_dirs attrs_dirs_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Set up the policy of a run.
+ *
+ * @param p         the policy to set up
+ * @param uid       owner of the copies, -1 for the source's
+ * @param gid       group of the copies, -1 for the source's
+ * @param preserve  give the copies the mode and times of their source
+ */
+void attrs_policy_init(attrs_policy_t *p, uid_t uid, gid_t gid, int preserve);
+
+
+/**
+ * Work out what a new copy of `st` is given under `p`, without xattrs.
+ */
+void attrs_init(attrs_t *a, const struct stat *st, const attrs_policy_t *p);
+
+
+/**
+ * Give `a` to the copy open on `fd`, leaving out the owner or mode when the
+ * copy already has them. The owner goes first, chown clears the set-id bits
+ * and file capabilities. The xattrs follow while the mode still lets them be
+ * set, and the times go last.
+ *
+ * @return          0 on success, -1 if the xattrs could not be set, the
+ *                  owner, mode and times are only tried
+ */
+int attrs_fd(int fd, const attrs_t *a);
+
+
+/**
+ * Same as attrs_fd for `path` relative to `dirfd`, not following a symbolic
+ * link, without xattrs.
+ *
+ * @return          0 on success, -1 if a call failed
+ */
+int attrs_at(int dirfd, const char *path, const attrs_t *a);
+
+
+/**
+ * Create an empty list of directories.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int attrs_dirs_create(attrs_dirs_t **d);
+
+
+/**
+ * release the list, NULL is ignored
+ */
+void attrs_dirs_free(attrs_dirs_t *d);
+
+
+/**
+ * Record `path`, relative to the destination root, to be given `a` later.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int attrs_dirs_add(attrs_dirs_t *d, const char *path, const attrs_t *a);
+
+
+/**
+ * @return          # of directories recorded
+ */
+size_t attrs_dirs_count(const attrs_dirs_t *d);
+
+
+/**
+ * @return          the path of the `i`th directory recorded, its attrs_t in
+ *                  `a`
+ */
+const char *attrs_dirs_get(const attrs_dirs_t *d, size_t i, const attrs_t **a);
+
+
+/**
+ * forget every directory recorded
+ */
+void attrs_dirs_clear(attrs_dirs_t *d);
+
+
+#endif
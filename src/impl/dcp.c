@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <fts.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -27,6 +28,14 @@
 #include "../index/index.h"
 #include "../logging.h"
 
+#include "async.h"
+#include "durable.h"
+#include "meta.h"
+#include "plan.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "serial.h"
+#include "stream.h"
 #include "process.h"
 
 
@@ -43,6 +52,88 @@
     } while(0)
 
 
+/**
+ * # of uncached files held back when --prefetch does not give a count
+ */
+#define DEFAULT_COLD_WINDOW 32
+
+
+/**
+ * bytes of directory entries read at once from a streamed directory
+ */
+#define STREAM_BATCH (256 * 1024)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * bounded FIFO of regular files held back because their data was not in the
+ * page cache when the walk reached them
+ */
+struct coldqueue {
+    work_t **items;     /**< ring buffer of `max` held back files */
+    size_t max;         /**< capacity, 0 when cached first is disabled */
+    size_t head;        /**< index of the oldest file */
+    size_t count;       /**< # of files held back */
+};
+
+
+/**
+ * In shard mode every entry belongs to one of `count` shards by its pathmd5.
+ * Only this shard's entries are reported, the others are filtered out of the
+ * callback.
+ */
+struct shard {
+    size_t index;               /**< this shard, [0, count) */
+    size_t count;               /**< # of shards, 0 when not sharding */
+    dcp_callback_f callback;    /**< where this shard's entries go */
+    void *ctx;
+};
+
+
+/**
+ * state shared by the walk and the nested walks of streamed directories
+ */
+struct walk {
+    file_t destroot;
+    char *sanitized;            /**< the destination without trailing '/' */
+
+    /* dapath is the reported path, destpath is the path to the new file */
+    char *path;                 /**< buf for dapath and destpath to point */
+    const char *dapath;         /**< the current Destination Absolute Path */
+    const char *destpath;
+
+    /* struct used by the process_* functions for parameters that are common
+     * between them all */
+    struct process_opts popts;
+    int verbose;
+
+    size_t stream;              /**< directory size to stream at, 0 never */
+    prefetch_t *prefetch;
+    meta_t *meta;
+    plan_t *plan;
+    struct coldqueue cold;
+
+    mirror_t mirrors[DCP_MAX_DESTS];
+    size_t nmirrors;            /**< # of `mirrors` opened */
+
+    struct shard shard;
+    watch_t *watch;             /**< where to watch the directories walked */
+    int visit;                  /**< mark what is walked in the index */
+};
+
+
+/**
+ * what the threads of walk_sources share
+ */
+struct sources {
+    struct walk **walkers;      /**< one per thread, the first is the caller's */
+    const char **src;
+    int *failed;                /**< one per thread */
+};
+
+
 /* Private API ****************************************************************/
 
 
@@ -54,17 +145,211 @@ static inline void process(file_t *newdir, const char *newpath, FTSENT *ent,
         int verbose);
 
 
+/**
+ * Add `ent` to the archive in `popts` instead of creating it, directories are
+ * added as the walk enters them.
+ *
+ * @return          1 when `ent` was handled, 0 when it is an error left to
+ *                  process
+ */
+static int archive(file_t *newdir, const char *newpath, FTSENT *ent,
+        const char *dapath, const void *pathmd5, struct process_opts *popts,
+        int verbose);
+
+
+/**
+ * Walk the trees at `paths` copying every entry. The roots of a nested walk
+ * are subdirectories of a streamed directory whose name is already in the
+ * destination path.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int walk(struct walk *w, char * const *paths, int nested);
+
+
+/**
+ * Copy the entries of `dir` reading it a batch at a time instead of letting
+ * fts read all of it, subdirectories are walked as they are found. Called once
+ * `dir` was returned as FTS_D and created.
+ */
+static void stream_dir(struct walk *w, FTS *fts, FTSENT *dir,
+        const char *dapath, const void *pathmd5);
+
+
+/*
+ * open the directory the copy goes in. `newpath` is that directory when it
+ * exists, unless `named` is set, otherwise it names the copy of the single
+ * source
+ */
 static int initdestandpaths(file_t *dest, char *path, const char **destpath,
+        const char **dapath, const char *newpath, size_t src_count, int named);
+
+
+/*
+ * set up the paths of an archive the way initdestandpaths does, without
+ * opening anything. `newpath` names the copy of the single source, of several
+ * it is the directory they are copied in
+ */
+static int inittarpaths(file_t *dest, char *path, const char **destpath,
         const char **dapath, const char *newpath, size_t src_count);
 
 
+/**
+ * open every --dest the way initdestandpaths opens the destination, working
+ * out what each one names the copy's root
+ *
+ * @return          0 on success, -1 on failure with none left open
+ */
+static int open_mirrors(struct walk *w, const char *dests[], size_t ndests,
+        const char *src[], size_t srcc, int named);
+
+
+/**
+ * close what open_mirrors opened
+ */
+static void close_mirrors(struct walk *w);
+
+
 static inline int do_append(FTSENT *ent, const file_t *destroot,
-        const char *newpath);
+        const char *newpath, int nested);
 
 
 static inline int do_unappend(FTSENT *ent);
 
 
+/**
+ * create a copy of the file described by `work` in `newdir`
+ */
+static void process_work(file_t *newdir, work_t *work,
+        struct process_opts *popts, int verbose);
+
+
+/**
+ * Give the entry to the asynchronous engine through `start`, async_regular or
+ * async_symlink.
+ *
+ * @return          1 if the engine took it, 0 if the caller must process it
+ */
+static int hand_off(struct process_opts *popts,
+        int (*start)(async_t *, work_t *), const char *newpath, FTSENT *ent,
+        const char *dapath, const void *pathmd5);
+
+
+/**
+ * Hold back `work` until its data has had time to be read in. When the queue
+ * is full the oldest file is processed first to make room.
+ */
+static void cold_defer(struct coldqueue *cold, work_t *work, file_t *newdir,
+        struct process_opts *popts, int verbose);
+
+
+/**
+ * process every file held back, oldest first
+ */
+static void cold_flush(struct coldqueue *cold, file_t *newdir,
+        struct process_opts *popts, int verbose);
+
+
+/**
+ * Record the entries of `list`, paths relative to `src`, in the walk's plan
+ * without walking `src`. The directories leading to an entry are recorded
+ * with it, each once.
+ *
+ * @return          0 on success, -1 if any entry could not be recorded
+ */
+static int list_record(struct walk *w, const char *src, const char **list,
+        size_t count);
+
+
+/**
+ * Record the entry at the first `len` bytes of `rel` in the plan, when
+ * `parent` is set it must be a directory.
+ *
+ * @param mode      set to the entry's st_mode
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int list_add(struct walk *w, const char *src, const char *rel,
+        size_t len, int level, int parent, mode_t *mode);
+
+
+/**
+ * @return          1 if `newpath` is a directory at the destination and at
+ *                  every mirror, 0 otherwise
+ */
+static int list_exists(const struct walk *w, const char *newpath);
+
+
+/**
+ * @return          `path` without empty and '.' components or a leading or
+ *                  trailing '/', NULL if it has a ".." component
+ */
+static char *list_normalize(const char *path);
+
+
+/**
+ * qsort comparison of paths, '/' sorts before any other byte so the entries
+ * below a directory directly follow it
+ */
+static int pathptr_cmp(const void *a, const void *b);
+
+
+/**
+ * start what a walker keeps to itself: its prefetcher, the files it holds
+ * back, its io_uring and its metadata batches
+ */
+static void walker_init(struct walk *w, const struct dcp_options *opts);
+
+
+/**
+ * release what walker_init started, nothing may be held back
+ */
+static void walker_fini(struct walk *w);
+
+
+/**
+ * Walk every source at once into the shared destination. Each thread of a
+ * pool runs its own walker, a copy of `w` with its own path, buffer and
+ * walker_init state, taking the sources one at a time. The callback is
+ * serialized so every entry is still reported on a whole line.
+ *
+ * @return          0 on success, -1 if any walk failed
+ */
+static int walk_sources(struct walk *w, const struct dcp_options *opts,
+        const char *src[], size_t srcc);
+
+
+/**
+ * pool_func_f walking source `i` on the walker of `thread`
+ */
+static void walk_source(void *ctx, size_t i, size_t thread);
+
+
+/**
+ * @return          whether the entry with `pathmd5` belongs to `shard`, always
+ *                  when not sharding
+ */
+static inline int shard_mine(const struct shard *shard, const void *pathmd5);
+
+
+/**
+ * dcp_callback_f forwarding the entries of the shard in `context` to its
+ * callback and dropping the others
+ */
+static int shard_callback(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context);
+
+
+/**
+ * @return          # of cpus online, at least 1
+ */
+static size_t online_cpus(void);
+
+
 /* Public Impl ****************************************************************/
 
 
@@ -89,46 +374,58 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
     int r;
     size_t i;
     const char **paths;     /* fts expects a NULL terminated list of c strs */
-    FTS *fts;               /* pointer to the fts library's handle */
-    FTSENT *ent;            /* entry in the walk returned by fts_read */
     void *buf;              /* pointer to the buffer to use to cache files */
-    char dapathmd5[MD5_DIGEST_LENGTH];
-
-    /* dapath is the reported path, destpath is the path to the new file */
-    char *path;                      /* buf for dapath and destpath to point */
-    const char *dapath;              /* The current Destination Absolute Path */
-    const char *destpath;
-
-    /* struct used by the process_* functions for parameters that are common
-     * between them all */
-    struct process_opts popts;
+    int named;
+    const char *mode;
 
-    file_t destroot;
-    char *sanitized;
+    /* everything the walk and the walks of streamed directories share */
+    struct walk w;
 
     /* allow paths upto this max, kernel will error before we reach it */
     enum { MAX_LENGTH = PATH_MAX * 2 };
 
     assert(srcc != 0);
 
-    sanitized = strdup(newpath);
-    REMOVE_TRAILING_SLASHES(sanitized);
-    newpath = sanitized;
+    memset(&w, 0, sizeof(w));
+    w.verbose = opts->verbose;
+
+    w.sanitized = strdup(newpath);
+    REMOVE_TRAILING_SLASHES(w.sanitized);
 
     /* allocate the buffer to build our dest and dapaths in */
-    path = malloc(MAX_LENGTH);
-    dapath = NULL;
-    destpath = NULL;
+    w.path = malloc(MAX_LENGTH);
+    w.dapath = NULL;
+    w.destpath = NULL;
 
     /*
      * dest is the directory to clone every entry in, if newpath is an
      * existing directory dest represents that, otherwise it is the parent
-     * of the file/directory to create
+     * of the file/directory to create. Shards of a single source start at
+     * different times, whichever creates newpath first must not change where
+     * the others copy to so for them newpath always names the copy, as it
+     * does for a list whose paths are relative to the copy
      */
-    if (initdestandpaths(&destroot,path,&destpath,&dapath,sanitized,srcc) != 0)
+    named = (opts->shards > 0 || opts->list != NULL) && srcc == 1;
+    if (opts->tar != NULL)
+        r = inittarpaths(&w.destroot, w.path, &w.destpath, &w.dapath,
+                w.sanitized, srcc);
+    else
+        r = initdestandpaths(&w.destroot, w.path, &w.destpath, &w.dapath,
+                w.sanitized, srcc, named);
+    if (r != 0)
     {
-        free(path);
-        free(sanitized);
+        free(w.path);
+        free(w.sanitized);
+        return -1;
+    }
+
+    /* every other destination gets the same tree from the same reads */
+    if (open_mirrors(&w, opts->dests, opts->ndests, src, srcc, named) != 0)
+    {
+        close(w.destroot.fd);
+        free(w.destroot.path);
+        free(w.path);
+        free(w.sanitized);
         return -1;
     }
 
@@ -139,12 +436,55 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
     if ((buf = malloc(opts->bufsize)) == NULL)
     {
         log_error("cannot allocate buffer of size %zu bytes", opts->bufsize);
-        close(destroot.fd);
-        free(destroot.path);
-        free(path);
-        free(sanitized);
+        close_mirrors(&w);
+        close(w.destroot.fd);
+        free(w.destroot.path);
+        free(w.path);
+        free(w.sanitized);
+        return -1;
+    }
+
+    /* the copies are synced and named as asked, with batch their entries
+     * wait for it */
+    w.popts.durable = NULL;
+    if ((opts->sync != DURABLE_NONE || opts->atomic) && durable_create(
+            &w.popts.durable, opts->sync, opts->atomic, callback, ctx) != 0)
+    {
+        close_mirrors(&w);
+        close(w.destroot.fd);
+        free(w.destroot.path);
+        free(w.path);
+        free(w.sanitized);
+        free(buf);
         return -1;
     }
+    if (durable_mode(w.popts.durable) == DURABLE_BATCH)
+    {
+        callback = durable_callback;
+        ctx      = w.popts.durable;
+    }
+
+    /* record the walk and copy it afterwards, the per file optimizations
+     * below only make sense while copying along the walk. A list is always
+     * copied from a plan */
+    w.plan = NULL;
+    mode = opts->list != NULL? "--files-from" : "--two-phase";
+    if ((opts->two_phase || opts->list != NULL) && plan_create(&w.plan) != 0)
+        log_warnx("cannot record the walk, copying while walking");
+    if (w.plan != NULL && (opts->prefetch > 0 || opts->cached_first ||
+            opts->async > 0))
+        log_warnx("--prefetch, --cached-first and --async are ignored with "
+                "%s", mode);
+
+    /* a recorded walk is in memory anyway, streaming would not bound it */
+    w.stream = w.plan == NULL? opts->stream : 0;
+    if (w.plan != NULL && opts->stream > 0)
+        log_warnx("--stream is ignored with %s", mode);
+    if (w.plan != NULL && opts->parallel_src)
+        log_warnx("--parallel-src is ignored with %s", mode);
+
+    if (w.nmirrors > 0 && opts->async > 0)
+        log_warnx("--async is ignored with --dest");
 
     /* map source paths to a null terminated paths array */
     paths = calloc(srcc + 1, sizeof(char *));
@@ -152,64 +492,89 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
         paths[i] = src[i];
 
     /* put static parameters into the process_opts struct */
-    popts.buffer       = buf;
-    popts.buffer_size  = opts->bufsize;
-    popts.digests      = opts->digests;
-    popts.uid          = opts->uid;
-    popts.gid          = opts->gid;
-    popts.index        = opts->index;
-    popts.callback     = callback;
-    popts.callback_ctx = ctx;
-
-    r = 0;
-    /* begin the directory walk - physical so links are not followed */
-    fts = fts_open((char * const *) paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
-    while ((ent = fts_read(fts)) != NULL)
+    w.popts.buffer       = buf;
+    w.popts.buffer_size  = opts->bufsize;
+    w.popts.digests      = opts->digests;
+    w.popts.index        = opts->index;
+    w.popts.update       = opts->update;
+    w.popts.tar          = opts->tar;
+    memcpy(w.popts.engines, opts->engines, sizeof(w.popts.engines));
+    w.popts.mirrors      = w.mirrors;
+    w.popts.nmirrors     = w.nmirrors;
+    w.popts.callback     = callback;
+    w.popts.callback_ctx = ctx;
+    attrs_policy_init(&w.popts.attrs, opts->uid, opts->gid, opts->preserve);
+
+    /* a directory is set once nothing more is written in it */
+    w.popts.dirs = NULL;
+    if (attrs_dirs_create(&w.popts.dirs) != 0)
+        log_warnx("cannot defer directories, setting them as they are left");
+
+    /* xattrs are read once for both the callback and the copies */
+    w.popts.xattrs         = NULL;
+    w.popts.copy_xattrs    = opts->copy_xattrs;
+    w.popts.xattr_filters  = (const char *const *) opts->xattr_filters;
+    w.popts.nxattr_filters = opts->nxattr_filters;
+    if ((opts->read_xattrs || opts->copy_xattrs) &&
+            xattrs_create(&w.popts.xattrs) != 0)
+        log_warnx("cannot read xattrs, continuing without them");
+
+    w.watch = opts->watch;
+    w.visit = opts->deleted && opts->index != NULL;
+
+    /* every shard creates every directory, but only reports its own */
+    w.shard.index = opts->shard;
+    w.shard.count = opts->shards;
+    if (opts->shards > 0)
     {
-        /* update the destination path for this entry */
-        if (do_append(ent, &destroot, sanitized))
-            strcat(strcat(path, "/"), ent->fts_name);
-
-        /*
-         * unfortunatly we have two cases where dapath wont be set right
-         *  1. cp a dir to a dir that dne: report dapath as "/"
-         *  2. cp a file to a path that dne: report dapath as "/$filename"
-         */
-        char *reported_dapath;
-        if (strlen(dapath) == 0)
-        {
-            if (S_ISDIR(ent->fts_statp->st_mode))
-                reported_dapath = strdup("/");
-            else
-                if(asprintf(&reported_dapath, "/%s", destpath) < 0)
-                    reported_dapath = NULL;
-        }
-        else
-            reported_dapath = (char *) dapath;
-
-
-        digest(DGST_MD5, dapathmd5, reported_dapath, strlen(reported_dapath));
-        process(&destroot, destpath, ent, reported_dapath, dapathmd5, &popts,
-                opts->verbose);
+        w.shard.callback     = callback;
+        w.shard.ctx          = ctx;
+        w.popts.callback     = shard_callback;
+        w.popts.callback_ctx = &w.shard;
+    }
 
-        /* check pointers, no need to check string contents */
-        if (reported_dapath != dapath)
-            free(reported_dapath);
+    walker_init(&w, opts);
 
-        /* do not remove a directory entry if this is a directory preorder */
-        if (do_unappend(ent))
-        {
-            if (strrchr(path, '/') != NULL)
-                *strrchr(path, '/') = '\0';
-            else
-                *path = '\0';
-        }
+    /* begin the directory walk - physical so links are not followed, each
+     * source on a walker of its own when they are walked at once. A list is
+     * not walked, only its entries are recorded */
+    if (opts->list != NULL)
+        r = list_record(&w, src[0], opts->list, opts->nlist);
+    else if (w.plan == NULL && opts->parallel_src && srcc > 1)
+        r = walk_sources(&w, opts, src, srcc);
+    else
+    {
+        r = walk(&w, (char * const *) paths, 0);
+        cold_flush(&w.cold, &w.destroot, &w.popts, w.verbose);
     }
-    close(destroot.fd);
-    free(destroot.path);
-    free(path);
+
+    walker_fini(&w);
+    process_settle(&w.destroot, &w.popts);
+
+    if (w.plan != NULL && plan_run(w.plan, &w.destroot, &w.popts, w.verbose,
+            opts->jobs > 0? opts->jobs : online_cpus()) != 0)
+        r = -1;
+    plan_free(w.plan);
+
+    /* every copy is synced before the destinations themselves */
+    if (durable_drain(w.popts.durable) != 0)
+        r = -1;
+    if (durable_root(w.popts.durable, w.destroot.fd) != 0)
+        r = -1;
+    for (i = 0; i < w.nmirrors; i++)
+        if (durable_root(w.popts.durable, w.mirrors[i].dir.fd) != 0)
+            r = -1;
+    durable_free(w.popts.durable);
+
+    close_mirrors(&w);
+    close(w.destroot.fd);
+    free(w.destroot.path);
+    free(w.path);
     free(paths);
-    free(sanitized);
+    free(w.sanitized);
+    free(buf);
+    xattrs_free(w.popts.xattrs);
+    attrs_dirs_free(w.popts.dirs);
     return r;
 }
 
@@ -218,7 +583,7 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
 
 
 int initdestandpaths(file_t *dest, char *path, const char **destpath,
-        const char **dapath, const char *newpath, size_t src_count)
+        const char **dapath, const char *newpath, size_t src_count, int named)
 {
     int fd;
     char *real;
@@ -226,7 +591,7 @@ int initdestandpaths(file_t *dest, char *path, const char **destpath,
     char *delim;
 
     /* newpath is a directory that exists */
-    if ((fd = open(newpath, O_RDONLY | O_DIRECTORY)) != -1)
+    if (!named && (fd = open(newpath, O_RDONLY | O_DIRECTORY)) != -1)
     {
         tmp = strdup(newpath);
         REMOVE_TRAILING_SLASHES(tmp);
@@ -239,7 +604,7 @@ int initdestandpaths(file_t *dest, char *path, const char **destpath,
     }
 
     /* if dest does not exist open its parent directory */
-    if (errno == ENOENT)
+    if (named || errno == ENOENT)
     {
         if (src_count > 1)
         {
@@ -337,11 +702,112 @@ int initdestandpaths(file_t *dest, char *path, const char **destpath,
 }
 
 
-int do_append(FTSENT *ent, const file_t *destroot, const char *newpath)
+int inittarpaths(file_t *dest, char *path, const char **destpath,
+        const char **dapath, const char *newpath, size_t src_count)
+{
+    /* do_append only adds the name of each source when the root's path is
+     * the destination */
+    if ((dest->path = strdup(src_count > 1? newpath : "")) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    dest->fd = -1;
+    strcpy(path, newpath);
+    *destpath = path;
+    *dapath = path + strlen(path);
+    return 0;
+}
+
+
+int open_mirrors(struct walk *w, const char *dests[], size_t ndests,
+        const char *src[], size_t srcc, int named)
+{
+    char *path;
+    char *sanitized;
+    char *name;
+    const char *destpath;
+    const char *dapath;
+    mirror_t *m;
+
+    /* allow paths upto this max, kernel will error before we reach it */
+    enum { MAX_LENGTH = PATH_MAX * 2 };
+
+    w->nmirrors = 0;
+    if (ndests == 0)
+        return 0;
+
+    if (ndests > DCP_MAX_DESTS)
+    {
+        log_errorx("at most %d --dest may be given", DCP_MAX_DESTS);
+        return -1;
+    }
+
+    if ((path = malloc(MAX_LENGTH)) == NULL)
+    {
+        log_error("cannot open destinations");
+        return -1;
+    }
+
+    for (; w->nmirrors < ndests; w->nmirrors++)
+    {
+        m = &w->mirrors[w->nmirrors];
+        sanitized = strdup(dests[w->nmirrors]);
+        REMOVE_TRAILING_SLASHES(sanitized);
+        if (initdestandpaths(&m->dir, path, &destpath, &dapath, sanitized,
+                srcc, named) != 0)
+        {
+            free(sanitized);
+            free(path);
+            close_mirrors(w);
+            return -1;
+        }
+        free(sanitized);
+
+        /*
+         * the top component of a new path is the name of the copy's root, the
+         * source's own name when copying into an existing directory. Only
+         * when both are copying into existing directories are they the same
+         */
+        m->top = NULL;
+        if (*path != '\0')
+            m->top = strdup(path);
+        else if (*w->path != '\0')
+        {
+            name = strdup(src[0]);
+            REMOVE_TRAILING_SLASHES(name);
+            m->top = strdup(strrchr(name, '/') == NULL? name :
+                    strrchr(name, '/') + 1);
+            free(name);
+        }
+    }
+
+    free(path);
+    return 0;
+}
+
+
+void close_mirrors(struct walk *w)
+{
+    size_t i;
+
+    for (i = 0; i < w->nmirrors; i++)
+    {
+        close(w->mirrors[i].dir.fd);
+        free(w->mirrors[i].dir.path);
+        free(w->mirrors[i].top);
+    }
+    w->nmirrors = 0;
+}
+
+
+int do_append(FTSENT *ent, const file_t *destroot, const char *newpath,
+        int nested)
 {
     /* if newpath is not the destroot then we are renaming so don't append at
-     * root level */
-    if (ent->fts_level == 0 && strcmp(destroot->path, newpath) != 0)
+     * root level, the root of a nested walk was appended by its parent */
+    if (ent->fts_level == 0 && (nested || strcmp(destroot->path, newpath) != 0))
         return 0;
 
     /* no append for directory postorder */
@@ -360,31 +826,44 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
         const char *dapath, const void *pathmd5, struct process_opts *popts,
         int verbose)
 {
-    dcp_state_t state;
+    int created;
+
+    if (popts->tar != NULL && archive(newdir, newpath, ent, dapath, pathmd5,
+            popts, verbose))
+        return;
+
     switch (ent->fts_info)
     {
 
     case FTS_D:                                 /* PREORDER DIRECTORY     */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        /* when batched the directory was created while its parent was
+         * entered, only the messages are left */
+        created = (ent->fts_number & META_CREATED) != 0;
+        if ((!created || verbose) && preprocess(newdir, newpath,
+                ent->fts_path, ent->fts_statp, popts, verbose))
             break;
 
-        /* directory existing is not an error */
-        state = DCP_DIR_CREATED;
-        if (mkdirat(newdir->fd, newpath, 0777) != 0 && errno != EEXIST)
+        if (!created)
         {
-            log_error("cannot create dir '%s/%s'", newdir->path, newpath);
-            state  = DCP_DIR_FAILED;
+            process_mkdir(newdir, newpath, ent->fts_accpath, ent->fts_statp,
+                    dapath, pathmd5, popts);
+            break;
         }
 
-        popts->callback(state, pathmd5, dapath, ent->fts_statp,
-                ent->fts_accpath, NULL, NULL, NULL, NULL, NULL, -1,
-                popts->callback_ctx);
+        popts->callback(DCP_DIR_CREATED, NULL, 0, pathmd5, dapath,
+                ent->fts_statp, ent->fts_accpath,
+                process_xattrs(newdir, newpath, ent->fts_accpath, -1,
+                        ent->fts_statp, DCP_DIR_CREATED, NULL, popts),
+                NULL, NULL, NULL, NULL, NULL, -1, -1, popts->callback_ctx);
         break;
     }
 
     case FTS_DP:                                /* POSTORDER DIRECTORY    */
     {
+        /* ownership was already given when the batch created it */
+        if (ent->fts_number & META_CHOWNED)
+            break;
         process_directory(newdir, newpath, ent->fts_accpath, ent->fts_statp,
                 dapath, pathmd5, popts);
         break;
@@ -392,7 +871,10 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
 
     case FTS_F:                                 /* REGULAR FILE           */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        if (preprocess(newdir, newpath, ent->fts_path, ent->fts_statp, popts,
+                verbose) != 0)
+            break;
+        if (hand_off(popts, async_regular, newpath, ent, dapath, pathmd5))
             break;
         process_regular(newdir, newpath, ent->fts_accpath, ent->fts_statp,
                 dapath, pathmd5, popts);
@@ -401,7 +883,10 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
 
     case FTS_SL:                                /* SYMLINK                */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        if (preprocess(newdir, newpath, ent->fts_path, ent->fts_statp, popts,
+                verbose) != 0)
+            break;
+        if (hand_off(popts, async_symlink, newpath, ent, dapath, pathmd5))
             break;
         process_symlink(newdir, newpath, ent->fts_accpath, ent->fts_statp,
                 dapath, pathmd5, popts);
@@ -410,7 +895,8 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
 
     case FTS_DEFAULT:                           /* SPECIAL TYPES          */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        if (preprocess(newdir, newpath, ent->fts_path, ent->fts_statp, popts,
+                verbose) != 0)
             break;
         process_special(newdir, newpath, ent->fts_accpath, ent->fts_statp,
                 dapath, pathmd5, popts);
@@ -420,8 +906,9 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
                                                 /* Errors                 */
     case FTS_ERR:
     {
-        popts->callback(DCP_FAILED, pathmd5, dapath, NULL, NULL, NULL, NULL,
-                NULL, NULL, NULL, -1, popts->callback_ctx);
+        popts->callback(DCP_FAILED, NULL, 0, pathmd5, dapath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                popts->callback_ctx);
         errno = ent->fts_errno;
         log_error("fts_read '%s'", ent->fts_path);
         break;
@@ -429,8 +916,9 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
 
     case FTS_NS:
     {
-        popts->callback(DCP_FAILED, pathmd5, dapath, NULL, NULL, NULL, NULL,
-                NULL, NULL, NULL, -1, popts->callback_ctx);
+        popts->callback(DCP_FAILED, NULL, 0, pathmd5, dapath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                popts->callback_ctx);
         errno = ent->fts_errno;
         log_error("cannot stat '%s'", ent->fts_path);
         break;
@@ -438,8 +926,9 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
 
     case FTS_DNR:
     {
-        popts->callback(DCP_FAILED, pathmd5, dapath, NULL, NULL, NULL, NULL,
-                NULL, NULL, NULL, -1, popts->callback_ctx);
+        popts->callback(DCP_FAILED, NULL, 0, pathmd5, dapath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                popts->callback_ctx);
         errno = ent->fts_errno;
         log_error("cannot read dir '%s'", ent->fts_path);
         break;
@@ -461,3 +950,813 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
                                 ent->fts_info, ent->fts_path);
     }
 }
+
+
+int archive(file_t *newdir, const char *newpath, FTSENT *ent,
+        const char *dapath, const void *pathmd5, struct process_opts *popts,
+        int verbose)
+{
+    switch (ent->fts_info)
+    {
+    case FTS_D:
+    case FTS_F:
+    case FTS_SL:
+    case FTS_DEFAULT:
+        if (verbose)
+        {
+            fprintf(stdout, "`%s' -> `%s'\n", ent->fts_path, newpath);
+            fflush(stdout);
+        }
+        process_tar(newdir, newpath, ent->fts_accpath, ent->fts_statp, dapath,
+                pathmd5, popts);
+        return 1;
+
+    case FTS_DP:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+
+void process_work(file_t *newdir, work_t *work, struct process_opts *popts,
+        int verbose)
+{
+    int (*start)(async_t *, work_t *);
+    work_t *copy;
+
+    if (preprocess(newdir, work->newpath, work->path, &work->st, popts,
+            verbose) != 0)
+        return;
+
+    start = NULL;
+    if (S_ISREG(work->st.st_mode))
+        start = async_regular;
+    else if (S_ISLNK(work->st.st_mode))
+        start = async_symlink;
+
+    /* the engine frees the work it is given, the caller frees this one */
+    if (popts->async != NULL && start != NULL && (copy = work_create(work->path,
+            work->accpath, work->newpath, work->dapath, work->pathmd5,
+            &work->st)) != NULL)
+    {
+        if (start(popts->async, copy) == 0)
+            return;
+        work_free(copy);
+    }
+
+    if (S_ISREG(work->st.st_mode))
+        process_regular(newdir, work->newpath, work->accpath, &work->st,
+                work->dapath, work->pathmd5, popts);
+    else if (S_ISLNK(work->st.st_mode))
+        process_symlink(newdir, work->newpath, work->accpath, &work->st,
+                work->dapath, work->pathmd5, popts);
+    else
+        process_special(newdir, work->newpath, work->accpath, &work->st,
+                work->dapath, work->pathmd5, popts);
+}
+
+
+int hand_off(struct process_opts *popts, int (*start)(async_t *, work_t *),
+        const char *newpath, FTSENT *ent, const char *dapath,
+        const void *pathmd5)
+{
+    work_t *work;
+
+    if (popts->async == NULL)
+        return 0;
+
+    if ((work = work_create(ent->fts_path, ent->fts_accpath, newpath, dapath,
+            pathmd5, ent->fts_statp)) == NULL)
+        return 0;
+
+    if (start(popts->async, work) != 0)
+    {
+        work_free(work);
+        return 0;
+    }
+    return 1;
+}
+
+
+void cold_defer(struct coldqueue *cold, work_t *work, file_t *newdir,
+        struct process_opts *popts, int verbose)
+{
+    /* make room by processing the file that has waited the longest */
+    if (cold->count == cold->max)
+    {
+        process_work(newdir, cold->items[cold->head], popts, verbose);
+        work_free(cold->items[cold->head]);
+        cold->head = (cold->head + 1) % cold->max;
+        cold->count--;
+    }
+
+    cold->items[(cold->head + cold->count) % cold->max] = work;
+    cold->count++;
+}
+
+
+void cold_flush(struct coldqueue *cold, file_t *newdir,
+        struct process_opts *popts, int verbose)
+{
+    while (cold->count > 0)
+    {
+        process_work(newdir, cold->items[cold->head], popts, verbose);
+        work_free(cold->items[cold->head]);
+        cold->head = (cold->head + 1) % cold->max;
+        cold->count--;
+    }
+}
+
+
+int walk(struct walk *w, char * const *paths, int nested)
+{
+    FTS *fts;               /* pointer to the fts library's handle */
+    FTSENT *ent;            /* entry in the walk returned by fts_read */
+    meta_t *meta;
+    work_t *work;
+    char *reported_dapath;
+    char dapathmd5[MD5_DIGEST_LENGTH];
+    int streamed;
+    int mine;
+
+    meta = w->meta;
+    if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR |
+            (meta != NULL? FTS_NOSTAT : 0), NULL)) == NULL)
+    {
+        log_error("fts_open");
+        return -1;
+    }
+    if (meta != NULL && meta_roots(meta, fts) != 0)
+    {
+        log_warnx("cannot batch metadata, continuing without it");
+        fts_close(fts);
+        meta = NULL;
+        if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+        {
+            log_error("fts_open");
+            return -1;
+        }
+    }
+    while ((ent = fts_read(fts)) != NULL)
+    {
+        /* update the destination path for this entry */
+        if (do_append(ent, &w->destroot, w->sanitized, nested))
+            strcat(strcat(w->path, "/"), ent->fts_name);
+
+        /*
+         * unfortunatly we have two cases where dapath wont be set right
+         *  1. cp a dir to a dir that dne: report dapath as "/"
+         *  2. cp a file to a path that dne: report dapath as "/$filename"
+         */
+        if (strlen(w->dapath) == 0)
+        {
+            if (S_ISDIR(ent->fts_statp->st_mode))
+                reported_dapath = strdup("/");
+            else
+                if(asprintf(&reported_dapath, "/%s", w->destpath) < 0)
+                    reported_dapath = NULL;
+        }
+        else
+            reported_dapath = (char *) w->dapath;
+
+
+        digest(DGST_MD5, dapathmd5, reported_dapath, strlen(reported_dapath));
+
+        /* the walk goes into every directory, other shards copy the rest */
+        mine = ent->fts_info == FTS_D || ent->fts_info == FTS_DP ||
+                shard_mine(&w->shard, dapathmd5);
+
+        /* still there, whether or not it changed, so not deleted */
+        if (w->visit && ent->fts_info != FTS_D && ent->fts_info != FTS_DP)
+            index_visit(w->popts.index, dapathmd5);
+
+        /* watched before fts reads it, nothing created after is missed */
+        if (w->watch != NULL && ent->fts_info == FTS_D)
+            watch_dir(w->watch, ent->fts_path);
+
+        /* files held back are done before their directory is left or a
+         * subdirectory is entered */
+        if (ent->fts_info == FTS_D || ent->fts_info == FTS_DP)
+            cold_flush(&w->cold, &w->destroot, &w->popts, w->verbose);
+
+        /* start reading the next files before this one is hashed */
+        if (ent->fts_info == FTS_F && mine)
+            prefetch_window(w->prefetch, ent);
+
+        /* hash what is in the page cache now, the rest once it is read in */
+        if (!mine)
+            ;   /* another shard copies it */
+        else if (w->plan != NULL && plan_add(w->plan, ent, w->destpath,
+                    reported_dapath, dapathmd5) == 0)
+            ;   /* copied once the walk is over */
+        else if (w->cold.max > 0 && ent->fts_info == FTS_F &&
+                !prefetch_is_cached(ent->fts_accpath, ent->fts_statp->st_size)
+                && (work = work_create(ent->fts_path, ent->fts_accpath,
+                        w->destpath, reported_dapath, dapathmd5,
+                        ent->fts_statp)) != NULL)
+        {
+            prefetch_path(ent->fts_accpath, ent->fts_statp->st_size);
+            cold_defer(&w->cold, work, &w->destroot, &w->popts, w->verbose);
+        }
+        else
+            process(&w->destroot, w->destpath, ent, reported_dapath, dapathmd5,
+                    &w->popts, w->verbose);
+
+        /* huge directories are read a batch at a time instead of by fts */
+        streamed = ent->fts_info == FTS_D && w->stream > 0 &&
+                (size_t) ent->fts_statp->st_size >= w->stream;
+        if (streamed)
+            stream_dir(w, fts, ent, reported_dapath, dapathmd5);
+
+        /* the directory exists now, stat its entries and create its
+         * subdirectories, in two phase mode or with more destinations only
+         * stat them */
+        if (meta != NULL && ent->fts_info == FTS_D && !streamed)
+            meta_enter(meta, fts, ent, w->plan == NULL && w->nmirrors == 0?
+                    w->destpath : NULL);
+        if (meta != NULL && ent->fts_info == FTS_DP)
+            meta_leave(meta, ent);
+
+        /* check pointers, no need to check string contents */
+        if (reported_dapath != w->dapath)
+            free(reported_dapath);
+
+        /* do not remove a directory entry if this is a directory preorder */
+        if (do_unappend(ent))
+        {
+            if (strrchr(w->path, '/') != NULL)
+                *strrchr(w->path, '/') = '\0';
+            else
+                *w->path = '\0';
+        }
+    }
+
+    fts_close(fts);
+    return 0;
+}
+
+
+void stream_dir(struct walk *w, FTS *fts, FTSENT *dir, const char *dapath,
+        const void *pathmd5)
+{
+    stream_t *stream;
+    const char *name;
+    char *srcpath;
+    char *roots[2];
+    char md5[MD5_DIGEST_LENGTH];
+    work_t work;
+    size_t srclen;
+    size_t pathlen;
+    int unstated;
+    int r;
+
+    /* allow paths upto this max, kernel will error before we reach it */
+    enum { MAX_LENGTH = PATH_MAX * 2 };
+
+    /* fts must not read the directory, it still returns its postorder */
+    fts_set(fts, dir, FTS_SKIP);
+
+    srcpath = malloc(MAX_LENGTH);
+    if (srcpath == NULL || stream_open(&stream, dir->fts_accpath,
+            STREAM_BATCH) != 0)
+    {
+        w->popts.callback(DCP_FAILED, NULL, 0, pathmd5, dapath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                w->popts.callback_ctx);
+        log_error("cannot read dir '%s'", dir->fts_path);
+        free(srcpath);
+        return;
+    }
+
+    /* fts does not double the '/' when the directory was given with one */
+    srclen = dir->fts_pathlen;
+    if (srclen > 0 && dir->fts_path[srclen - 1] == '/')
+        srclen--;
+    memcpy(srcpath, dir->fts_path, srclen);
+    srcpath[srclen++] = '/';
+    pathlen = strlen(w->path);
+
+    while ((r = stream_next(stream, &name)) == 1)
+    {
+        strcpy(srcpath + srclen, name);
+        strcat(strcat(w->path, "/"), name);
+        digest(DGST_MD5, md5, w->dapath, strlen(w->dapath));
+
+        unstated = fstatat(stream_fd(stream), name, &work.st,
+                AT_SYMLINK_NOFOLLOW) != 0;
+
+        /* directories are visited by their own walk, as in walk() */
+        if (w->visit && (unstated || !S_ISDIR(work.st.st_mode)))
+            index_visit(w->popts.index, md5);
+
+        if (unstated)
+        {
+            w->popts.callback(DCP_FAILED, NULL, 0, md5, w->dapath, NULL, NULL,
+                    NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                    w->popts.callback_ctx);
+            log_error("cannot stat '%s'", srcpath);
+        }
+        else if (S_ISDIR(work.st.st_mode))
+        {
+            /* the subdirectory gets a walk of its own */
+            roots[0] = srcpath;
+            roots[1] = NULL;
+            walk(w, roots, 1);
+        }
+        else if (shard_mine(&w->shard, md5))
+        {
+            work.path    = srcpath;
+            work.accpath = srcpath;
+            work.newpath = (char *) w->destpath;
+            work.dapath  = (char *) w->dapath;
+            memcpy(work.pathmd5, md5, MD5_DIGEST_LENGTH);
+            process_work(&w->destroot, &work, &w->popts, w->verbose);
+        }
+
+        w->path[pathlen] = '\0';
+    }
+
+    if (r != 0)
+        log_error("cannot read dir '%s'", dir->fts_path);
+    stream_close(stream);
+    free(srcpath);
+}
+
+
+void walker_init(struct walk *w, const struct dcp_options *opts)
+{
+    async_t *async;
+
+    /* lookahead on the files that follow the one being hashed */
+    w->prefetch = NULL;
+    if (w->plan == NULL && opts->prefetch > 0 &&
+            prefetch_create(&w->prefetch, opts->prefetch) != 0)
+        log_warnx("cannot create prefetcher, continuing without it");
+    w->popts.prefetch = w->prefetch;
+
+    /* files not in the page cache wait here while they are read ahead */
+    memset(&w->cold, 0, sizeof(w->cold));
+    if (w->plan == NULL && opts->cached_first)
+    {
+        w->cold.max = opts->prefetch > 0? opts->prefetch : DEFAULT_COLD_WINDOW;
+        if ((w->cold.items = calloc(w->cold.max, sizeof(work_t *))) == NULL)
+        {
+            log_warn("cannot hold back uncached files");
+            w->cold.max = 0;
+        }
+    }
+
+    /* keep many files in flight on a single thread */
+    async = NULL;
+    if (w->plan == NULL && w->nmirrors == 0 && opts->async > 0 &&
+            async_create(&async, opts->async, &w->destroot, &w->popts) != 0)
+        log_warnx("io_uring unavailable, copying one file at a time");
+    w->popts.async = async;
+
+    /* stat a directory's entries all at once instead of letting fts do it */
+    w->meta = NULL;
+    if (opts->meta_batch > 0 && meta_create(&w->meta, opts->meta_batch,
+            &w->destroot, &w->popts.attrs) != 0)
+        log_warnx("cannot batch metadata, continuing without it");
+}
+
+
+void walker_fini(struct walk *w)
+{
+    free(w->cold.items);
+    async_free(w->popts.async);
+    w->popts.async = NULL;
+    meta_free(w->meta);
+    prefetch_free(w->prefetch);
+    w->popts.prefetch = NULL;
+}
+
+
+int walk_sources(struct walk *w, const struct dcp_options *opts,
+        const char *src[], size_t srcc)
+{
+    pool_t *pool;
+    serial_t serial;
+    struct sources s;
+    struct walk *v;
+    size_t threads;
+    size_t count;
+    size_t i;
+    int r;
+
+    /* allow paths upto this max, kernel will error before we reach it */
+    enum { MAX_LENGTH = PATH_MAX * 2 };
+
+    threads = opts->jobs > 0? opts->jobs : online_cpus();
+    if (threads > srcc)
+        threads = srcc;
+
+    pool = NULL;
+    if (threads > 1 && pool_create(&pool, threads - 1) != 0)
+        log_warnx("cannot start walker threads, walking one source at a time");
+
+    count = pool_threads(pool);
+    s.src = src;
+    s.walkers = calloc(count, sizeof(struct walk *));
+    s.failed = calloc(count, sizeof(int));
+    if (s.walkers == NULL || s.failed == NULL)
+    {
+        log_error("malloc");
+        free(s.walkers);
+        free(s.failed);
+        pool_free(pool);
+        return -1;
+    }
+
+    /* everyone reports through the lock, the caller's io_uring included */
+    serial_init(&serial, w->popts.callback, w->popts.callback_ctx);
+    w->popts.callback     = serial_callback;
+    w->popts.callback_ctx = &serial;
+
+    r = 0;
+    s.walkers[0] = w;
+    for (i = 1; i < count; i++)
+    {
+        if ((v = malloc(sizeof(*v))) == NULL)
+        {
+            log_error("malloc");
+            r = -1;
+            break;
+        }
+
+        /* the destination is shared, where the walk is and the buffer are
+         * not. The sources are in an existing directory so dapath is the
+         * start of path and destpath follows the '/' */
+        *v = *w;
+        v->path = malloc(MAX_LENGTH);
+        v->popts.buffer = malloc(w->popts.buffer_size);
+        v->popts.xattrs = NULL;
+        v->popts.dirs = NULL;
+        if (v->path == NULL || v->popts.buffer == NULL ||
+                (w->popts.xattrs != NULL &&
+                xattrs_create(&v->popts.xattrs) != 0) ||
+                (w->popts.dirs != NULL &&
+                attrs_dirs_create(&v->popts.dirs) != 0))
+        {
+            log_error("cannot allocate buffer of size %zu bytes",
+                    w->popts.buffer_size);
+            free(v->path);
+            free(v->popts.buffer);
+            xattrs_free(v->popts.xattrs);
+            attrs_dirs_free(v->popts.dirs);
+            free(v);
+            r = -1;
+            break;
+        }
+        strcpy(v->path, w->path);
+        v->dapath   = v->path + (w->dapath - w->path);
+        v->destpath = v->path + (w->destpath - w->path);
+
+        walker_init(v, opts);
+        s.walkers[i] = v;
+    }
+
+    if (r == 0)
+        pool_for(pool, srcc, walk_source, &s);
+
+    pool_free(pool);
+    for (i = 0; i < count; i++)
+    {
+        if (s.failed[i])
+            r = -1;
+        if (i == 0 || (v = s.walkers[i]) == NULL)
+            continue;
+        walker_fini(v);
+        process_settle(&v->destroot, &v->popts);
+        free(v->path);
+        free(v->popts.buffer);
+        xattrs_free(v->popts.xattrs);
+        attrs_dirs_free(v->popts.dirs);
+        free(v);
+    }
+
+    w->popts.callback     = serial.callback;
+    w->popts.callback_ctx = serial.ctx;
+    serial_destroy(&serial);
+    free(s.walkers);
+    free(s.failed);
+    return r;
+}
+
+
+void walk_source(void *ctx, size_t i, size_t thread)
+{
+    struct sources *s = ctx;
+    struct walk *w = s->walkers[thread];
+    char *roots[2];
+
+    roots[0] = (char *) s->src[i];
+    roots[1] = NULL;
+    if (walk(w, roots, 0) != 0)
+        s->failed[thread] = 1;
+
+    /* nothing of this source is held back once it is done */
+    cold_flush(&w->cold, &w->destroot, &w->popts, w->verbose);
+}
+
+
+int list_record(struct walk *w, const char *src, const char **list,
+        size_t count)
+{
+    struct stat st;
+    char **rels;
+    char *dirs;
+    size_t *lens;
+    size_t depth;
+    size_t nrels;
+    size_t i;
+    size_t p;
+    mode_t mode;
+    int r;
+
+    if (w->plan == NULL)
+    {
+        log_errorx("cannot record the listed entries");
+        return -1;
+    }
+
+    if (stat(src, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        log_errorx("cannot copy a list from '%s', not a directory", src);
+        return -1;
+    }
+
+    /* the directories above the current entry, deepest last, each is the
+     * first lens[i] bytes of dirs. Normalized, a path shorter than PATH_MAX
+     * has no more than PATH_MAX / 2 of them */
+    rels = calloc(count + 1, sizeof(char *));
+    lens = calloc(PATH_MAX / 2 + 1, sizeof(size_t));
+    dirs = malloc(PATH_MAX);
+    if (rels == NULL || lens == NULL || dirs == NULL)
+    {
+        log_error("cannot record %zu entries", count);
+        free(rels);
+        free(lens);
+        free(dirs);
+        return -1;
+    }
+
+    r = 0;
+    nrels = 0;
+    for (i = 0; i < count; i++)
+    {
+        if ((rels[nrels] = list_normalize(list[i])) == NULL)
+        {
+            log_errorx("skipping '%s', it is not below '%s'", list[i], src);
+            r = -1;
+        }
+        else if (strlen(rels[nrels]) >= PATH_MAX)
+        {
+            log_errorx("skipping '%s', path too long", list[i]);
+            free(rels[nrels]);
+            r = -1;
+        }
+        else if (*rels[nrels] == '\0')
+            free(rels[nrels]);  /* the root is always recorded */
+        else
+            nrels++;
+    }
+
+    /* sorted the entries below a directory follow it, so a directory is
+     * recorded once when the first of them is reached */
+    qsort(rels, nrels, sizeof(char *), pathptr_cmp);
+
+    /* the root leads to every entry */
+    depth = 0;
+    if (list_add(w, src, "", 0, 0, 1, &mode) != 0)
+    {
+        for (i = 0; i < nrels; i++)
+            free(rels[i]);
+        nrels = 0;
+        r = -1;
+    }
+
+    for (i = 0; i < nrels; i++)
+    {
+        if (i > 0 && strcmp(rels[i], rels[i - 1]) == 0)
+            continue;
+
+        /* leave the directories the entry is not in */
+        while (depth > 0 && (strncmp(rels[i], dirs, lens[depth - 1]) != 0 ||
+                rels[i][lens[depth - 1]] != '/'))
+            depth--;
+
+        /* enter the ones it is in that were not recorded yet */
+        for (p = depth > 0? lens[depth - 1] + 1 : 0; rels[i][p] != '\0'; p++)
+        {
+            if (rels[i][p] != '/')
+                continue;
+            if (list_add(w, src, rels[i], p, depth + 1, 1, &mode) != 0)
+                break;
+            memcpy(dirs, rels[i], p);
+            lens[depth++] = p;
+        }
+        if (rels[i][p] != '\0' || list_add(w, src, rels[i], p, depth + 1, 0,
+                &mode) != 0)
+        {
+            r = -1;
+            continue;
+        }
+
+        /* a listed directory may be followed by its own entries */
+        if (S_ISDIR(mode))
+        {
+            memcpy(dirs, rels[i], p);
+            lens[depth++] = p;
+        }
+    }
+
+    for (i = 0; i < nrels; i++)
+        free(rels[i]);
+    free(rels);
+    free(lens);
+    free(dirs);
+    return r;
+}
+
+
+int list_add(struct walk *w, const char *src, const char *rel, size_t len,
+        int level, int parent, mode_t *mode)
+{
+    struct stat st;
+    char *srcpath;
+    char *path;
+    const char *newpath;
+    const char *dapath;
+    char md5[MD5_DIGEST_LENGTH];
+    int r;
+
+    /* the destination of rel is under the copy's root, as the walk would
+     * have built it in w->path */
+    srcpath = NULL;
+    path = NULL;
+    if (asprintf(&srcpath, "%s%s%.*s", src, len > 0? "/" : "", (int) len,
+            rel) < 0 || asprintf(&path, "%s%s%.*s", w->path,
+            len > 0? "/" : "", (int) len, rel) < 0)
+    {
+        log_error("cannot record '%s/%.*s'", src, (int) len, rel);
+        free(srcpath);
+        return -1;
+    }
+    dapath = path + (w->dapath - w->path);
+    if (*dapath == '\0')
+        dapath = "/";
+    digest(DGST_MD5, md5, dapath, strlen(dapath));
+
+    r = 0;
+    if (lstat(srcpath, &st) != 0)
+    {
+        w->popts.callback(DCP_FAILED, NULL, 0, md5, dapath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                w->popts.callback_ctx);
+        log_error("cannot stat '%s'", srcpath);
+        r = -1;
+    }
+    else if (parent && !S_ISDIR(st.st_mode))
+    {
+        log_errorx("'%s' is not a directory", srcpath);
+        r = -1;
+    }
+    else
+    {
+        /* every shard needs the directories, each copies its own files. A
+         * directory only leading to the entries that is already there, as
+         * --watch lists into an existing copy, is not created again */
+        *mode = st.st_mode;
+        newpath = path + (w->destpath - w->path);
+        if ((S_ISDIR(st.st_mode) || shard_mine(&w->shard, md5)) &&
+                plan_add_path(w->plan, srcpath, &st, level, newpath, dapath,
+                        md5, parent && list_exists(w, newpath)) != 0)
+        {
+            log_errorx("cannot record '%s'", srcpath);
+            r = -1;
+        }
+    }
+
+    free(srcpath);
+    free(path);
+    return r;
+}
+
+
+int list_exists(const struct walk *w, const char *newpath)
+{
+    struct stat st;
+    size_t i;
+
+    if (fstatat(w->destroot.fd, newpath, &st, 0) != 0 || !S_ISDIR(st.st_mode))
+        return 0;
+
+    for (i = 0; i < w->nmirrors; i++)
+        if (fstatat(w->mirrors[i].dir.fd, mirror_path(&w->mirrors[i],
+                newpath), &st, 0) != 0 || !S_ISDIR(st.st_mode))
+            return 0;
+    return 1;
+}
+
+
+char *list_normalize(const char *path)
+{
+    char *norm;
+    const char *c;
+    size_t len;
+    size_t n;
+
+    if ((norm = malloc(strlen(path) + 1)) == NULL)
+        return NULL;
+
+    n = 0;
+    for (c = path; *c != '\0'; c += len)
+    {
+        while (*c == '/')
+            c++;
+        len = strcspn(c, "/");
+        if (len == 0 || (len == 1 && c[0] == '.'))
+            continue;
+        if (len == 2 && c[0] == '.' && c[1] == '.')
+        {
+            free(norm);
+            return NULL;
+        }
+
+        if (n > 0)
+            norm[n++] = '/';
+        memcpy(norm + n, c, len);
+        n += len;
+    }
+    norm[n] = '\0';
+    return norm;
+}
+
+
+int pathptr_cmp(const void *a, const void *b)
+{
+    const unsigned char *l = *(const unsigned char * const *) a;
+    const unsigned char *r = *(const unsigned char * const *) b;
+
+    while (*l != '\0' && *l == *r)
+    {
+        l++;
+        r++;
+    }
+
+    /* the end of a path, then '/', then the other bytes */
+    if (*l == *r)
+        return 0;
+    if (*l == '\0' || *r == '\0')
+        return *l == '\0'? -1 : 1;
+    if (*l == '/' || *r == '/')
+        return *l == '/'? -1 : 1;
+    return *l < *r? -1 : 1;
+}
+
+
+int shard_mine(const struct shard *shard, const void *pathmd5)
+{
+    const unsigned char *b = pathmd5;
+    uint64_t h;
+    int i;
+
+    if (shard->count == 0)
+        return 1;
+
+    /* md5 is uniform so the first 8 bytes are as good as all 16, read in a
+     * fixed byte order so hosts of any endianness agree */
+    h = 0;
+    for (i = 0; i < 8; i++)
+        h = (h << 8) | b[i];
+    return h % shard->count == shard->index;
+}
+
+
+int shard_callback(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context)
+{
+    struct shard *shard = context;
+
+    if (!shard_mine(shard, pathmd5))
+        return 0;
+
+    return shard->callback(state, dests, ndests, pathmd5, dapath, sstat,
+            accesspath, xattrs, symlinkpath, md5, sha1, sha256, sha512,
+            process_time, offset, shard->ctx);
+}
+
+
+size_t online_cpus(void)
+{
+    long n;
+
+    return (n = sysconf(_SC_NPROCESSORS_ONLN)) < 1? 1 : (size_t) n;
+}
@@ -26,6 +26,19 @@
 #include <sys/types.h>
 
 #include "../index/index.h"
+#include "engine.h"
+#include "tar.h"
+#include "watch.h"
+#include "xattr.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * max # of destinations copied to besides the first, @see dcp_options.dests
+ */
+#define DCP_MAX_DESTS 16
 
 
 /* Type Defs ******************************************************************/
@@ -50,13 +63,18 @@ typedef enum {
  * callback function for dcp to call once a file has finished being processed
  * The callback will be provided with the file's stat information, where the
  * file was copied from and to, and if it is a regular file the digests
- * calculated.
+ * calculated. When there are more destinations `dests` holds how the entry
+ * went at each of them, in the order they were given, otherwise it is NULL.
+ * `xattrs` are the extended attributes of the source when they were read,
+ * NULL otherwise, they are only valid during the call. `offset` is where the
+ * entry starts in the --tar archive, -1 when there is none.
  */
-typedef int (*dcp_callback_f)(dcp_state_t state, const void *pathmd5,
+typedef int (*dcp_callback_f)(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5,
         const char *dapath, const struct stat *sstat, const char *accesspath,
-        const char *symlinkpath, const void *md5,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
         const void *sha1, const void *sha256, const void *sha512,
-        unsigned long process_time, void *context);
+        unsigned long process_time, off_t offset, void *context);
 
 
 /**
@@ -64,12 +82,44 @@ typedef int (*dcp_callback_f)(dcp_state_t state, const void *pathmd5,
  */
 struct dcp_options {
     size_t bufsize;     /**< amount of memory to set aside to cache files */
-    uid_t uid;          /**< owner of copied files */
-    gid_t gid;          /**< group of copied files */
+    uid_t uid;          /**< owner of copied files, -1 for the source's */
+    gid_t gid;          /**< group of copied files, -1 for the source's */
+    int preserve;       /**< give copies the mode and times of the source */
     int digests;        /**< mask of @see digest_alg_t's specifying what hashes
                              to calc */
     index_t *index;     /**< if not NULL do not copy any file in the index */
     int verbose;        /**< should we output explanation of what is going on */
+    size_t prefetch;    /**< max # of upcoming files to prefetch, 0 disables */
+    int cached_first;   /**< process files in the page cache before others */
+    size_t async;       /**< max # of files in flight on io_uring, 0 disables */
+    size_t meta_batch;  /**< max # of metadata requests in flight, 0 disables */
+    int two_phase;      /**< record the walk then copy it in parallel passes */
+    size_t jobs;        /**< # of threads for two phase, a list or parallel
+                             sources, 0 for one per cpu */
+    size_t stream;      /**< stream directories this size or more, 0 never */
+    int parallel_src;   /**< walk every source at once on its own thread */
+    size_t shard;       /**< which share of the entries to copy and report */
+    size_t shards;      /**< # of shares the entries are split in, 0 for no
+                             split */
+    int engines[ENGINE_CLASSES]; /**< engine_id_t for each size class */
+    const char **dests; /**< more destinations to copy to, read only once */
+    size_t ndests;      /**< # of `dests`, at most DCP_MAX_DESTS */
+    const char **list;  /**< if not NULL copy only these paths, relative to
+                             the single source, instead of walking it */
+    size_t nlist;       /**< # of `list` */
+    watch_t *watch;     /**< if not NULL every directory walked is watched */
+    int deleted;        /**< visit the index entry of everything walked to
+                             find what is gone, @see index_visit */
+    int read_xattrs;    /**< read the xattrs of every entry for the callback */
+    int copy_xattrs;    /**< and set them on the copies as well */
+    const char **xattr_filters; /**< which ones are set, @see xattr.h */
+    size_t nxattr_filters;      /**< # of `xattr_filters`, 0 sets them all */
+    int sync;           /**< durable_mode_t, how the copies are synced */
+    int atomic;         /**< files are written unnamed, named once complete */
+    int update;         /**< update_mode_t, how a current copy is found */
+    tar_t *tar;         /**< if not NULL nothing is created, the entries are
+                             added to this archive named as their copies
+                             would be, @see tar.h */
 };
 
 
@@ -0,0 +1,521 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the durable.h API. With batch the copies handed over and
+ * the entries held back make up the next batch, the thread swaps both out at
+ * once. An entry is always reported after its copy was handed over, so the
+ * batch holding it is never synced before the one holding its copy.
+ */
+ /* for syncfs and sync_file_range */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "durable.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * # of copies that can wait for the thread
+ */
+#define MAX_FDS (2 * DURABLE_BATCH_SIZE)
+
+
+/**
+ * # of entries held back that wake the thread even when the batch holds fewer
+ * than DURABLE_BATCH_SIZE copies. Directories, symlinks, failures and skipped
+ * files hand over no copy and would otherwise be held till the end.
+ */
+#define MAX_ENTRIES (8 * DURABLE_BATCH_SIZE)
+
+
+/* Static Vars ****************************************************************/
+
+
+/**
+ * names of the modes by durable_mode_t
+ */
+static const char *const NAMES[] = { "none", "file", "batch", "fs" };
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * an entry held back, its strings follow it in the same allocation
+ */
+struct entry {
+    struct entry *next;
+    dcp_state_t state;
+    dcp_state_t dests[DCP_MAX_DESTS];
+    size_t ndests;
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];
+    struct stat st;
+    const struct stat *sstat; /**< &st, NULL when none was given */
+    xattrs_t *xattrs;
+    const char *dapath;
+    const char *accesspath; /**< NULL when none was given */
+    const char *symlinkpath;
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    unsigned char sha1[SHA_DIGEST_LENGTH];
+    unsigned char sha256[SHA256_DIGEST_LENGTH];
+    unsigned char sha512[SHA512_DIGEST_LENGTH];
+    int digests;            /**< mask of the digests given */
+    unsigned long process_time;
+    off_t offset;
+};
+
+
+struct durable {
+    durable_mode_t mode;
+    int atomic;             /**< the copies are named once complete */
+    dcp_callback_f callback;
+    void *ctx;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /**< a batch is ready or the thread must stop */
+    pthread_cond_t room;    /**< the thread took the copies waiting */
+    int fds[MAX_FDS];       /**< copies of the next batch */
+    size_t nfds;
+    struct entry *head;     /**< entries of the next batch */
+    struct entry **tail;
+    size_t nentries;
+    int stop;
+    int failed;             /**< a copy could not be synced */
+    int running;
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * the thread, syncs and reports a batch at a time till told to stop
+ */
+static void *run(void *arg);
+
+
+/**
+ * sync and close `n` copies
+ *
+ * @return          0 on success, -1 if one could not be synced or closed
+ */
+static int sync_fds(const int *fds, size_t n);
+
+
+/**
+ * copy an entry given to durable_callback
+ *
+ * @return          the copy, NULL on failure
+ */
+static struct entry *entry_create(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset);
+
+
+/**
+ * report every entry of `e` onwards and free them
+ */
+static void report(durable_t *d, struct entry *e);
+
+
+/* Public Impl ****************************************************************/
+
+
+int durable_create(durable_t **d, durable_mode_t mode, int atomic,
+        dcp_callback_f callback, void *ctx)
+{
+    if ((*d = calloc(1, sizeof(durable_t))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    (*d)->mode     = mode;
+    (*d)->atomic   = atomic;
+    (*d)->callback = callback;
+    (*d)->ctx      = ctx;
+    (*d)->tail     = &(*d)->head;
+    if (mode != DURABLE_BATCH)
+        return 0;
+
+    pthread_mutex_init(&(*d)->lock, NULL);
+    pthread_cond_init(&(*d)->wake, NULL);
+    pthread_cond_init(&(*d)->room, NULL);
+    if ((errno = pthread_create(&(*d)->thread, NULL, run, *d)) != 0)
+    {
+        log_error("cannot start the sync thread");
+        durable_free(*d);
+        *d = NULL;
+        return -1;
+    }
+    (*d)->running = 1;
+    return 0;
+}
+
+
+void durable_free(durable_t *d)
+{
+    if (d == NULL)
+        return;
+
+    if (d->mode == DURABLE_BATCH)
+    {
+        durable_drain(d);
+        pthread_cond_destroy(&d->room);
+        pthread_cond_destroy(&d->wake);
+        pthread_mutex_destroy(&d->lock);
+    }
+    free(d);
+}
+
+
+int durable_find(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(NAMES) / sizeof(NAMES[0]); i++)
+        if (strcmp(NAMES[i], name) == 0)
+            return i;
+    return -1;
+}
+
+
+const char *durable_name(durable_mode_t mode)
+{
+    return NAMES[mode];
+}
+
+
+durable_mode_t durable_mode(const durable_t *d)
+{
+    return d == NULL? DURABLE_NONE : d->mode;
+}
+
+
+int durable_atomic(const durable_t *d)
+{
+    return d != NULL && d->atomic;
+}
+
+
+int durable_open(const durable_t *d, int dirfd, const char *path)
+{
+    return fd_create(dirfd, path, durable_atomic(d));
+}
+
+
+int durable_publish(const durable_t *d, int fd, int dirfd, const char *path)
+{
+    return durable_atomic(d)? fd_publish(fd, dirfd, path) : 0;
+}
+
+
+int durable_close(durable_t *d, int fd, int dirfd, const char *path)
+{
+    int saved;
+
+    /* the name only ever points at synced data */
+    if ((durable_mode(d) == DURABLE_FILE && fdatasync(fd) == -1) ||
+            durable_publish(d, fd, dirfd, path) == -1)
+    {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    switch (durable_mode(d))
+    {
+    case DURABLE_BATCH:
+        pthread_mutex_lock(&d->lock);
+        while (d->nfds == MAX_FDS)
+            pthread_cond_wait(&d->room, &d->lock);
+        d->fds[d->nfds++] = fd;
+        if (d->nfds == DURABLE_BATCH_SIZE)
+            pthread_cond_signal(&d->wake);
+        pthread_mutex_unlock(&d->lock);
+        return 0;
+
+    default:
+        return close(fd);
+    }
+}
+
+
+int durable_dir(const durable_t *d, int dirfd, const char *path)
+{
+    int saved;
+    int fd;
+
+    if (durable_mode(d) != DURABLE_FILE && durable_mode(d) != DURABLE_BATCH)
+        return 0;
+
+    if ((fd = openat(dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        return -1;
+    if (fsync(fd) == -1)
+    {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return close(fd);
+}
+
+
+int durable_root(const durable_t *d, int fd)
+{
+    switch (durable_mode(d))
+    {
+    case DURABLE_FS:
+        if (syncfs(fd) == -1)
+        {
+            log_error("syncfs");
+            return -1;
+        }
+        return 0;
+
+    case DURABLE_FILE:
+    case DURABLE_BATCH:
+        if (fsync(fd) == -1)
+        {
+            log_error("fsync");
+            return -1;
+        }
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+
+int durable_drain(durable_t *d)
+{
+    if (d == NULL)
+        return 0;
+
+    if (d->mode == DURABLE_BATCH && d->running)
+    {
+        pthread_mutex_lock(&d->lock);
+        d->stop = 1;
+        pthread_cond_signal(&d->wake);
+        pthread_mutex_unlock(&d->lock);
+
+        pthread_join(d->thread, NULL);
+        d->running = 0;
+    }
+
+    return d->failed? -1 : 0;
+}
+
+
+int durable_callback(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context)
+{
+    durable_t *d = context;
+    struct entry *e;
+
+    if ((e = entry_create(state, dests, ndests, pathmd5, dapath, sstat,
+            accesspath, xattrs, symlinkpath, md5, sha1, sha256, sha512,
+            process_time, offset)) == NULL)
+    {
+        log_errorx("cannot hold back the entry of '%s'",
+                accesspath == NULL? dapath : accesspath);
+        return -1;
+    }
+
+    pthread_mutex_lock(&d->lock);
+    *d->tail = e;
+    d->tail = &e->next;
+    if (++d->nentries == MAX_ENTRIES)
+        pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void *run(void *arg)
+{
+    durable_t *d = arg;
+    int fds[MAX_FDS];
+    struct entry *head;
+    size_t n;
+
+    pthread_mutex_lock(&d->lock);
+    for (;;)
+    {
+        while (!d->stop && d->nfds < DURABLE_BATCH_SIZE &&
+                d->nentries < MAX_ENTRIES)
+            pthread_cond_wait(&d->wake, &d->lock);
+        if (d->stop && d->nfds == 0 && d->head == NULL)
+            break;
+
+        /* the copies and entries so far make up the batch */
+        n = d->nfds;
+        memcpy(fds, d->fds, n * sizeof(int));
+        head = d->head;
+        d->nfds = 0;
+        d->head = NULL;
+        d->tail = &d->head;
+        d->nentries = 0;
+        pthread_cond_broadcast(&d->room);
+        pthread_mutex_unlock(&d->lock);
+
+        if (sync_fds(fds, n) != 0)
+            d->failed = 1;
+        report(d, head);
+
+        pthread_mutex_lock(&d->lock);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+
+int sync_fds(const int *fds, size_t n)
+{
+    size_t i;
+    int r;
+
+    /* start writing all of them back before waiting on any */
+    for (i = 0; i < n; i++)
+        sync_file_range(fds[i], 0, 0, SYNC_FILE_RANGE_WRITE);
+
+    r = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (fdatasync(fds[i]) == -1)
+        {
+            log_error("cannot sync a copy, possible data loss");
+            r = -1;
+        }
+        if (close(fds[i]) == -1)
+        {
+            log_error("closing a copy failed, possible data loss");
+            r = -1;
+        }
+    }
+    return r;
+}
+
+
+struct entry *entry_create(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset)
+{
+    struct entry *e;
+    size_t dlen;
+    size_t alen;
+    size_t slen;
+    char *p;
+
+    dlen = strlen(dapath) + 1;
+    alen = accesspath == NULL? 0 : strlen(accesspath) + 1;
+    slen = symlinkpath == NULL? 0 : strlen(symlinkpath) + 1;
+    if ((e = malloc(sizeof(struct entry) + dlen + alen + slen)) == NULL)
+        return NULL;
+
+    e->xattrs = NULL;
+    if (xattrs != NULL && xattrs_copy(&e->xattrs, xattrs) != 0)
+    {
+        free(e);
+        return NULL;
+    }
+
+    p = (char *) (e + 1);
+    e->dapath = memcpy(p, dapath, dlen);
+    e->accesspath = alen == 0? NULL : memcpy(p + dlen, accesspath, alen);
+    e->symlinkpath = slen == 0? NULL : memcpy(p + dlen + alen, symlinkpath,
+            slen);
+
+    e->next   = NULL;
+    e->state  = state;
+    e->ndests = ndests;
+    if (ndests > 0)
+        memcpy(e->dests, dests, ndests * sizeof(dcp_state_t));
+    memcpy(e->pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    e->sstat = NULL;
+    if (sstat != NULL)
+    {
+        e->st = *sstat;
+        e->sstat = &e->st;
+    }
+    e->process_time = process_time;
+    e->offset       = offset;
+
+    e->digests = 0;
+    if (md5 != NULL)
+    {
+        memcpy(e->md5, md5, sizeof(e->md5));
+        e->digests |= DGST_MD5;
+    }
+    if (sha1 != NULL)
+    {
+        memcpy(e->sha1, sha1, sizeof(e->sha1));
+        e->digests |= DGST_SHA1;
+    }
+    if (sha256 != NULL)
+    {
+        memcpy(e->sha256, sha256, sizeof(e->sha256));
+        e->digests |= DGST_SHA256;
+    }
+    if (sha512 != NULL)
+    {
+        memcpy(e->sha512, sha512, sizeof(e->sha512));
+        e->digests |= DGST_SHA512;
+    }
+    return e;
+}
+
+
+void report(durable_t *d, struct entry *e)
+{
+    struct entry *next;
+
+    for (; e != NULL; e = next)
+    {
+        next = e->next;
+        d->callback(e->state, e->ndests > 0? e->dests : NULL, e->ndests,
+                e->pathmd5, e->dapath, e->sstat, e->accesspath, e->xattrs,
+                e->symlinkpath,
+                HAS_MD5(e->digests)?    e->md5    : NULL,
+                HAS_SHA1(e->digests)?   e->sha1   : NULL,
+                HAS_SHA256(e->digests)? e->sha256 : NULL,
+                HAS_SHA512(e->digests)? e->sha512 : NULL,
+                e->process_time, e->offset, d->ctx);
+        xattrs_free(e->xattrs);
+        free(e);
+    }
+}
@@ -0,0 +1,193 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * How the copies are made durable, @see --sync. Left to the page cache a
+ * crash after an entry was reported can lose the data it describes, syncing
+ * every copy as it is closed makes the copy wait on the disk a file at a time.
+ *
+ *      none    nothing is synced
+ *      file    each copy is fdatasync'd before it is closed
+ *      batch   each copy is handed to a thread that syncs them
+ *              DURABLE_BATCH_SIZE at a time, writeback of the whole batch
+ *              is started before the first fdatasync so the file system
+ *              commits them together
+ *      fs      nothing is synced while copying, each destination gets a
+ *              single syncfs once everything was copied
+ *
+ * With file and batch every directory is fsync'd once, after everything in it
+ * and in the order the walk left them, for the names of the copies to last as
+ * well. An entry is only reported once the data of its copy is synced, with
+ * batch the entries are held back until the copies handed to the thread
+ * before them are, @see durable_callback.
+ *
+ * With --atomic the copies are written unnamed and only given their name once
+ * complete, replacing what was there in a single step, @see fd_create. With
+ * file the name is given after the data is synced. The batch thread would only
+ * sync a copy after it was named, so --atomic cannot be used with batch.
+ */
+#ifndef DURABLE_H__
+#define DURABLE_H__
+
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "dcp.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * # of copies synced together with batch, twice as many may be left open
+ */
+#define DURABLE_BATCH_SIZE 128
+
+
+/* Type Defs ******************************************************************/
+
+
+typedef enum {
+    DURABLE_NONE,
+    DURABLE_FILE,
+    DURABLE_BATCH,
+    DURABLE_FS
+} durable_mode_t;
+
+
+/**
+ * a run's syncing and with batch the thread and the entries held back
+ */
+typedef struct durable durable_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Set up the syncing of a run, with batch its thread is started.
+ *
+ * @param d         where to store the new instance
+ * @param mode      how the copies are synced
+ * @param atomic    the copies are named once complete
+ * @param callback  where the entries held back with batch are reported
+ * @param ctx       given to `callback`
+ *
+ * @return          0 on success, -1 on failure
+ */
+int durable_create(durable_t **d, durable_mode_t mode, int atomic,
+        dcp_callback_f callback, void *ctx);
+
+
+/**
+ * release `d` once drained, NULL is ignored
+ */
+void durable_free(durable_t *d);
+
+
+/**
+ * @return          the durable_mode_t called `name`, -1 if there is none
+ */
+int durable_find(const char *name);
+
+
+/**
+ * @return          the name of `mode`, as given to --sync
+ */
+const char *durable_name(durable_mode_t mode);
+
+
+/**
+ * @return          how `d` syncs, DURABLE_NONE when it is NULL
+ */
+durable_mode_t durable_mode(const durable_t *d);
+
+
+/**
+ * @return          1 when the copies of `d` are named once complete, 0 when
+ *                  they are created in place or `d` is NULL
+ */
+int durable_atomic(const durable_t *d);
+
+
+/**
+ * Create the copy `path` relative to `dirfd` as `d` asks, @see fd_create.
+ *
+ * @return          the copy open for writing, -1 on failure with errno set
+ */
+int durable_open(const durable_t *d, int dirfd, const char *path);
+
+
+/**
+ * Give a complete copy made by durable_open its name, nothing is done unless
+ * it is atomic, @see fd_publish. durable_close does it already, this is for a
+ * copy that is synced by other means.
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+int durable_publish(const durable_t *d, int fd, int dirfd, const char *path);
+
+
+/**
+ * Close a copy that was written in full, syncing it first and giving it its
+ * name as `d` asks. With batch the fd is handed to the thread, which closes it
+ * once synced, waiting while 2 * DURABLE_BATCH_SIZE are.
+ *
+ * @param d         NULL or the run's syncing
+ * @param fd        the copy open for writing
+ * @param dirfd     directory `path` is relative to
+ * @param path      name of the copy
+ *
+ * @return          0 on success, -1 on failure with errno set, the copy is
+ *                  closed either way
+ */
+int durable_close(durable_t *d, int fd, int dirfd, const char *path);
+
+
+/**
+ * fsync directory `path` relative to `dirfd` with file and batch, nothing is
+ * done otherwise
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+int durable_dir(const durable_t *d, int dirfd, const char *path);
+
+
+/**
+ * Sync a destination once everything was copied to it: syncfs with fs, an
+ * fsync of `fd` with file and batch.
+ *
+ * @param fd        the directory copied to
+ *
+ * @return          0 on success, -1 on failure
+ */
+int durable_root(const durable_t *d, int fd);
+
+
+/**
+ * Wait for the thread to sync every copy handed to it and report the entries
+ * held back, NULL is ignored.
+ *
+ * @return          0 when every copy was synced, -1 otherwise
+ */
+int durable_drain(durable_t *d);
+
+
+/**
+ * dcp_callback_f that holds the entry back until the copies handed to the
+ * thread so far are synced, everything the entry points at is copied.
+ * `context` is the durable_t.
+ */
+int durable_callback(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context);
+
+
+#endif
@@ -0,0 +1,651 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the engine.h API. copy_file_range is called through
+ * syscall(2), older C libraries have no wrapper for it.
+ */
+ /* for splice and O_DIRECT */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <fts.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "durable.h"
+#include "engine.h"
+#include "prefetch.h"
+#include "../fd.h"
+#include "../logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * largest file the probe copies, bigger ones would make startup slow
+ */
+#define PROBE_MAX       (64 * 1024 * 1024)
+
+
+/**
+ * # of entries of the sources the probe looks at for files to time
+ */
+#define PROBE_ENTRIES   4096
+
+
+/**
+ * # of times each engine copies a file, the fastest copy counts
+ */
+#define PROBE_RUNS      3
+
+
+/**
+ * O_DIRECT wants buffers, offsets and lengths aligned to the block size
+ */
+#define DIRECT_ALIGN    4096
+
+
+/**
+ * bytes moved by a single splice or copy_file_range call
+ */
+#define KERNEL_CHUNK    (1024 * 1024)
+
+
+/* Private API ****************************************************************/
+
+
+/*
+ * the engines, @see engine_copy_f
+ */
+static ssize_t copy_rw(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing);
+static ssize_t copy_mmap(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing);
+static ssize_t copy_direct(int dirfd, const char *pathname,
+        const attrs_t *attrs, durable_t *durable, digesterset_t *set, int fd,
+        off_t size, void *buf, size_t blen, prefetch_timing_t *timing);
+static ssize_t copy_cfr(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing);
+static ssize_t copy_splice(int dirfd, const char *pathname,
+        const attrs_t *attrs, durable_t *durable, digesterset_t *set, int fd,
+        off_t size, void *buf, size_t blen, prefetch_timing_t *timing);
+
+
+/**
+ * Give a file created by an engine its attrs and close it, synced and named
+ * `pathname` relative to `dirfd` as `durable` asks. When fewer than the `size`
+ * bytes reserved were `written` the rest is given back.
+ *
+ * @return          0 on success, -1 if setting its xattrs, syncing, naming or
+ *                  closing failed
+ */
+static int finish(int d, int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, off_t size, off_t written);
+
+
+/**
+ * read `fd` from `offset` to the end updating the digests, used by the engines
+ * that copy in the kernel
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int digest_rest(digesterset_t *set, int fd, off_t offset, void *buf,
+        size_t blen, prefetch_timing_t *timing);
+
+
+/**
+ * @return          ns the engine took to copy `path` into `destdir` at best
+ *                  over PROBE_RUNS copies, 0 when it failed
+ */
+static uint64_t probe_one(engine_id_t engine, const char *path, int destdir,
+        const char *scratch, int digests, void *buf, size_t blen);
+
+
+/* Private Variables **********************************************************/
+
+
+static const struct {
+    const char *name;
+    engine_copy_f copy;
+} ENGINES[ENGINE_COUNT] = {
+    [ENGINE_RW]     = { "rw",     copy_rw     },
+    [ENGINE_MMAP]   = { "mmap",   copy_mmap   },
+    [ENGINE_DIRECT] = { "direct", copy_direct },
+    [ENGINE_CFR]    = { "cfr",    copy_cfr    },
+    [ENGINE_SPLICE] = { "splice", copy_splice },
+};
+
+
+static const char *CLASSES[ENGINE_CLASSES] = {
+    [ENGINE_CLASS_SMALL]  = "small",
+    [ENGINE_CLASS_MEDIUM] = "medium",
+    [ENGINE_CLASS_LARGE]  = "large",
+};
+
+
+/* Public Impl ****************************************************************/
+
+
+engine_copy_f engine_get(engine_id_t engine)
+{
+    return ENGINES[engine].copy;
+}
+
+
+const char *engine_name(engine_id_t engine)
+{
+    return ENGINES[engine].name;
+}
+
+
+int engine_find(const char *name)
+{
+    int i;
+
+    for (i = 0; i < ENGINE_COUNT; i++)
+        if (strcmp(ENGINES[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+
+const char *engine_class_name(engine_class_t class)
+{
+    return CLASSES[class];
+}
+
+
+engine_class_t engine_class(off_t size)
+{
+    if (size < ENGINE_MEDIUM)
+        return ENGINE_CLASS_SMALL;
+    if (size < ENGINE_LARGE)
+        return ENGINE_CLASS_MEDIUM;
+    return ENGINE_CLASS_LARGE;
+}
+
+
+void engine_update(digesterset_t *set, const void *bytes, size_t count,
+        prefetch_timing_t *timing)
+{
+    uint64_t start;
+
+    if (timing == NULL)
+    {
+        digesterset_update(set, bytes, count);
+        return;
+    }
+
+    start = prefetch_clock();
+    digesterset_update(set, bytes, count);
+    timing->digest_ns += prefetch_clock() - start;
+}
+
+
+ssize_t engine_read(int fd, void *buf, size_t count, prefetch_timing_t *timing)
+{
+    uint64_t start;
+    ssize_t result;
+
+    if (timing == NULL)
+        return fd_read(fd, buf, count);
+
+    start = prefetch_clock();
+    result = fd_read(fd, buf, count);
+    timing->read_ns += prefetch_clock() - start;
+    return result;
+}
+
+
+int engine_probe(const char *src[], size_t srcc, const char *destdir,
+        int digests, void *buf, size_t blen, int picks[ENGINE_CLASSES])
+{
+    FTS *fts;
+    FTSENT *ent;
+    char *samples[ENGINE_CLASSES];
+    char scratch[64];
+    const char **paths;
+    size_t found;
+    size_t seen;
+    size_t i;
+    uint64_t best;
+    uint64_t took;
+    int engine;
+    int class;
+    int d;
+
+    if ((d = open(destdir, O_RDONLY | O_DIRECTORY)) == -1)
+    {
+        log_error("cannot open '%s' to time the copy engines", destdir);
+        return -1;
+    }
+
+    if ((paths = calloc(srcc + 1, sizeof(char *))) == NULL)
+    {
+        log_error("malloc");
+        close(d);
+        return -1;
+    }
+    for (i = 0; i < srcc; i++)
+        paths[i] = src[i];
+
+    /* the first files of each class the copy will see */
+    memset(samples, 0, sizeof(samples));
+    found = 0;
+    seen = 0;
+    if ((fts = fts_open((char * const *) paths, FTS_PHYSICAL | FTS_NOCHDIR,
+            NULL)) != NULL)
+    {
+        while (found < ENGINE_CLASSES && seen++ < PROBE_ENTRIES &&
+                (ent = fts_read(fts)) != NULL)
+        {
+            if (ent->fts_info != FTS_F || ent->fts_statp->st_size == 0 ||
+                    ent->fts_statp->st_size > PROBE_MAX)
+                continue;
+
+            class = engine_class(ent->fts_statp->st_size);
+            if (samples[class] == NULL &&
+                    (samples[class] = strdup(ent->fts_accpath)) != NULL)
+                found++;
+        }
+        fts_close(fts);
+    }
+
+    snprintf(scratch, sizeof(scratch), ".dcp-probe.%ld", (long) getpid());
+    for (class = 0; class < ENGINE_CLASSES; class++)
+    {
+        if (samples[class] == NULL)
+            continue;
+
+        best = 0;
+        for (engine = 0; engine < ENGINE_COUNT; engine++)
+        {
+            took = probe_one(engine, samples[class], d, scratch, digests, buf,
+                    blen);
+            if (took != 0 && (best == 0 || took < best))
+            {
+                best = took;
+                picks[class] = engine;
+            }
+        }
+        free(samples[class]);
+    }
+
+    unlinkat(d, scratch, 0);
+    free(paths);
+    close(d);
+    return 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+uint64_t probe_one(engine_id_t engine, const char *path, int destdir,
+        const char *scratch, int digests, void *buf, size_t blen)
+{
+    digesterset_t set;
+    struct stat st;
+    uint64_t best;
+    uint64_t start;
+    uint64_t took;
+    int s;
+    int i;
+
+    if ((s = open(path, O_RDONLY)) == -1)
+        return 0;
+    if (fstat(s, &st) == -1)
+    {
+        close(s);
+        return 0;
+    }
+
+    best = 0;
+    for (i = 0; i < PROBE_RUNS; i++)
+    {
+        if (lseek(s, 0, SEEK_SET) == -1)
+            break;
+
+        digesterset_create(&set, digests);
+        start = prefetch_clock();
+        if (ENGINES[engine].copy(destdir, scratch, NULL, NULL, &set, s,
+                st.st_size, buf, blen, NULL) < 0)
+        {
+            digesterset_free(&set);
+            best = 0;
+            break;
+        }
+        digesterset_finalize(&set);
+        took = prefetch_clock() - start;
+        digesterset_free(&set);
+
+        if (best == 0 || took < best)
+            best = took;
+    }
+
+    close(s);
+    return best;
+}
+
+
+ssize_t copy_rw(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing)
+{
+    ssize_t result;
+    size_t total;
+    int d;
+
+    /* causes the kernel to double its read ahead buffer for this file */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* create the dest file and copy all the bytes */
+    if ((d = durable_open(durable, dirfd, pathname)) == -1)
+    {
+        log_debug("openat '%s'", pathname);
+        return -1;
+    }
+    fd_preallocate(d, size);
+
+    total = 0;
+    for (;;)
+    {
+        result = engine_read(fd, buf, blen, timing);
+
+        if (result < 0)
+        {
+            close(d);
+            return -1;
+        }
+        if (result == 0)
+            break;
+
+        /* update the digests */
+        engine_update(set, buf, result, timing);
+
+        /* write all the bytes */
+        if (fd_write_full(d, buf, result) == -1)
+        {
+            log_debug("fd_write");
+            close(d);
+            return -1;
+        }
+
+        total += result;
+    }
+
+    return finish(d, dirfd, pathname, attrs, durable, size, total) == 0?
+            (ssize_t) total : -1;
+}
+
+
+ssize_t copy_mmap(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing)
+{
+    struct stat st;
+    unsigned char *map;
+    off_t offset;
+    size_t count;
+    size_t pos;
+    int d;
+
+    if (fstat(fd, &st) == -1 || (offset = lseek(fd, 0, SEEK_CUR)) == -1)
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+
+    /* nothing to map */
+    if (st.st_size <= offset)
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+
+    count = st.st_size;
+    if ((map = mmap(NULL, count, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+    madvise(map, count, MADV_SEQUENTIAL);
+
+    if ((d = durable_open(durable, dirfd, pathname)) == -1)
+    {
+        log_debug("openat '%s'", pathname);
+        munmap(map, count);
+        return -1;
+    }
+    fd_preallocate(d, count - offset);
+
+    /* digest and write a buffer's worth at a time so both stay in cache */
+    for (pos = offset; pos < count; pos += blen)
+    {
+        if (blen > count - pos)
+            blen = count - pos;
+
+        engine_update(set, map + pos, blen, timing);
+        if (fd_write_full(d, map + pos, blen) == -1)
+        {
+            log_debug("fd_write");
+            munmap(map, count);
+            close(d);
+            return -1;
+        }
+    }
+
+    munmap(map, count);
+    return finish(d, dirfd, pathname, attrs, durable, count - offset,
+            count - offset) == 0? (ssize_t) (count - offset) : -1;
+}
+
+
+ssize_t copy_direct(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing)
+{
+    void *aligned;
+    ssize_t total;
+    size_t len;
+    int flags;
+
+    /* the caller's buffer has no particular alignment */
+    len = blen < DIRECT_ALIGN? DIRECT_ALIGN : blen & ~(size_t) (DIRECT_ALIGN-1);
+    if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+            lseek(fd, 0, SEEK_CUR) % DIRECT_ALIGN != 0 ||
+            posix_memalign(&aligned, DIRECT_ALIGN, len) != 0)
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+
+    /* not every file system supports O_DIRECT */
+    if (fcntl(fd, F_SETFL, flags | O_DIRECT) == -1)
+    {
+        free(aligned);
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+    }
+
+    total = copy_rw(dirfd, pathname, attrs, durable, set, fd, size, aligned,
+            len, timing);
+
+    fcntl(fd, F_SETFL, flags);
+    free(aligned);
+    return total;
+}
+
+
+ssize_t copy_cfr(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing)
+{
+#ifdef SYS_copy_file_range
+    off_t offset;
+    ssize_t result;
+    size_t total;
+    int d;
+
+    if ((offset = lseek(fd, 0, SEEK_CUR)) == -1)
+        return -1;
+
+    if ((d = durable_open(durable, dirfd, pathname)) == -1)
+    {
+        log_debug("openat '%s'", pathname);
+        return -1;
+    }
+
+    total = 0;
+    while ((result = syscall(SYS_copy_file_range, fd, NULL, d, NULL,
+            KERNEL_CHUNK, 0)) > 0)
+        total += result;
+
+    /* before 5.3 only copies within a file system are supported */
+    if (result == -1 && total == 0 && (errno == EXDEV || errno == ENOSYS ||
+            errno == EINVAL || errno == EOPNOTSUPP))
+    {
+        close(d);
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+    }
+
+    if (result == -1 || digest_rest(set, fd, offset, buf, blen, timing))
+    {
+        log_debug("copy_file_range '%s'", pathname);
+        close(d);
+        return -1;
+    }
+
+    /* nothing was reserved, the file system may share the blocks instead */
+    return finish(d, dirfd, pathname, attrs, durable, 0, total) == 0?
+            (ssize_t) total : -1;
+#else
+    return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+            blen, timing);
+#endif
+}
+
+
+ssize_t copy_splice(int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, digesterset_t *set, int fd, off_t size, void *buf,
+        size_t blen, prefetch_timing_t *timing)
+{
+    off_t offset;
+    ssize_t result;
+    ssize_t moved;
+    ssize_t n;
+    size_t total;
+    int p[2];
+    int d;
+
+    if ((offset = lseek(fd, 0, SEEK_CUR)) == -1)
+        return -1;
+
+    if (pipe(p) == -1)
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+
+    if ((d = durable_open(durable, dirfd, pathname)) == -1)
+    {
+        log_debug("openat '%s'", pathname);
+        close(p[0]);
+        close(p[1]);
+        return -1;
+    }
+    fd_preallocate(d, size);
+
+    total = 0;
+    while ((result = splice(fd, NULL, p[1], NULL, KERNEL_CHUNK,
+            SPLICE_F_MOVE)) > 0)
+    {
+        /* the pipe holds what was read until all of it is written */
+        for (moved = 0; moved < result; moved += n)
+            if ((n = splice(p[0], NULL, d, NULL, result - moved,
+                    SPLICE_F_MOVE)) <= 0)
+                break;
+
+        if (moved < result)
+        {
+            result = -1;
+            break;
+        }
+        total += moved;
+    }
+
+    close(p[0]);
+    close(p[1]);
+
+    /* a source or destination that cannot be spliced is copied the long way,
+     * from where it started as a failed write may have read some of it */
+    if (result == -1 && total == 0 && (errno == ENOSYS || errno == EINVAL ||
+            errno == EOPNOTSUPP))
+    {
+        close(d);
+        if (lseek(fd, offset, SEEK_SET) == -1)
+            return -1;
+        return copy_rw(dirfd, pathname, attrs, durable, set, fd, size, buf,
+                blen, timing);
+    }
+
+    if (result == -1 || digest_rest(set, fd, offset, buf, blen, timing))
+    {
+        log_debug("splice '%s'", pathname);
+        close(d);
+        return -1;
+    }
+
+    return finish(d, dirfd, pathname, attrs, durable, size, total) == 0?
+            (ssize_t) total : -1;
+}
+
+
+int finish(int d, int dirfd, const char *pathname, const attrs_t *attrs,
+        durable_t *durable, off_t size, off_t written)
+{
+    if (fd_trim(d, size, written) == -1)
+        log_debug("ftruncate");
+
+    /* a copy without the xattrs asked for is not published */
+    if (attrs != NULL && attrs_fd(d, attrs) == -1)
+    {
+        log_errorx("cannot set the xattrs of '%s'", pathname);
+        close(d);
+        return -1;
+    }
+
+    /* do not report success here because there can be data loss */
+    if (durable_close(durable, d, dirfd, pathname) == -1)
+    {
+        log_error("closing '%s' failed, possible data loss", pathname);
+        return -1;
+    }
+    return 0;
+}
+
+
+int digest_rest(digesterset_t *set, int fd, off_t offset, void *buf,
+        size_t blen, prefetch_timing_t *timing)
+{
+    ssize_t result;
+
+    /* the copy did not need the bytes, only read them back to digest them */
+    if (set->md5 == NULL && set->sha1 == NULL && set->sha256 == NULL &&
+            set->sha512 == NULL)
+        return 0;
+
+    if (lseek(fd, offset, SEEK_SET) == -1)
+        return -1;
+
+    while ((result = engine_read(fd, buf, blen, timing)) > 0)
+        engine_update(set, buf, result, timing);
+
+    return result == 0? 0 : -1;
+}
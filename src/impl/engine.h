@@ -0,0 +1,182 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Copy engines used by process_regular to copy a file while digesting it. Each
+ * engine moves the bytes differently:
+ *
+ *      rw          read(2) into the buffer, digest, write(2)
+ *      mmap        map the source, digest and write(2) from the mapping
+ *      direct      like rw but the source is read with O_DIRECT, bypassing
+ *                  the page cache
+ *      cfr         copy_file_range(2) in the kernel, then read the source
+ *                  again to digest it
+ *      splice      splice(2) through a pipe in the kernel, then read the
+ *                  source again to digest it
+ *
+ * The last two only read the source a second time when there is something to
+ * digest. An engine that cannot be used on a file, O_DIRECT on a file system
+ * without it or copy_file_range across file systems on an old kernel, falls
+ * back to rw.
+ *
+ * Which engine is fastest depends on the size of the file and on the file
+ * systems, so one is picked per size class. engine_probe times every engine
+ * on files of the actual source copied to the actual destination.
+ */
+#ifndef ENGINE_H__
+#define ENGINE_H__
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../digest.h"
+#include "attrs.h"
+#include "prefetch.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * files smaller than this are small, the others up to ENGINE_LARGE medium
+ */
+#define ENGINE_MEDIUM   (64 * 1024)
+
+
+/**
+ * files of at least this size are large
+ */
+#define ENGINE_LARGE    (8 * 1024 * 1024)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * how a new file is synced as it is closed, @see durable.h
+ */
+struct durable;
+
+
+/**
+ * the engines, ENGINE_RW is 0 so zeroed options use it
+ */
+typedef enum {
+    ENGINE_RW,
+    ENGINE_MMAP,
+    ENGINE_DIRECT,
+    ENGINE_CFR,
+    ENGINE_SPLICE,
+    ENGINE_COUNT
+} engine_id_t;
+
+
+/**
+ * the size classes an engine is picked for, @see engine_class
+ */
+typedef enum {
+    ENGINE_CLASS_SMALL,
+    ENGINE_CLASS_MEDIUM,
+    ENGINE_CLASS_LARGE,
+    ENGINE_CLASSES
+} engine_class_t;
+
+
+/**
+ * Copy everything left to read from `fd` into a new file digesting it.
+ *
+ * @param dirfd     fd to the parent directory of pathname
+ * @param pathname  file to create
+ * @param attrs     NULL or what the new file is given before it is closed
+ * @param durable   NULL or how the new file is created, synced and named
+ * @param set       initialized digesterset_t to update, may hold no digesters
+ * @param fd        the file descriptor to read the bytes from till the end
+ * @param size      # of bytes expected from `fd`, reserved for the new file
+ *                  up front, @see fd_preallocate
+ * @param buf       a preallocated buffer to use to read the bytes
+ * @param blen      number of bytes in the buffer
+ * @param timing    if not NULL incremented by the ns spent reading and
+ *                  digesting
+ *
+ * @return          number of bytes copied, -1 on error
+ */
+typedef ssize_t (*engine_copy_f)(int dirfd, const char *pathname,
+        const attrs_t *attrs, struct durable *durable, digesterset_t *set,
+        int fd, off_t size, void *buf, size_t blen, prefetch_timing_t *timing);
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * @return          the copy function of `engine`
+ */
+engine_copy_f engine_get(engine_id_t engine);
+
+
+/**
+ * @return          the name of `engine` as given on the command line
+ */
+const char *engine_name(engine_id_t engine);
+
+
+/**
+ * @return          the engine called `name`, -1 if there is none
+ */
+int engine_find(const char *name);
+
+
+/**
+ * @return          the name of the size class `class`
+ */
+const char *engine_class_name(engine_class_t class);
+
+
+/**
+ * @return          the size class of a file of `size` bytes
+ */
+engine_class_t engine_class(off_t size);
+
+
+/**
+ * update the digests with `count` bytes, timing the update if `timing` is
+ * not NULL
+ */
+void engine_update(digesterset_t *set, const void *bytes, size_t count,
+        prefetch_timing_t *timing);
+
+
+/**
+ * fd_read `count` bytes from `fd`, timing the read if `timing` is not NULL
+ *
+ * @return          as fd_read
+ */
+ssize_t engine_read(int fd, void *buf, size_t count, prefetch_timing_t *timing);
+
+
+/**
+ * Pick the fastest engine for each size class. The first regular files of each
+ * class found in `src` are copied by every engine into a scratch file in
+ * `destdir`, which is removed. Classes without a file of a size worth timing
+ * keep the engine already in `picks`.
+ *
+ * @param src       the sources of the copy
+ * @param srcc      # of sources
+ * @param destdir   existing directory the copy writes into
+ * @param digests   mask of digest_t's the copy calculates
+ * @param buf       buffer the copy reads into
+ * @param blen      # of bytes in `buf`
+ * @param picks     the engine to use for each class
+ *
+ * @return          0 on success, -1 on failure
+ */
+int engine_probe(const char *src[], size_t srcc, const char *destdir,
+        int digests, void *buf, size_t blen, int picks[ENGINE_CLASSES]);
+
+
+#endif
@@ -0,0 +1,534 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the meta.h API. A directory's entries are turned into an
+ * array of jobs, each holding the paths of one entry, then every phase (stat,
+ * mkdir, chown) runs over the whole array before the next one starts. The
+ * paths are built up front since fts only fills in an entry's path once
+ * fts_read returns it.
+ */
+ /* for struct statx */
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "meta.h"
+#include "pool.h"
+#include "process.h"
+#include "../logging.h"
+#include "../uring.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the stat information of a directory's entries, pointed to by the
+ * directory's `fts_pointer`
+ */
+struct block {
+    size_t count;
+    struct stat st[];
+};
+
+
+/**
+ * one entry of the directory being batched
+ */
+struct job {
+    FTSENT *ent;
+    const char *src;        /**< path to stat */
+    char *dst;              /**< destination when the entry is a directory */
+    struct stat *st;        /**< where its stat information goes */
+    struct statx stx;       /**< statx's result when done on the ring */
+    attrs_t attrs;          /**< what its new destination is given */
+    int err;                /**< errno of the phase that just ran */
+};
+
+
+/**
+ * a batch of jobs handed to the pool
+ */
+struct batch {
+    struct meta *m;
+    struct job *jobs;
+};
+
+
+struct meta {
+    uring_t *ring;          /**< NULL when io_uring is unavailable */
+    pool_t *pool;           /**< NULL when no thread could be started */
+    size_t count;           /**< max # of requests in flight */
+    const file_t *newdir;
+    const attrs_policy_t *attrs;
+    struct block *roots;    /**< stat information of the walk's roots */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * stat every job's `src` filling in its entry's information
+ */
+static int stat_all(struct meta *m, struct job *jobs, size_t n,
+        struct block **block);
+
+
+/**
+ * create the destinations of the jobs with a `dst` then give them away
+ */
+static void mkdir_all(struct meta *m, struct job *jobs, size_t n);
+
+
+/**
+ * Queue `n` requests on the ring with `queue`, keeping no more than
+ * `m->count` in flight, and store each result in its job's `err`.
+ *
+ * @return          0 on success, -1 if the ring failed
+ */
+static int ring_all(struct meta *m, struct job *jobs, size_t n,
+        int (*queue)(struct meta *, struct job *, uint64_t));
+
+
+static int queue_statx(struct meta *m, struct job *job, uint64_t data);
+static int queue_mkdirat(struct meta *m, struct job *job, uint64_t data);
+
+
+/*
+ * loop bodies for the pool
+ */
+static void stat_one(void *ctx, size_t i, size_t thread);
+static void mkdir_one(void *ctx, size_t i, size_t thread);
+static void chown_one(void *ctx, size_t i, size_t thread);
+
+
+/**
+ * convert statx's result into a struct stat
+ */
+static void statx_to_stat(const struct statx *stx, struct stat *st);
+
+
+/**
+ * fts_info of an entry fts was told not to stat
+ */
+static int fts_type(mode_t mode);
+
+
+/* Public Impl ****************************************************************/
+
+
+int meta_create(meta_t **m, size_t count, const file_t *newdir,
+        const attrs_policy_t *attrs)
+{
+    struct meta *e;
+
+    if (count == 0)
+        return -1;
+
+    if ((e = calloc(1, sizeof(*e))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    e->count  = count;
+    e->newdir = newdir;
+    e->attrs  = attrs;
+
+    if (uring_create(&e->ring, count) != 0)
+        e->ring = NULL;
+
+    /* chown always needs the pool, stat and mkdir only on older kernels */
+    if (pool_create(&e->pool, count) != 0)
+    {
+        log_warnx("cannot start metadata threads, batching on io_uring only");
+        e->pool = NULL;
+    }
+
+    *m = e;
+    return 0;
+}
+
+
+void meta_free(meta_t *m)
+{
+    if (m == NULL)
+        return;
+
+    uring_free(m->ring);
+    pool_free(m->pool);
+    free(m->roots);
+    free(m);
+}
+
+
+int meta_roots(meta_t *m, FTS *fts)
+{
+    FTSENT *root;
+    struct job *jobs;
+    size_t n;
+    int r;
+
+    for (n = 0, root = fts_children(fts, 0); root != NULL;
+            root = root->fts_link)
+        n++;
+
+    if ((jobs = calloc(n, sizeof(struct job))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    /* the roots keep the paths they were given */
+    for (n = 0, root = fts_children(fts, 0); root != NULL;
+            root = root->fts_link, n++)
+    {
+        jobs[n].ent = root;
+        jobs[n].src = root->fts_accpath;
+    }
+
+    r = stat_all(m, jobs, n, &m->roots);
+    free(jobs);
+    return r;
+}
+
+
+int meta_enter(meta_t *m, FTS *fts, FTSENT *dir, const char *newpath)
+{
+    FTSENT *kids;
+    FTSENT *kid;
+    struct job *jobs;
+    struct block *block;
+    char *paths;
+    char *pos;
+    size_t n;
+    size_t size;
+    size_t dirlen;
+    size_t newlen;
+    size_t i;
+    int r;
+
+    /* empty or unreadable, fts_read reports the latter */
+    if ((kids = fts_children(fts, 0)) == NULL)
+        return 0;
+
+    /* fts does not double the '/' when the directory was given with one */
+    dirlen = dir->fts_pathlen;
+    if (dirlen > 0 && dir->fts_path[dirlen - 1] == '/')
+        dirlen--;
+    newlen = newpath != NULL? strlen(newpath) : 0;
+
+    /* every entry may need both a source and a destination path */
+    size = 0;
+    for (n = 0, kid = kids; kid != NULL; kid = kid->fts_link, n++)
+        size += dirlen + newlen + 2 * (kid->fts_namelen + 2);
+
+    jobs  = calloc(n, sizeof(struct job));
+    paths = malloc(size);
+    if (jobs == NULL || paths == NULL)
+    {
+        log_error("cannot batch the entries of '%s'", dir->fts_path);
+        free(jobs);
+        free(paths);
+        for (kid = kids; kid != NULL; kid = kid->fts_link)
+        {
+            kid->fts_info = FTS_NS;
+            kid->fts_errno = ENOMEM;
+        }
+        return -1;
+    }
+
+    pos = paths;
+    for (i = 0, kid = kids; kid != NULL; kid = kid->fts_link, i++)
+    {
+        jobs[i].ent = kid;
+        jobs[i].src = pos;
+        memcpy(pos, dir->fts_path, dirlen);
+        pos += dirlen;
+        *pos++ = '/';
+        memcpy(pos, kid->fts_name, kid->fts_namelen + 1);
+        pos += kid->fts_namelen + 1;
+
+        if (newpath == NULL)
+            continue;
+
+        jobs[i].dst = pos;
+        memcpy(pos, newpath, newlen);
+        pos += newlen;
+        *pos++ = '/';
+        memcpy(pos, kid->fts_name, kid->fts_namelen + 1);
+        pos += kid->fts_namelen + 1;
+    }
+
+    if ((r = stat_all(m, jobs, n, &block)) == 0)
+    {
+        dir->fts_pointer = block;
+        if (newpath != NULL)
+            mkdir_all(m, jobs, n);
+    }
+
+    free(paths);
+    free(jobs);
+    return r;
+}
+
+
+void meta_leave(meta_t *m, FTSENT *dir)
+{
+    UNUSED(m);
+
+    free(dir->fts_pointer);
+    dir->fts_pointer = NULL;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int stat_all(struct meta *m, struct job *jobs, size_t n, struct block **block)
+{
+    struct batch batch = { m, jobs };
+    struct block *b;
+    size_t i;
+    int ring;
+    FTSENT *ent;
+
+    if ((b = calloc(1, sizeof(*b) + n * sizeof(struct stat))) == NULL)
+    {
+        log_error("malloc");
+        for (i = 0; i < n; i++)
+        {
+            jobs[i].ent->fts_info = FTS_NS;
+            jobs[i].ent->fts_errno = ENOMEM;
+        }
+        return -1;
+    }
+    b->count = n;
+
+    for (i = 0; i < n; i++)
+        jobs[i].st = &b->st[i];
+
+    ring = m->ring != NULL && uring_supports(m->ring, URING_STATX) &&
+            ring_all(m, jobs, n, queue_statx) == 0;
+    if (!ring)
+        pool_for(m->pool, n, stat_one, &batch);
+
+    for (i = 0; i < n; i++)
+    {
+        ent = jobs[i].ent;
+        ent->fts_statp = jobs[i].st;
+
+        if (jobs[i].err != 0)
+        {
+            ent->fts_info = FTS_NS;
+            ent->fts_errno = jobs[i].err;
+            continue;
+        }
+
+        if (ring)
+            statx_to_stat(&jobs[i].stx, jobs[i].st);
+
+        /* fts already typed the ones it had to stat itself */
+        if (ent->fts_info == FTS_NSOK)
+            ent->fts_info = fts_type(jobs[i].st->st_mode);
+    }
+
+    *block = b;
+    return 0;
+}
+
+
+void mkdir_all(struct meta *m, struct job *jobs, size_t n)
+{
+    struct batch batch = { m, jobs };
+    size_t i;
+    size_t dirs;
+
+    /* only directories are created, move them to the front */
+    for (i = 0, dirs = 0; i < n; i++)
+    {
+        if (jobs[i].ent->fts_info != FTS_D)
+            continue;
+
+        jobs[dirs].ent = jobs[i].ent;
+        jobs[dirs].dst = jobs[i].dst;
+        jobs[dirs].err = 0;
+        dirs++;
+    }
+
+    if (dirs == 0)
+        return;
+
+    if (m->ring == NULL || !uring_supports(m->ring, URING_MKDIRAT) ||
+            ring_all(m, jobs, dirs, queue_mkdirat) != 0)
+        pool_for(m->pool, dirs, mkdir_one, &batch);
+
+    /*
+     * an existing destination is left for process to examine, only the ones
+     * created here are marked
+     */
+    for (i = 0, n = 0; i < dirs; i++)
+        if (jobs[i].err == 0)
+        {
+            jobs[i].ent->fts_number |= META_CREATED;
+            jobs[n++] = jobs[i];
+        }
+
+    /* the times have to wait for the walk to be done with them */
+    if (m->attrs->preserve)
+        return;
+
+    /* a setgid parent may have given them another group than asked */
+    for (i = 0; i < n; i++)
+        attrs_init(&jobs[i].attrs, jobs[i].ent->fts_statp, m->attrs);
+
+    /* no io_uring operation exists for fchownat */
+    pool_for(m->pool, n, chown_one, &batch);
+
+    for (i = 0; i < n; i++)
+        if (jobs[i].err == 0)
+            jobs[i].ent->fts_number |= META_CHOWNED;
+}
+
+
+int ring_all(struct meta *m, struct job *jobs, size_t n,
+        int (*queue)(struct meta *, struct job *, uint64_t))
+{
+    size_t i;
+    uint64_t data;
+    int res;
+
+    for (i = 0; i < n || uring_pending(m->ring) > 0;)
+    {
+        if (i < n && uring_pending(m->ring) < m->count)
+        {
+            if (queue(m, &jobs[i], i) != 0)
+                break;
+            i++;
+            continue;
+        }
+
+        if (uring_wait(m->ring, &data, &res) != 0)
+            break;
+        jobs[data].err = res < 0? -res : 0;
+    }
+
+    if (i == n && uring_pending(m->ring) == 0)
+        return 0;
+
+    /* the ring is unusable, let the pool redo the work */
+    log_error("io_uring_enter");
+
+    /*
+     * the kernel writes into the jobs until their requests complete, those
+     * it may still hold keep the ring from being freed so the pool can have
+     * the jobs
+     */
+    while (uring_pending(m->ring) > 0)
+        if (uring_wait(m->ring, &data, &res) != 0)
+            break;
+    if (uring_pending(m->ring) == 0)
+        uring_free(m->ring);
+    else
+        log_errorx("leaking an io_uring with requests in flight");
+    m->ring = NULL;
+    for (i = 0; i < n; i++)
+        jobs[i].err = 0;
+    return -1;
+}
+
+
+int queue_statx(struct meta *m, struct job *job, uint64_t data)
+{
+    return uring_statx(m->ring, AT_FDCWD, job->src, AT_SYMLINK_NOFOLLOW,
+            STATX_BASIC_STATS, &job->stx, data);
+}
+
+
+int queue_mkdirat(struct meta *m, struct job *job, uint64_t data)
+{
+    return uring_mkdirat(m->ring, m->newdir->fd, job->dst, 0777, data);
+}
+
+
+void stat_one(void *ctx, size_t i, size_t thread)
+{
+    struct job *job = &((struct batch *) ctx)->jobs[i];
+
+    UNUSED(thread);
+
+    job->err = 0;
+    if (fstatat(AT_FDCWD, job->src, job->st, AT_SYMLINK_NOFOLLOW) == -1)
+        job->err = errno;
+}
+
+
+void mkdir_one(void *ctx, size_t i, size_t thread)
+{
+    struct batch *batch = ctx;
+    struct job *job = &batch->jobs[i];
+
+    UNUSED(thread);
+
+    job->err = 0;
+    if (mkdirat(batch->m->newdir->fd, job->dst, 0777) == -1)
+        job->err = errno;
+}
+
+
+void chown_one(void *ctx, size_t i, size_t thread)
+{
+    struct batch *batch = ctx;
+    struct job *job = &batch->jobs[i];
+
+    UNUSED(thread);
+
+    job->err = 0;
+    if (attrs_at(batch->m->newdir->fd, job->dst, &job->attrs) == -1)
+        job->err = errno;
+}
+
+
+void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_dev          = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino          = stx->stx_ino;
+    st->st_mode         = stx->stx_mode;
+    st->st_nlink        = stx->stx_nlink;
+    st->st_uid          = stx->stx_uid;
+    st->st_gid          = stx->stx_gid;
+    st->st_rdev         = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    st->st_size         = stx->stx_size;
+    st->st_blksize      = stx->stx_blksize;
+    st->st_blocks       = stx->stx_blocks;
+    st->st_atim.tv_sec  = stx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec  = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec  = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+
+int fts_type(mode_t mode)
+{
+    if (S_ISREG(mode))  return FTS_F;
+    if (S_ISDIR(mode))  return FTS_D;
+    if (S_ISLNK(mode))  return FTS_SL;
+    return FTS_DEFAULT;
+}
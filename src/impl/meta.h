@@ -0,0 +1,110 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Batched metadata for the directory walk. On network file systems every
+ * lstat, mkdir and chown is a round trip to the server and the walk spends
+ * most of its time waiting on them one after the other. In this mode fts is
+ * told not to stat anything, instead when a directory is entered all of its
+ * entries are stat'ed at once and the destinations of its subdirectories are
+ * created and chown'd at once, keeping many requests in flight.
+ *
+ * statx and mkdirat are queued on an io_uring when the kernel supports them,
+ * everything else runs on a pool of threads. fchownat has no io_uring
+ * operation so it always uses the pool.
+ *
+ * The stat information lives in blocks owned by the batcher, an entry's
+ * `fts_statp` stays valid until its parent directory is left. Directories whose
+ * destination was created by the batcher are marked in their `fts_number`.
+ */
+#ifndef META_H__
+#define META_H__
+
+
+#include <fts.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "process.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * bits set in a directory's `fts_number` by meta_enter
+ */
+#define META_CREATED    0x2     /**< its destination directory was created */
+#define META_CHOWNED    0x4     /**< and given to the requested owner */
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the ring, the threads and the stat blocks of the roots
+ */
+typedef struct meta meta_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Create a batcher keeping up to `count` requests in flight.
+ *
+ * @param m         where to store the new batcher
+ * @param count     max # of requests in flight, also the # of threads used
+ *                  when io_uring cannot do the work
+ * @param newdir    destination root every new path is relative to
+ * @param attrs     who owns the new directories, with --preserve they are
+ *                  left for process_directory
+ *
+ * @return          0 on success, -1 on failure
+ */
+int meta_create(meta_t **m, size_t count, const file_t *newdir,
+        const attrs_policy_t *attrs);
+
+
+/**
+ * release the batcher and the stat information of the roots, NULL is ignored
+ */
+void meta_free(meta_t *m);
+
+
+/**
+ * Stat the roots of a walk opened with FTS_NOSTAT. Must be called before the
+ * first fts_read.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int meta_roots(meta_t *m, FTS *fts);
+
+
+/**
+ * Called once `dir` has been returned as FTS_D and its destination created.
+ * Stats every entry in the directory and creates the destinations of the
+ * subdirectories under `newpath`.
+ *
+ * @param m         the batcher
+ * @param fts       the walk `dir` was returned by
+ * @param dir       the directory entered
+ * @param newpath   destination of `dir` relative to the destination root or
+ *                  NULL to only stat the entries
+ *
+ * @return          0 on success, -1 on failure in which case the entries are
+ *                  returned as FTS_NS
+ */
+int meta_enter(meta_t *m, FTS *fts, FTSENT *dir, const char *newpath);
+
+
+/**
+ * release the stat information of `dir`'s entries once it has been left
+ */
+void meta_leave(meta_t *m, FTSENT *dir);
+
+
+#endif
@@ -0,0 +1,370 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the plan.h API. Records are work_t's kept in two growing
+ * arrays. The process functions are not aware of threads, each thread gets
+ * its own copy of the process_opts with its own buffer and the callback is
+ * wrapped so only one thread reports at a time.
+ */
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "plan.h"
+#include "pool.h"
+#include "process.h"
+#include "serial.h"
+#include "../logging.h"
+#include "dcp.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * a directory to create, sorted by depth before the passes run
+ */
+struct dir {
+    work_t *work;
+    int level;          /**< depth in the walk, roots are 0 */
+    size_t order;       /**< position in the walk, keeps the sort stable */
+    int exists;         /**< already at the destination, not created */
+};
+
+
+struct plan {
+    struct dir *dirs;
+    size_t ndirs;
+    size_t maxdirs;
+
+    work_t **files;     /**< everything that is not a directory */
+    size_t nfiles;
+    size_t maxfiles;
+};
+
+
+/**
+ * state of a pass shared with the pool
+ */
+struct run {
+    struct plan *plan;
+    file_t *newdir;
+    int verbose;
+    struct process_opts *opts;  /**< one per thread */
+    size_t base;                /**< first directory of the current depth */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * grow `*array` of `*max` elements of `size` bytes to hold one more
+ */
+static int grow(void *array, size_t *max, size_t count, size_t size);
+
+
+/**
+ * keep `work` as a directory at depth `level`, which `exists` at the
+ * destination or not, or as a file
+ */
+static int record(struct plan *plan, work_t *work, int isdir, int level,
+        int exists);
+
+
+/**
+ * qsort comparison of struct dir by depth then walk order
+ */
+static int dir_cmp(const void *a, const void *b);
+
+
+/*
+ * loop bodies for the three passes
+ */
+static void skeleton_one(void *ctx, size_t i, size_t thread);
+static void fill_one(void *ctx, size_t i, size_t thread);
+static void own_one(void *ctx, size_t i, size_t thread);
+
+
+/* Public Impl ****************************************************************/
+
+
+int plan_create(plan_t **plan)
+{
+    if ((*plan = calloc(1, sizeof(struct plan))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+    return 0;
+}
+
+
+void plan_free(plan_t *plan)
+{
+    size_t i;
+
+    if (plan == NULL)
+        return;
+
+    for (i = 0; i < plan->ndirs; i++)
+        work_free(plan->dirs[i].work);
+    for (i = 0; i < plan->nfiles; i++)
+        work_free(plan->files[i]);
+    free(plan->dirs);
+    free(plan->files);
+    free(plan);
+}
+
+
+int plan_add(plan_t *plan, FTSENT *ent, const char *newpath,
+        const char *dapath, const void *pathmd5)
+{
+    work_t *work;
+
+    switch (ent->fts_info)
+    {
+    case FTS_D:
+    case FTS_F:
+    case FTS_SL:
+    case FTS_DEFAULT:
+        break;
+
+    /* the metadata is set in the last pass */
+    case FTS_DP:
+        return 0;
+
+    default:
+        return -1;
+    }
+
+    if ((work = work_create(ent->fts_path, ent->fts_accpath, newpath, dapath,
+            pathmd5, ent->fts_statp)) == NULL)
+        return -1;
+
+    return record(plan, work, ent->fts_info == FTS_D, ent->fts_level, 0);
+}
+
+
+int plan_add_path(plan_t *plan, const char *path, const struct stat *st,
+        int level, const char *newpath, const char *dapath,
+        const void *pathmd5, int exists)
+{
+    work_t *work;
+
+    if ((work = work_create(path, path, newpath, dapath, pathmd5, st)) == NULL)
+        return -1;
+
+    return record(plan, work, S_ISDIR(st->st_mode), level, exists);
+}
+
+
+int plan_run(plan_t *plan, file_t *newdir, const struct process_opts *opts,
+        int verbose, size_t threads)
+{
+    pool_t *pool;
+    struct run run;
+    serial_t serial;
+    size_t count;
+    size_t i;
+    size_t end;
+    int r;
+
+    pool = NULL;
+    if (threads > 1 && pool_create(&pool, threads - 1) != 0)
+        log_warnx("cannot start copy threads, copying on one thread");
+
+    count = pool_threads(pool);
+    if ((run.opts = calloc(count, sizeof(struct process_opts))) == NULL)
+    {
+        log_error("malloc");
+        pool_free(pool);
+        return -1;
+    }
+
+    serial_init(&serial, opts->callback, opts->callback_ctx);
+
+    /* the caller's buffer goes to thread 0, the others get their own */
+    r = 0;
+    for (i = 0; i < count; i++)
+    {
+        run.opts[i] = *opts;
+        run.opts[i].prefetch     = NULL;
+        run.opts[i].async        = NULL;
+        run.opts[i].dirs         = NULL;   /* the last pass is late enough */
+        run.opts[i].callback     = serial_callback;
+        run.opts[i].callback_ctx = &serial;
+
+        if (i > 0 && (run.opts[i].buffer = malloc(opts->buffer_size)) == NULL)
+        {
+            log_error("cannot allocate buffer of size %zu bytes",
+                    opts->buffer_size);
+            r = -1;
+        }
+
+        /* and so do the xattrs */
+        if (i > 0)
+            run.opts[i].xattrs = NULL;
+        if (i > 0 && opts->xattrs != NULL &&
+                xattrs_create(&run.opts[i].xattrs) != 0)
+            r = -1;
+    }
+
+    run.plan    = plan;
+    run.newdir  = newdir;
+    run.verbose = verbose;
+    run.base    = 0;
+
+    if (r == 0)
+    {
+        qsort(plan->dirs, plan->ndirs, sizeof(struct dir), dir_cmp);
+
+        /* a directory's parent is one level up, create a level at a time */
+        for (i = 0; i < plan->ndirs; i = end)
+        {
+            for (end = i; end < plan->ndirs &&
+                    plan->dirs[end].level == plan->dirs[i].level; end++)
+                continue;
+            run.base = i;
+            pool_for(pool, end - i, skeleton_one, &run);
+        }
+
+        pool_for(pool, plan->nfiles, fill_one, &run);
+
+        /* owner, mode and times last, the deepest directories first */
+        for (i = plan->ndirs; i > 0; i = end)
+        {
+            for (end = i; end > 0 &&
+                    plan->dirs[end - 1].level == plan->dirs[i - 1].level; end--)
+                continue;
+            run.base = end;
+            pool_for(pool, i - end, own_one, &run);
+        }
+    }
+
+    pool_free(pool);
+    for (i = 1; i < count; i++)
+    {
+        free(run.opts[i].buffer);
+        xattrs_free(run.opts[i].xattrs);
+    }
+    free(run.opts);
+    serial_destroy(&serial);
+    return r;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int grow(void *array, size_t *max, size_t count, size_t size)
+{
+    void *tmp;
+    size_t want;
+
+    if (count < *max)
+        return 0;
+
+    want = *max == 0? 1024 : *max * 2;
+    if ((tmp = realloc(*(void **) array, want * size)) == NULL)
+    {
+        log_error("cannot record more than %zu entries", count);
+        return -1;
+    }
+
+    *(void **) array = tmp;
+    *max = want;
+    return 0;
+}
+
+
+int record(struct plan *plan, work_t *work, int isdir, int level, int exists)
+{
+    if (isdir)
+    {
+        if (grow(&plan->dirs, &plan->maxdirs, plan->ndirs,
+                sizeof(struct dir)) != 0)
+        {
+            work_free(work);
+            return -1;
+        }
+        plan->dirs[plan->ndirs].work   = work;
+        plan->dirs[plan->ndirs].level  = level;
+        plan->dirs[plan->ndirs].order  = plan->ndirs;
+        plan->dirs[plan->ndirs].exists = exists;
+        plan->ndirs++;
+        return 0;
+    }
+
+    if (grow(&plan->files, &plan->maxfiles, plan->nfiles,
+            sizeof(work_t *)) != 0)
+    {
+        work_free(work);
+        return -1;
+    }
+    plan->files[plan->nfiles++] = work;
+    return 0;
+}
+
+
+int dir_cmp(const void *a, const void *b)
+{
+    const struct dir *l = a;
+    const struct dir *r = b;
+
+    if (l->level != r->level)
+        return l->level < r->level? -1 : 1;
+    return l->order < r->order? -1 : l->order > r->order;
+}
+
+
+void skeleton_one(void *ctx, size_t i, size_t thread)
+{
+    struct run *run = ctx;
+    work_t *w = run->plan->dirs[run->base + i].work;
+
+    if (run->plan->dirs[run->base + i].exists)
+        return;
+    if (preprocess(run->newdir, w->newpath, w->path, &w->st,
+            &run->opts[thread], run->verbose) != 0)
+        return;
+    process_mkdir(run->newdir, w->newpath, w->accpath, &w->st, w->dapath,
+            w->pathmd5, &run->opts[thread]);
+}
+
+
+void fill_one(void *ctx, size_t i, size_t thread)
+{
+    struct run *run = ctx;
+    work_t *w = run->plan->files[i];
+    const struct process_opts *opts = &run->opts[thread];
+
+    if (preprocess(run->newdir, w->newpath, w->path, &w->st, opts,
+            run->verbose) != 0)
+        return;
+
+    if (S_ISREG(w->st.st_mode))
+        process_regular(run->newdir, w->newpath, w->accpath, &w->st,
+                w->dapath, w->pathmd5, opts);
+    else if (S_ISLNK(w->st.st_mode))
+        process_symlink(run->newdir, w->newpath, w->accpath, &w->st,
+                w->dapath, w->pathmd5, opts);
+    else
+        process_special(run->newdir, w->newpath, w->accpath, &w->st,
+                w->dapath, w->pathmd5, opts);
+}
+
+
+void own_one(void *ctx, size_t i, size_t thread)
+{
+    struct run *run = ctx;
+    work_t *w = run->plan->dirs[run->base + i].work;
+
+    process_directory(run->newdir, w->newpath, w->accpath, &w->st, w->dapath,
+            w->pathmd5, &run->opts[thread]);
+}
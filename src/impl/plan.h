@@ -0,0 +1,109 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Two phase copy. Copying while walking ties the parallelism to the shape of
+ * the tree, a file can only be copied once the walk reaches it. In two phase
+ * mode the walk only records what it finds, then the copy runs in three
+ * passes over the records:
+ *
+ *      1. skeleton     every directory is created, one depth at a time with
+ *                      all the directories of a depth in parallel
+ *      2. fill         regular files, symlinks and specials from one flat
+ *                      list, all in parallel
+ *      3. metadata     process_directory for every directory, deepest first
+ *
+ * Entries fts reports errors for are not recorded, the walk handles them as it
+ * always has. A list of entries given instead of a walk is copied the same way.
+ */
+#ifndef PLAN_H__
+#define PLAN_H__
+
+
+#include <fts.h>
+#include <stddef.h>
+
+#include "process.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the recorded directories and files
+ */
+typedef struct plan plan_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * @return          0 on success, -1 on failure
+ */
+int plan_create(plan_t **plan);
+
+
+/**
+ * release the plan and every record left in it, NULL is ignored
+ */
+void plan_free(plan_t *plan);
+
+
+/**
+ * Record the entry returned by the walk.
+ *
+ * @param plan      the plan to add to
+ * @param ent       entry returned by fts_read
+ * @param newpath   destination path relative to the destination root
+ * @param dapath    Destination Absolute Path @see dcp.h DEFINITIONS
+ * @param pathmd5   md5sum of `dapath`
+ *
+ * @return          0 if the plan took care of the entry, -1 if the caller
+ *                  must process it now
+ */
+int plan_add(plan_t *plan, FTSENT *ent, const char *newpath,
+        const char *dapath, const void *pathmd5);
+
+
+/**
+ * Record an entry found without a walk, a directory when `st` says so.
+ *
+ * @param plan      the plan to add to
+ * @param path      the entry's source path
+ * @param st        the entry's lstat
+ * @param level     # of directories between the entry and the root, roots
+ *                  are 0
+ * @param newpath   destination path relative to the destination root
+ * @param dapath    Destination Absolute Path @see dcp.h DEFINITIONS
+ * @param pathmd5   md5sum of `dapath`
+ * @param exists    the directory is already at the destination, it is neither
+ *                  created nor reported, only given its attrs and synced
+ *
+ * @return          0 on success, -1 on failure
+ */
+int plan_add_path(plan_t *plan, const char *path, const struct stat *st,
+        int level, const char *newpath, const char *dapath,
+        const void *pathmd5, int exists);
+
+
+/**
+ * Run the three passes over what was recorded.
+ *
+ * @param plan      the recorded walk
+ * @param newdir    destination root every new path is relative to
+ * @param opts      parameters for the process functions, `buffer` is only
+ *                  used by the calling thread the others get their own
+ * @param verbose   explain what is being done
+ * @param threads   # of threads to copy with, including the caller
+ *
+ * @return          0 on success, -1 on failure
+ */
+int plan_run(plan_t *plan, file_t *newdir, const struct process_opts *opts,
+        int verbose, size_t threads);
+
+
+#endif
@@ -0,0 +1,209 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the pool.h API. Indexes are handed out with an atomic
+ * counter so a worker that draws cheap iterations keeps drawing. Each loop is
+ * a new generation, workers sleep until the generation changes.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "../logging.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+struct pool {
+    pthread_t *threads;
+    size_t count;               /**< # of workers started */
+    size_t ids;                 /**< last id given to a worker, atomic */
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;       /**< signaled when a loop begins or on exit */
+    pthread_cond_t done;        /**< signaled when the last worker leaves */
+    unsigned long generation;   /**< incremented for every loop */
+    size_t busy;                /**< # of workers inside the current loop */
+    int exit;                   /**< workers must return */
+
+    pool_func_f func;           /**< the current loop */
+    void *ctx;
+    size_t total;               /**< # of iterations in the current loop */
+    size_t next;                /**< next iteration to hand out, atomic */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * worker's main, runs loops until the pool exits
+ */
+static void *worker(void *arg);
+
+
+/**
+ * run iterations of the current loop on `thread` until none are left
+ */
+static void drain(struct pool *pool, size_t thread);
+
+
+/* Public Impl ****************************************************************/
+
+
+int pool_create(pool_t **pool, size_t threads)
+{
+    struct pool *p;
+
+    if (threads == 0)
+        return -1;
+
+    if ((p = calloc(1, sizeof(*p))) == NULL ||
+            (p->threads = calloc(threads, sizeof(pthread_t))) == NULL)
+    {
+        log_error("malloc");
+        free(p);
+        return -1;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for (p->count = 0; p->count < threads; p->count++)
+    {
+        if (pthread_create(&p->threads[p->count], NULL, worker, p) != 0)
+        {
+            log_errorx("cannot start worker thread %zu", p->count);
+            break;
+        }
+    }
+
+    /* a smaller pool still works, none at all does not */
+    if (p->count == 0)
+    {
+        pool_free(p);
+        return -1;
+    }
+
+    *pool = p;
+    return 0;
+}
+
+
+void pool_free(pool_t *pool)
+{
+    size_t i;
+
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->exit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+
+void pool_for(pool_t *pool, size_t count, pool_func_f func, void *ctx)
+{
+    size_t i;
+
+    if (count == 0)
+        return;
+
+    /* nothing to share the work with, or not enough work to share */
+    if (pool == NULL || count == 1)
+    {
+        for (i = 0; i < count; i++)
+            func(ctx, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->func  = func;
+    pool->ctx   = ctx;
+    pool->total = count;
+    pool->next  = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    drain(pool, 0);
+
+    /* the loop is over once every worker that joined it has left */
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pool->func = NULL;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+size_t pool_threads(const pool_t *pool)
+{
+    return pool == NULL? 1 : pool->count + 1;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void *worker(void *arg)
+{
+    struct pool *pool = arg;
+    unsigned long seen;
+    size_t thread;
+
+    thread = __atomic_add_fetch(&pool->ids, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pool->lock);
+    seen = pool->generation;
+    for (;;)
+    {
+        while (!pool->exit && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->exit)
+            break;
+
+        seen = pool->generation;
+        if (pool->func == NULL)
+            continue;   /* woke up after the loop already finished */
+
+        pool->busy++;
+        pthread_mutex_unlock(&pool->lock);
+
+        drain(pool, thread);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+void drain(struct pool *pool, size_t thread)
+{
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED))
+            < pool->total)
+        pool->func(pool->ctx, i, thread);
+}
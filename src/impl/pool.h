@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Fixed size pool of worker threads used to run blocking system calls in
+ * parallel. The pool only knows how to run a parallel for loop, `func` is
+ * called once for every index in [0, count) spread over the workers and the
+ * calling thread, and pool_for returns once every call has. Each call is told
+ * which thread runs it so per thread state can be kept in an array.
+ */
+#ifndef POOL_H__
+#define POOL_H__
+
+
+#include <stddef.h>
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the workers and the loop they are running
+ */
+typedef struct pool pool_t;
+
+
+/**
+ * body of a parallel loop, called with the loop's context, the index and the
+ * thread running it, 0 for the caller of pool_for and [1, pool_threads) for
+ * the workers
+ */
+typedef void (*pool_func_f)(void *ctx, size_t i, size_t thread);
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Start `threads` workers. The calling thread takes part in every loop so a
+ * pool of 1 has one worker and the caller.
+ *
+ * @param pool      where to store the new pool
+ * @param threads   # of workers to start, must be > 0
+ *
+ * @return          0 on success, -1 on failure
+ */
+int pool_create(pool_t **pool, size_t threads);
+
+
+/**
+ * stop and join every worker, NULL is ignored
+ */
+void pool_free(pool_t *pool);
+
+
+/**
+ * @return          # of threads that take part in a loop, the workers and the
+ *                  caller, 1 for a NULL pool
+ */
+size_t pool_threads(const pool_t *pool);
+
+
+/**
+ * Call `func(ctx, i, thread)` for every `i` in [0, count) and wait for all of
+ * them. With a NULL pool the loop runs on the calling thread. Not reentrant, only
+ * one thread may run a loop on a pool at a time.
+ */
+void pool_for(pool_t *pool, size_t count, pool_func_f func, void *ctx);
+
+
+#endif
@@ -0,0 +1,310 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the prefetch.h API. fts links every entry of a directory
+ * together before returning the first one, `fts_link` is used to find the
+ * files that come next and `fts_number` marks the ones already prefetched.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prefetch.h"
+#include "../logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * value stored in `fts_number` once an entry has been prefetched, fts
+ * initializes the field to 0
+ */
+#define PREFETCHED 1
+
+
+/**
+ * cachestat(2) was added in linux 6.5, older headers do not define it
+ */
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * cachestat(2)'s range and result, see linux/mman.h
+ */
+struct cachestat_range {
+    uint64_t off;
+    uint64_t len;
+};
+
+struct cachestat {
+    uint64_t nr_cache;
+    uint64_t nr_dirty;
+    uint64_t nr_writeback;
+    uint64_t nr_evicted;
+    uint64_t nr_recently_evicted;
+};
+
+
+struct prefetch {
+    size_t max;             /**< upper bound of the window */
+    size_t window;          /**< # of files currently prefetched ahead */
+    uint64_t read_ns;       /**< moving average of ns spent reading */
+    uint64_t digest_ns;     /**< moving average of ns spent digesting */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Build the path of `sibling` in `buf`. Below the roots fts only fills in an
+ * entry's path when fts_read returns it, until then its siblings' paths are the
+ * prefix of `ent`'s path followed by their name.
+ *
+ * @return          the path, NULL if it does not fit in PATH_MAX
+ */
+static const char *sibling_path(const FTSENT *ent, const FTSENT *sibling,
+        char *buf);
+
+
+/**
+ * count the resident pages in the first `len` bytes of `fd` with mincore(2)
+ *
+ * @return          # of pages in the page cache, -1 on error
+ */
+static ssize_t resident_pages(int fd, size_t len);
+
+
+/**
+ * exponential moving average with a weight of 1/8 for the new sample
+ */
+static inline uint64_t ewma(uint64_t avg, uint64_t sample);
+
+
+/* Public Impl ****************************************************************/
+
+
+int prefetch_create(prefetch_t **pf, size_t max)
+{
+    if (pf == NULL || max == 0)
+        return -1;
+
+    if ((*pf = malloc(sizeof(struct prefetch))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    (*pf)->max       = max;
+    (*pf)->window    = 1;
+    (*pf)->read_ns   = 0;
+    (*pf)->digest_ns = 0;
+    return 0;
+}
+
+
+void prefetch_free(prefetch_t *pf)
+{
+    if (pf != NULL)
+        free(pf);
+}
+
+
+void prefetch_window(prefetch_t *pf, FTSENT *ent)
+{
+    FTSENT *next;
+    size_t files;
+    size_t seen;
+    const char *path;
+    char buf[PATH_MAX];
+
+    if (pf == NULL)
+        return;
+
+    /*
+     * look at a bounded # of siblings so a directory full of subdirectories
+     * doesn't turn every call into a walk of the whole list
+     */
+    files = 0;
+    seen = 0;
+    for (next = ent->fts_link;
+            next != NULL && files < pf->window && seen < pf->max * 4;
+            next = next->fts_link, seen++)
+    {
+        if (next->fts_info != FTS_F)
+            continue;
+
+        files++;
+        if (next->fts_number != PREFETCHED && next->fts_statp->st_size > 0 &&
+                (path = sibling_path(ent, next, buf)) != NULL)
+            prefetch_path(path, next->fts_statp->st_size);
+        next->fts_number = PREFETCHED;
+    }
+}
+
+
+/*
+ * If reading a file takes N times longer than digesting it, N files need to be
+ * in flight for the digesters never to wait on the disk. The window is that
+ * ratio rounded up plus the file being processed.
+ */
+void prefetch_account(prefetch_t *pf, uint64_t read_ns, uint64_t digest_ns)
+{
+    uint64_t want;
+
+    if (pf == NULL)
+        return;
+
+    pf->read_ns   = ewma(pf->read_ns, read_ns);
+    pf->digest_ns = ewma(pf->digest_ns, digest_ns);
+
+    want = pf->read_ns / (pf->digest_ns == 0? 1 : pf->digest_ns) + 1;
+    pf->window = want > pf->max? pf->max : want;
+}
+
+
+void prefetch_path(const char *path, off_t size)
+{
+    int fd;
+
+    /* only the head of large files, they get sequential readahead later */
+    enum { MAX_PREFETCH = 1024 * 1024 };
+
+    if ((fd = open(path, O_RDONLY | O_NONBLOCK)) == -1)
+        return; /* not an error, processing the file will report it */
+
+    if (size > MAX_PREFETCH)
+        size = MAX_PREFETCH;
+
+    posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+
+int prefetch_is_cached(const char *path, off_t size)
+{
+    int fd;
+    size_t pages;
+    ssize_t resident;
+    struct cachestat_range range;
+    struct cachestat cs;
+    long pagesize;
+
+    /* set once the kernel tells us it has no cachestat */
+    static int no_cachestat = 0;
+
+    /* judge large files by their head, that is what gets read first */
+    enum { MAX_SPAN = 16 * 1024 * 1024 };
+
+    if (size == 0)
+        return 1; /* nothing to read */
+
+    if (size > MAX_SPAN)
+        size = MAX_SPAN;
+
+    if ((fd = open(path, O_RDONLY | O_NONBLOCK)) == -1)
+        return 0;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    pages = (size + pagesize - 1) / pagesize;
+    resident = -1;
+
+    if (!no_cachestat)
+    {
+        range.off = 0;
+        range.len = size;
+        if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0)
+            resident = cs.nr_cache;
+        else if (errno == ENOSYS)
+            no_cachestat = 1;
+    }
+
+    if (resident == -1)
+        resident = resident_pages(fd, size);
+
+    close(fd);
+    return resident >= (ssize_t) pages;
+}
+
+
+uint64_t prefetch_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+const char *sibling_path(const FTSENT *ent, const FTSENT *sibling, char *buf)
+{
+    size_t prefix;
+
+    /* the roots keep the path they were given */
+    if (sibling->fts_level == FTS_ROOTLEVEL)
+        return sibling->fts_accpath;
+
+    prefix = ent->fts_pathlen - ent->fts_namelen;
+    if (prefix + sibling->fts_namelen + 1 > PATH_MAX)
+        return NULL;
+
+    memcpy(buf, ent->fts_path, prefix);
+    memcpy(buf + prefix, sibling->fts_name, sibling->fts_namelen + 1);
+    return buf;
+}
+
+
+ssize_t resident_pages(int fd, size_t len)
+{
+    void *map;
+    unsigned char *vec;
+    size_t pages;
+    size_t i;
+    ssize_t resident;
+    long pagesize;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    pages = (len + pagesize - 1) / pagesize;
+
+    if ((map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return -1;
+
+    resident = -1;
+    if ((vec = malloc(pages)) != NULL)
+    {
+        if (mincore(map, len, vec) == 0)
+            for (i = 0, resident = 0; i < pages; i++)
+                resident += vec[i] & 1;
+        free(vec);
+    }
+
+    munmap(map, len);
+    return resident;
+}
+
+
+inline uint64_t ewma(uint64_t avg, uint64_t sample)
+{
+    return avg == 0? sample : avg - (avg / 8) + (sample / 8);
+}
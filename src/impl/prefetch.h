@@ -0,0 +1,120 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Lookahead prefetching for the directory walk. While the current file is
+ * being read and digested the kernel is asked to start reading the next few
+ * regular files of the same directory, hiding I/O latency behind the time
+ * spent hashing.
+ *
+ * The number of files prefetched, the window, is tuned while running. Each
+ * processed file reports how long was spent reading it and how long was spent
+ * digesting it. The slower reading is compared to hashing the more files need
+ * to be in flight to keep the digesters busy, so the window is sized to the
+ * observed ratio of the two.
+ *
+ * The API can also tell if a file's data is already in the page cache, letting
+ * the walk hash cached files first while cold ones are read ahead.
+ */
+#ifndef PREFETCH_H__
+#define PREFETCH_H__
+
+
+#include <fts.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * state of the lookahead window and the timing used to tune it
+ */
+typedef struct prefetch prefetch_t;
+
+
+/**
+ * where the time processing a regular file went, @see prefetch_account
+ */
+typedef struct {
+    uint64_t read_ns;       /**< ns spent reading the source */
+    uint64_t digest_ns;     /**< ns spent updating digests */
+} prefetch_timing_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Create a prefetcher which will never have more than `max` files in its
+ * window.
+ *
+ * @param pf        where to store the new prefetcher
+ * @param max       upper bound on the # of files to prefetch, must be > 0
+ *
+ * @return          0 on success, -1 on failure
+ */
+int prefetch_create(prefetch_t **pf, size_t max);
+
+
+/**
+ * Release all resources held by the prefetcher, NULL is ignored.
+ */
+void prefetch_free(prefetch_t *pf);
+
+
+/**
+ * Start readahead on the regular files following `ent` in its directory. Only
+ * files that have not been prefetched already are touched, so calling this
+ * for every file in a directory costs one open per file at most.
+ *
+ * @param pf        the prefetcher, if NULL nothing is done
+ * @param ent       entry about to be processed, its siblings are prefetched
+ */
+void prefetch_window(prefetch_t *pf, FTSENT *ent);
+
+
+/**
+ * Report how a regular file was processed so the window can be tuned.
+ *
+ * @param pf        the prefetcher, if NULL nothing is done
+ * @param read_ns   nanoseconds spent waiting on reads of the source
+ * @param digest_ns nanoseconds spent updating digests
+ */
+void prefetch_account(prefetch_t *pf, uint64_t read_ns, uint64_t digest_ns);
+
+
+/**
+ * Ask the kernel to start reading the head of the file at `path`.
+ *
+ * @param path      file to prefetch
+ * @param size      the file's size in bytes
+ */
+void prefetch_path(const char *path, off_t size);
+
+
+/**
+ * Determine if the data of the file at `path` is in the page cache. Uses
+ * cachestat(2) when the kernel supports it, mincore(2) on a mapping of the file
+ * otherwise. Only the head of very large files is considered.
+ *
+ * @param path      file to look at
+ * @param size      the file's size in bytes
+ *
+ * @return          1 if cached, 0 if not or it cannot be determined
+ */
+int prefetch_is_cached(const char *path, off_t size);
+
+
+/**
+ * @return          current value of the monotonic clock in nanoseconds
+ */
+uint64_t prefetch_clock(void);
+
+
+#endif
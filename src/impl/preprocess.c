@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -22,17 +23,25 @@
 /* Static Vars ****************************************************************/
 
 
-static char PATHSTRBUF[PATH_MAX];
+/* one per thread so pathstr can be used by parallel copies */
+static __thread char PATHSTRBUF[PATH_MAX];
+static __thread char MIRRORBUF[PATH_MAX];
 
 
 /* Public Impl ****************************************************************/
 
 
 int preprocess(file_t *newdir, const char *newpath, const char *oldpath,
-        const struct stat *oldst, int verbose)
+        const struct stat *oldst, const struct process_opts *opts,
+        int verbose)
 {
     struct stat st;
 
+    /* what is there is only found out when the copy replaces or skips it */
+    if (S_ISREG(oldst->st_mode) && (durable_atomic(opts->durable) ||
+            opts->update != UPDATE_NONE))
+        goto cleanup;
+
     if (fstatat(newdir->fd, newpath + 1, &st, 0) == -1)
     {
         if (errno == ENOENT)
@@ -99,3 +108,85 @@ const char *pathstr(const file_t *root, const char *path)
             strlen(root->path) == 0? "" : "/", path);
     return PATHSTRBUF;
 }
+
+
+const char *mirror_path(const mirror_t *mirror, const char *newpath)
+{
+    const char *rest;
+
+    if (mirror->top == NULL)
+        return newpath;
+
+    /* everything below the top component stays the same */
+    rest = strchr(newpath, '/');
+    snprintf(MIRRORBUF, sizeof(MIRRORBUF), "%s%s", mirror->top,
+            rest == NULL? "" : rest);
+    return MIRRORBUF;
+}
+
+
+int process_current(const file_t *newdir, const char *newpath,
+        const struct stat *oldst, const struct process_opts *opts,
+        digest_t type, const void *digest)
+{
+    size_t i;
+
+    if (!update_current(opts->update, newdir->fd, newpath, oldst, type,
+            digest))
+        return 0;
+
+    for (i = 0; i < opts->nmirrors; i++)
+        if (!update_current(opts->update, opts->mirrors[i].dir.fd,
+                mirror_path(&opts->mirrors[i], newpath), oldst, type, digest))
+            return 0;
+    return 1;
+}
+
+
+const xattrs_t *process_xattrs(const file_t *newdir, const char *newpath,
+        const char *oldpath, int fd, const struct stat *oldst,
+        dcp_state_t state, const dcp_state_t *dests,
+        const struct process_opts *opts)
+{
+    const mirror_t *m;
+    size_t i;
+
+    /* nothing was created from a failed entry */
+    if (opts->xattrs == NULL || state == DCP_FAILED || state == DCP_DIR_FAILED)
+        return NULL;
+
+    if (xattrs_read(opts->xattrs, fd, oldpath, oldst) != 0)
+        return NULL;
+    if (!opts->copy_xattrs || S_ISREG(oldst->st_mode))
+        return opts->xattrs;
+
+    xattrs_write(opts->xattrs, newdir->fd, newdir->path, newpath, oldst,
+            opts->xattr_filters, opts->nxattr_filters);
+    for (i = 0; dests != NULL && i < opts->nmirrors; i++)
+    {
+        m = &opts->mirrors[i];
+        if (dests[i] != DCP_FAILED && dests[i] != DCP_DIR_FAILED)
+            xattrs_write(opts->xattrs, m->dir.fd, m->dir.path,
+                    mirror_path(m, newpath), oldst, opts->xattr_filters,
+                    opts->nxattr_filters);
+    }
+    return opts->xattrs;
+}
+
+
+const xattrs_t *process_file_xattrs(attrs_t *attrs, int fd,
+        const char *oldpath, const struct stat *oldst,
+        const struct process_opts *opts)
+{
+    if (opts->xattrs == NULL ||
+            xattrs_read(opts->xattrs, fd, oldpath, oldst) != 0)
+        return NULL;
+
+    if (opts->copy_xattrs)
+    {
+        attrs->xattrs   = opts->xattrs;
+        attrs->filters  = opts->xattr_filters;
+        attrs->nfilters = opts->nxattr_filters;
+    }
+    return opts->xattrs;
+}
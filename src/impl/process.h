@@ -21,7 +21,13 @@
 
 #include "../digest.h"
 #include "../index/index.h"
+#include "attrs.h"
 #include "dcp.h"
+#include "durable.h"
+#include "engine.h"
+#include "prefetch.h"
+#include "tar.h"
+#include "update.h"
 
 
 /* Macros *********************************************************************/
@@ -48,23 +54,65 @@ typedef struct {
 } file_t;
 
 
+/**
+ * A further destination every entry is copied to. Its paths are the ones of
+ * the first destination with the top component replaced by `top`, or the same
+ * when `top` is NULL. @see mirror_path
+ */
+typedef struct {
+    file_t dir;                 /**< what the paths are relative to */
+    char *top;                  /**< NULL or the name of the copy's root */
+} mirror_t;
+
+
 /**
  * struct to hold static parameters that the following functions utilize.
  */
 struct process_opts {
     int digests;                /**< mask of digest_alg_t for what hashes to
                                      compute */
-    uid_t uid;                  /**< who owns the copied files */
-    gid_t gid;                  /**< what group do copied files belong */
+    attrs_policy_t attrs;       /**< owner, mode and times of the copies */
     void *buffer;               /**< preallocated memory to use for reading */
     size_t buffer_size;         /**< # of bytes in `buffer` */
 
     index_t *index;             /**< NULL or files we should not copy */
+    prefetch_t *prefetch;       /**< NULL or told how long files take */
+    int engines[ENGINE_CLASSES];/**< engine_id_t to copy each size class with */
+    struct async *async;        /**< NULL or engine to hand files to */
+    const mirror_t *mirrors;    /**< more destinations written to as well */
+    size_t nmirrors;            /**< # of `mirrors`, at most DCP_MAX_DESTS */
     dcp_callback_f callback;    /**< callback to send processing info to */
     void *callback_ctx;         /**< provided pointer to send to `processor` */
+    xattrs_t *xattrs;           /**< NULL or where to read xattrs, one per
+                                     thread */
+    int copy_xattrs;            /**< set the xattrs read on the copies */
+    const char *const *xattr_filters;   /**< @see xattr.h */
+    size_t nxattr_filters;
+    attrs_dirs_t *dirs;         /**< NULL or where the directories left wait
+                                     for process_settle, one per thread */
+    durable_t *durable;         /**< NULL or how the copies are synced */
+    update_mode_t update;       /**< how a copy already there is found current,
+                                     @see process_current */
+    tar_t *tar;                 /**< NULL or the archive the entries are added
+                                     to instead of created, @see process_tar */
 };
 
 
+/**
+ * An entry the walk has moved past that still needs to be processed. fts frees
+ * its entries once their directory is done, so everything the process
+ * functions need is copied. @see work_create
+ */
+typedef struct {
+    char *path;                 /**< source path, used in messages */
+    char *accpath;              /**< source path to access the file with */
+    char *newpath;              /**< destination path relative to its root */
+    char *dapath;               /**< Destination Absolute Path */
+    unsigned char pathmd5[MD5_DIGEST_LENGTH]; /**< md5 of `dapath` */
+    struct stat st;             /**< the source's stat information */
+} work_t;
+
+
 /* Public API *****************************************************************/
 
 
@@ -99,6 +147,11 @@ int process_special(file_t *newdir, const char *newpath, const char *oldpath,
  * walk we assume that the directory exists since for all its children to have
  * been processed already means the destination directory must exist.
  *
+ * Its owner, mode and times, @see attrs.h, are set right away unless
+ * `opts->dirs` is set and it has times to keep or is to be synced, then the
+ * directory waits there for process_settle. It is fsync'd afterwards when
+ * `opts->durable` asks, @see durable_dir.
+ *
  * If `newpath` is relative, then it is interpreted relative to the directory
  * referred to by `newdirfd` rather than the process's cwd. If `newpath` is
  * absolute `newdirfd` is ignored.
@@ -113,10 +166,38 @@ int process_directory(file_t *newdir, const char *newpath, const char *oldpath,
         const struct process_opts *opts);
 
 
+/**
+ * Set the metadata of the directories waiting in `opts->dirs` at `newdir` and
+ * every mirror, fsync'ing them when `opts->durable` asks, then forget them.
+ * They are set in the order they were left, the deepest first, relative to
+ * their parent, which is opened once for the siblings that follow each other.
+ *
+ * @return          0 on success, -1 if a directory could not be set
+ */
+int process_settle(file_t *newdir, const struct process_opts *opts);
+
+
+/**
+ * Create a directory the walk has entered and report it. An existing directory
+ * is not an error.
+ *
+ * If `newpath` is relative, then it is interpreted relative to the directory
+ * referred to by `newdirfd` rather than the process's cwd. If `newpath` is
+ * absolute `newdirfd` is ignored.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int process_mkdir(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        const struct process_opts *opts);
+
+
 /**
  * Processes a regular file
  *      1. Deduplication    If `index` is not null then we won't copy unless
- *                          the file is new or modified.
+ *                          the file is new or modified. With `opts.update`
+ *                          a current copy at the destination is not
+ *                          rewritten either, @see process_current.
  *      2. Digests          as specified by the `opts.digests` mask, we will
  *                          calculate all the required digests for the file.
  *      3. Cacheing         if `opts.buffer` is large enough we will only read
@@ -167,21 +248,112 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
         const struct process_opts *opts);
 
 
+/**
+ * Add an entry to the archive in `opts->tar` instead of creating it, named by
+ * `newpath`. Directories are added as the walk enters them, a regular file is
+ * digested while its data is archived. Every entry is reported with where it
+ * starts in the archive, @see tar.h.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int process_tar(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        const struct process_opts *opts);
+
+
 /**
  * Performs two tasks. First if there is an existing entry in the copy
  * destination then it is unlinked if possible and secondly if the verbose flag
  * was set will output the required messages.
  *
+ * A regular file is left be when its copy replaces it once complete, @see
+ * fd_publish, or when it may turn out current, @see process_current. Only the
+ * messages are output then.
  */
 int preprocess(file_t *newdir, const char *newpath, const char *oldpath,
-        const struct stat *oldst, int verbose);
+        const struct stat *oldst, const struct process_opts *opts,
+        int verbose);
+
+
+/**
+ * Copy an entry's information into a single allocation so it can be processed
+ * after the walk has moved on.
+ *
+ * @param path      source path, used in messages
+ * @param accpath   source path to access the file with
+ * @param newpath   destination path relative to the destination root
+ * @param dapath    Destination Absolute Path @see dcp.h DEFINITIONS
+ * @param pathmd5   md5sum of `dapath`
+ * @param st        the source's stat information
+ *
+ * @return          the new work item, NULL if out of memory
+ */
+work_t *work_create(const char *path, const char *accpath, const char *newpath,
+        const char *dapath, const void *pathmd5, const struct stat *st);
+
+
+/**
+ * release a work item created by work_create, NULL is ignored
+ */
+void work_free(work_t *work);
 
 
 /**
- * not threadsafe. builds the path in a static buffer returning a pointer to it.
- * Later calls to this function will overwrite returned string.
+ * builds the path in a thread local buffer returning a pointer to it. Later
+ * calls to this function from the same thread will overwrite returned string.
  */
 const char *pathstr(const file_t *root, const char *path);
 
 
+/**
+ * builds the path of `newpath` at `mirror` relative to `mirror->dir` in a
+ * thread local buffer, later calls from the same thread overwrite it.
+ */
+const char *mirror_path(const mirror_t *mirror, const char *newpath);
+
+
+/**
+ * See if the copy of a regular file at `newdir` and at every mirror is
+ * current as `opts->update` asks, @see update_current.
+ *
+ * @param type      the digest `digest` is, with UPDATE_DIGEST
+ * @param digest    the source's digest, with UPDATE_DIGEST
+ *
+ * @return          1 when all of them are and the file is skipped, 0 when it
+ *                  must be copied
+ */
+int process_current(const file_t *newdir, const char *newpath,
+        const struct stat *oldst, const struct process_opts *opts,
+        digest_t type, const void *digest);
+
+
+/**
+ * Read the xattrs of the source for the callback and, when they are copied,
+ * set them on every destination the entry was created at. The source is read
+ * through `fd` unless it is -1. A regular file is only read, it was given
+ * them as it was written, @see process_file_xattrs.
+ *
+ * @param state     the entry's state at `newdir`
+ * @param dests     NULL or its state at each mirror
+ *
+ * @return          the xattrs to report, NULL when they are not read
+ */
+const xattrs_t *process_xattrs(const file_t *newdir, const char *newpath,
+        const char *oldpath, int fd, const struct stat *oldst,
+        dcp_state_t state, const dcp_state_t *dests,
+        const struct process_opts *opts);
+
+
+/**
+ * Read the xattrs of a regular file before it is copied and, when they are
+ * copied, have `attrs` set them on each copy through its fd. The source is
+ * read through `fd` unless it is -1.
+ *
+ * @return          the xattrs to report, NULL when they are not read
+ */
+const xattrs_t *process_file_xattrs(attrs_t *attrs, int fd,
+        const char *oldpath, const struct stat *oldst,
+        const struct process_opts *opts);
+
+
 #endif
@@ -9,6 +9,7 @@
  * todo write description for process_directory.c
  */
 #include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -20,6 +21,19 @@
 #include "dcp.h"
 
 
+/* Private API ****************************************************************/
+
+
+/**
+ * set the metadata of the directories waiting in `d` at `dir`, their paths
+ * rewritten for `mirror` unless it is NULL, @see process_settle
+ *
+ * @return          0 on success, -1 if a directory could not be set
+ */
+static int settle(const file_t *dir, const mirror_t *mirror,
+        const attrs_dirs_t *d, const durable_t *durable);
+
+
 /* Public Impl ****************************************************************/
 
 
@@ -28,13 +42,176 @@ int process_directory(file_t *newdir, const char *newpath, const char *oldpath,
         const struct process_opts *opts)
 {
     UNUSED(oldpath);
-    UNUSED(oldst);
     UNUSED(dapath);
     UNUSED(pathmd5);
+    const mirror_t *m;
+    attrs_t attrs;
+    size_t i;
+
+    attrs_init(&attrs, oldst, &opts->attrs);
+
+    /* the owner alone can be given now, times and syncs wait for the walk */
+    if (opts->dirs != NULL && (opts->attrs.preserve ||
+            durable_mode(opts->durable) == DURABLE_FILE ||
+            durable_mode(opts->durable) == DURABLE_BATCH))
+        return attrs_dirs_add(opts->dirs, newpath, &attrs);
+
+    if (attrs_at(newdir->fd, newpath, &attrs) == -1)
+        log_warn("cannot set the owner, mode or times of '%s'",
+                pathstr(newdir, newpath));
+    if (durable_dir(opts->durable, newdir->fd, newpath) == -1)
+        log_warn("cannot sync '%s'", pathstr(newdir, newpath));
 
-    if (fchownat(newdir->fd, newpath, opts->uid, opts->gid, 0) == -1)
-        log_warn("cannot chown '%s'", pathstr(newdir, newpath));
+    for (i = 0; i < opts->nmirrors; i++)
+    {
+        m = &opts->mirrors[i];
+        if (attrs_at(m->dir.fd, mirror_path(m, newpath), &attrs) == -1)
+            log_warn("cannot set the owner, mode or times of '%s'",
+                    pathstr(&m->dir, mirror_path(m, newpath)));
+        if (durable_dir(opts->durable, m->dir.fd, mirror_path(m, newpath))
+                == -1)
+            log_warn("cannot sync '%s'",
+                    pathstr(&m->dir, mirror_path(m, newpath)));
+    }
 
     return 0;
 }
 
+
+int process_settle(file_t *newdir, const struct process_opts *opts)
+{
+    size_t i;
+    int r;
+
+    if (opts->dirs == NULL)
+        return 0;
+
+    r = settle(newdir, NULL, opts->dirs, opts->durable);
+    for (i = 0; i < opts->nmirrors; i++)
+        if (settle(&opts->mirrors[i].dir, &opts->mirrors[i], opts->dirs,
+                opts->durable) != 0)
+            r = -1;
+
+    attrs_dirs_clear(opts->dirs);
+    return r;
+}
+
+
+int process_mkdir(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        const struct process_opts *opts)
+{
+    dcp_state_t state;
+    dcp_state_t dests[DCP_MAX_DESTS];
+    const mirror_t *m;
+    struct stat st;
+    size_t i;
+
+    /* directory existing is not an error */
+    state = DCP_DIR_CREATED;
+    if (mkdirat(newdir->fd, newpath, 0777) != 0 && errno != EEXIST)
+    {
+        log_error("cannot create dir '%s/%s'", newdir->path, newpath);
+        state  = DCP_DIR_FAILED;
+    }
+
+    /*
+     * nothing examines what already exists at a mirror later, so anything but
+     * a directory there fails
+     */
+    for (i = 0; i < opts->nmirrors; i++)
+    {
+        m = &opts->mirrors[i];
+        dests[i] = DCP_DIR_CREATED;
+        if (mkdirat(m->dir.fd, mirror_path(m, newpath), 0777) == 0)
+            continue;
+
+        if (errno != EEXIST)
+            log_error("cannot create dir '%s'",
+                    pathstr(&m->dir, mirror_path(m, newpath)));
+        else if (fstatat(m->dir.fd, mirror_path(m, newpath), &st, 0) != 0)
+            log_error("cannot stat '%s'",
+                    pathstr(&m->dir, mirror_path(m, newpath)));
+        else if (!S_ISDIR(st.st_mode))
+            log_errorx("'%s' exists and is not a directory",
+                    pathstr(&m->dir, mirror_path(m, newpath)));
+        else
+            continue;
+        dests[i] = DCP_DIR_FAILED;
+    }
+
+    opts->callback(state, opts->nmirrors > 0? dests : NULL, opts->nmirrors,
+            pathmd5, dapath, oldst, oldpath,
+            process_xattrs(newdir, newpath, oldpath, -1, oldst, state,
+                    opts->nmirrors > 0? dests : NULL, opts),
+            NULL, NULL, NULL, NULL, NULL, -1, -1, opts->callback_ctx);
+    return state == DCP_DIR_CREATED? 0 : -1;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int settle(const file_t *dir, const mirror_t *mirror, const attrs_dirs_t *d,
+        const durable_t *durable)
+{
+    char parent[PATH_MAX];
+    const attrs_t *attrs;
+    const char *path;
+    const char *name;
+    size_t len;
+    size_t i;
+    int pfd;
+    int fd;
+    int r;
+
+    r = 0;
+    pfd = -1;
+    parent[0] = '\0';
+    for (i = 0; i < attrs_dirs_count(d); i++)
+    {
+        path = attrs_dirs_get(d, i, &attrs);
+        if (mirror != NULL)
+            path = mirror_path(mirror, path);
+
+        /* a parent is only opened again when its children were apart */
+        fd = dir->fd;
+        name = strrchr(path, '/');
+        len = name == NULL? 0 : (size_t) (name - path);
+        if (name == NULL || len >= sizeof(parent))
+            name = path;
+        else
+        {
+            name++;
+            if (pfd == -1 || strncmp(parent, path, len) != 0 ||
+                    parent[len] != '\0')
+            {
+                if (pfd != -1)
+                    close(pfd);
+                memcpy(parent, path, len);
+                parent[len] = '\0';
+                if ((pfd = openat(dir->fd, parent, O_RDONLY | O_DIRECTORY |
+                        O_CLOEXEC)) == -1)
+                    log_error("cannot open '%s'", pathstr(dir, parent));
+            }
+            fd = pfd;
+        }
+
+        if (fd == -1 || attrs_at(fd, name, attrs) == -1)
+        {
+            log_warn("cannot set the owner, mode or times of '%s'",
+                    pathstr(dir, path));
+            r = -1;
+        }
+        else if (durable_dir(durable, fd, name) == -1)
+        {
+            log_warn("cannot sync '%s'", pathstr(dir, path));
+            r = -1;
+        }
+    }
+
+    if (pfd != -1)
+        close(pfd);
+    return r;
+}
+
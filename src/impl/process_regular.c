@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -29,6 +30,8 @@
 #include "../index/index.h"
 #include "../logging.h"
 #include "dcp.h"
+#include "engine.h"
+#include "prefetch.h"
 
 /* Type Defs ******************************************************************/
 
@@ -38,7 +41,8 @@
  * specific information to both functions.
  *
  * copy_fd   `fd` is the file descriptor to read from, `bytes` is a buffer to
- *           use and `count` is the size of the buffer.
+ *           use, `count` is the size of the buffer and `size` the # of bytes
+ *           expected from `fd`, @see fd_preallocate.
  *
  * copy_mem  `fd` is ignored, `bytes` is a buffer containing the file's bytes
  *           and `count` is the number of valid bytes in the buffer.
@@ -47,6 +51,7 @@ struct stream {
     int fd;
     void *bytes;
     size_t count;
+    off_t size;
 };
 
 
@@ -56,7 +61,7 @@ struct stream {
  * file descriptor. @see copy_fd and @see copy_mem for implementations.
  */
 typedef int (*copy_f)(int dirfd, const char *pathname, struct stream *stream,
-        uid_t uid, gid_t gid);
+        const attrs_t *attrs, durable_t *durable);
 
 
 /* Private API ****************************************************************/
@@ -69,13 +74,13 @@ typedef int (*copy_f)(int dirfd, const char *pathname, struct stream *stream,
  * @param dirfd     fd to the parent directory of pathname
  * @param pathname  file to create copying the bytes from stream
  * @param stream    holds the buffer and number of valid bytes in it
- * @param uid       who will own the new file
- * @param gid       what group the new file will belong to
+ * @param attrs     what the new file is given before it is closed
+ * @param durable   NULL or how the new file is synced as it is closed
  *
  * @return          0 on success, -1 on failure with errno set
  */
 static int copy_mem(int dirfd, const char *pathname, struct stream *stream,
-        uid_t uid, gid_t gid);
+        const attrs_t *attrs, durable_t *durable);
 
 
 /**
@@ -85,13 +90,13 @@ static int copy_mem(int dirfd, const char *pathname, struct stream *stream,
  * @param dirfd     fd to the parent directory of pathname
  * @param pathname  file to create copying the bytes from stream
  * @param stream    the file descriptor and buffer to use
- * @param uid       who will own the new file
- * @param gid       what group the new file will belong to
+ * @param attrs     what the new file is given before it is closed
+ * @param durable   NULL or how the new file is synced as it is closed
  *
  * @return          0 on success, -1 on failure with errno set
  */
 static int copy_fd(int dirfd, const char *pathname, struct stream *stream,
-        uid_t uid, gid_t gid);
+        const attrs_t *attrs, durable_t *durable);
 
 
 /**
@@ -103,29 +108,45 @@ static int copy_fd(int dirfd, const char *pathname, struct stream *stream,
  * @param fd        the file descriptor to read the bytes from till the end
  * @param buf       a preallocated buffer to use to read the bytes
  * @param blen      number of bytes in the buffer
+ * @param timing    if not NULL incremented by the ns spent reading and
+ *                  digesting
  *
  * @return          number of bytes that are valid in buf, -1 on error
  */
 static ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf,
-        size_t blen);
+        size_t blen, prefetch_timing_t *timing);
+
 
 /**
- * Read from the FD using the provided buffer, update all the digests, finally
- * write the bytes to the destination.
+ * Copy the file to `newdir`/`newpath` and to the same path at every mirror,
+ * reading it only once. Each chunk read is written to every destination
+ * before the next is read, a destination that fails is dropped and the others
+ * carry on.
  *
- * @param dirfd     fd to the parent directory of pathname
- * @param pathname  file to create copying the bytes from stream
- * @param uid       who will own the new file
- * @param gid       what group the new file will belong to
- * @param set       initialized digestset_t to update and finalize
- * @param fd        the file descriptor to read the bytes from till the end
- * @param buf       a preallocated buffer to use to read the bytes
- * @param blen      number of bytes in the buffer
+ * @param newdir    directory `newpath` is relative to
+ * @param newpath   file to create at the destination and the mirrors
+ * @param stream    as copy_mem when `cached`, as copy_fd otherwise
+ * @param cached    whether `stream` holds all of the file's bytes
+ * @param set       NULL or digests to update with the bytes read
+ * @param opts      the mirrors and how the copies are synced
+ * @param attrs     what every copy is given before it is closed
+ * @param dests     set to the state at each mirror
+ * @param timing    if not NULL incremented by the ns spent reading and
+ *                  digesting
  *
- * @return          number of bytes copied, -1 on error
+ * @return          the state at `newdir`
+ */
+static dcp_state_t fan_out(file_t *newdir, const char *newpath,
+        struct stream *stream, int cached, digesterset_t *set,
+        const struct process_opts *opts, const attrs_t *attrs,
+        dcp_state_t *dests, prefetch_timing_t *timing);
+
+
+/**
+ * write `count` bytes to each of the `n` fds that is not -1, closing and
+ * setting to -1 the ones that fail
  */
-static ssize_t copy_n_digest(int dirfd, const char *pathname, uid_t uid,
-        gid_t gid, digesterset_t *set, int fd, void *buf, size_t blen);
+static void fan_write(int *fds, size_t n, const void *bytes, size_t count);
 
 
 /* Public Impl ****************************************************************/
@@ -134,11 +155,15 @@ static ssize_t copy_n_digest(int dirfd, const char *pathname, uid_t uid,
 /*
  * Given a regular file do the following:
  *
- *      If index is not NULL
+ *      If index is not NULL or copies are compared by digest
  *          1. Digest the file caching it in memory if possible
- *          2. Look to see if the file is in the index, if not copy the file
+ *          2. Look to see if the file is in the index or its copy is current,
+ *             if not copy the file
  *      else
- *          1. Hash the file while copying it to the destination
+ *          1. Hash the file while copying it to the destination with the
+ *             engine picked for its size
+ *
+ * With mirrors every copy is written from the one read, @see fan_out
  */
 int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
         const struct stat *oldst, const char *dapath, const void *pathmd5,
@@ -148,45 +173,99 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
     int s;
     digesterset_t dgstset;
     digest_t idxkeytype;
+    digest_t updtype;
+    int hashfirst;
     ssize_t valid_len;
     struct stream datastream;
+    engine_copy_f copy;
+    attrs_t attrs;
+    const xattrs_t *xattrs;
 
     dcp_state_t state;
+    dcp_state_t dests[DCP_MAX_DESTS];
+    const dcp_state_t *mirrored;
 
     clock_t start;
     unsigned long diff;
 
+    /* time spent reading and digesting this file */
+    prefetch_timing_t spent;
+    prefetch_timing_t *timing;
+
+    /* a current copy by time is found without opening the source */
+    if (opts->update == UPDATE_TIME &&
+            process_current(newdir, newpath, oldst, opts, 0, NULL))
+        return 0;
+
     start = clock();
 
+    /* only pay for timing when a prefetcher is listening */
+    spent.read_ns = 0;
+    spent.digest_ns = 0;
+    timing = opts->prefetch != NULL? &spent : NULL;
+
     idxkeytype = opts->index == NULL? 0 : index_get_digest_type(opts->index);
+    updtype = opts->update != UPDATE_DIGEST? 0 :
+            update_digest_type(opts->digests);
+    hashfirst = opts->index != NULL || updtype != 0;
+    mirrored = opts->nmirrors > 0? dests : NULL;
+    attrs_init(&attrs, oldst, &opts->attrs);
 
     if ((s = open(oldpath, O_RDONLY)) == -1)
     {
         log_error("cannot open '%s'", oldpath);
-        opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL, NULL,
-                NULL, NULL, NULL, -1, opts->callback_ctx);
+        opts->callback(DCP_FAILED, NULL, 0, pathmd5, dapath, oldst, oldpath,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, -1, opts->callback_ctx);
         return -1;
     }
 
     ret = 0;
 
     /* ensure we create the hash needed for the and index */
-    digesterset_create(&dgstset, opts->digests | idxkeytype);
+    digesterset_create(&dgstset, opts->digests | idxkeytype | updtype);
 
     /*
      * there is no index to check against, just copy and digest at the same
      * time
      */
-    if (opts->index == NULL)
+    if (!hashfirst && opts->nmirrors > 0)
+    {
+        datastream.fd = s;
+        datastream.bytes = opts->buffer;
+        datastream.count = opts->buffer_size;
+        datastream.size = oldst->st_size;
+        xattrs = process_file_xattrs(&attrs, s, oldpath, oldst, opts);
+        state = fan_out(newdir, newpath, &datastream, 0, &dgstset, opts,
+                &attrs, dests, timing);
+
+        digesterset_finalize(&dgstset);
+
+        /* calculate the number of milliseconds elapsed to process this file */
+        diff = ((clock() - start) * 1000) / CLOCKS_PER_SEC;
+
+        opts->callback(state, dests, opts->nmirrors, pathmd5, dapath, oldst,
+                oldpath, state == DCP_FAILED? NULL : xattrs, NULL,
+                digesterset_get_value(&dgstset, DGST_MD5),
+                digesterset_get_value(&dgstset, DGST_SHA1),
+                digesterset_get_value(&dgstset, DGST_SHA256),
+                digesterset_get_value(&dgstset, DGST_SHA512),
+                diff, -1, opts->callback_ctx);
+
+        ret = (state == DCP_FAILED)? -1 : 0;
+    }
+    else if (!hashfirst)
     {
-        valid_len = copy_n_digest(newdir->fd, newpath, opts->uid, opts->gid,
-                &dgstset, s, opts->buffer, opts->buffer_size);
+        copy = engine_get(opts->engines[engine_class(oldst->st_size)]);
+        xattrs = process_file_xattrs(&attrs, s, oldpath, oldst, opts);
+        valid_len = copy(newdir->fd, newpath, &attrs, opts->durable, &dgstset,
+                s, oldst->st_size, opts->buffer, opts->buffer_size, timing);
 
         if (valid_len < 0)
         {
             log_debugx("failed copying and hashing '%s'", oldpath);
-            opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL,
-                    NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+            opts->callback(DCP_FAILED, NULL, 0, pathmd5, dapath, oldst,
+                    oldpath, NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                    opts->callback_ctx);
             ret = -1;
             goto cleanup;
         }
@@ -197,23 +276,25 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
         diff = ((clock() - start) * 1000) / CLOCKS_PER_SEC;
 
         /* finally send the information to the file processor */
-        opts->callback(DCP_FILE_COPIED, pathmd5, dapath, oldst, oldpath, NULL,
+        opts->callback(DCP_FILE_COPIED, NULL, 0, pathmd5, dapath, oldst,
+                oldpath, xattrs, NULL,
                 digesterset_get_value(&dgstset, DGST_MD5),
                 digesterset_get_value(&dgstset, DGST_SHA1),
                 digesterset_get_value(&dgstset, DGST_SHA256),
                 digesterset_get_value(&dgstset, DGST_SHA512),
-                diff, opts->callback_ctx);
+                diff, -1, opts->callback_ctx);
         ret = 0;
     }
     else
     {
         /* read in the file and calculate the desired digests */
         if ((valid_len = cache_n_digest(&dgstset, s, opts->buffer,
-                opts->buffer_size)) == -1)
+                opts->buffer_size, timing)) == -1)
         {
             log_debugx("cannot calculate hashes for '%s'", oldpath);
-            opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL,
-                    NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+            opts->callback(DCP_FAILED, NULL, 0, pathmd5, dapath, oldst,
+                    oldpath, NULL, NULL, NULL, NULL, NULL, NULL, -1, -1,
+                    opts->callback_ctx);
             ret = -1;
             goto cleanup;
         }
@@ -240,37 +321,57 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
             }
         }
 
+        /* the copy already there has the same bytes */
+        if (updtype != 0 && process_current(newdir, newpath, oldst, opts,
+                updtype, digesterset_get_value(&dgstset, updtype)))
+            goto cleanup;
+
+        xattrs = process_file_xattrs(&attrs, s, oldpath, oldst, opts);
+
         /*
          * if cache_n_digest was able to store the whole file in the buffer then
          * we do not need to seek to the beginning of the fd and reread the
          * bytes
          */
-        if (valid_len == oldst->st_size)
+        if (opts->nmirrors > 0)
+        {
+            datastream.fd = s;
+            datastream.bytes = opts->buffer;
+            datastream.count = valid_len == oldst->st_size? (size_t) valid_len :
+                    opts->buffer_size;
+            datastream.size = oldst->st_size;
+            state = fan_out(newdir, newpath, &datastream,
+                    valid_len == oldst->st_size, NULL, opts, &attrs, dests,
+                    NULL);
+        }
+        else if (valid_len == oldst->st_size)
         {
             datastream.bytes = opts->buffer;
             datastream.count = valid_len;
-            state = copy_mem(newdir->fd, newpath, &datastream, opts->uid,
-                    opts->gid);
+            state = copy_mem(newdir->fd, newpath, &datastream, &attrs,
+                    opts->durable) == 0? DCP_FILE_COPIED : DCP_FAILED;
         }
         else
         {
             datastream.fd = s;
             datastream.bytes = opts->buffer;
             datastream.count = opts->buffer_size;
-            state = copy_fd(newdir->fd, newpath, &datastream, opts->uid,
-                    opts->gid);
+            datastream.size = oldst->st_size;
+            state = copy_fd(newdir->fd, newpath, &datastream, &attrs,
+                    opts->durable) == 0? DCP_FILE_COPIED : DCP_FAILED;
         }
 
         /* calculate the number of milliseconds elapsed to process this file */
         diff = ((clock() - start) * 1000) / CLOCKS_PER_SEC;
 
         /* finally send the information to the file processor */
-        opts->callback(state, pathmd5, dapath, oldst, oldpath, NULL,
+        opts->callback(state, mirrored, opts->nmirrors, pathmd5, dapath, oldst,
+                oldpath, state == DCP_FAILED? NULL : xattrs, NULL,
                 digesterset_get_value(&dgstset, DGST_MD5),
                 digesterset_get_value(&dgstset, DGST_SHA1),
                 digesterset_get_value(&dgstset, DGST_SHA256),
                 digesterset_get_value(&dgstset, DGST_SHA512),
-                diff, opts->callback_ctx);
+                diff, -1, opts->callback_ctx);
 
         ret = (state == DCP_FAILED)? -1 : 0;
     }
@@ -279,6 +380,9 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
         digesterset_free(&dgstset);
         close(s);
 
+    if (timing != NULL && ret == 0)
+        prefetch_account(opts->prefetch, spent.read_ns, spent.digest_ns);
+
     return ret;
 }
 
@@ -286,8 +390,8 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
 /* Private Impl ***************************************************************/
 
 
-int copy_fd(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
-        gid_t gid)
+int copy_fd(int dirfd, const char *pathname, struct stream *stream,
+        const attrs_t *attrs, durable_t *durable)
 {
     int d;
 
@@ -298,13 +402,16 @@ int copy_fd(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
         return -1;
     }
 
-    /* create/truncate the dest file and copy all the bytes */
-    if ((d = openat(dirfd, pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    /* create the dest file and copy all the bytes */
+    if ((d = durable_open(durable, dirfd, pathname)) == -1)
     {
         log_debug("openat '%s'", pathname);
         return -1;
     }
 
+    if (fd_preallocate(d, stream->size) == -1)
+        log_debug("fd_preallocate '%s'", pathname);
+
     /* copy all bytes from `fd` to `d` using `bytes` as a buffer to read to */
     if (fd_pipe(d, stream->fd, stream->bytes, stream->count) == -1)
     {
@@ -313,11 +420,18 @@ int copy_fd(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
         return -1;
     }
 
-    if (fchown(d, uid, gid) == -1)
-        log_debug("fchown");
+    if (fd_trim(d, stream->size, lseek(d, 0, SEEK_CUR)) == -1)
+        log_debug("fd_trim '%s'", pathname);
+
+    if (attrs_fd(d, attrs) == -1)
+    {
+        log_errorx("cannot set the xattrs of '%s'", pathname);
+        close(d);
+        return -1;
+    }
 
     /* do not report success here because there can be data loss */
-    if (close(d) == -1)
+    if (durable_close(durable, d, dirfd, pathname) == -1)
     {
         log_debug("close");
         return -1;
@@ -326,13 +440,13 @@ int copy_fd(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
 }
 
 
-int copy_mem(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
-        gid_t gid)
+int copy_mem(int dirfd, const char *pathname, struct stream *stream,
+        const attrs_t *attrs, durable_t *durable)
 {
     int d;
 
-    /* create/truncate the dest file and copy all the bytes */
-    if ((d = openat(dirfd, pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    /* create the dest file and copy all the bytes */
+    if ((d = durable_open(durable, dirfd, pathname)) == -1)
     {
         log_debug("openat '%s'", pathname);
         return -1;
@@ -346,11 +460,15 @@ int copy_mem(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
         return -1;
     }
 
-    if (fchown(d, uid, gid) == -1)
-        log_debug("fchown");
+    if (attrs_fd(d, attrs) == -1)
+    {
+        log_errorx("cannot set the xattrs of '%s'", pathname);
+        close(d);
+        return -1;
+    }
 
     /* do not report success here because there can be data loss */
-    if (close(d) == -1)
+    if (durable_close(durable, d, dirfd, pathname) == -1)
     {
         log_error("closing '%s' failed, possible data loss", pathname);
         return -1;
@@ -359,6 +477,107 @@ int copy_mem(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
 }
 
 
+dcp_state_t fan_out(file_t *newdir, const char *newpath,
+        struct stream *stream, int cached, digesterset_t *set,
+        const struct process_opts *opts, const attrs_t *attrs,
+        dcp_state_t *dests, prefetch_timing_t *timing)
+{
+    int fds[DCP_MAX_DESTS + 1];
+    int failed;
+    const file_t *dir;
+    const char *path;
+    size_t n;
+    size_t i;
+    ssize_t r;
+
+    /* the destination is first, the mirrors follow in order */
+    n = opts->nmirrors + 1;
+    for (i = 0; i < n; i++)
+    {
+        dir  = i == 0? newdir  : &opts->mirrors[i - 1].dir;
+        path = i == 0? newpath : mirror_path(&opts->mirrors[i - 1], newpath);
+        if ((fds[i] = durable_open(opts->durable, dir->fd, path)) == -1)
+            log_debug("openat '%s'", path);
+        else if (!cached && fd_preallocate(fds[i], stream->size) == -1)
+            log_debug("fd_preallocate '%s'", path);
+    }
+
+    failed = 0;
+    if (cached)
+        fan_write(fds, n, stream->bytes, stream->count);
+    else if (lseek(stream->fd, 0, SEEK_SET) == -1)
+    {
+        log_debug("lseek");
+        failed = 1;
+    }
+    else
+    {
+        /* causes the kernel to double its read ahead buffer for this file */
+        posix_fadvise(stream->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        while ((r = engine_read(stream->fd, stream->bytes, stream->count,
+                timing)) > 0)
+        {
+            if (set != NULL)
+                engine_update(set, stream->bytes, r, timing);
+            fan_write(fds, n, stream->bytes, r);
+        }
+
+        if (r < 0)
+        {
+            log_debug("fd_read");
+            failed = 1;
+        }
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        dir  = i == 0? newdir  : &opts->mirrors[i - 1].dir;
+        path = i == 0? newpath : mirror_path(&opts->mirrors[i - 1], newpath);
+        if (fds[i] != -1 && !cached && fd_trim(fds[i], stream->size,
+                lseek(fds[i], 0, SEEK_CUR)) == -1)
+            log_debug("fd_trim");
+        if (fds[i] != -1 && attrs_fd(fds[i], attrs) == -1)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+
+        /* do not report success here because there can be data loss, a copy
+         * the source could not be read for is not synced nor named */
+        if (fds[i] != -1 && (failed? close(fds[i]) : durable_close(
+                opts->durable, fds[i], dir->fd, path)) == -1)
+            fds[i] = -1;
+
+        if (failed || fds[i] == -1)
+        {
+            log_errorx("copying to '%s' failed", pathstr(dir, path));
+        }
+
+        if (i > 0)
+            dests[i - 1] = failed || fds[i] == -1? DCP_FAILED : DCP_FILE_COPIED;
+    }
+
+    return failed || fds[0] == -1? DCP_FAILED : DCP_FILE_COPIED;
+}
+
+
+void fan_write(int *fds, size_t n, const void *bytes, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (fds[i] != -1 && fd_write_full(fds[i], bytes, count) == -1)
+        {
+            log_debug("fd_write");
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+
 /*
  * This function tries to cache the file into memory, by maintaining the number
  * of valid bytes in the buffer.
@@ -370,7 +589,8 @@ int copy_mem(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
  * the whole file into the buffer allowing it to be used later on instead of
  * needing to be reread from the kernel.
  */
-ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf, size_t blen)
+ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf, size_t blen,
+        prefetch_timing_t *timing)
 {
     ssize_t result;
     size_t total;
@@ -387,68 +607,14 @@ ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf, size_t blen)
             total = 0;
 
         pos = ((unsigned char *) buf) + total;
-        result = fd_read(fd, pos, blen - total);
+        result = engine_read(fd, pos, blen - total, timing);
 
         if (result < 0)     return -1;
         if (result == 0)    break;
 
-        digesterset_update(set, pos, result);
+        engine_update(set, pos, result, timing);
         total += result;
     }
 
     return total;
 }
-
-
-ssize_t copy_n_digest(int dirfd, const char *pathname, uid_t uid, gid_t gid,
-        digesterset_t *set, int fd, void *buf, size_t blen)
-{
-    ssize_t result;
-    size_t total;
-    int d;
-
-    /* causes the kernel to double its read ahead buffer for this file */
-    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
-
-    /* create/truncate the dest file and copy all the bytes */
-    if ((d = openat(dirfd, pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
-    {
-        log_debug("openat '%s'", pathname);
-        return -1;
-    }
-
-    total = 0;
-    for (;;)
-    {
-        result = fd_read(fd, buf, blen);
-
-        if (result < 0)     return -1;
-        if (result == 0)    break;
-
-        /* update the digests */
-        digesterset_update(set, buf, result);
-
-        /* write all the bytes */
-        if (fd_write_full(d, buf, result) == -1)
-        {
-            log_debug("fd_write");
-            close(d);
-            return -1;
-        }
-
-        total += result;
-    }
-
-    if (fchown(d, uid, gid) == -1)
-        log_debug("fchown");
-
-    /* do not report success here because there can be data loss */
-    if (close(d) == -1)
-    {
-        log_error("closing '%s' failed, possible data loss", pathname);
-        return -1;
-    }
-
-    return total;
-}
-
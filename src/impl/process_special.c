@@ -9,6 +9,7 @@
  * todo write description for process_special.c
  */
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -18,6 +19,19 @@
 #include "dcp.h"
 
 
+/* Private API ****************************************************************/
+
+
+/**
+ * create `path` in `dir` like `oldst` and give it its attrs, unlinking an
+ * existing file
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int create_special(const file_t *dir, const char *path,
+        const struct stat *oldst, const struct process_opts *opts);
+
+
 /* Public Impl ****************************************************************/
 
 
@@ -25,23 +39,50 @@ int process_special(file_t *newdir, const char *newpath, const char *oldpath,
         const struct stat *oldst, const char *dapath, const void *pathmd5,
         const struct process_opts *opts)
 {
-    UNUSED(oldpath);
     int r;
     dcp_state_t state;
+    dcp_state_t dests[DCP_MAX_DESTS];
+    size_t i;
 
-    state = DCP_SPECIAL_CREATED;
-    if ((r = mknodat(newdir->fd, newpath,
-            (oldst->st_mode & S_IFMT) | 0666, oldst->st_rdev)) != 0)
-    {
-        log_error("cannot create special file '%s'", pathstr(newdir, newpath));
-        state = DCP_FAILED;
-    }
+    r = create_special(newdir, newpath, oldst, opts);
+    state = r == 0? DCP_SPECIAL_CREATED : DCP_FAILED;
 
-    if (r == 0 && fchownat(newdir->fd, newpath, opts->uid, opts->gid, 0) != 0)
-        log_warn("cannot chown '%s'", pathstr(newdir, newpath));
+    for (i = 0; i < opts->nmirrors; i++)
+        dests[i] = create_special(&opts->mirrors[i].dir,
+                mirror_path(&opts->mirrors[i], newpath), oldst, opts) == 0?
+                DCP_SPECIAL_CREATED : DCP_FAILED;
 
-    opts->callback(state, pathmd5, dapath, oldst, oldpath, NULL, NULL, NULL, NULL, NULL, -1,
-            opts->callback_ctx);
+    opts->callback(state, opts->nmirrors > 0? dests : NULL, opts->nmirrors,
+            pathmd5, dapath, oldst, oldpath,
+            process_xattrs(newdir, newpath, oldpath, -1, oldst, state,
+                    opts->nmirrors > 0? dests : NULL, opts),
+            NULL, NULL, NULL, NULL, NULL, -1, -1, opts->callback_ctx);
     return r;
 }
 
+
+/* Private Impl ***************************************************************/
+
+
+int create_special(const file_t *dir, const char *path,
+        const struct stat *oldst, const struct process_opts *opts)
+{
+    attrs_t attrs;
+
+    while (mknodat(dir->fd, path, (oldst->st_mode & S_IFMT) | 0666,
+            oldst->st_rdev) != 0)
+    {
+        if (errno != EEXIST || unlinkat(dir->fd, path, 0) != 0)
+        {
+            log_error("cannot create special file '%s'", pathstr(dir, path));
+            return -1;
+        }
+    }
+
+    attrs_init(&attrs, oldst, &opts->attrs);
+    if (attrs_at(dir->fd, path, &attrs) != 0)
+        log_warn("cannot set the owner, mode or times of '%s'",
+                pathstr(dir, path));
+    return 0;
+}
+
@@ -8,6 +8,7 @@
  *
  * todo write description for process_symlink.c
  */
+#include <errno.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -21,6 +22,18 @@
 #include "dcp.h"
 
 
+/* Private API ****************************************************************/
+
+
+/**
+ * create `path` in `dir` pointing at `target`, unlinking an existing file
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int create_symlink(const file_t *dir, const char *path,
+        const char *target);
+
+
 /* Public Impl ****************************************************************/
 
 
@@ -32,6 +45,8 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
     void *buf;
     size_t bufsize;
     dcp_state_t state;
+    dcp_state_t dests[DCP_MAX_DESTS];
+    size_t i;
 
     /* ensure the buffer is large enough */
     if (oldst->st_size < (off_t) (opts->buffer_size + 1))
@@ -46,6 +61,9 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
     }
 
     state = DCP_SYMLINK_CREATED;
+    for (i = 0; i < opts->nmirrors; i++)
+        dests[i] = DCP_FAILED;
+
     if ((r = readlink(oldpath, buf, bufsize)) == -1)
     {
         state = DCP_FAILED;
@@ -53,29 +71,19 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
     }
     else
     {
-        /* create the symlink, unlinking an existing file if it exists */
-        while ((r = symlinkat(buf, newdir->fd, newpath)) == -1)
-        {
-            if (errno == EEXIST)
-            {
-                if ((r = unlinkat(newdir->fd, newpath, 0)) == -1)
-                {
-                    state = DCP_FAILED;
-                    log_error("cannot unlink '%s'", pathstr(newdir, newpath));
-                    break;
-                }
-            }
-            else
-            {
-                state = DCP_FAILED;
-                log_error("cannot create symlink '%s'",
-                        pathstr(newdir, newpath));
-                break;
-            }
-        }
+        if ((r = create_symlink(newdir, newpath, buf)) == -1)
+            state = DCP_FAILED;
+
+        for (i = 0; i < opts->nmirrors; i++)
+            if (create_symlink(&opts->mirrors[i].dir,
+                    mirror_path(&opts->mirrors[i], newpath), buf) == 0)
+                dests[i] = DCP_SYMLINK_CREATED;
     }
-    opts->callback(state, pathmd5, dapath, oldst, oldpath, buf, NULL, NULL, NULL, NULL, -1,
-            opts->callback_ctx);
+    opts->callback(state, opts->nmirrors > 0? dests : NULL, opts->nmirrors,
+            pathmd5, dapath, oldst, oldpath,
+            process_xattrs(newdir, newpath, oldpath, -1, oldst, state,
+                    opts->nmirrors > 0? dests : NULL, opts),
+            buf, NULL, NULL, NULL, NULL, -1, -1, opts->callback_ctx);
 
     /* if we allocated a new buffer free it */
     if (buf != opts->buffer)
@@ -84,3 +92,26 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
     return r;
 }
 
+
+/* Private Impl ***************************************************************/
+
+
+int create_symlink(const file_t *dir, const char *path, const char *target)
+{
+    /* create the symlink, unlinking an existing file if it exists */
+    while (symlinkat(target, dir->fd, path) == -1)
+    {
+        if (errno != EEXIST)
+        {
+            log_error("cannot create symlink '%s'", pathstr(dir, path));
+            return -1;
+        }
+
+        if (unlinkat(dir->fd, path, 0) == -1)
+        {
+            log_error("cannot unlink '%s'", pathstr(dir, path));
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Adds the entries of the walk to the --tar archive instead of creating them,
+ * the member of each is named by its path at the destination. A file is
+ * digested while it is archived, every entry is reported with where it starts
+ * in the archive.
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "tar.h"
+#include "../logging.h"
+#include "dcp.h"
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * add the regular file `oldpath` to the archive and report it
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int archive_regular(const file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, const struct process_opts *opts);
+
+
+/* Public Impl ****************************************************************/
+
+
+int process_tar(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        const struct process_opts *opts)
+{
+    char target[PATH_MAX + 1];
+    const char *linkname;
+    dcp_state_t state;
+    ssize_t len;
+    off_t offset;
+    int r;
+
+    if (tar_is_archive(opts->tar, oldst))
+    {
+        log_warnx("'%s' is the archive, it is not added to itself", oldpath);
+        return 0;
+    }
+
+    if (S_ISREG(oldst->st_mode))
+        return archive_regular(newdir, newpath, oldpath, oldst, dapath, pathmd5,
+                opts);
+
+    r = 0;
+    offset = -1;
+    linkname = NULL;
+    if (S_ISLNK(oldst->st_mode))
+    {
+        if ((len = readlink(oldpath, target, sizeof(target) - 1)) == -1)
+        {
+            log_error("cannot read symlink '%s'", oldpath);
+            r = -1;
+        }
+        else
+        {
+            target[len] = '\0';
+            linkname = target;
+        }
+    }
+
+    if (r == 0)
+        r = tar_entry(opts->tar, newpath, oldst, linkname, &offset);
+
+    if (S_ISDIR(oldst->st_mode))
+        state = r == 0? DCP_DIR_CREATED : DCP_DIR_FAILED;
+    else if (r != 0)
+        state = DCP_FAILED;
+    else
+        state = S_ISLNK(oldst->st_mode)? DCP_SYMLINK_CREATED :
+                DCP_SPECIAL_CREATED;
+
+    opts->callback(state, NULL, 0, pathmd5, dapath, oldst, oldpath,
+            process_xattrs(newdir, newpath, oldpath, -1, oldst, state, NULL,
+                    opts),
+            linkname, NULL, NULL, NULL, NULL, -1, offset, opts->callback_ctx);
+    return r;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int archive_regular(const file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, const struct process_opts *opts)
+{
+    digesterset_t dgstset;
+    dcp_state_t state;
+    off_t offset;
+    clock_t start;
+    unsigned long diff;
+    int r;
+    int s;
+
+    start = clock();
+
+    if ((s = open(oldpath, O_RDONLY)) == -1)
+    {
+        log_error("cannot open '%s'", oldpath);
+        opts->callback(DCP_FAILED, NULL, 0, pathmd5, dapath, oldst, oldpath,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, -1, opts->callback_ctx);
+        return -1;
+    }
+
+    digesterset_create(&dgstset, opts->digests);
+    r = tar_file(opts->tar, newpath, oldst, s, &dgstset, opts->buffer,
+            opts->buffer_size, &offset);
+    digesterset_finalize(&dgstset);
+    state = r == 0? DCP_FILE_COPIED : DCP_FAILED;
+
+    /* calculate the number of milliseconds elapsed to process this file */
+    diff = ((clock() - start) * 1000) / CLOCKS_PER_SEC;
+
+    /* a member that could not be read in full is still reported where it
+     * is, but without digests */
+    opts->callback(state, NULL, 0, pathmd5, dapath, oldst, oldpath,
+            process_xattrs(newdir, newpath, oldpath, s, oldst, state, NULL,
+                    opts), NULL,
+            r == 0? digesterset_get_value(&dgstset, DGST_MD5)    : NULL,
+            r == 0? digesterset_get_value(&dgstset, DGST_SHA1)   : NULL,
+            r == 0? digesterset_get_value(&dgstset, DGST_SHA256) : NULL,
+            r == 0? digesterset_get_value(&dgstset, DGST_SHA512) : NULL,
+            diff, offset, opts->callback_ctx);
+
+    digesterset_free(&dgstset);
+    close(s);
+    return r;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the serial.h API with a pthread mutex.
+ */
+#include <pthread.h>
+
+#include "serial.h"
+
+
+/* Public Impl ****************************************************************/
+
+
+void serial_init(serial_t *serial, dcp_callback_f callback, void *ctx)
+{
+    pthread_mutex_init(&serial->lock, NULL);
+    serial->callback = callback;
+    serial->ctx      = ctx;
+}
+
+
+void serial_destroy(serial_t *serial)
+{
+    pthread_mutex_destroy(&serial->lock);
+}
+
+
+int serial_callback(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context)
+{
+    serial_t *serial = context;
+    int r;
+
+    pthread_mutex_lock(&serial->lock);
+    r = serial->callback(state, dests, ndests, pathmd5, dapath, sstat,
+            accesspath, xattrs, symlinkpath, md5, sha1, sha256, sha512,
+            process_time, offset, serial->ctx);
+    pthread_mutex_unlock(&serial->lock);
+    return r;
+}
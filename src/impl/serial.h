@@ -0,0 +1,62 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Serialized callback. The process functions report each entry through a
+ * dcp_callback_f that writes a line of output, when several threads process
+ * entries at once the callback is wrapped so only one of them reports at a
+ * time and each entry's line stays whole.
+ */
+#ifndef SERIAL_H__
+#define SERIAL_H__
+
+
+#include <pthread.h>
+
+#include "dcp.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the callback shared by every thread and the lock serializing it
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    dcp_callback_f callback;
+    void *ctx;
+} serial_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * wrap `callback` called with `ctx`, @see serial_callback
+ */
+void serial_init(serial_t *serial, dcp_callback_f callback, void *ctx);
+
+
+/**
+ * release the lock, no thread may be reporting
+ */
+void serial_destroy(serial_t *serial);
+
+
+/**
+ * dcp_callback_f that forwards to the wrapped callback holding the lock,
+ * `context` is the serial_t
+ */
+int serial_callback(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *sstat, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context);
+
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the stream.h API with the getdents64(2) system call, older
+ * C libraries have no wrapper for it.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * layout of the records getdents64 fills the buffer with
+ */
+struct record {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+
+struct stream {
+    int fd;
+    char *buf;
+    size_t size;        /**< bytes in `buf` */
+    size_t len;         /**< bytes of the current batch */
+    size_t pos;         /**< offset of the next record in the batch */
+};
+
+
+/* Public Impl ****************************************************************/
+
+
+int stream_open(stream_t **stream, const char *path, size_t bufsize)
+{
+    struct stream *s;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        return -1;
+
+    /* the kernel refuses buffers too small for a single record */
+    if (bufsize < 4096)
+        bufsize = 4096;
+
+    if ((s = calloc(1, sizeof(*s))) == NULL ||
+            (s->buf = malloc(bufsize)) == NULL)
+    {
+        free(s);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    s->fd   = fd;
+    s->size = bufsize;
+    *stream = s;
+    return 0;
+}
+
+
+void stream_close(stream_t *stream)
+{
+    if (stream == NULL)
+        return;
+
+    close(stream->fd);
+    free(stream->buf);
+    free(stream);
+}
+
+
+int stream_fd(const stream_t *stream)
+{
+    return stream->fd;
+}
+
+
+int stream_next(stream_t *stream, const char **name)
+{
+    struct record *d;
+    long n;
+
+    for (;;)
+    {
+        if (stream->pos >= stream->len)
+        {
+            if ((n = syscall(SYS_getdents64, stream->fd, stream->buf,
+                    stream->size)) <= 0)
+                return n == 0? 0 : -1;
+
+            stream->len = n;
+            stream->pos = 0;
+        }
+
+        d = (struct record *) (stream->buf + stream->pos);
+        stream->pos += d->d_reclen;
+
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+
+        *name = d->d_name;
+        return 1;
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Streaming directory reader. fts reads every entry of a directory into a list
+ * before returning the first one, for a directory of millions of entries that
+ * is gigabytes of memory and a long wait before anything is copied. The stream
+ * reads a directory with getdents64(2) into a fixed size buffer and hands out
+ * the entries of one batch before reading the next, so memory stays the same
+ * whatever the size of the directory.
+ *
+ * Entries come in the order the file system stores them, "." and ".." are
+ * skipped.
+ */
+#ifndef STREAM_H__
+#define STREAM_H__
+
+
+#include <stddef.h>
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the open directory and the batch being handed out
+ */
+typedef struct stream stream_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Open the directory at `path` for streaming.
+ *
+ * @param stream    where to store the new stream
+ * @param path      the directory to read
+ * @param bufsize   bytes to read entries into, each batch fills it
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+int stream_open(stream_t **stream, const char *path, size_t bufsize);
+
+
+/**
+ * close the directory and release the stream, NULL is ignored
+ */
+void stream_close(stream_t *stream);
+
+
+/**
+ * @return          the directory's file descriptor, for the *at functions
+ */
+int stream_fd(const stream_t *stream);
+
+
+/**
+ * Get the next entry, reading a new batch when the current one is exhausted.
+ * `name` is valid until the next call.
+ *
+ * @param stream    the directory
+ * @param name      set to the entry's name
+ *
+ * @return          1 when `name` is set, 0 at the end of the directory and -1
+ *                  on failure with errno set
+ */
+int stream_next(stream_t *stream, const char **name);
+
+
+#endif
@@ -0,0 +1,721 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the tar.h API. The headers are written with write(2),
+ * vmsplice would hand the pages of a header to the pipe and they could not be
+ * reused until the reader of the archive consumed them.
+ */
+/* for splice and F_SETPIPE_SZ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "tar.h"
+#include "../fd.h"
+#include "../logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * the archive is padded to a whole record of this many bytes, as tar does
+ */
+#define TAR_RECORD      (20 * TAR_BLOCK)
+
+
+/**
+ * bytes moved by a single splice, the pipe is grown to hold as many
+ */
+#define TAR_CHUNK       (1024 * 1024)
+
+
+/**
+ * # of bytes of the pax records of an entry, its path and link target
+ */
+#define TAR_PAX_MAX     (4 * PATH_MAX)
+
+
+/**
+ * largest values of the 8 and 12 byte octal fields, a pax record holds more
+ */
+#define OCTAL_8_MAX     07777777
+#define OCTAL_12_MAX    077777777777
+
+
+#ifndef MIN
+#define MIN(a, b)       ((a) < (b)? (a) : (b))
+#endif
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * how the data of a file reaches the archive
+ */
+typedef enum {
+    OUT_SPLICE,             /**< spliced through the pipe of the tar_t */
+    OUT_RW                  /**< read and written */
+} out_t;
+
+
+/**
+ * a ustar header, numbers are NUL terminated octal
+ */
+struct ustar {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+
+struct tar {
+    int fd;                 /**< the archive */
+    out_t out;
+    int p[2];               /**< what is spliced passes through, OUT_SPLICE */
+    off_t offset;           /**< # of bytes written to the archive */
+    int broken;             /**< a write failed, nothing more is written */
+    int regular;            /**< the archive is a regular file ... */
+    dev_t dev;              /**< ... on this device */
+    ino_t ino;              /**< ... with this inode */
+    char *name;             /**< member name of the entry being written */
+    char *pax;              /**< pax records of the entry being written */
+};
+
+
+/* Static Vars ****************************************************************/
+
+
+static const char ZEROS[TAR_BLOCK];
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Write the headers of an entry, a pax header first when the ustar one cannot
+ * hold all of it.
+ *
+ * @param type      ustar type flag of the entry
+ * @param size      # of bytes of data that follow
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int header(tar_t *t, const char *name, const struct stat *st,
+        const char *linkname, char type, off_t size, off_t *offset);
+
+
+/**
+ * fill in the ustar fields of `h` every header has and its checksum
+ */
+static void seal(struct ustar *h, mode_t mode, uintmax_t uid, uintmax_t gid,
+        uintmax_t size, uintmax_t mtime);
+
+
+/**
+ * Put `name` in the name and prefix fields of `h`, split at a slash.
+ *
+ * @return          0 when it fits, -1 when a pax record must hold it
+ */
+static int split(struct ustar *h, const char *name);
+
+
+/**
+ * Append the pax record "<length> `key`=`value`\n" to `t->pax` at `used`.
+ *
+ * @return          the new # of bytes of records, 0 when they do not fit
+ */
+static size_t record(tar_t *t, size_t used, const char *key,
+        const char *value);
+
+
+/**
+ * write `value` to the `len` byte field as len - 1 octal digits and a NUL
+ */
+static void octal(char *field, size_t len, uintmax_t value);
+
+
+/**
+ * write `count` bytes to the archive, marking it broken on failure
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int put(tar_t *t, const void *buf, size_t count);
+
+
+/**
+ * write `count` zero bytes to the archive, through `buf`
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int zeros(tar_t *t, off_t count, void *buf, size_t blen);
+
+
+/**
+ * Move the data of `fd` from `*moved` to `size` through the pipe of `t`,
+ * digesting what was moved by reading it back.
+ *
+ * @return          0 once done or the source ended early, 1 when `fd` cannot
+ *                  be spliced and nothing was moved, -1 on failure
+ */
+static int move_splice(tar_t *t, int fd, off_t size, digesterset_t *set,
+        void *buf, size_t blen, off_t *moved);
+
+
+/**
+ * Same as move_splice reading and writing the data.
+ *
+ * @return          0 once done or the source ended early, -1 on failure
+ */
+static int move_rw(tar_t *t, int fd, off_t size, digesterset_t *set,
+        void *buf, size_t blen, off_t *moved);
+
+
+/**
+ * Write the `count` bytes in the pipe to the archive, read and written once
+ * it turns out the archive cannot be spliced to.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int drain(tar_t *t, size_t count, void *buf, size_t blen);
+
+
+/**
+ * digest the `count` bytes of `fd` at `offset` in the page cache
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int digest_back(digesterset_t *set, int fd, off_t offset, size_t count,
+        void *buf, size_t blen);
+
+
+/* Public Impl ****************************************************************/
+
+
+int tar_create(tar_t **t, int fd)
+{
+    struct stat st;
+    int flags;
+
+    if ((*t = calloc(1, sizeof(tar_t))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    (*t)->fd   = fd;
+    (*t)->out  = OUT_RW;
+    (*t)->p[0] = -1;
+    (*t)->p[1] = -1;
+    if (((*t)->name = malloc(TAR_PAX_MAX)) == NULL ||
+            ((*t)->pax = malloc(TAR_PAX_MAX)) == NULL)
+    {
+        log_error("malloc");
+        tar_free(*t);
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1)
+        return 0;
+
+    (*t)->regular = S_ISREG(st.st_mode);
+    (*t)->dev     = st.st_dev;
+    (*t)->ino     = st.st_ino;
+
+    /* splice writes files, pipes and sockets, but not appending */
+    flags = fcntl(fd, F_GETFL);
+    if ((S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode) ||
+            S_ISSOCK(st.st_mode)) && flags != -1 && !(flags & O_APPEND) &&
+            pipe((*t)->p) == 0)
+    {
+        (*t)->out = OUT_SPLICE;
+        fcntl((*t)->p[1], F_SETPIPE_SZ, TAR_CHUNK);
+    }
+    return 0;
+}
+
+
+void tar_free(tar_t *t)
+{
+    if (t == NULL)
+        return;
+
+    if (t->p[0] != -1)
+    {
+        close(t->p[0]);
+        close(t->p[1]);
+    }
+    free(t->name);
+    free(t->pax);
+    free(t);
+}
+
+
+int tar_finish(tar_t *t)
+{
+    off_t end;
+
+    if (t->broken)
+        return -1;
+
+    /* two zero blocks end the archive, more fill its last record */
+    end = t->offset + 2 * TAR_BLOCK;
+    end += (TAR_RECORD - end % TAR_RECORD) % TAR_RECORD;
+    while (t->offset < end)
+        if (put(t, ZEROS, TAR_BLOCK) != 0)
+            return -1;
+    return 0;
+}
+
+
+int tar_is_archive(const tar_t *t, const struct stat *st)
+{
+    return t->regular && st->st_dev == t->dev && st->st_ino == t->ino;
+}
+
+
+int tar_entry(tar_t *t, const char *name, const struct stat *st,
+        const char *linkname, off_t *offset)
+{
+    char type;
+
+    *offset = -1;
+    if      (S_ISDIR(st->st_mode))  type = '5';
+    else if (S_ISLNK(st->st_mode))  type = '2';
+    else if (S_ISCHR(st->st_mode))  type = '3';
+    else if (S_ISBLK(st->st_mode))  type = '4';
+    else if (S_ISFIFO(st->st_mode)) type = '6';
+    else
+    {
+        log_errorx("cannot archive '%s', tar has no type for it", name);
+        return -1;
+    }
+
+    return header(t, name, st, linkname, type, 0, offset);
+}
+
+
+int tar_file(tar_t *t, const char *name, const struct stat *st, int fd,
+        digesterset_t *set, void *buf, size_t blen, off_t *offset)
+{
+    off_t moved;
+    int r;
+
+    *offset = -1;
+    if (header(t, name, st, NULL, '0', st->st_size, offset) != 0)
+        return -1;
+
+    /* causes the kernel to double its read ahead buffer for this file */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    moved = 0;
+    r = 1;
+    if (t->out == OUT_SPLICE)
+        r = move_splice(t, fd, st->st_size, set, buf, blen, &moved);
+    if (r == 1)
+        r = move_rw(t, fd, st->st_size, set, buf, blen, &moved);
+
+    if (t->broken)
+        return -1;
+    if (r == -1)
+        log_error("cannot read '%s'", name);
+    else if (moved < st->st_size)
+    {
+        log_errorx("'%s' shrank while archived", name);
+        r = -1;
+    }
+
+    /* the header promised st_size bytes, the rest are zeros */
+    if (zeros(t, st->st_size - moved + (TAR_BLOCK - st->st_size % TAR_BLOCK) %
+            TAR_BLOCK, buf, blen) != 0)
+        return -1;
+    return r;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int header(tar_t *t, const char *name, const struct stat *st,
+        const char *linkname, char type, off_t size, off_t *offset)
+{
+    struct ustar h;
+    struct ustar x;
+    char num[32];
+    const char *base;
+    uintmax_t mtime;
+    size_t len;
+    size_t used;
+    int fits;
+
+    if (t->broken)
+        return -1;
+
+    /* like tar, members are never absolute and directories end in a slash */
+    while (*name == '/')
+        name++;
+    len = strlen(name);
+    if (len + 3 > TAR_PAX_MAX)
+    {
+        log_errorx("cannot archive '%s', its name is too long", name);
+        return -1;
+    }
+    memcpy(t->name, len == 0? "." : name, len == 0? 2 : len + 1);
+    len = strlen(t->name);
+    if (type == '5' && t->name[len - 1] != '/')
+        strcpy(t->name + len, "/");
+
+    memset(&h, 0, sizeof(h));
+    h.typeflag = type;
+    used = 0;
+    fits = 1;
+    if (split(&h, t->name) != 0)
+        fits = (used = record(t, used, "path", t->name)) != 0;
+
+    if (linkname != NULL && strlen(linkname) > sizeof(h.linkname))
+        fits = fits && (used = record(t, used, "linkpath", linkname)) != 0;
+    if (linkname != NULL)
+        memcpy(h.linkname, linkname, MIN(strlen(linkname),
+                sizeof(h.linkname)));
+
+    if (size > OCTAL_12_MAX)
+    {
+        snprintf(num, sizeof(num), "%jd", (intmax_t) size);
+        fits = fits && (used = record(t, used, "size", num)) != 0;
+    }
+    if (st->st_uid > OCTAL_8_MAX)
+    {
+        snprintf(num, sizeof(num), "%ju", (uintmax_t) st->st_uid);
+        fits = fits && (used = record(t, used, "uid", num)) != 0;
+    }
+    if (st->st_gid > OCTAL_8_MAX)
+    {
+        snprintf(num, sizeof(num), "%ju", (uintmax_t) st->st_gid);
+        fits = fits && (used = record(t, used, "gid", num)) != 0;
+    }
+    mtime = st->st_mtim.tv_sec;
+    if (st->st_mtim.tv_sec < 0 || st->st_mtim.tv_sec > OCTAL_12_MAX)
+    {
+        mtime = 0;
+        snprintf(num, sizeof(num), "%jd", (intmax_t) st->st_mtim.tv_sec);
+        fits = fits && (used = record(t, used, "mtime", num)) != 0;
+    }
+
+    if (!fits)
+    {
+        log_errorx("cannot archive '%s', its pax records are too long",
+                t->name);
+        return -1;
+    }
+
+    if (type == '3' || type == '4')
+    {
+        octal(h.devmajor, sizeof(h.devmajor), major(st->st_rdev));
+        octal(h.devminor, sizeof(h.devminor), minor(st->st_rdev));
+    }
+    seal(&h, st->st_mode & 07777,
+            st->st_uid > OCTAL_8_MAX? 0 : st->st_uid,
+            st->st_gid > OCTAL_8_MAX? 0 : st->st_gid,
+            size > OCTAL_12_MAX? 0 : size, mtime);
+
+    *offset = t->offset;
+    if (used == 0)
+        return put(t, &h, sizeof(h));
+
+    /* the pax header is named after the entry, for readers that list it */
+    memset(&x, 0, sizeof(x));
+    x.typeflag = 'x';
+    base = strrchr(name, '/') == NULL? name : strrchr(name, '/') + 1;
+    snprintf(x.name, sizeof(x.name), "PaxHeaders/%.88s", base);
+    seal(&x, 0644, 0, 0, used, mtime);
+
+    if (put(t, &x, sizeof(x)) != 0 || put(t, t->pax, used) != 0 ||
+            put(t, ZEROS, (TAR_BLOCK - used % TAR_BLOCK) % TAR_BLOCK) != 0 ||
+            put(t, &h, sizeof(h)) != 0)
+        return -1;
+    return 0;
+}
+
+
+void seal(struct ustar *h, mode_t mode, uintmax_t uid, uintmax_t gid,
+        uintmax_t size, uintmax_t mtime)
+{
+    const unsigned char *p;
+    unsigned long sum;
+    size_t i;
+
+    octal(h->mode,  sizeof(h->mode),  mode);
+    octal(h->uid,   sizeof(h->uid),   uid);
+    octal(h->gid,   sizeof(h->gid),   gid);
+    octal(h->size,  sizeof(h->size),  size);
+    octal(h->mtime, sizeof(h->mtime), mtime);
+    memcpy(h->magic, "ustar", sizeof(h->magic));
+    memcpy(h->version, "00", sizeof(h->version));
+    if (h->devmajor[0] == '\0')
+    {
+        octal(h->devmajor, sizeof(h->devmajor), 0);
+        octal(h->devminor, sizeof(h->devminor), 0);
+    }
+
+    /* the checksum is taken with its own field as spaces */
+    memset(h->chksum, ' ', sizeof(h->chksum));
+    p = (const unsigned char *) h;
+    for (sum = 0, i = 0; i < sizeof(*h); i++)
+        sum += p[i];
+    octal(h->chksum, sizeof(h->chksum) - 1, sum);
+    h->chksum[sizeof(h->chksum) - 1] = ' ';
+}
+
+
+int split(struct ustar *h, const char *name)
+{
+    size_t len;
+    size_t i;
+
+    len = strlen(name);
+    if (len <= sizeof(h->name))
+    {
+        memcpy(h->name, name, len);
+        return 0;
+    }
+
+    /* the first slash leaving at most 100 bytes of name after it */
+    for (i = len - sizeof(h->name) - 1; i <= sizeof(h->prefix) && i < len - 1;
+            i++)
+    {
+        if (name[i] != '/')
+            continue;
+        memcpy(h->prefix, name, i);
+        memcpy(h->name, name + i + 1, len - i - 1);
+        return 0;
+    }
+
+    memcpy(h->name, name, sizeof(h->name));
+    return -1;
+}
+
+
+size_t record(tar_t *t, size_t used, const char *key, const char *value)
+{
+    size_t base;
+    size_t len;
+    size_t digits;
+    size_t n;
+
+    /* the length counts its own digits, which can take it to one more */
+    base = strlen(key) + strlen(value) + 3;
+    for (len = base + 1;; len = base + digits)
+    {
+        for (digits = 1, n = len; n >= 10; n /= 10)
+            digits++;
+        if (base + digits == len)
+            break;
+    }
+
+    if (used + len + 1 > TAR_PAX_MAX)
+        return 0;
+    snprintf(t->pax + used, len + 1, "%zu %s=%s\n", len, key, value);
+    return used + len;
+}
+
+
+void octal(char *field, size_t len, uintmax_t value)
+{
+    size_t i;
+
+    field[len - 1] = '\0';
+    for (i = len - 1; i > 0; i--)
+    {
+        field[i - 1] = '0' + (value & 7);
+        value >>= 3;
+    }
+}
+
+
+int put(tar_t *t, const void *buf, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    if (t->broken || fd_write_full(t->fd, buf, count) != (ssize_t) count)
+    {
+        if (!t->broken)
+            log_error("cannot write the archive");
+        t->broken = 1;
+        return -1;
+    }
+    t->offset += count;
+    return 0;
+}
+
+
+int zeros(tar_t *t, off_t count, void *buf, size_t blen)
+{
+    size_t len;
+
+    if (count <= TAR_BLOCK)
+        return put(t, ZEROS, count);
+
+    memset(buf, 0, blen);
+    for (; count > 0; count -= len)
+    {
+        len = (off_t) blen < count? blen : (size_t) count;
+        if (put(t, buf, len) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+int move_splice(tar_t *t, int fd, off_t size, digesterset_t *set,
+        void *buf, size_t blen, off_t *moved)
+{
+    loff_t pos;
+    ssize_t n;
+    size_t len;
+
+    pos = *moved;
+    while (pos < size)
+    {
+        len = size - pos < TAR_CHUNK? (size_t) (size - pos) : TAR_CHUNK;
+        if ((n = splice(fd, &pos, t->p[1], NULL, len, SPLICE_F_MOVE)) == -1 &&
+                errno == EINTR)
+            continue;
+
+        /* some file systems cannot be spliced from */
+        if (n == -1 && errno == EINVAL && *moved == 0)
+            return 1;
+        if (n <= 0)
+            return n == 0? 0 : -1;
+
+        /* the pipe is emptied first, it is full whatever happens next */
+        if (drain(t, n, buf, blen) != 0)
+            return -1;
+        if (digest_back(set, fd, *moved, n, buf, blen) != 0)
+            return -1;
+        *moved += n;
+    }
+    return 0;
+}
+
+
+int move_rw(tar_t *t, int fd, off_t size, digesterset_t *set,
+        void *buf, size_t blen, off_t *moved)
+{
+    ssize_t n;
+    size_t len;
+
+    while (*moved < size)
+    {
+        len = size - *moved < (off_t) blen? (size_t) (size - *moved) : blen;
+        if ((n = pread(fd, buf, len, *moved)) == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n == 0? 0 : -1;
+
+        digesterset_update(set, buf, n);
+        if (put(t, buf, n) != 0)
+            return -1;
+        *moved += n;
+    }
+    return 0;
+}
+
+
+int drain(tar_t *t, size_t count, void *buf, size_t blen)
+{
+    ssize_t n;
+
+    while (count > 0)
+    {
+        if (t->out == OUT_SPLICE)
+        {
+            n = splice(t->p[0], NULL, t->fd, NULL, count,
+                    SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n > 0)
+            {
+                t->offset += n;
+                count -= n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR)
+                continue;
+
+            /* some archives cannot be spliced to after all */
+            if (n == -1 && errno == EINVAL)
+            {
+                t->out = OUT_RW;
+                continue;
+            }
+        }
+        else if ((n = fd_read(t->p[0], buf, count < blen? count : blen)) > 0)
+        {
+            if (put(t, buf, n) != 0)
+                return -1;
+            count -= n;
+            continue;
+        }
+
+        if (!t->broken)
+            log_error("cannot write the archive");
+        t->broken = 1;
+        return -1;
+    }
+    return 0;
+}
+
+
+int digest_back(digesterset_t *set, int fd, off_t offset, size_t count,
+        void *buf, size_t blen)
+{
+    ssize_t n;
+
+    /* the data never left the kernel, only read it back to digest it */
+    if (set->md5 == NULL && set->sha1 == NULL && set->sha256 == NULL &&
+            set->sha512 == NULL)
+        return 0;
+
+    while (count > 0)
+    {
+        if ((n = pread(fd, buf, count < blen? count : blen, offset)) == -1 &&
+                errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        digesterset_update(set, buf, n);
+        offset += n;
+        count -= n;
+    }
+    return 0;
+}
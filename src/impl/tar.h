@@ -0,0 +1,119 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * A POSIX tar archive written as a stream, @see --tar. Every entry is a ustar
+ * header followed by its data padded to TAR_BLOCK bytes. An entry whose path,
+ * link target, size or ids do not fit the ustar fields is preceded by a pax
+ * extended header holding them, readers without pax support still find the
+ * entry with its name cut short.
+ *
+ * The data of a file is moved to the archive with splice, straight into it
+ * when the archive is a pipe and through a pipe of its own otherwise. The
+ * bytes never pass through the process, they are digested by reading them
+ * back from the page cache after each chunk. Where the source or the archive
+ * cannot be spliced the data is read and written.
+ *
+ * Entries are written one at a time, a tar_t is not safe to share between
+ * threads.
+ */
+#ifndef TAR_H__
+#define TAR_H__
+
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../digest.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * # of bytes of a header and what the data of an entry is padded to
+ */
+#define TAR_BLOCK 512
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * an archive being written and how the data reaches it
+ */
+typedef struct tar tar_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Start an archive on `fd`, which stays open and is written from where it is.
+ *
+ * @param t         where to store the new instance
+ * @param fd        the archive open for writing
+ *
+ * @return          0 on success, -1 on failure
+ */
+int tar_create(tar_t **t, int fd);
+
+
+/**
+ * release `t` without ending the archive, NULL is ignored
+ */
+void tar_free(tar_t *t);
+
+
+/**
+ * End the archive with its two zero blocks.
+ *
+ * @return          0 on success, -1 if the archive is incomplete
+ */
+int tar_finish(tar_t *t);
+
+
+/**
+ * @return          1 when `st` is the archive itself, which is not archived
+ */
+int tar_is_archive(const tar_t *t, const struct stat *st);
+
+
+/**
+ * Add a directory, symlink or device, anything with no data but its header.
+ *
+ * @param name      member name, leading slashes are dropped
+ * @param st        stat information of the source
+ * @param linkname  where a symlink points, NULL otherwise
+ * @param offset    where the header was written in the archive
+ *
+ * @return          0 on success, -1 on failure
+ */
+int tar_entry(tar_t *t, const char *name, const struct stat *st,
+        const char *linkname, off_t *offset);
+
+
+/**
+ * Add the regular file open on `fd` with `st->st_size` bytes of data, digesting
+ * them into `set`. A source that cannot be read in full is padded with zeros
+ * so the archive stays whole, but fails.
+ *
+ * @param name      member name, leading slashes are dropped
+ * @param st        stat information of the source
+ * @param fd        the source open for reading at its start
+ * @param set       where the data is digested
+ * @param buf       memory to read the data into
+ * @param blen      # of bytes of `buf`
+ * @param offset    where the header was written in the archive
+ *
+ * @return          0 on success, -1 on failure
+ */
+int tar_file(tar_t *t, const char *name, const struct stat *st, int fd,
+        digesterset_t *set, void *buf, size_t blen, off_t *offset);
+
+
+#endif
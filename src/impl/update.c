@@ -0,0 +1,80 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the update.h API.
+ */
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "update.h"
+
+
+/* Static Vars ****************************************************************/
+
+
+/**
+ * names of the modes by update_mode_t
+ */
+static const char *const NAMES[] = { "none", "time", "digest" };
+
+
+/* Public Impl ****************************************************************/
+
+
+int update_find(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(NAMES) / sizeof(NAMES[0]); i++)
+        if (strcmp(NAMES[i], name) == 0)
+            return i;
+    return -1;
+}
+
+
+digest_t update_digest_type(int digests)
+{
+    if (HAS_MD5(digests) || digests == 0)
+        return DGST_MD5;
+    if (HAS_SHA1(digests))
+        return DGST_SHA1;
+    if (HAS_SHA256(digests))
+        return DGST_SHA256;
+    return DGST_SHA512;
+}
+
+
+int update_current(update_mode_t mode, int dirfd, const char *path,
+        const struct stat *st, digest_t type, const void *digest)
+{
+    unsigned char have[MAX_DIGEST_LENGTH];
+    struct stat dst;
+    int fd;
+    int r;
+
+    if (mode == UPDATE_TIME)
+        return fstatat(dirfd, path, &dst, AT_SYMLINK_NOFOLLOW) == 0 &&
+                S_ISREG(dst.st_mode) && dst.st_size == st->st_size &&
+                (dst.st_mtim.tv_sec > st->st_mtim.tv_sec ||
+                (dst.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+                dst.st_mtim.tv_nsec >= st->st_mtim.tv_nsec));
+
+    if (mode != UPDATE_DIGEST || digest == NULL)
+        return 0;
+
+    /* a symbolic link in the way is replaced, not followed */
+    if ((fd = openat(dirfd, path, O_RDONLY | O_NOFOLLOW)) == -1)
+        return 0;
+
+    r = fstat(fd, &dst) == 0 && S_ISREG(dst.st_mode) &&
+            dst.st_size == st->st_size && digest_fd(type, have, fd) == 0 &&
+            memcmp(have, digest, DIGEST_LENGTH(type)) == 0;
+    close(fd);
+    return r;
+}
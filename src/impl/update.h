@@ -0,0 +1,69 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Whether the copy already at the destination is current, @see --update. A
+ * run that was cut short is run again to copy what is left, comparing with
+ * what is there instead of a --input manifest:
+ *
+ *      time    the copy is a regular file of the source's size, not older
+ *              than the source, nothing is read
+ *      digest  the copy is a regular file of the source's size with the same
+ *              digest, the source's is the one computed while reading it for
+ *              the output and the copy is read in full
+ *
+ * A file whose copy is current is neither written nor reported, like one found
+ * in the --input manifest.
+ */
+#ifndef UPDATE_H__
+#define UPDATE_H__
+
+
+#include <sys/stat.h>
+
+#include "../digest.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+typedef enum {
+    UPDATE_NONE,
+    UPDATE_TIME,
+    UPDATE_DIGEST
+} update_mode_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * @return          the update_mode_t called `name`, -1 if there is none
+ */
+int update_find(const char *name);
+
+
+/**
+ * @return          the digest copies are compared by with digest, the first
+ *                  of `digests` or md5 when it is empty
+ */
+digest_t update_digest_type(int digests);
+
+
+/**
+ * See if `path` relative to `dirfd` is a current copy of the source `st`.
+ *
+ * @param mode      how to tell, UPDATE_NONE never finds a copy current
+ * @param type      the digest `digest` is, with digest
+ * @param digest    the source's digest, with digest
+ *
+ * @return          1 when it is current, 0 when it must be copied
+ */
+int update_current(update_mode_t mode, int dirfd, const char *path,
+        const struct stat *st, digest_t type, const void *digest);
+
+
+#endif
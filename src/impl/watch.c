@@ -0,0 +1,432 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the watch.h API. Watch descriptors are small integers
+ * handed out in order, the path of each watched directory is kept in an array
+ * indexed by its descriptor. The same directory watched twice gets the same
+ * descriptor, so a directory moved inside the source is watched again to
+ * update its path.
+ */
+
+ /* for asprintf and ppoll */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <poll.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "watch.h"
+#include "../logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * the events of a directory that can make something to copy
+ */
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | \
+        IN_DONT_FOLLOW)
+
+
+/**
+ * a batch is returned after this many delays even while events keep coming
+ */
+#define WATCH_MAX_DELAYS 10
+
+
+/* Type Defs ******************************************************************/
+
+
+struct watch {
+    int fd;                 /**< the inotify instance */
+    char *root;             /**< the source without trailing '/' */
+    size_t rootlen;
+
+    char **dirs;            /**< path below root of each descriptor, or NULL */
+    size_t ndirs;           /**< # of slots in `dirs` */
+    int full;               /**< warned the watch limit was reached */
+
+    char **batch;           /**< the paths changed */
+    size_t count;
+    size_t max;
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * @return          `path` below the root without the root
+ */
+static const char *relative(const struct watch *watch, const char *path);
+
+
+/**
+ * watch the directory at `path` which is `rel` below the root
+ */
+static int add(struct watch *watch, const char *path, const char *rel);
+
+
+/**
+ * handle the events in the `len` bytes of `buf`
+ */
+static void events(struct watch *watch, const char *buf, size_t len);
+
+
+/**
+ * add `name` in directory `dir`, both below the root, to the batch
+ */
+static void queue(struct watch *watch, const char *dir, const char *name);
+
+
+/**
+ * the directory `name` appeared in `dir`, watch it and everything in it and
+ * add it all to the batch
+ */
+static void added_dir(struct watch *watch, const char *dir, const char *name);
+
+
+/**
+ * @return          whether `name` in `dir` is whole once created, everything
+ *                  but a regular file or a new link to one
+ */
+static int whole(struct watch *watch, const char *dir, const char *name);
+
+
+/**
+ * @return          ms elapsed since `start`
+ */
+static long since(const struct timespec *start);
+
+
+/* Public Impl ****************************************************************/
+
+
+int watch_create(watch_t **watch, const char *root)
+{
+    struct watch *w;
+
+    if ((w = calloc(1, sizeof(struct watch))) == NULL ||
+            (w->root = strdup(root)) == NULL)
+    {
+        log_error("malloc");
+        free(w);
+        return -1;
+    }
+
+    /* keep "/" when it is the root */
+    w->rootlen = strlen(w->root);
+    while (w->rootlen > 1 && w->root[w->rootlen - 1] == '/')
+        w->root[--w->rootlen] = '\0';
+
+    if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+    {
+        log_error("inotify_init1");
+        free(w->root);
+        free(w);
+        return -1;
+    }
+
+    *watch = w;
+    return 0;
+}
+
+
+void watch_free(watch_t *watch)
+{
+    size_t i;
+
+    if (watch == NULL)
+        return;
+
+    close(watch->fd);
+    for (i = 0; i < watch->ndirs; i++)
+        free(watch->dirs[i]);
+    for (i = 0; i < watch->count; i++)
+        free(watch->batch[i]);
+    free(watch->dirs);
+    free(watch->batch);
+    free(watch->root);
+    free(watch);
+}
+
+
+int watch_dir(watch_t *watch, const char *path)
+{
+    if (strncmp(path, watch->root, watch->rootlen) != 0)
+    {
+        log_errorx("cannot watch '%s', not in '%s'", path, watch->root);
+        return -1;
+    }
+
+    return add(watch, path, relative(watch, path));
+}
+
+
+int watch_wait(watch_t *watch, long delay, const sigset_t *sigmask,
+        const char ***list, size_t *count)
+{
+    /* inotify_event is followed by its name, keep the buffer aligned for it */
+    char buf[64 * 1024]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd;
+    struct timespec start;
+    struct timespec quiet;
+    ssize_t len;
+    size_t i;
+    int n;
+
+    for (i = 0; i < watch->count; i++)
+        free(watch->batch[i]);
+    watch->count = 0;
+
+    pfd.fd = watch->fd;
+    pfd.events = POLLIN;
+    quiet.tv_sec  = delay / 1000;
+    quiet.tv_nsec = (delay % 1000) * 1000000;
+
+    /* wait as long as it takes for the first change, then gather the ones
+     * that follow it */
+    for (;;)
+    {
+        n = ppoll(&pfd, 1, watch->count == 0? NULL : &quiet, sigmask);
+        if (n == -1 && errno == EINTR && watch->count > 0)
+            break;
+        if (n == -1)
+        {
+            if (errno != EINTR)
+                log_error("ppoll");
+            return -1;
+        }
+        if (n == 0)
+            break;
+
+        if ((len = read(watch->fd, buf, sizeof(buf))) == -1)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            log_error("cannot read inotify events");
+            return -1;
+        }
+
+        if (watch->count == 0)
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        events(watch, buf, len);
+
+        if (watch->count > 0 && (watch->count >= WATCH_MAX_BATCH ||
+                since(&start) >= delay * WATCH_MAX_DELAYS))
+            break;
+    }
+
+    *list = (const char **) watch->batch;
+    *count = watch->count;
+    return 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+const char *relative(const struct watch *watch, const char *path)
+{
+    path += watch->rootlen;
+    while (*path == '/')
+        path++;
+    return path;
+}
+
+
+int add(struct watch *watch, const char *path, const char *rel)
+{
+    char **tmp;
+    size_t want;
+    int wd;
+
+    if ((wd = inotify_add_watch(watch->fd, path, WATCH_MASK)) == -1)
+    {
+        if (errno != ENOSPC)
+            log_error("cannot watch '%s'", path);
+        else if (!watch->full)
+        {
+            log_warnx("cannot watch more directories, changes below '%s' "
+                    "and any other directory left are missed, see "
+                    "fs.inotify.max_user_watches", path);
+            watch->full = 1;
+        }
+        return -1;
+    }
+
+    if ((size_t) wd >= watch->ndirs)
+    {
+        want = watch->ndirs == 0? 1024 : watch->ndirs * 2;
+        while (want <= (size_t) wd)
+            want *= 2;
+        if ((tmp = realloc(watch->dirs, want * sizeof(char *))) == NULL)
+        {
+            log_error("cannot watch '%s'", path);
+            inotify_rm_watch(watch->fd, wd);
+            return -1;
+        }
+        memset(tmp + watch->ndirs, 0, (want - watch->ndirs) * sizeof(char *));
+        watch->dirs = tmp;
+        watch->ndirs = want;
+    }
+
+    /* watched again after a move, it has a new path */
+    free(watch->dirs[wd]);
+    if ((watch->dirs[wd] = strdup(rel)) == NULL)
+    {
+        log_error("cannot watch '%s'", path);
+        inotify_rm_watch(watch->fd, wd);
+        return -1;
+    }
+    return 0;
+}
+
+
+void events(struct watch *watch, const char *buf, size_t len)
+{
+    const struct inotify_event *ev;
+    const char *p;
+    const char *dir;
+
+    for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+    {
+        ev = (const struct inotify_event *) p;
+
+        if (ev->mask & IN_Q_OVERFLOW)
+        {
+            log_warnx("inotify queue overflowed, changes were missed, see "
+                    "fs.inotify.max_queued_events");
+            continue;
+        }
+
+        if (ev->wd < 0 || (size_t) ev->wd >= watch->ndirs ||
+                (dir = watch->dirs[ev->wd]) == NULL)
+            continue;
+
+        /* the directory is gone */
+        if (ev->mask & IN_IGNORED)
+        {
+            free(watch->dirs[ev->wd]);
+            watch->dirs[ev->wd] = NULL;
+            continue;
+        }
+
+        if (ev->len == 0)
+            continue;
+
+        if (ev->mask & IN_ISDIR)
+        {
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                added_dir(watch, dir, ev->name);
+        }
+        else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+            queue(watch, dir, ev->name);
+        else if ((ev->mask & IN_CREATE) && whole(watch, dir, ev->name))
+            queue(watch, dir, ev->name);
+    }
+}
+
+
+void queue(struct watch *watch, const char *dir, const char *name)
+{
+    char **tmp;
+    char *path;
+
+    if (watch->count == watch->max)
+    {
+        watch->max = watch->max == 0? 256 : watch->max * 2;
+        if ((tmp = realloc(watch->batch, watch->max * sizeof(char *))) == NULL)
+        {
+            log_error("cannot queue '%s/%s'", dir, name);
+            watch->max = watch->count;
+            return;
+        }
+        watch->batch = tmp;
+    }
+
+    if (asprintf(&path, "%s%s%s", dir, *dir == '\0'? "" : "/", name) < 0)
+    {
+        log_error("cannot queue '%s/%s'", dir, name);
+        return;
+    }
+    watch->batch[watch->count++] = path;
+}
+
+
+void added_dir(struct watch *watch, const char *dir, const char *name)
+{
+    FTS *fts;
+    FTSENT *ent;
+    char *paths[2];
+    char *path;
+
+    if (asprintf(&path, "%s/%s%s%s", watch->root, dir, *dir == '\0'? "" : "/",
+            name) < 0)
+    {
+        log_error("cannot watch '%s/%s'", dir, name);
+        return;
+    }
+
+    /* what was put in it before it was watched has no events of its own */
+    paths[0] = path;
+    paths[1] = NULL;
+    if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+    {
+        log_error("cannot watch '%s'", path);
+        free(path);
+        return;
+    }
+
+    while ((ent = fts_read(fts)) != NULL)
+    {
+        if (ent->fts_info == FTS_DP)
+            continue;
+        if (ent->fts_info == FTS_D)
+            watch_dir(watch, ent->fts_path);
+        queue(watch, "", relative(watch, ent->fts_path));
+    }
+
+    fts_close(fts);
+    free(path);
+}
+
+
+int whole(struct watch *watch, const char *dir, const char *name)
+{
+    struct stat st;
+    char *path;
+    int r;
+
+    if (asprintf(&path, "%s/%s%s%s", watch->root, dir, *dir == '\0'? "" : "/",
+            name) < 0)
+        return 0;
+
+    r = lstat(path, &st) == 0 && (!S_ISREG(st.st_mode) || st.st_nlink > 1);
+    free(path);
+    return r;
+}
+
+
+long since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+            (now.tv_nsec - start->tv_nsec) / 1000000;
+}
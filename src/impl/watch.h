@@ -0,0 +1,91 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Watch a copied source for changes with inotify(7). The walk registers every
+ * directory it enters before it reads it, so nothing created afterwards is
+ * missed. A file is reported once it is closed after being written or moved
+ * in, anything else that is not a regular file when it is created. A directory
+ * created or moved in is watched along with everything already in it, which is
+ * reported as well.
+ *
+ * Changes are reported in batches of paths relative to the source. A batch is
+ * returned once no event came for a delay, or it has waited ten delays or
+ * grown to WATCH_MAX_BATCH paths, so a busy source is still copied often.
+ * Removals are not reported.
+ */
+#ifndef WATCH_H__
+#define WATCH_H__
+
+
+#include <signal.h>
+#include <stddef.h>
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * # of paths a batch is returned at whatever the delay
+ */
+#define WATCH_MAX_BATCH 4096
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the inotify instance, the path of each watched directory and the batch
+ */
+typedef struct watch watch_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * @param watch     where to store the new watch
+ * @param root      the source the watched directories are in
+ *
+ * @return          0 on success, -1 on failure
+ */
+int watch_create(watch_t **watch, const char *root);
+
+
+/**
+ * stop watching and release the watch, NULL is ignored
+ */
+void watch_free(watch_t *watch);
+
+
+/**
+ * Watch the directory at `path`, `root` or a path below it as the walk built
+ * it. Not thread safe.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int watch_dir(watch_t *watch, const char *path);
+
+
+/**
+ * Wait for the next batch of changes. Signals are only taken while waiting
+ * and with `sigmask` as the signal mask, so those blocked while copying
+ * interrupt the wait and nothing else.
+ *
+ * @param watch     the watch
+ * @param delay     ms without an event that ends a batch
+ * @param sigmask   the signal mask to wait with
+ * @param list      set to the paths changed, valid until the next call
+ * @param count     set to the # of paths in `list`
+ *
+ * @return          0 with a batch, -1 on failure or when a signal came before
+ *                  any change, with errno set to EINTR
+ */
+int watch_wait(watch_t *watch, long delay, const sigset_t *sigmask,
+        const char ***list, size_t *count);
+
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the work_t API from process.h. The structure and its
+ * strings share one allocation, a walk can hold back many of them.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "process.h"
+#include "../logging.h"
+
+
+/* Public Impl ****************************************************************/
+
+
+work_t *work_create(const char *path, const char *accpath, const char *newpath,
+        const char *dapath, const void *pathmd5, const struct stat *st)
+{
+    work_t *work;
+    char *pos;
+    size_t plen, alen, nlen, dlen;
+
+    plen = strlen(path) + 1;
+    alen = strlen(accpath) + 1;
+    nlen = strlen(newpath) + 1;
+    dlen = strlen(dapath) + 1;
+
+    if ((work = malloc(sizeof(*work) + plen + alen + nlen + dlen)) == NULL)
+    {
+        log_error("malloc");
+        return NULL;
+    }
+
+    /* strings are laid out right after the struct */
+    pos = (char *) (work + 1);
+    work->path    = memcpy(pos, path, plen);      pos += plen;
+    work->accpath = memcpy(pos, accpath, alen);   pos += alen;
+    work->newpath = memcpy(pos, newpath, nlen);   pos += nlen;
+    work->dapath  = memcpy(pos, dapath, dlen);
+
+    memcpy(work->pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    memcpy(&work->st, st, sizeof(work->st));
+    return work;
+}
+
+
+void work_free(work_t *work)
+{
+    if (work != NULL)
+        free(work);
+}
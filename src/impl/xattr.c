@@ -0,0 +1,378 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the xattr.h API. The values of a source are read one
+ * after the other into a single buffer, each at the end of the previous one.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "xattr.h"
+#include "../logging.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+struct xattrs {
+    char *names;        /**< '\0' delimited names of the source */
+    size_t ncap;        /**< # of bytes `names` can hold */
+    char *values;       /**< the values, one after the other */
+    size_t vcap;        /**< # of bytes `values` can hold */
+    size_t *offs;       /**< where each value starts in `values` */
+    size_t *sizes;      /**< # of bytes in each value */
+    const char **index; /**< where each name starts in `names` */
+    size_t count;       /**< # of attributes read */
+    size_t cap;         /**< # of `offs`, `sizes` and `index` allocated */
+    dev_t *nodevs;      /**< devices that do not support xattrs */
+    size_t ndevs;       /**< # of `nodevs` */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Read the list of names of the source, when `name` is NULL, or the value of
+ * `name` into `*buf` from `used` on, growing it to the size a probe call asks
+ * for when it is too small. A full `buf` is only grown if there is something
+ * to read.
+ *
+ * @return          # of bytes read, -1 on failure
+ */
+static ssize_t fetch(int fd, const char *path, const char *name, char **buf,
+        size_t *cap, size_t used);
+
+
+/**
+ * @return          whether `name` passes `filters`, @see xattr.h
+ */
+static int pass(const char *name, const char *const *filters, size_t nfilters);
+
+
+/* Public Impl ****************************************************************/
+
+
+int xattrs_create(xattrs_t **x)
+{
+    if ((*x = calloc(1, sizeof(struct xattrs))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+    return 0;
+}
+
+
+void xattrs_free(xattrs_t *x)
+{
+    if (x == NULL)
+        return;
+
+    free(x->names);
+    free(x->values);
+    free(x->offs);
+    free(x->sizes);
+    free(x->index);
+    free(x->nodevs);
+    free(x);
+}
+
+
+int xattrs_read(xattrs_t *x, int fd, const char *path, const struct stat *st)
+{
+    ssize_t len;
+    ssize_t size;
+    size_t used;
+    size_t cap;
+    dev_t *tmp;
+    char *next;
+    char *end;
+    size_t i;
+
+    x->count = 0;
+
+    /* a file system without xattrs only has to say so once */
+    for (i = 0; st != NULL && i < x->ndevs; i++)
+        if (x->nodevs[i] == st->st_dev)
+            return 0;
+
+    if ((len = fetch(fd, path, NULL, &x->names, &x->ncap, 0)) == 0)
+        return 0;
+    else if (len < 0)
+    {
+        /* xattrs not supported or disabled for this file, success */
+        if (errno == ENOTSUP)
+        {
+            if (st != NULL && (tmp = realloc(x->nodevs,
+                    (x->ndevs + 1) * sizeof(dev_t))) != NULL)
+            {
+                x->nodevs = tmp;
+                x->nodevs[x->ndevs++] = st->st_dev;
+            }
+            return 0;
+        }
+        log_error("cannot list xattrs of '%s'", path);
+        return -1;
+    }
+
+    end = x->names + len; /* pointer to the end of the list */
+
+    /* names is one large string with '\0' delimited names */
+    used = 0;
+    for (next = x->names; next < end; next += (strlen(next) + 1))
+    {
+        if ((size = fetch(fd, path, next, &x->values, &x->vcap, used)) < 0)
+        {
+            log_error("cannot get xattr '%s' of '%s'", next, path);
+            continue;
+        }
+
+        if (x->count == x->cap)
+        {
+            cap = x->cap == 0? 16 : x->cap * 2;
+            if ((x->offs = realloc(x->offs, cap * sizeof(size_t))) == NULL ||
+                    (x->sizes = realloc(x->sizes, cap * sizeof(size_t))) ==
+                    NULL || (x->index = realloc(x->index,
+                    cap * sizeof(char *))) == NULL)
+                log_critx(EXIT_FAILURE, "cannot allocate %zu xattrs", cap);
+            x->cap = cap;
+        }
+        x->index[x->count] = next;
+        x->offs[x->count] = used;
+        x->sizes[x->count] = size;
+        x->count++;
+        used += size;
+    }
+
+    return 0;
+}
+
+
+size_t xattrs_count(const xattrs_t *x)
+{
+    return x->count;
+}
+
+
+const char *xattrs_get(const xattrs_t *x, size_t i, const void **value,
+        size_t *size)
+{
+    *value = x->values + x->offs[i];
+    *size = x->sizes[i];
+    return x->index[i];
+}
+
+
+int xattrs_copy(xattrs_t **copy, const xattrs_t *x)
+{
+    xattrs_t *c;
+    size_t nlen;
+    size_t vlen;
+    size_t len;
+    size_t i;
+
+    if (xattrs_create(copy) != 0)
+        return -1;
+    c = *copy;
+    if (x->count == 0)
+        return 0;
+
+    nlen = 0;
+    vlen = 0;
+    for (i = 0; i < x->count; i++)
+    {
+        nlen += strlen(x->index[i]) + 1;
+        vlen += x->sizes[i];
+    }
+
+    /* an empty value still needs a buffer to point in */
+    if ((c->names = malloc(nlen)) == NULL ||
+            (c->values = malloc(vlen + 1)) == NULL ||
+            (c->offs = malloc(x->count * sizeof(size_t))) == NULL ||
+            (c->sizes = malloc(x->count * sizeof(size_t))) == NULL ||
+            (c->index = malloc(x->count * sizeof(char *))) == NULL)
+    {
+        log_error("cannot copy %zu xattrs", x->count);
+        xattrs_free(c);
+        *copy = NULL;
+        return -1;
+    }
+    c->ncap = nlen;
+    c->vcap = vlen + 1;
+    c->cap  = x->count;
+
+    nlen = 0;
+    vlen = 0;
+    for (i = 0; i < x->count; i++)
+    {
+        len = strlen(x->index[i]) + 1;
+        memcpy(c->names + nlen, x->index[i], len);
+        memcpy(c->values + vlen, x->values + x->offs[i], x->sizes[i]);
+        c->index[i] = c->names + nlen;
+        c->offs[i]  = vlen;
+        c->sizes[i] = x->sizes[i];
+        nlen += len;
+        vlen += x->sizes[i];
+    }
+    c->count = x->count;
+    return 0;
+}
+
+
+int xattrs_fd(const xattrs_t *x, int fd, const char *const *filters,
+        size_t nfilters)
+{
+    const char *name;
+    size_t i;
+
+    for (i = 0; i < x->count; i++)
+    {
+        name = x->index[i];
+        if (pass(name, filters, nfilters) && fsetxattr(fd, name,
+                x->values + x->offs[i], x->sizes[i], 0) != 0)
+        {
+            log_error("cannot set xattr '%s'", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+int xattrs_write(const xattrs_t *x, int dirfd, const char *dirpath,
+        const char *path, const struct stat *st, const char *const *filters,
+        size_t nfilters)
+{
+    char full[PATH_MAX];
+    const char *name;
+    size_t i;
+    int fd;
+    int r;
+
+    if (x->count == 0)
+        return 0;
+
+    /* only directories can be opened without side effects, fsetxattr does
+     * not work on an O_PATH fd */
+    fd = -1;
+    if (S_ISDIR(st->st_mode))
+    {
+        if ((fd = openat(dirfd, path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK |
+                O_CLOEXEC)) == -1)
+        {
+            log_error("cannot open '%s/%s' to set its xattrs", dirpath, path);
+            return -1;
+        }
+    }
+    else
+        snprintf(full, sizeof(full), "%s%s%s", dirpath,
+                strlen(dirpath) == 0? "" : "/", path);
+
+    r = 0;
+    for (i = 0; i < x->count && r == 0; i++)
+    {
+        name = x->index[i];
+        if (!pass(name, filters, nfilters))
+            continue;
+
+        if ((fd != -1? fsetxattr(fd, name, x->values + x->offs[i],
+                x->sizes[i], 0) : lsetxattr(full, name,
+                x->values + x->offs[i], x->sizes[i], 0)) != 0)
+        {
+            log_error("cannot set xattr '%s' on '%s/%s'", name, dirpath,
+                    path);
+            r = -1;
+        }
+    }
+
+    if (fd != -1)
+        close(fd);
+    return r;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+ssize_t fetch(int fd, const char *path, const char *name, char **buf,
+        size_t *cap, size_t used)
+{
+    ssize_t n;
+    char *tmp;
+
+    for (;;)
+    {
+        if (name == NULL)
+            n = fd != -1? flistxattr(fd, *buf + used, *cap - used) :
+                    llistxattr(path, *buf + used, *cap - used);
+        else
+            n = fd != -1? fgetxattr(fd, name, *buf + used, *cap - used) :
+                    lgetxattr(path, name, *buf + used, *cap - used);
+
+        /* with no room left the call was the probe */
+        if (n == 0 || (n > 0 && *cap > used))
+            return n;
+        if (n < 0 && errno != ERANGE)
+            return -1;
+
+        /* it grew since it was probed, ask again */
+        if (n < 0)
+        {
+            if (name == NULL)
+                n = fd != -1? flistxattr(fd, NULL, 0) :
+                        llistxattr(path, NULL, 0);
+            else
+                n = fd != -1? fgetxattr(fd, name, NULL, 0) :
+                        lgetxattr(path, name, NULL, 0);
+            if (n <= 0)
+                return n;
+        }
+
+        /* at least double so the values of a source take few reallocs */
+        if (used + n < *cap * 2)
+            n = *cap * 2 - used;
+        if ((tmp = realloc(*buf, used + n)) == NULL)
+            return -1;
+        *buf = tmp;
+        *cap = used + n;
+    }
+}
+
+
+int pass(const char *name, const char *const *filters, size_t nfilters)
+{
+    int includes;
+    int included;
+    size_t i;
+
+    includes = 0;
+    included = 0;
+    for (i = 0; i < nfilters; i++)
+    {
+        if (filters[i][0] == '!')
+        {
+            if (strncmp(name, filters[i] + 1, strlen(filters[i] + 1)) == 0)
+                return 0;
+        }
+        else
+        {
+            includes = 1;
+            if (strncmp(name, filters[i], strlen(filters[i])) == 0)
+                included = 1;
+        }
+    }
+    return !includes || included;
+}
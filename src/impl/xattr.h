@@ -0,0 +1,128 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * The extended attributes of a source, read once for both the callback and
+ * the copies. A source still open is read through its fd, anything else by
+ * its path. The names and values go into buffers that only grow, sized by a
+ * probe call when they are too small, so a file without attributes costs a
+ * single syscall. A device that does not support them is only asked once.
+ *
+ * Written to a copy they can be limited by name with filters: "PREFIX" keeps
+ * only the names starting with one of the PREFIXes given, "!PREFIX" drops the
+ * names starting with PREFIX.
+ */
+#ifndef XATTR_H__
+#define XATTR_H__
+
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the attributes of the last source read, one per thread
+ */
+typedef struct xattrs xattrs_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Create an empty set of attributes.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int xattrs_create(xattrs_t **x);
+
+
+/**
+ * release the set, NULL is ignored
+ */
+void xattrs_free(xattrs_t *x);
+
+
+/**
+ * Read the attributes of a source, replacing the ones read before. On failure
+ * the set is left empty.
+ *
+ * @param x         where to read the attributes to
+ * @param fd        the source open for reading, -1 to use `path`
+ * @param path      the source, symbolic links are not followed
+ * @param st        NULL or the source's stat information
+ *
+ * @return          0 on success, -1 on failure
+ */
+int xattrs_read(xattrs_t *x, int fd, const char *path, const struct stat *st);
+
+
+/**
+ * @return          # of attributes in the set
+ */
+size_t xattrs_count(const xattrs_t *x);
+
+
+/**
+ * Get attribute `i` of the set.
+ *
+ * @param value     set to its value, valid until the next read
+ * @param size      set to # of bytes in `value`
+ *
+ * @return          its name, valid until the next read
+ */
+const char *xattrs_get(const xattrs_t *x, size_t i, const void **value,
+        size_t *size);
+
+
+/**
+ * Create a set holding the attributes of `x`, that stays valid once `x` is
+ * read again.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int xattrs_copy(xattrs_t **copy, const xattrs_t *x);
+
+
+/**
+ * Set the attributes of the set that pass `filters` on the copy open on `fd`.
+ * A regular file is given them this way while it is still open for writing,
+ * @see attrs_t.
+ *
+ * @param x         the attributes to set
+ * @param fd        the copy
+ * @param filters   @see DESCRIPTION
+ * @param nfilters  # of `filters`, 0 sets every attribute
+ *
+ * @return          0 on success, -1 on failure
+ */
+int xattrs_fd(const xattrs_t *x, int fd, const char *const *filters,
+        size_t nfilters);
+
+
+/**
+ * Set the attributes of the set that pass `filters` on a copy that is not
+ * open. Directories are opened and set through their fd, the others by path.
+ *
+ * @param x         the attributes to set
+ * @param dirfd     directory `path` is relative to
+ * @param dirpath   `dirfd`'s path, for the entries set by path
+ * @param path      the copy
+ * @param st        the source's stat information
+ * @param filters   @see DESCRIPTION
+ * @param nfilters  # of `filters`, 0 sets every attribute
+ *
+ * @return          0 on success, -1 on failure
+ */
+int xattrs_write(const xattrs_t *x, int dirfd, const char *dirpath,
+        const char *path, const struct stat *st, const char *const *filters,
+        size_t nfilters);
+
+
+#endif
@@ -8,6 +8,8 @@
  * Implementation of the index.h api using an in-memory Berkeley DB B-Tree.
  */
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +22,15 @@
 #include "../io/pack.h"
 
 
+/* Macros *********************************************************************/
+
+
+/**
+ * # of entries in one word of the visited bitset
+ */
+#define WORD_BITS 64
+
+
 /* Type Defs ******************************************************************/
 
 
@@ -31,11 +42,21 @@
  * @param key_digest_length the # of bytes of our digest used for search
  * @param key_digest        given a ptr to an entry retrieve a pointer to the
  *                          digest used for searching
+ * @param lock              serializes access to `dbh`, which is not opened
+ *                          with DB_THREAD, so copies in parallel can share it
+ * @param visited           a bit for each entry, set when the walk finds its
+ *                          path, indexed by the slot stored as the value
+ * @param count             # of entries, the next slot
+ * @param max               # of bits `visited` has room for
  */
 struct index {
     DB *dbh;
     digest_t key_digest_type;
     size_t key_digest_length;
+    pthread_mutex_t lock;
+    uint64_t *visited;
+    size_t count;
+    size_t max;
 };
 
 
@@ -86,6 +107,13 @@ static int key_cmp(DB *db, const DBT *dbt1, const DBT *dbt2);
 static int init_db(struct index *idx);
 
 
+/**
+ * @return          the slot of the entry with key `k`, (size_t) -1 when there is
+ *                  no such entry, the lock must be held
+ */
+static size_t slot_of(struct index *idx, struct key *k);
+
+
 /* Public Impl ****************************************************************/
 
 
@@ -98,6 +126,10 @@ index_return_t index_create(index_t **idx, digest_t digest_type)
 
     (*idx)->key_digest_type = digest_type;
     (*idx)->key_digest_length = DIGEST_LENGTH(digest_type);
+    (*idx)->visited = NULL;
+    (*idx)->count = 0;
+    (*idx)->max = 0;
+    pthread_mutex_init(&(*idx)->lock, NULL);
     init_db(*idx);
 
     return INDEX_SUCCESS;
@@ -109,6 +141,8 @@ index_return_t index_free(index_t *idx)
     if (idx != NULL)
     {
         idx->dbh->close(idx->dbh, 0);
+        pthread_mutex_destroy(&idx->lock);
+        free(idx->visited);
         free(idx);
     }
     return INDEX_SUCCESS;
@@ -127,6 +161,10 @@ index_return_t index_insert(index_t *idx, const void *pathmd5,
     DBT key;
     DBT val;
     struct key k;
+    uint64_t *tmp;
+    size_t slot;
+    size_t max;
+    int r;
 
     memset(&key, 0, sizeof(key));
     memset(&val, 0, sizeof(val));
@@ -139,7 +177,32 @@ index_return_t index_insert(index_t *idx, const void *pathmd5,
     key.data = &k;
     key.size = sizeof(k);
 
-    if (idx->dbh->put(idx->dbh, NULL, &key, &val, 0) != 0)
+    pthread_mutex_lock(&idx->lock);
+
+    /* the bitset grows with the entries, a bit each */
+    if (idx->count == idx->max)
+    {
+        max = idx->max == 0? 64 * WORD_BITS : idx->max * 2;
+        if ((tmp = realloc(idx->visited, max / 8)) == NULL)
+        {
+            pthread_mutex_unlock(&idx->lock);
+            log_error("failed to write an index entry");
+            return INDEX_FAILED;
+        }
+        memset(tmp + idx->max / WORD_BITS, 0, (max - idx->max) / 8);
+        idx->visited = tmp;
+        idx->max = max;
+    }
+
+    slot = idx->count;
+    val.data = &slot;
+    val.size = sizeof(slot);
+    if ((r = idx->dbh->put(idx->dbh, NULL, &key, &val, 0)) == 0)
+        idx->count++;
+
+    pthread_mutex_unlock(&idx->lock);
+
+    if (r != 0)
     {
         log_errorx("failed to write an index entry");
         return INDEX_FAILED;
@@ -169,7 +232,11 @@ index_return_t index_lookup(index_t *idx, const void *pathmd5,
     key.data = &k;
     key.size = sizeof(k);
 
-    switch (r = idx->dbh->get(idx->dbh, NULL, &key, &val, 0))
+    pthread_mutex_lock(&idx->lock);
+    r = idx->dbh->get(idx->dbh, NULL, &key, &val, 0);
+    pthread_mutex_unlock(&idx->lock);
+
+    switch (r)
     {
     case 0:
         return INDEX_SUCCESS;
@@ -184,9 +251,119 @@ index_return_t index_lookup(index_t *idx, const void *pathmd5,
 }
 
 
+index_return_t index_visit(index_t *idx, const void *pathmd5)
+{
+    DBC *cur;
+    DBT key;
+    DBT val;
+    struct key k;
+    size_t slot;
+    index_return_t ret;
+    int r;
+
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    /* the smallest key of the path, every digest of it follows in order */
+    memset(&k, 0, sizeof(k));
+    memcpy(&k.pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+
+    key.data = &k;
+    key.size = sizeof(k);
+
+    pthread_mutex_lock(&idx->lock);
+    if ((r = idx->dbh->cursor(idx->dbh, NULL, &cur, 0)) != 0)
+    {
+        pthread_mutex_unlock(&idx->lock);
+        idx->dbh->err(idx->dbh, r, "failed index lookup");
+        return INDEX_FAILED;
+    }
+
+    ret = INDEX_NO_ENTRY;
+    for (r = cur->get(cur, &key, &val, DB_SET_RANGE); r == 0 &&
+            memcmp(key.data, pathmd5, MD5_DIGEST_LENGTH) == 0;
+            r = cur->get(cur, &key, &val, DB_NEXT))
+    {
+        memcpy(&slot, val.data, sizeof(slot));
+        idx->visited[slot / WORD_BITS] |= UINT64_C(1) << (slot % WORD_BITS);
+        ret = INDEX_SUCCESS;
+    }
+    cur->close(cur);
+    pthread_mutex_unlock(&idx->lock);
+
+    if (r != 0 && r != DB_NOTFOUND)
+    {
+        idx->dbh->err(idx->dbh, r, "failed index lookup");
+        return INDEX_FAILED;
+    }
+    return ret;
+}
+
+
+size_t index_unvisited(index_t *idx)
+{
+    size_t visited;
+    size_t i;
+
+    visited = 0;
+    pthread_mutex_lock(&idx->lock);
+    for (i = 0; i < (idx->count + WORD_BITS - 1) / WORD_BITS; i++)
+        visited += __builtin_popcountll(idx->visited[i]);
+    pthread_mutex_unlock(&idx->lock);
+
+    return idx->count - visited;
+}
+
+
+index_return_t index_take_unvisited(index_t *idx, const void *pathmd5,
+        const void *digest)
+{
+    struct key k;
+    size_t slot;
+    uint64_t bit;
+    index_return_t ret;
+
+    memset(&k, 0, sizeof(k));
+    memcpy(&k.pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    memcpy(&k.digest, digest, idx->key_digest_length);
+
+    pthread_mutex_lock(&idx->lock);
+    ret = INDEX_NO_ENTRY;
+    if ((slot = slot_of(idx, &k)) != (size_t) -1)
+    {
+        bit = UINT64_C(1) << (slot % WORD_BITS);
+        if ((idx->visited[slot / WORD_BITS] & bit) == 0)
+            ret = INDEX_SUCCESS;
+        idx->visited[slot / WORD_BITS] |= bit;
+    }
+    pthread_mutex_unlock(&idx->lock);
+
+    return ret;
+}
+
+
 /* Private Impl ***************************************************************/
 
 
+size_t slot_of(struct index *idx, struct key *k)
+{
+    DBT key;
+    DBT val;
+    size_t slot;
+
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    key.data = k;
+    key.size = sizeof(*k);
+
+    if (idx->dbh->get(idx->dbh, NULL, &key, &val, 0) != 0 ||
+            val.size != sizeof(slot))
+        return (size_t) -1;
+
+    memcpy(&slot, val.data, sizeof(slot));
+    return slot;
+}
+
+
 inline int init_db(struct index *idx)
 {
     int r;
@@ -10,6 +10,10 @@
  * lookups based on file path md5 and a file digest, @see DGSTTYPE, specified at
  * initialization.
  *
+ * Every entry also has a bit in a visited bitset. The walk marks the entries of
+ * each path it finds, those left unmarked at the end are files removed since
+ * the input was written.
+ *
  * Current implementation @see db_index.c
  */
 #ifndef INDEX_H__
@@ -90,4 +94,34 @@ index_return_t index_lookup(index_t *idx, const void *pathmd5,
         const void *digest);
 
 
+/**
+ * Mark every entry of the file at `pathmd5` visited, whatever its digest, a
+ * file changed since is still there.
+ *
+ * Returns
+ *      INDEX_SUCCESS           when the path has entries
+ *      INDEX_NO_ENTRY          when it has none
+ *      INDEX_FAILED            on unrecoverable error
+ */
+index_return_t index_visit(index_t *idx, const void *pathmd5);
+
+
+/**
+ * @return              the # of entries not visited
+ */
+size_t index_unvisited(index_t *idx);
+
+
+/**
+ * Take an entry that was not visited, marking it visited so it is only taken
+ * once.
+ *
+ * Returns
+ *      INDEX_SUCCESS           when the entry was not visited
+ *      INDEX_NO_ENTRY          when it was or it is not in the index
+ */
+index_return_t index_take_unvisited(index_t *idx, const void *pathmd5,
+        const void *digest);
+
+
 #endif
@@ -0,0 +1,108 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of base64.h. The encoder takes 4 groups of 3 bytes at a time.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base64.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * # of bytes base64_write encodes on the stack before writing them
+ */
+#define WRITE_BLOCK 3072
+
+
+/* Private Variables **********************************************************/
+
+
+static const char ENCODE[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * encode the 3 bytes of `src` as the 4 characters of `dest`
+ */
+static inline void encode_group(char *dest, const uint8_t *src);
+
+
+/* Public Impl ****************************************************************/
+
+
+size_t base64_encode(char *dest, const void *src, size_t count)
+{
+    const uint8_t *s;
+    char *d;
+    uint32_t v;
+
+    s = src;
+    d = dest;
+
+    /* unrolled so the compiler can interleave the lookups */
+    for (; count >= 12; count -= 12, s += 12, d += 16)
+    {
+        encode_group(d, s);
+        encode_group(d + 4, s + 3);
+        encode_group(d + 8, s + 6);
+        encode_group(d + 12, s + 9);
+    }
+    for (; count >= 3; count -= 3, s += 3, d += 4)
+        encode_group(d, s);
+
+    if (count > 0)
+    {
+        v = (uint32_t) s[0] << 16 | (count == 2? (uint32_t) s[1] << 8 : 0);
+        d[0] = ENCODE[v >> 18];
+        d[1] = ENCODE[(v >> 12) & 0x3f];
+        d[2] = count == 2? ENCODE[(v >> 6) & 0x3f] : '=';
+        d[3] = '=';
+        d += 4;
+    }
+    return d - dest;
+}
+
+
+int base64_write(const void *src, size_t count, FILE *stream)
+{
+    char buf[BASE64_ENCODED_SIZE(WRITE_BLOCK)];
+    const uint8_t *s;
+    size_t n;
+    size_t len;
+
+    for (s = src; count > 0; s += n, count -= n)
+    {
+        n = count < WRITE_BLOCK? count : WRITE_BLOCK;
+        len = base64_encode(buf, s, n);
+        if (fwrite(buf, 1, len, stream) != len)
+            return -1;
+    }
+    return 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+inline void encode_group(char *dest, const uint8_t *src)
+{
+    uint32_t v;
+
+    v = (uint32_t) src[0] << 16 | (uint32_t) src[1] << 8 | src[2];
+    dest[0] = ENCODE[v >> 18];
+    dest[1] = ENCODE[(v >> 12) & 0x3f];
+    dest[2] = ENCODE[(v >> 6) & 0x3f];
+    dest[3] = ENCODE[v & 0x3f];
+}
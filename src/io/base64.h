@@ -0,0 +1,50 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Base64, RFC 4648 with padding and no line breaks, straight between buffers.
+ * Values are encoded a few groups of 3 bytes at a time with table lookups, so
+ * nothing is allocated and nothing goes through an OpenSSL BIO chain.
+ */
+#ifndef BASE64_H__
+#define BASE64_H__
+
+
+#include <stdio.h>
+#include <stddef.h>
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * # of characters `count` bytes encode to
+ */
+#define BASE64_ENCODED_SIZE(count) ((((count) + 2) / 3) * 4)
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Encode `count` bytes of `src` into `dest`, which is not '\0' terminated.
+ *
+ * @param dest      where to write BASE64_ENCODED_SIZE(count) characters
+ *
+ * @return          # of characters written
+ */
+size_t base64_encode(char *dest, const void *src, size_t count);
+
+
+/**
+ * Encode `count` bytes of `src` onto `stream` a block at a time.
+ *
+ * @return          0 on success, -1 on error
+ */
+int base64_write(const void *src, size_t count, FILE *stream);
+
+
+#endif
@@ -96,13 +96,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
 {
     char *buf;
     size_t blen;
-    json_t *obj;
-    json_error_t jerr;
-    void *it;
-    const char *key;
-    const json_t *val;
-
-    int has_pathmd5;
+    int r;
 
     /* read the next line skipping any metadata lines */
     buf = NULL;
@@ -116,19 +110,33 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         (*line)++;
     } while (buf[0] == '#');
 
+    r = io_entry_parse(entry, buf, *line);
+    free(buf);
+    return r;
+}
+
+
+int io_entry_parse(entry_t *entry, const char *buf, size_t line)
+{
+    json_t *obj;
+    json_error_t jerr;
+    void *it;
+    const char *key;
+    const json_t *val;
+
+    int has_pathmd5;
 
     /* for jansson's documentation, JSON_REJECT_DUPLICATES issues an error when
      * multiple keys in an object have the same name instead of default
      * behavior which is to use the last defined value */
     if ((obj = json_loads(buf, JSON_REJECT_DUPLICATES, &jerr)) == NULL)
     {
-        log_errorx("cannot parse json line %zd: %s'", *line, jerr.text);
+        log_errorx("cannot parse json line %zu: %s'", line, jerr.text);
         return -1;
     }
 
-    free(buf);
-
     memset(entry, 0, sizeof(*entry)); /* 0/NULL out every thing in the struct */
+    has_pathmd5 = 0;
 
     for (   it = json_object_iter(obj);
             it != NULL ;
@@ -140,9 +148,9 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         if (strcmp(key, "md5") == 0)
         {
             if (pack_digest(entry->_digest_bytes.md5, MD5_DIGEST_LENGTH, val,
-                    *line, "md5") == -1)
+                    line, "md5") == -1)
             {
-                LOG_NONHEX(*line, "md5");
+                LOG_NONHEX(line, "md5");
                 json_decref(obj);
                 return -1;
             }
@@ -152,9 +160,9 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         else if (strcmp(key, "sha1") == 0)
         {
             if (pack_digest(entry->_digest_bytes.sha1, SHA_DIGEST_LENGTH, val,
-                    *line, "sha1") == -1)
+                    line, "sha1") == -1)
             {
-                LOG_NONHEX(*line, "sha1");
+                LOG_NONHEX(line, "sha1");
                 json_decref(obj);
                 return -1;
             }
@@ -164,9 +172,9 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         else if (strcmp(key, "sha256") == 0)
         {
             if (pack_digest(entry->_digest_bytes.sha256, SHA256_DIGEST_LENGTH,
-                    val, *line, "sha256") == -1)
+                    val, line, "sha256") == -1)
             {
-                LOG_NONHEX(*line, "sha256");
+                LOG_NONHEX(line, "sha256");
                 json_decref(obj);
                 return -1;
             }
@@ -176,9 +184,9 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         else if (strcmp(key, "sha512") == 0)
         {
             if (pack_digest(entry->_digest_bytes.sha512, SHA512_DIGEST_LENGTH,
-                    val, *line, "sha512") == -1)
+                    val, line, "sha512") == -1)
             {
-                LOG_NONHEX(*line, "sha512");
+                LOG_NONHEX(line, "sha512");
                 json_decref(obj);
                 return -1;
             }
@@ -187,10 +195,10 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
 
         else if (strcmp(key, "pathmd5") == 0)
         {
-            if (pack_digest(entry->pathmd5, MD5_DIGEST_LENGTH, val, *line,
+            if (pack_digest(entry->pathmd5, MD5_DIGEST_LENGTH, val, line,
                     "pathmd5") == -1)
             {
-                LOG_NONHEX(*line, "pathmd5");
+                LOG_NONHEX(line, "pathmd5");
                 json_decref(obj);
                 return -1;
             }
@@ -201,7 +209,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "mode");
+                LOG_NONINT(line, "mode");
                 json_decref(obj);
                 return -1;
             }
@@ -212,7 +220,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "size");
+                LOG_NONINT(line, "size");
                 json_decref(obj);
                 return -1;
             }
@@ -223,7 +231,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "asec");
+                LOG_NONINT(line, "asec");
                 json_decref(obj);
                 return -1;
             }
@@ -234,7 +242,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "ansec");
+                LOG_NONINT(line, "ansec");
                 json_decref(obj);
                 return -1;
             }
@@ -245,7 +253,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "msec");
+                LOG_NONINT(line, "msec");
                 json_decref(obj);
                 return -1;
             }
@@ -256,7 +264,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "mnsec");
+                LOG_NONINT(line, "mnsec");
                 json_decref(obj);
                 return -1;
             }
@@ -267,7 +275,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "csec");
+                LOG_NONINT(line, "csec");
                 json_decref(obj);
                 return -1;
             }
@@ -278,7 +286,7 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         {
             if (!json_is_integer(val))
             {
-                LOG_NONINT(*line, "cnsec");
+                LOG_NONINT(line, "cnsec");
                 json_decref(obj);
                 return -1;
             }
@@ -289,42 +297,59 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
         /* ignoring since bdb will copy the entry struct but not manage the
          * dynamically allocated memory the structs point to */
         else if (strcmp(key, "path")     == 0) {}
-        else if (strcmp(key, "state")    == 0) {}
+        else if (strcmp(key, "state")    == 0)
+            entry->deleted = json_is_string(val) &&
+                    strcmp(json_string_value(val), "DELETED") == 0;
+        else if (strcmp(key, "dests")    == 0) {}
         else if (strcmp(key, "uid")      == 0) {}
         else if (strcmp(key, "gid")      == 0) {}
         else if (strcmp(key, "type")     == 0) {}
         else if (strcmp(key, "elapsed")  == 0) {}
+        else if (strcmp(key, "tarOffset") == 0) {}
         else if (strcmp(key, "pathhex")  == 0) {}
 
         else
-            log_warnx("ignoring unknown key '%s' on line %zu", key, *line);
+            log_warnx("ignoring unknown key '%s' on line %zu", key, line);
     }
 
     if (!has_pathmd5)
     {
-        log_errorx("'pathmd5' missing on line: %zu", *line);
+        log_errorx("'pathmd5' missing on line: %zu", line);
         json_decref(obj);
         return -1;
     }
 
+    json_decref(obj);
     return 0;
 }
 
 
+void io_entry_copy(entry_t *dst, const entry_t *src)
+{
+    memcpy(dst, src, sizeof(entry_t));
+    if (dst->md5    != NULL) dst->md5    = dst->_digest_bytes.md5;
+    if (dst->sha1   != NULL) dst->sha1   = dst->_digest_bytes.sha1;
+    if (dst->sha256 != NULL) dst->sha256 = dst->_digest_bytes.sha256;
+    if (dst->sha512 != NULL) dst->sha512 = dst->_digest_bytes.sha512;
+}
+
+
 /*
  * while jansson can be used for creating a json structure then printing it
  * out, there is a large overhead cost. Since we control the data only use
  * jansson to escape the strings we cannot control.
  */
-int io_entry_write_fields(const char *state, const char *path,
-        const struct stat *st, const void *pathmd5, const char *symlinkpath,
+int io_entry_write_fields(const char *state, const char **dests,
+        size_t ndests, const char *path, const struct stat *st,
+        const void *pathmd5, const char *symlinkpath,
         const void *md5, const void *sha1, const void *sha256,
-        const void *sha512, long elapsed, FILE *stream)
+        const void *sha512, long elapsed, off_t offset, FILE *stream)
 {
     enum { MAX_LENGTH = PATH_MAX * 4 };
 
     int ret;
     size_t len;
+    size_t i;
 
     /* use jansson for string character escaping of paths */
     json_t *escaped;
@@ -409,10 +434,23 @@ int io_entry_write_fields(const char *state, const char *path,
     json_dumpf(escaped, stream, JSON_ENCODE_ANY);
     json_decref(escaped);
 
+    /* how it went at the other destinations, the strings need no escaping */
+    if (ndests > 0)
+    {
+        fputs(",\"dests\":[", stream);
+        for (i = 0; i < ndests; i++)
+            fprintf(stream, "%s\"%s\"", i == 0? "" : ",", dests[i]);
+        fputc(']', stream);
+    }
+
     /* # of secs elapsed while processing */
     if (elapsed > -1)
         fprintf(stream, ",\"elapsed\":%ld", elapsed);
 
+    /* where the entry starts in the --tar archive */
+    if (offset > -1)
+        fprintf(stream, ",\"tarOffset\":%jd", (intmax_t) offset);
+
     /* if entry is a symlink we include what its target path was */
 	if (symlinkpath != NULL)
     {
@@ -39,10 +39,30 @@
 int io_entry_read(entry_t *entry, FILE *in, size_t *line);
 
 
+/**
+ * Parse the entry on line `line` of a stream, already read into `buf`.
+ *
+ * @param entry         where to store the data parsed
+ * @param buf           the line, not a metadata line
+ * @param line          the line # for logging
+ *
+ * @return              0 on success, -1 on error
+ */
+int io_entry_parse(entry_t *entry, const char *buf, size_t line);
+
+
+/**
+ * copy `src` to `dst` with the digests of `dst` pointing at its own bytes
+ */
+void io_entry_copy(entry_t *dst, const entry_t *src);
+
+
 /**
  * write the following fields as a JSON object to the stream
  *
  * @param state         string describing how the processing of the entry went
+ * @param dests         `state` of the entry at each further destination
+ * @param ndests        # of `dests`, 0 to leave the field out
  * @param path          abs path of the file, with src dir treated as root
  * @param st            pointer to the source file's stat struct
  * @param pathmd5       16 byte md5 of the path
@@ -52,14 +72,17 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line);
  * @param sha256        sha256 of the file's contents or NULL if not applicable
  * @param sha512        sha512 of the file's contents or NULL if not applicable
  * @param process_time  # of milliseconds it took to process the file
+ * @param offset        where the entry starts in the --tar archive, left out
+ *                      when negative
  * @param stream        where to write the json object
  *
  * @return              0 on success, -1 on error
  */
-int io_entry_write_fields(const char *state, const char *path,
-        const struct stat *st, const void *pathmd5, const char *symlinkpath,
+int io_entry_write_fields(const char *state, const char **dests,
+        size_t ndests, const char *path, const struct stat *st,
+        const void *pathmd5, const char *symlinkpath,
         const void *md5, const void *sha1, const void *sha256,
-        const void *sha512, long process_time, FILE *stream);
+        const void *sha512, long process_time, off_t offset, FILE *stream);
 
 
 #endif
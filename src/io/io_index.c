@@ -1,7 +1,10 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#include <jansson.h>
+
 #include "io_index.h"
 #include "io_entry.h"
 #include "../digest.h"
@@ -23,6 +26,21 @@
 static int valid_digests(const entry_t *entry);
 
 
+/**
+ * @return          the digest of `entry` of type `type`, NULL when it has none
+ */
+static const void *entry_digest(const entry_t *entry, digest_t type);
+
+
+/**
+ * Write the entry in `buf` as a DELETED record, without what only applies to
+ * the copy made.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int write_deleted(const char *buf, size_t linenum, FILE *out);
+
+
 /**
  * Add an entry to the index if it isn't already there. When the entry exists
  * we log that we are skipping the entry due to it being a duplicate.
@@ -61,8 +79,9 @@ int io_index_read(index_t *idx, const char *path)
     expected = 0;
     while (io_entry_read(&entry, stream, &linenum) == 0)
     {
-        /* the index is only regular files, ignore everything else */
-        if (!S_ISREG(entry.mode))
+        /* the index is only regular files that exist, ignore everything
+         * else */
+        if (!S_ISREG(entry.mode) || entry.deleted)
             continue;
 
         /* create a mask of all digests that the entry had */
@@ -139,6 +158,69 @@ int io_index_digest_peek(const char *paths[], size_t count, int *digests)
 }
 
 
+int io_index_deleted(index_t *idx, const char *paths[], size_t count,
+        FILE *out)
+{
+    FILE *stream;
+    char *buf;
+    size_t blen;
+    size_t linenum;
+    size_t i;
+    entry_t entry;
+    const void *dgst;
+    digest_t type;
+    int r;
+
+    /* nothing is gone, no need to read the inputs again */
+    if (index_unvisited(idx) == 0)
+        return 0;
+
+    type = index_get_digest_type(idx);
+    buf = NULL;
+    blen = 0;
+    r = 0;
+    for (i = 0; i < count && r == 0; i++)
+    {
+        if ((stream = fopen(paths[i], "r")) == NULL)
+        {
+            log_error("cannot open '%s'", paths[i]);
+            r = -1;
+            break;
+        }
+
+        linenum = 0;
+        while (getline(&buf, &blen, stream) != -1)
+        {
+            linenum++;
+            if (buf[0] == '#' || io_entry_parse(&entry, buf, linenum) != 0)
+                continue;
+
+            /* the same entries io_index_read added */
+            if (!S_ISREG(entry.mode) || entry.deleted ||
+                    (dgst = entry_digest(&entry, type)) == NULL)
+                continue;
+
+            if (index_take_unvisited(idx, entry.pathmd5, dgst) ==
+                    INDEX_SUCCESS && write_deleted(buf, linenum, out) != 0)
+            {
+                r = -1;
+                break;
+            }
+        }
+
+        if (r == 0 && ferror(stream))
+        {
+            log_error("cannot read '%s'", paths[i]);
+            r = -1;
+        }
+        fclose(stream);
+    }
+
+    free(buf);
+    return r;
+}
+
+
 /* Private Impl ***************************************************************/
 
 
@@ -164,3 +246,51 @@ int valid_digests(const entry_t *entry)
     if (entry->sha512 != NULL) dgsts |= DGST_SHA512;
     return dgsts;
 }
+
+
+const void *entry_digest(const entry_t *entry, digest_t type)
+{
+    switch (type)
+    {
+    case DGST_MD5:    return entry->md5;
+    case DGST_SHA1:   return entry->sha1;
+    case DGST_SHA256: return entry->sha256;
+    case DGST_SHA512: return entry->sha512;
+    default:          return NULL;
+    }
+}
+
+
+int write_deleted(const char *buf, size_t linenum, FILE *out)
+{
+    json_t *obj;
+    json_error_t jerr;
+    char *line;
+    int r;
+
+    if ((obj = json_loads(buf, 0, &jerr)) == NULL)
+    {
+        log_errorx("cannot parse json line %zu: %s", linenum, jerr.text);
+        return -1;
+    }
+
+    /* the file was neither copied, timed nor archived this run */
+    json_object_del(obj, "dests");
+    json_object_del(obj, "elapsed");
+    json_object_del(obj, "tarOffset");
+    if (json_object_set_new(obj, "state", json_string("DELETED")) != 0 ||
+            (line = json_dumps(obj, JSON_COMPACT | JSON_PRESERVE_ORDER)) ==
+            NULL)
+    {
+        log_errorx("cannot write a DELETED record for line %zu", linenum);
+        json_decref(obj);
+        return -1;
+    }
+
+    r = fprintf(out, "%s\n", line) < 0? -1 : 0;
+    if (r != 0)
+        log_error("cannot write a DELETED record for line %zu", linenum);
+    free(line);
+    json_decref(obj);
+    return r;
+}
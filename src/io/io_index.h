@@ -38,4 +38,20 @@ int io_index_read(index_t *index, const char *path);
 int io_index_digest_peek(const char *paths[], size_t count, int *digests);
 
 
+/**
+ * Write a DELETED record for each file in the inputs whose path was not found
+ * by the walk, @see index_visit. A record is the file's entry in the input
+ * with its state replaced.
+ *
+ * @param index     the index built from `paths`
+ * @param paths     the inputs
+ * @param count     # of `paths`
+ * @param out       where to write the records
+ *
+ * @return          0 on success, -1 on failure
+ */
+int io_index_deleted(index_t *index, const char *paths[], size_t count,
+        FILE *out);
+
+
 #endif
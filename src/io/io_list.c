@@ -0,0 +1,174 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the io_list API. A line starting with '{' is a manifest
+ * entry, anything else but a metadata line is taken as a path as is.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+
+#include "io_list.h"
+#include "pack.h"
+#include "../logging.h"
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Get the path of the manifest entry in `buf`.
+ *
+ * @return          the path to free, NULL on failure
+ */
+static char *entry_path(const char *buf, size_t line);
+
+
+/* Public Impl ****************************************************************/
+
+
+int io_list_read(const char *path, char ***list, size_t *count)
+{
+    FILE *in;
+    char *buf;
+    size_t blen;
+    ssize_t len;
+    size_t line;
+    size_t max;
+    char *entry;
+    char **tmp;
+    int r;
+
+    in = stdin;
+    if (strcmp(path, "-") != 0 && (in = fopen(path, "r")) == NULL)
+    {
+        log_error("cannot open '%s'", path);
+        return -1;
+    }
+
+    /* an empty list is not NULL, it copies nothing */
+    *count = 0;
+    max = 1024;
+    if ((*list = malloc(max * sizeof(char *))) == NULL)
+    {
+        log_error("malloc");
+        if (in != stdin)
+            fclose(in);
+        return -1;
+    }
+
+    buf = NULL;
+    blen = 0;
+    line = 0;
+    r = 0;
+    while (r == 0 && (len = getline(&buf, &blen, in)) != -1)
+    {
+        line++;
+        if (len > 0 && buf[len - 1] == '\n')
+            buf[--len] = '\0';
+        if (len == 0 || buf[0] == '#')
+            continue;
+
+        if (buf[0] == '{')
+            entry = entry_path(buf, line);
+        else
+            entry = strdup(buf);
+        if (entry == NULL)
+        {
+            log_errorx("cannot read '%s' line %zu", path, line);
+            r = -1;
+            break;
+        }
+
+        if (*count == max)
+        {
+            max *= 2;
+            if ((tmp = realloc(*list, max * sizeof(char *))) == NULL)
+            {
+                log_error("cannot list more than %zu paths", *count);
+                free(entry);
+                r = -1;
+                break;
+            }
+            *list = tmp;
+        }
+        (*list)[(*count)++] = entry;
+    }
+
+    if (r == 0 && ferror(in))
+    {
+        log_error("cannot read '%s'", path);
+        r = -1;
+    }
+
+    free(buf);
+    if (in != stdin)
+        fclose(in);
+
+    if (r != 0)
+    {
+        io_list_free(*list, *count);
+        *list = NULL;
+        *count = 0;
+    }
+    return r;
+}
+
+
+void io_list_free(char **list, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        free(list[i]);
+    free(list);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+char *entry_path(const char *buf, size_t line)
+{
+    json_t *obj;
+    json_error_t jerr;
+    const json_t *val;
+    const char *hex;
+    char *path;
+    size_t len;
+
+    if ((obj = json_loads(buf, 0, &jerr)) == NULL)
+    {
+        log_errorx("cannot parse json line %zu: %s", line, jerr.text);
+        return NULL;
+    }
+
+    path = NULL;
+
+    /* paths that are not valid UTF-8 are only written in hex */
+    if ((val = json_object_get(obj, "path")) != NULL && json_is_string(val))
+        path = strdup(json_string_value(val));
+    else if ((val = json_object_get(obj, "pathhex")) != NULL &&
+            json_is_string(val))
+    {
+        hex = json_string_value(val);
+        len = strlen(hex);
+        if (len % 2 == 0 && (path = calloc(len / 2 + 1, 1)) != NULL &&
+                pack(path, hex, line) != 0)
+        {
+            free(path);
+            path = NULL;
+        }
+    }
+    else
+        log_errorx("no 'path' or 'pathhex' on line %zu", line);
+
+    json_decref(obj);
+    return path;
+}
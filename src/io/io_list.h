@@ -0,0 +1,42 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * API for reading the list of entries given to --files-from. A list is either
+ * one path per line or the output of dcp, a manifest, whose entries' "path" or
+ * "pathhex" is used. Both can be mixed, metadata lines and empty lines are
+ * skipped.
+ */
+#ifndef IO_LIST_H__
+#define IO_LIST_H__
+
+
+#include <stddef.h>
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Read every path in the list at `path`, "-" reads stdin.
+ *
+ * @param path      the list to read
+ * @param list      set to the paths read, not NULL when there are none,
+ *                  release with io_list_free
+ * @param count     set to the # of paths in `list`
+ *
+ * @return          0 on success, -1 on failure
+ */
+int io_list_read(const char *path, char ***list, size_t *count);
+
+
+/**
+ * release what io_list_read returned
+ */
+void io_list_free(char **list, size_t count);
+
+
+#endif
@@ -0,0 +1,720 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the io_sort API. The buffer holds each entry and its line
+ * one after the other, it is sorted through an array of keys with the first 8
+ * bytes of the pathmd5 and where the entry is. The keys are radix sorted a
+ * byte at a time, least significant first, then keys with the same 8 bytes are
+ * put in order by the whole pathmd5. Every step is stable so entries with the
+ * same pathmd5 keep the order they were read in, runs are merged with a heap
+ * that takes the earlier run first on a tie for the same reason.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "io_sort.h"
+#include "io_entry.h"
+#include "../logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * # of bytes of the pathmd5 that are radix sorted
+ */
+#define KEY_BYTES 8
+
+
+/**
+ * round `n` up to keep what follows it in the buffer aligned
+ */
+#define ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * an entry as it is buffered and written to a run, its line follows
+ */
+struct rec {
+    entry_t entry;
+    size_t len;             /**< # of bytes in the line */
+};
+
+
+/**
+ * what the buffer is sorted by
+ */
+struct key {
+    uint64_t prefix;        /**< the first bytes of the pathmd5, big endian */
+    size_t off;             /**< where the entry is in the buffer */
+};
+
+
+/**
+ * a sorted part of the manifest written out
+ */
+struct run {
+    FILE *f;
+    struct rec rec;         /**< the next entry of the run */
+    char *line;             /**< and its line */
+    size_t cap;
+};
+
+
+struct io_sort {
+    const char *path;
+    FILE *in;               /**< the manifest, only open while read */
+    size_t linenum;
+    int sorted;             /**< the manifest is streamed as is */
+
+    char *buf;              /**< the entries buffered */
+    size_t used;
+    size_t size;
+    size_t memory;          /**< what the buffer and keys may take */
+    struct key *keys;
+    struct key *tmp;        /**< where the radix sort scatters the keys */
+    size_t count;
+    size_t max;
+    int inorder;            /**< the buffer was read sorted */
+    size_t next;            /**< the next key to return */
+
+    struct run *runs;
+    size_t nruns;
+    size_t *heap;           /**< the runs left, the one to take next first */
+    size_t nheap;
+
+    entry_t entry;          /**< the entry returned */
+    char *line;             /**< its line unless it is in the buffer */
+    size_t cap;
+    uint8_t last[MD5_DIGEST_LENGTH];    /**< the pathmd5 returned last */
+    int started;
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Read the next entry of the manifest.
+ *
+ * @return          1 with an entry, 0 at the end, -1 on failure
+ */
+static int read_entry(struct io_sort *sort, entry_t *entry, char **line,
+        size_t *cap, size_t *len);
+
+
+/**
+ * read the whole manifest into the buffer and runs
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int fill(struct io_sort *sort);
+
+
+/**
+ * buffer `entry` and its `len` bytes of `line`, writing out a run first when
+ * there is no room left
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int add(struct io_sort *sort, const entry_t *entry, const char *line,
+        size_t len);
+
+
+/**
+ * put the keys of the buffer in pathmd5 order
+ */
+static void radix(struct io_sort *sort);
+
+
+/**
+ * sort the buffer and write it out as a run, emptying it
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int spill(struct io_sort *sort);
+
+
+/**
+ * @return          a temporary file already unlinked, NULL on failure
+ */
+static FILE *spill_file(void);
+
+
+/**
+ * Read the next entry of `run`.
+ *
+ * @return          1 with an entry, 0 at the end of the run, -1 on failure
+ */
+static int run_read(struct io_sort *sort, struct run *run);
+
+
+/**
+ * restore the heap property below `i`
+ */
+static void sift_down(struct io_sort *sort, size_t i);
+
+
+/**
+ * @return          whether the entry of run `a` comes before the one of run `b`
+ */
+static int run_less(const struct io_sort *sort, size_t a, size_t b);
+
+
+/**
+ * @return          the pathmd5 of the entry `key` is for
+ */
+static inline const uint8_t *key_md5(const struct io_sort *sort,
+        const struct key *key);
+
+
+/* Public Impl ****************************************************************/
+
+
+int io_sort_open(io_sort_t **sort, const char *path, size_t memory,
+        int sorted)
+{
+    struct io_sort *s;
+
+    if ((s = calloc(1, sizeof(struct io_sort))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+    s->path = path;
+    s->sorted = sorted;
+    s->memory = memory;
+
+    if ((s->in = fopen(path, "r")) == NULL)
+    {
+        log_error("cannot open '%s'", path);
+        free(s);
+        return -1;
+    }
+
+    if (!sorted && fill(s) != 0)
+    {
+        io_sort_close(s);
+        return -1;
+    }
+
+    *sort = s;
+    return 0;
+}
+
+
+int io_sort_next(io_sort_t *sort, const entry_t **entry, const char **line,
+        size_t *len)
+{
+    const struct rec *rec;
+    struct run *run;
+    char *tmp;
+    size_t cap;
+    int r;
+
+    if (sort->sorted)
+    {
+        if ((r = read_entry(sort, &sort->entry, &sort->line, &sort->cap,
+                len)) != 1)
+            return r;
+
+        if (sort->started &&
+                memcmp(sort->last, sort->entry.pathmd5, MD5_DIGEST_LENGTH) > 0)
+        {
+            log_errorx("'%s' is not sorted by pathmd5 at line %zu",
+                    sort->path, sort->linenum);
+            return -1;
+        }
+        memcpy(sort->last, sort->entry.pathmd5, MD5_DIGEST_LENGTH);
+        sort->started = 1;
+        *line = sort->line;
+    }
+
+    /* everything fit in the buffer */
+    else if (sort->nruns == 0)
+    {
+        if (sort->next == sort->count)
+            return 0;
+        rec = (const struct rec *) (sort->buf + sort->keys[sort->next++].off);
+        io_entry_copy(&sort->entry, &rec->entry);
+        *line = (const char *) (rec + 1);
+        *len = rec->len;
+    }
+
+    else
+    {
+        if (sort->nheap == 0)
+            return 0;
+
+        /* take the run's entry and give it the old line buffer to read its
+         * next one in */
+        run = &sort->runs[sort->heap[0]];
+        io_entry_copy(&sort->entry, &run->rec.entry);
+        *len = run->rec.len;
+        tmp = sort->line;
+        cap = sort->cap;
+        sort->line = run->line;
+        sort->cap = run->cap;
+        run->line = tmp;
+        run->cap = cap;
+        *line = sort->line;
+
+        if ((r = run_read(sort, run)) == -1)
+            return -1;
+        if (r == 0)
+            sort->heap[0] = sort->heap[--sort->nheap];
+        sift_down(sort, 0);
+    }
+
+    *entry = &sort->entry;
+    return 1;
+}
+
+
+void io_sort_close(io_sort_t *sort)
+{
+    size_t i;
+
+    if (sort == NULL)
+        return;
+
+    if (sort->in != NULL)
+        fclose(sort->in);
+    for (i = 0; i < sort->nruns; i++)
+    {
+        fclose(sort->runs[i].f);
+        free(sort->runs[i].line);
+    }
+    free(sort->runs);
+    free(sort->heap);
+    free(sort->buf);
+    free(sort->keys);
+    free(sort->tmp);
+    free(sort->line);
+    free(sort);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int read_entry(struct io_sort *sort, entry_t *entry, char **line, size_t *cap,
+        size_t *len)
+{
+    ssize_t n;
+    char *tmp;
+
+    for (;;)
+    {
+        if ((n = getline(line, cap, sort->in)) == -1)
+        {
+            if (ferror(sort->in))
+            {
+                log_error("cannot read '%s'", sort->path);
+                return -1;
+            }
+            return 0;
+        }
+        sort->linenum++;
+
+        /* metadata and empty lines */
+        if ((*line)[0] == '#' || (*line)[0] == '\n')
+            continue;
+
+        /* every line written out ends the same */
+        if ((*line)[n - 1] != '\n')
+        {
+            if ((size_t) n + 2 > *cap)
+            {
+                if ((tmp = realloc(*line, n + 2)) == NULL)
+                {
+                    log_error("malloc");
+                    return -1;
+                }
+                *line = tmp;
+                *cap = n + 2;
+            }
+            (*line)[n++] = '\n';
+            (*line)[n] = '\0';
+        }
+
+        if (io_entry_parse(entry, *line, sort->linenum) != 0)
+        {
+            log_errorx("cannot read '%s' line %zu", sort->path, sort->linenum);
+            return -1;
+        }
+        *len = n;
+        return 1;
+    }
+}
+
+
+int fill(struct io_sort *sort)
+{
+    entry_t entry;
+    char *line;
+    size_t cap;
+    size_t len;
+    size_t i;
+    char *tmp;
+    int r;
+
+    /* the buffer's pages are only used as it fills */
+    sort->size = sort->memory;
+    if ((sort->buf = malloc(sort->size)) == NULL)
+    {
+        log_error("cannot allocate %zu bytes to sort '%s'", sort->size,
+                sort->path);
+        return -1;
+    }
+    sort->inorder = 1;
+
+    line = NULL;
+    cap = 0;
+    while ((r = read_entry(sort, &entry, &line, &cap, &len)) == 1)
+        if (add(sort, &entry, line, len) != 0)
+        {
+            r = -1;
+            break;
+        }
+    free(line);
+
+    fclose(sort->in);
+    sort->in = NULL;
+    if (r != 0)
+        return -1;
+
+    /* a manifest that fits is returned from the buffer */
+    if (sort->nruns == 0)
+    {
+        radix(sort);
+        free(sort->tmp);
+        sort->tmp = NULL;
+        if (sort->used > 0 && (tmp = realloc(sort->buf, sort->used)) != NULL)
+            sort->buf = tmp;
+        return 0;
+    }
+
+    if (sort->count > 0 && spill(sort) != 0)
+        return -1;
+    free(sort->buf);
+    free(sort->keys);
+    free(sort->tmp);
+    sort->buf = NULL;
+    sort->keys = NULL;
+    sort->tmp = NULL;
+
+    if ((sort->heap = malloc(sort->nruns * sizeof(size_t))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+
+    /* no run is empty */
+    for (i = 0; i < sort->nruns; i++)
+    {
+        if (run_read(sort, &sort->runs[i]) != 1)
+            return -1;
+        sort->heap[sort->nheap++] = i;
+    }
+    for (i = sort->nheap / 2; i > 0; i--)
+        sift_down(sort, i - 1);
+    return 0;
+}
+
+
+int add(struct io_sort *sort, const entry_t *entry, const char *line,
+        size_t len)
+{
+    struct rec *rec;
+    struct key *keys;
+    struct key *tmp;
+    size_t need;
+    size_t max;
+    char *buf;
+    int i;
+
+    need = ALIGN(sizeof(struct rec) + len);
+    if (sort->count > 0 && sort->used + need +
+            (sort->count + 1) * 2 * sizeof(struct key) > sort->memory &&
+            spill(sort) != 0)
+        return -1;
+
+    /* only an entry alone in the buffer can be larger than it */
+    if (sort->used + need > sort->size)
+    {
+        if ((buf = realloc(sort->buf, sort->used + need)) == NULL)
+        {
+            log_error("malloc");
+            return -1;
+        }
+        sort->buf = buf;
+        sort->size = sort->used + need;
+    }
+
+    if (sort->count == sort->max)
+    {
+        max = sort->max == 0? 1024 : sort->max * 2;
+        if ((keys = realloc(sort->keys, max * sizeof(struct key))) == NULL)
+        {
+            log_error("malloc");
+            return -1;
+        }
+        sort->keys = keys;
+        if ((tmp = realloc(sort->tmp, max * sizeof(struct key))) == NULL)
+        {
+            log_error("malloc");
+            return -1;
+        }
+        sort->tmp = tmp;
+        sort->max = max;
+    }
+
+    rec = (struct rec *) (sort->buf + sort->used);
+    memcpy(&rec->entry, entry, sizeof(entry_t));
+    rec->len = len;
+    memcpy(rec + 1, line, len);
+
+    sort->keys[sort->count].off = sort->used;
+    sort->keys[sort->count].prefix = 0;
+    for (i = 0; i < KEY_BYTES; i++)
+        sort->keys[sort->count].prefix = sort->keys[sort->count].prefix << 8 |
+                entry->pathmd5[i];
+
+    if (sort->count > 0 && sort->inorder &&
+            memcmp(key_md5(sort, &sort->keys[sort->count - 1]),
+                entry->pathmd5, MD5_DIGEST_LENGTH) > 0)
+        sort->inorder = 0;
+
+    sort->used += need;
+    sort->count++;
+    return 0;
+}
+
+
+void radix(struct io_sort *sort)
+{
+    size_t hist[KEY_BYTES][256];
+    size_t sum;
+    size_t n;
+    size_t i;
+    size_t j;
+    struct key *tmp;
+    struct key k;
+    int p;
+
+    /* a manifest written in order costs nothing to sort */
+    if (sort->inorder)
+        return;
+
+    /* every byte is counted in a single pass over the keys */
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < sort->count; i++)
+        for (p = 0; p < KEY_BYTES; p++)
+            hist[p][(sort->keys[i].prefix >> (p * 8)) & 0xff]++;
+
+    for (p = 0; p < KEY_BYTES; p++)
+    {
+        /* the keys all have the same byte, nothing moves */
+        if (hist[p][(sort->keys[0].prefix >> (p * 8)) & 0xff] == sort->count)
+            continue;
+
+        sum = 0;
+        for (j = 0; j < 256; j++)
+        {
+            n = hist[p][j];
+            hist[p][j] = sum;
+            sum += n;
+        }
+        for (i = 0; i < sort->count; i++)
+            sort->tmp[hist[p][(sort->keys[i].prefix >> (p * 8)) & 0xff]++] =
+                    sort->keys[i];
+
+        tmp = sort->keys;
+        sort->keys = sort->tmp;
+        sort->tmp = tmp;
+    }
+
+    /* the rest of the pathmd5 only matters for the few keys that share the
+     * sorted bytes, which are next to each other now */
+    for (i = 1; i < sort->count; i++)
+    {
+        if (sort->keys[i].prefix != sort->keys[i - 1].prefix)
+            continue;
+        k = sort->keys[i];
+        for (j = i; j > 0 && sort->keys[j - 1].prefix == k.prefix &&
+                memcmp(key_md5(sort, &sort->keys[j - 1]), key_md5(sort, &k),
+                    MD5_DIGEST_LENGTH) > 0; j--)
+            sort->keys[j] = sort->keys[j - 1];
+        sort->keys[j] = k;
+    }
+}
+
+
+int spill(struct io_sort *sort)
+{
+    struct run *runs;
+    const struct rec *rec;
+    FILE *f;
+    size_t i;
+
+    if ((runs = realloc(sort->runs, (sort->nruns + 1) * sizeof(struct run)))
+            == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+    sort->runs = runs;
+
+    radix(sort);
+    if ((f = spill_file()) == NULL)
+        return -1;
+
+    for (i = 0; i < sort->count; i++)
+    {
+        rec = (const struct rec *) (sort->buf + sort->keys[i].off);
+        if (fwrite(rec, sizeof(struct rec) + rec->len, 1, f) != 1)
+            break;
+    }
+    if (i < sort->count || fflush(f) != 0)
+    {
+        log_error("cannot write a sorted run of '%s'", sort->path);
+        fclose(f);
+        return -1;
+    }
+    rewind(f);
+
+    memset(&sort->runs[sort->nruns], 0, sizeof(struct run));
+    sort->runs[sort->nruns++].f = f;
+
+    sort->used = 0;
+    sort->count = 0;
+    sort->inorder = 1;
+    return 0;
+}
+
+
+FILE *spill_file(void)
+{
+    char path[PATH_MAX];
+    const char *dir;
+    FILE *f;
+    int fd;
+
+    if ((dir = getenv("TMPDIR")) == NULL || *dir == '\0')
+        dir = "/tmp";
+    if ((size_t) snprintf(path, sizeof(path), "%s/dcp-sort.XXXXXX", dir) >=
+            sizeof(path))
+    {
+        log_errorx("TMPDIR '%s' is too long", dir);
+        return NULL;
+    }
+
+    if ((fd = mkstemp(path)) == -1)
+    {
+        log_error("cannot create a temporary file in '%s'", dir);
+        return NULL;
+    }
+
+    /* it is gone once closed, however dcp ends */
+    unlink(path);
+    if ((f = fdopen(fd, "w+")) == NULL)
+    {
+        log_error("fdopen");
+        close(fd);
+    }
+    return f;
+}
+
+
+int run_read(struct io_sort *sort, struct run *run)
+{
+    char *line;
+
+    if (fread(&run->rec, sizeof(struct rec), 1, run->f) != 1)
+    {
+        if (ferror(run->f))
+        {
+            log_error("cannot read a sorted run of '%s'", sort->path);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (run->rec.len > run->cap)
+    {
+        if ((line = realloc(run->line, run->rec.len)) == NULL)
+        {
+            log_error("malloc");
+            return -1;
+        }
+        run->line = line;
+        run->cap = run->rec.len;
+    }
+
+    /* the padding that kept the buffer aligned is not written out */
+    if (fread(run->line, run->rec.len, 1, run->f) != 1)
+    {
+        log_error("cannot read a sorted run of '%s'", sort->path);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+void sift_down(struct io_sort *sort, size_t i)
+{
+    size_t least;
+    size_t child;
+    size_t tmp;
+
+    for (;;)
+    {
+        least = i;
+        child = 2 * i + 1;
+        if (child < sort->nheap &&
+                run_less(sort, sort->heap[child], sort->heap[least]))
+            least = child;
+        if (child + 1 < sort->nheap &&
+                run_less(sort, sort->heap[child + 1], sort->heap[least]))
+            least = child + 1;
+        if (least == i)
+            return;
+
+        tmp = sort->heap[i];
+        sort->heap[i] = sort->heap[least];
+        sort->heap[least] = tmp;
+        i = least;
+    }
+}
+
+
+int run_less(const struct io_sort *sort, size_t a, size_t b)
+{
+    int c;
+
+    c = memcmp(sort->runs[a].rec.entry.pathmd5, sort->runs[b].rec.entry.pathmd5,
+            MD5_DIGEST_LENGTH);
+
+    /* the earlier run was read first */
+    return c < 0 || (c == 0 && a < b);
+}
+
+
+const uint8_t *key_md5(const struct io_sort *sort, const struct key *key)
+{
+    return ((const struct rec *) (sort->buf + key->off))->entry.pathmd5;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * API for reading the entries of a manifest, the output of dcp, in pathmd5
+ * order whatever its size. The entries are read into a buffer of bounded size
+ * which is radix sorted and written out as a run to a temporary file each time
+ * it fills up. The runs are then merged as they are read. A manifest that fits
+ * in the buffer is never written out, one already sorted can be streamed as is.
+ *
+ * Entries with the same pathmd5 come in the order they are in the manifest, so
+ * the last one is the newest.
+ */
+#ifndef IO_SORT_H__
+#define IO_SORT_H__
+
+
+#include <stddef.h>
+
+#include "../entry.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * default # of bytes an io_sort_t buffers entries in
+ */
+#define IO_SORT_MEMORY (256 * 1024 * 1024)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * a manifest read in pathmd5 order
+ */
+typedef struct io_sort io_sort_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Open the manifest at `path` and, unless `sorted`, sort it. Temporary files
+ * are created in $TMPDIR, /tmp when it is not set, and are gone once closed.
+ *
+ * @param sort      where to store the sorted manifest
+ * @param path      the manifest to read
+ * @param memory    # of bytes to buffer entries in, the sort needs 32 bytes
+ *                  more for each
+ * @param sorted    the manifest is already in pathmd5 order, it is streamed
+ *                  and reading it fails at the first entry out of order
+ *
+ * @return          0 on success, -1 on failure
+ */
+int io_sort_open(io_sort_t **sort, const char *path, size_t memory,
+        int sorted);
+
+
+/**
+ * Get the next entry.
+ *
+ * @param sort      the sorted manifest
+ * @param entry     set to the entry, valid until the next call
+ * @param line      set to the entry's line with its '\n', valid until the
+ *                  next call
+ * @param len       set to the length of `line`
+ *
+ * @return          1 with an entry, 0 when there are no more, -1 on failure
+ */
+int io_sort_next(io_sort_t *sort, const entry_t **entry, const char **line,
+        size_t *len);
+
+
+/**
+ * close the manifest and remove its temporary files, NULL is ignored
+ */
+void io_sort_close(io_sort_t *sort);
+
+
+#endif
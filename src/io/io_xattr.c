@@ -8,88 +8,331 @@
  * Implementation of the io_xattr.h interface. Entries in dcp input and output
  * are an entry in the filesystem that was copied/duplicated. For each
  * file and symbolic link we log xattr information about each as a single line
- * json object.
+ * json object. Values repeated across files are written once and referred
+ * to by id after that, @see io_xattr.h.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
 #include <jansson.h>
-#include <openssl/bio.h>
-#include <openssl/evp.h>
 
 #include "io_xattr.h"
+#include "base64.h"
 #include "../digest.h"
 #include "pack.h"
 #include "../logging.h"
 
 
+/* Type Defs ******************************************************************/
+
+
+/**
+ * a distinct name and value, its id is its index + 1
+ */
+struct dict_entry {
+    char *name;
+    unsigned char *value;
+    size_t size;
+    uint64_t hash;
+};
+
+
+struct io_xattr_dict {
+    struct dict_entry *entries;
+    size_t count;           /**< # of ids given out or read */
+    size_t cap;             /**< # of `entries` allocated */
+    size_t *slots;          /**< open addressed ids by hash, 0 when empty */
+    size_t nslots;          /**< a power of 2 */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * @return              the FNV-1a hash of `name` and `value`
+ */
+static uint64_t dict_hash(const char *name, const void *value, size_t size);
+
+
+/**
+ * Look `name` and `value` up, adding them when there is still room.
+ *
+ * @param id            set to their id, 0 when they are not kept
+ * @param added         set when they were added by this call
+ *
+ * @return              0 on success, -1 on error
+ */
+static int dict_intern(io_xattr_dict_t *dict, const char *name,
+        const void *value, size_t size, size_t *id, int *added);
+
+
+/**
+ * Set what `id` stands for, growing the dictionary to hold it.
+ *
+ * @return              0 on success, -1 on error
+ */
+static int dict_define(io_xattr_dict_t *dict, size_t id, const char *name,
+        const void *value, size_t size);
+
+
+/**
+ * write `valuebuffer` as base64 to the stream
+ *
+ * @return              0 on success, -1 on error
+ */
+static int write_value(const char *name, const void *valuebuffer,
+        ssize_t valuesize, FILE *stream);
+
+
 /* Public Impl ****************************************************************/
 
 
+int io_xattr_dict_create(io_xattr_dict_t **dict)
+{
+    if ((*dict = calloc(1, sizeof(struct io_xattr_dict))) == NULL)
+    {
+        log_error("malloc");
+        return -1;
+    }
+    return 0;
+}
+
+
+void io_xattr_dict_free(io_xattr_dict_t *dict)
+{
+    size_t i;
+
+    if (dict == NULL)
+        return;
+
+    for (i = 0; i < dict->count; i++)
+    {
+        free(dict->entries[i].name);
+        free(dict->entries[i].value);
+    }
+    free(dict->entries);
+    free(dict->slots);
+    free(dict);
+}
+
+
 int io_entry_write_xattr_fields(const void *pathmd5, const char *name,
-        void *valuebuffer, ssize_t valuesize, FILE *stream)
+        void *valuebuffer, ssize_t valuesize, io_xattr_dict_t *dict,
+        FILE *stream)
 {
     int ret;
-    int w;
+    int added;
+    size_t id;
 
     /* where to store the hex representation of the path md5 sum */
     char buf[(MD5_DIGEST_LENGTH * 2) + 1];
 
-    /* we store the xattr value as base64 */
-    BIO *bio, *b64;
-
     /* used to properly escape the utf-8 name of an xattr */
     json_t *escaped;
 
     ret = 0;
-    b64 = NULL;
+    id = 0;
+    added = 1;
+    if (valuesize < 0)
+        valuesize = 0;
+
+    /* a name that cannot be written must not be given an id */
+    escaped = NULL;
+    if (name != NULL && (escaped = json_string(name)) == NULL)
+    {
+        log_errorx("non valid utf-8 xattr string '%s'", name);
+        ret = -1;
+    }
+
+    /* only the id of a value already written is needed */
+    if (escaped != NULL && dict != NULL &&
+            valuesize <= IO_XATTR_DICT_VALUE_MAX &&
+            dict_intern(dict, name, valuebuffer, valuesize, &id, &added) != 0)
+    {
+        json_decref(escaped);
+        return -1;
+    }
 
     /* we are writing a json object on the line */
     fputc('{', stream);
 
     unpack(buf, pathmd5, MD5_DIGEST_LENGTH);
-    fprintf(stream, "\"pathmd5\":\"%s\",", buf);
+    fprintf(stream, "\"pathmd5\":\"%s\"", buf);
+
+    if (id != 0)
+        fprintf(stream, ",\"xattrId\":%zu", id);
 
-    if (name != NULL)
+    if (ret != 0)
+        goto cleanup;
+
+    if (escaped != NULL && added)
     {
-        if ((escaped = json_string(name)) == NULL)
+        fputs(",\"xattrName\":", stream);
+        json_dumpf(escaped, stream, JSON_ENCODE_ANY);
+    }
+
+    if (valuesize > 0 && added)
+        ret = write_value(name, valuebuffer, valuesize, stream);
+
+
+cleanup:
+    json_decref(escaped);
+
+    /* print a newline our record separator */
+    fputs("}\n", stream);
+    return ret;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+uint64_t dict_hash(const char *name, const void *value, size_t size)
+{
+    const unsigned char *p;
+    uint64_t h;
+    size_t i;
+
+    h = 14695981039346656037ULL;
+    for (p = (const unsigned char *) name; *p != '\0'; p++)
+        h = (h ^ *p) * 1099511628211ULL;
+    h *= 1099511628211ULL;      /* the '\0' ending the name */
+    for (p = value, i = 0; i < size; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+
+int dict_intern(io_xattr_dict_t *dict, const char *name, const void *value,
+        size_t size, size_t *id, int *added)
+{
+    struct dict_entry *entry;
+    size_t *slots;
+    size_t nslots;
+    size_t mask;
+    size_t i;
+    size_t j;
+    uint64_t h;
+
+    h = dict_hash(name, value, size);
+    mask = dict->nslots - 1;
+    for (i = h & mask; dict->nslots > 0 && dict->slots[i] != 0;
+            i = (i + 1) & mask)
+    {
+        entry = &dict->entries[dict->slots[i] - 1];
+        if (entry->hash == h && entry->size == size &&
+                memcmp(entry->value, value, size) == 0 &&
+                strcmp(entry->name, name) == 0)
         {
-            log_errorx("non valid utf-8 xattr string '%s'", name);
-            ret = -1;
-            goto cleanup;
+            *id = dict->slots[i];
+            *added = 0;
+            return 0;
         }
-        fputs("\"xattrName\":", stream);
-        json_dumpf(escaped, stream, JSON_ENCODE_ANY);
-        json_decref(escaped);
     }
 
-    if (valuesize > 0)
+    /* a full dictionary writes the new values in full */
+    *id = 0;
+    *added = 1;
+    if (dict->count == IO_XATTR_DICT_MAX)
+        return 0;
+
+    /* keep the table at most half full */
+    if ((dict->count + 1) * 2 > dict->nslots)
     {
-        fputs(",\"xattrValue\":\"", stream);
-        /*
-         * base64 encoding
-         * https://www.openssl.org/docs/manmaster/crypto/BIO_f_base64.html
-         */
-        b64 = BIO_new(BIO_f_base64());
-        BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL); /* do not append newline */
-        bio = BIO_new_fp(stream, BIO_NOCLOSE);      /* do not close stream */
-        BIO_push(b64, bio);
-        if ((w = BIO_write(b64, valuebuffer, valuesize)) != valuesize)
+        nslots = dict->nslots == 0? 64 : dict->nslots * 2;
+        if ((slots = calloc(nslots, sizeof(size_t))) == NULL)
         {
-            log_errorx("cannot base64 encode xattr value for attr: '%s'", name);
-            ret = -1;
+            log_error("malloc");
+            return -1;
         }
-        BIO_flush(b64);
-        BIO_free_all(b64);
-        fputc('"', stream);
+        for (j = 0; j < dict->count; j++)
+        {
+            for (i = dict->entries[j].hash & (nslots - 1); slots[i] != 0;
+                    i = (i + 1) & (nslots - 1))
+                ;
+            slots[i] = j + 1;
+        }
+        free(dict->slots);
+        dict->slots = slots;
+        dict->nslots = nslots;
+        for (i = h & (nslots - 1); slots[i] != 0; i = (i + 1) & (nslots - 1))
+            ;
     }
 
+    if (dict_define(dict, dict->count + 1, name, value, size) != 0)
+        return -1;
+    dict->entries[dict->count - 1].hash = h;
+    dict->slots[i] = dict->count;
+    *id = dict->count;
+    return 0;
+}
 
-cleanup:
-    /* print a newline our record separator */
-    fputs("}\n", stream);
+
+int dict_define(io_xattr_dict_t *dict, size_t id, const char *name,
+        const void *value, size_t size)
+{
+    struct dict_entry *entry;
+    struct dict_entry *tmp;
+    size_t cap;
+    char *n;
+    unsigned char *v;
+
+    if (id > dict->cap)
+    {
+        cap = dict->cap == 0? 64 : dict->cap;
+        while (cap < id)
+            cap *= 2;
+        if ((tmp = realloc(dict->entries, cap * sizeof(*tmp))) == NULL)
+        {
+            log_error("malloc");
+            return -1;
+        }
+        memset(tmp + dict->cap, 0, (cap - dict->cap) * sizeof(*tmp));
+        dict->entries = tmp;
+        dict->cap = cap;
+    }
+
+    n = strdup(name);
+    v = malloc(size > 0? size : 1);
+    if (n == NULL || v == NULL)
+    {
+        free(n);
+        free(v);
+        log_error("malloc");
+        return -1;
+    }
+    memcpy(v, value, size);
+
+    entry = &dict->entries[id - 1];
+    free(entry->name);
+    free(entry->value);
+    entry->name = n;
+    entry->value = v;
+    entry->size = size;
+    if (id > dict->count)
+        dict->count = id;
+    return 0;
+}
+
+
+int write_value(const char *name, const void *valuebuffer, ssize_t valuesize,
+        FILE *stream)
+{
+    int ret;
+
+    /* we store the xattr value as base64, encoded straight into the stream */
+    ret = 0;
+    fputs(",\"xattrValue\":\"", stream);
+    if (base64_write(valuebuffer, valuesize, stream) != 0)
+    {
+        log_errorx("cannot base64 encode xattr value for attr: '%s'", name);
+        ret = -1;
+    }
+    fputc('"', stream);
     return ret;
 }
@@ -7,6 +7,17 @@
  *
  * API for reading and writing extended attributes to a stream. Each attribute
  * is written as a JSON Object with the path's md5.
+ *
+ * Trees often give the same value of an attribute, a SELinux label or an ACL,
+ * to most of their files. Written with a dictionary each distinct name and
+ * value is written once, by the first record that has it, along with an
+ * "xattrId". The records after it only give that id:
+ *
+ *      {"pathmd5":"...","xattrId":1,"xattrName":"...","xattrValue":"..."}
+ *      {"pathmd5":"...","xattrId":1}
+ *
+ * An id means what the last record to define it said, so the outputs of a
+ * --shard copy concatenated by dcp-merge still read back right.
  */
 #ifndef IO_XATTR_H__
 #define IO_XATTR_H__
@@ -15,9 +26,48 @@
 #include <stddef.h>
 #include <sys/types.h>
 
+
+/* Macros *********************************************************************/
+
+
+/**
+ * largest value the dictionary keeps, bigger ones are written in full
+ */
+#define IO_XATTR_DICT_VALUE_MAX 4096
+
+
+/**
+ * max # of distinct values the dictionary keeps, later ones are written in full
+ */
+#define IO_XATTR_DICT_MAX (64 * 1024)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the distinct names and values seen on a stream and their ids
+ */
+typedef struct io_xattr_dict io_xattr_dict_t;
+
+
 /* Public API *****************************************************************/
 
 
+/**
+ * Create an empty dictionary, one per stream written.
+ *
+ * @return              0 on success, -1 on error
+ */
+int io_xattr_dict_create(io_xattr_dict_t **dict);
+
+
+/**
+ * release the dictionary, NULL is ignored
+ */
+void io_xattr_dict_free(io_xattr_dict_t *dict);
+
+
 /**
  * write the following fields as a JSON object to the stream
  *
@@ -25,12 +75,14 @@
  * @param name          the name of the xattr field
  * @param valuebuffer   the contents of the xattr field
  * @param valuesize     the size of the xattr field
+ * @param dict          the stream's dictionary, NULL to write the value
  * @param stream        where to write the json object
  *
  * @return              0 on success, -1 on error
  */
 int io_entry_write_xattr_fields(const void *pathmd5, const char *name,
-        void *valuebuffer, ssize_t valuesize, FILE *stream);
+        void *valuebuffer, ssize_t valuesize, io_xattr_dict_t *dict,
+        FILE *stream);
 
 
 #endif
@@ -11,8 +11,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <sys/xattr.h>
-#include <linux/limits.h>
 
 #include "io_dcp_processor.h"
 #include "entry.h"
@@ -31,29 +29,46 @@
 struct io_dcp_processor_ctx {
     FILE *out;      /**< where to write each file system entry info to */
     FILE *xattrout; /**< where to write xattr values for paths */
+    io_xattr_dict_t *dict; /**< the values already written to xattrout */
 };
 
 
 /* Private API ****************************************************************/
 
 
-static int process_xattrs(const void *pathmd5, const char *filepath, FILE *out);
+/**
+ * write `xattrs` to the xattr stream of `ctx`, the stream is flushed when it
+ * is closed or a batch is done
+ */
+static void process_xattrs(struct io_dcp_processor_ctx *ctx,
+        const void *pathmd5, const xattrs_t *xattrs);
 
 
 /* Public Impl ****************************************************************/
 
 
-int io_dcp_processor(dcp_state_t state, const void *pathmd5,
-        const char *dapath, const struct stat *st, const char *accesspath,
-        const char *symlinkpath, const void *md5, const void *sha1,
-        const void *sha256, const void *sha512, unsigned long process_time,
-        void *context)
+int io_dcp_processor(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *st, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context)
 {
     struct io_dcp_processor_ctx *ctx = context;
-    process_xattrs(pathmd5, accesspath, ctx->xattrout);
+    const char *names[DCP_MAX_DESTS];
+    size_t i;
+
+    (void) accesspath;
 
-    return io_entry_write_fields(dcp_strstate(state), dapath, st, pathmd5,
-            symlinkpath, md5, sha1, sha256, sha512, process_time, ctx->out);
+    if (xattrs != NULL && ctx->xattrout != NULL)
+        process_xattrs(ctx, pathmd5, xattrs);
+
+    for (i = 0; i < ndests; i++)
+        names[i] = dcp_strstate(dests[i]);
+
+    return io_entry_write_fields(dcp_strstate(state), names, ndests, dapath,
+            st, pathmd5, symlinkpath, md5, sha1, sha256, sha512, process_time,
+            offset, ctx->out);
 }
 
 
@@ -65,7 +80,7 @@ int io_dcp_processor_ctx_create(io_dcp_processor_ctx_t **ctx, FILE *stream,
         *ctx = malloc(sizeof(struct io_dcp_processor_ctx));
         (*ctx)->out = stream;
         (*ctx)->xattrout = xattrstream;
-        return 0;
+        return io_xattr_dict_create(&(*ctx)->dict);
     }
     return -1;
 }
@@ -74,7 +89,10 @@ int io_dcp_processor_ctx_create(io_dcp_processor_ctx_t **ctx, FILE *stream,
 int io_dcp_processor_ctx_free(io_dcp_processor_ctx_t *ctx)
 {
     if (ctx != NULL)
+    {
+        io_xattr_dict_free(ctx->dict);
         free(ctx);
+    }
     return 0;
 }
 
@@ -82,42 +100,18 @@ int io_dcp_processor_ctx_free(io_dcp_processor_ctx_t *ctx)
 /* Private Impl **************************************************************/
 
 
-int process_xattrs(const void *pathmd5, const char *filepath, FILE *out)
+void process_xattrs(struct io_dcp_processor_ctx *ctx, const void *pathmd5,
+        const xattrs_t *xattrs)
 {
-    char keys[XATTR_LIST_MAX];
-    size_t keysbuffersize = XATTR_LIST_MAX;
-    uint8_t valuebuffer[XATTR_SIZE_MAX];
-    size_t valuebuffersize = XATTR_SIZE_MAX;
-    ssize_t bufsize, valuesize;
-    char *next, *end;
-
-    if (filepath == NULL)
-        return 0; /* Nothing to do */
-
-    if ((bufsize = llistxattr(filepath, keys, keysbuffersize)) == 0)
-        return 0;
-    else if (bufsize < 0)
-    {
-        /* xattrs not supported or disabled for this file, success */
-        if (errno == ENOTSUP)
-            return 0;
-        log_error("llistxattr");
-        return -1;
-    }
+    const char *name;
+    const void *value;
+    size_t size;
+    size_t i;
 
-    end = keys + bufsize; /* pointer to the end of the list */
-
-    /* keys is one large string with '\0' delimited names */
-    for (next = keys; next < end; next += (strlen(next) + 1))
+    for (i = 0; i < xattrs_count(xattrs); i++)
     {
-        memset(valuebuffer, 0, valuebuffersize);
-        valuesize = lgetxattr(filepath, next, valuebuffer, valuebuffersize);
-        if (valuesize < 0)
-            log_error("lgetxattr");
-        else
-            io_entry_write_xattr_fields(pathmd5,next,valuebuffer,valuesize-1,out);
+        name = xattrs_get(xattrs, i, &value, &size);
+        io_entry_write_xattr_fields(pathmd5, name, (void *) value,
+                (ssize_t) size - 1, ctx->dict, ctx->xattrout);
     }
-
-    fflush(out);
-    return 0;
 }
@@ -35,26 +35,33 @@ typedef struct io_dcp_processor_ctx io_dcp_processor_ctx_t;
  * FILE stream. Outputs each entry using @see io_entry.h.
  *
  * @param state             the resulting state of processing, @see impl/dcp.h
+ * @param dests             the state at each --dest, NULL without any
+ * @param ndests            # of `dests`
  * @param pathmd5           the md5 sum of the file's dapath
  * @param dapath            mount relative path to the file to be copied
  * @param st                stat struct for the source file
  * @param accesspath        path to the original file
+ * @param xattrs            the extended attributes of the file, NULL if they
+ *                          were not read
  * @param symlinkpath       if file is a symbolic link, where is it pointing
  * @param md5               md5 digest of the file
  * @param sha1              sha1 digest of the file
  * @param sha256            sha256 digest of the file
  * @param sha512            sha512 digest of the file
  * @param elapsed           secs to process the entry, ignored if NULL
+ * @param offset            where the entry starts in the --tar archive, -1
+ *                          when there is none
  * @param context           pointer to an initialized io_digest_output_context_t
  *                          instance
  *
  * @return                  0 on success
  */
-int io_dcp_processor(dcp_state_t state, const void *pathmd5,
-        const char *dapath, const struct stat *st, const char *accesspath,
-        const char *symlinkpath, const void *md5, const void *sha1,
-        const void *sha256, const void *sha512, unsigned long process_time,
-        void *context);
+int io_dcp_processor(dcp_state_t state, const dcp_state_t *dests,
+        size_t ndests, const void *pathmd5, const char *dapath,
+        const struct stat *st, const char *accesspath,
+        const xattrs_t *xattrs, const char *symlinkpath, const void *md5,
+        const void *sha1, const void *sha256, const void *sha512,
+        unsigned long process_time, off_t offset, void *context);
 
 
 /**
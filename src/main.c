@@ -20,6 +20,7 @@
 #include <grp.h>
 #include <limits.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -36,6 +37,9 @@
 #include "io_dcp_processor.h"
 #include "logging.h"
 #include "impl/dcp.h"
+#include "impl/durable.h"
+#include "impl/tar.h"
+#include "impl/update.h"
 
 
 /* MACROS *********************************************************************/
@@ -60,25 +64,58 @@ struct mainopts {
     const char **files;     /**< all the source paths specified.              */
     ssize_t filecount;      /**< number of source paths                       */
     const char *dest;       /**< path to where we are copying the source to   */
+    const char **dests;     /**< more paths to copy the source to             */
+    size_t destcount;       /**< # of --dest given                            */
     int digests;            /**< mask of what digests dcp should calculate   */
     const char **inputs;    /**< result files from previous runs of dcp     */
     size_t inputcount;      /**< # input files specified                      */
+    int deleted;            /**< report what the inputs have that is gone     */
     FILE *outputstream;     /**< where we should write results to             */
     char *outfilename;      /**< the output file that outputstream is writing */
     FILE *xattroutputstream;/**< where we should write xattr results to       */
     char *xattroutfilename; /**< the output file that xattroutputstream is writing to */
+    int copy_xattrs;        /**< set the xattrs on the copies too             */
+    const char **xattr_filters; /**< which xattrs are copied                  */
+    size_t nxattr_filters;  /**< # of --xattr-filter given                    */
 
     uid_t uid;              /**< id of who will own the copies                */
     gid_t gid;              /**< id of what group will own the copies         */
     char *username;         /**< who will own the copies                      */
     char *groupname;        /**< what group will own the copies               */
+    int preserve;           /**< keep the mode, times and owner of sources */
 
     size_t cache_size;      /**< how much memory to set aside for caching     */
+    size_t prefetch;        /**< max # of files to prefetch, 0 disables       */
+    int cached_first;       /**< hash files in the page cache first           */
+    size_t async;           /**< max # of files in flight, 0 disables         */
+    size_t meta_batch;      /**< max # of metadata requests, 0 disables       */
+    int two_phase;          /**< walk first then copy in parallel passes      */
+    size_t jobs;            /**< # of threads, 0 for one per cpu              */
+    int parallel_src;       /**< walk the sources at once                     */
+    size_t stream;          /**< size of directories to stream, 0 disables    */
+    size_t shard;           /**< which share of the copy to do                */
+    size_t shards;          /**< # of shares, 0 when not sharding             */
+    const char *files_from; /**< list of the entries to copy, NULL walks      */
+    int watch;              /**< keep copying what changes in the source      */
+    long watch_delay;       /**< ms without a change that ends a batch        */
+    int engines[ENGINE_CLASSES]; /**< engine for each size class              */
+    int autotune;           /**< time the engines to fill in `engines`        */
+    int sync;               /**< durable_mode_t, how the copies are synced    */
+    int atomic;             /**< name the copies once complete                */
+    int update;             /**< update_mode_t, how a current copy is found   */
+    const char *tar;        /**< archive written instead, NULL to copy        */
 
     int verbose_mode;       /**< should we output what is being done          */
 };
 
 
+/* Static Vars ****************************************************************/
+
+
+/* set by SIGINT or SIGTERM while watching */
+static volatile sig_atomic_t STOPPED;
+
+
 /* Private API ****************************************************************/
 
 
@@ -101,7 +138,32 @@ static FILE  *parse_xattroutputstream(const struct cmdline_info *info,
 		char **xattroutfilename);
 static gid_t  parse_group(const struct cmdline_info *info, char **name);
 static uid_t  parse_owner(const struct cmdline_info *info, char **name);
+static size_t parse_size(const char *val, const char *what);
 static size_t parse_cache_size(const struct cmdline_info *info);
+static size_t parse_prefetch(const struct cmdline_info *info);
+static size_t parse_async(const struct cmdline_info *info);
+static size_t parse_meta_batch(const struct cmdline_info *info);
+static size_t parse_jobs(const struct cmdline_info *info);
+static size_t parse_stream(const struct cmdline_info *info);
+static void   parse_shard(const struct cmdline_info *info, size_t *shard,
+        size_t *shards);
+static int    parse_engines(const struct cmdline_info *info,
+        int engines[ENGINE_CLASSES]);
+static int    parse_sync(const struct cmdline_info *info);
+static int    parse_update(const struct cmdline_info *info);
+
+/**
+ * time the copy engines on the sources and destination and keep the fastest
+ * for each size class
+ */
+static void autotune(struct mainopts *opts);
+
+
+/**
+ * @return          1 if the manifest names the copy engines, they copy the
+ *                  regular files and were chosen rather than left to rw
+ */
+static int engines_named(const struct mainopts *opts);
 
 static index_t *build_index(int digests, const char *paths[], size_t count);
 
@@ -110,6 +172,29 @@ static void mainopts_cleanup(struct mainopts *opts);
 
 static int dcp_main(const struct mainopts *opts, int argc, const char *argv[]);
 
+/**
+ * Copy the batches of changes `watch` reports until SIGINT or SIGTERM. The
+ * signals are only taken between batches, a batch is always finished and
+ * written out.
+ *
+ * @return          0 when stopped and every batch copied, -1 otherwise
+ */
+static int follow(watch_t *watch, const struct mainopts *opts,
+        const char *dest, struct dcp_options *dcpopts,
+        io_dcp_processor_ctx_t *ctx);
+
+/**
+ * signal handler ending follow
+ */
+static void stop(int sig);
+
+/**
+ * With --sync mark the outputs durable once everything reported in them is,
+ * with a `durable` metadata line, and sync the outputs themselves. Readers
+ * can trust the entries above the last such line to have survived a crash.
+ */
+static void seal(const struct mainopts *opts);
+
 /**
  * for dcp we want `dcp src dest` to be the same as `dcp src dest/src` where
  * dest exists in both. To make this happen before we call dcp we will create
@@ -133,6 +218,8 @@ int main(int argc, const char *argv[])
      * a dcp_options struct */
     cmdline_parser(argc, (char **) argv, &info);
     mainopts_parse(&opts, &info);
+    if (opts.autotune)
+        autotune(&opts);
     r = dcp_main(&opts, argc, argv);
     mainopts_cleanup(&opts);
     cmdline_parser_free(&info);
@@ -143,24 +230,14 @@ int main(int argc, const char *argv[])
 /* Private Impl ***************************************************************/
 
 
-size_t parse_cache_size(const struct cmdline_info *info)
+size_t parse_size(const char *val, const char *what)
 {
     size_t size;
-    const char *val;
     char *end;
 
-    size = 32768; /* default if not specified */
-
-    val = getenv(ENV_CACHE_SIZE);
-    if (info->cache_size_given)
-        val = info->cache_size_arg;
-
-    if (val == NULL)
-        return size;
-
     size = strtol(val, &end, 0);
     if (val == end)
-        log_critx(EXIT_FAILURE, "invalid cache size: '%s'", val);
+        log_critx(EXIT_FAILURE, "invalid %s size: '%s'", what, val);
 
     switch (*end)
     {
@@ -169,13 +246,234 @@ size_t parse_cache_size(const struct cmdline_info *info)
     case 'm':  case 'M':    size *= (1024 * 1024);          break;
     case 'g':  case 'G':    size *= (1024 * 1024 * 1024);   break;
     default:
-        log_critx(EXIT_FAILURE, "invalid cache suffix: '%s'", val);
+        log_critx(EXIT_FAILURE, "invalid %s suffix: '%s'", what, val);
     }
 
     return size;
 }
 
 
+size_t parse_cache_size(const struct cmdline_info *info)
+{
+    const char *val;
+
+    val = getenv(ENV_CACHE_SIZE);
+    if (info->cache_size_given)
+        val = info->cache_size_arg;
+
+    if (val == NULL)
+        return 32768; /* default if not specified */
+
+    return parse_size(val, "cache");
+}
+
+
+size_t parse_stream(const struct cmdline_info *info)
+{
+    if (!info->stream_given)
+        return 0;
+
+    return parse_size(info->stream_arg, "stream");
+}
+
+
+void parse_shard(const struct cmdline_info *info, size_t *shard,
+        size_t *shards)
+{
+    char extra;
+
+    *shard = 0;
+    *shards = 0;
+    if (!info->shard_given)
+        return;
+
+    if (sscanf(info->shard_arg, "%zu/%zu%c", shard, shards, &extra) != 2 ||
+            *shards == 0 || *shard >= *shards)
+        log_critx(EXIT_FAILURE, "invalid shard: '%s', expected I/N with "
+                "0 <= I < N", info->shard_arg);
+}
+
+
+int parse_engines(const struct cmdline_info *info, int engines[ENGINE_CLASSES])
+{
+    int engine;
+    int i;
+
+    engine = ENGINE_RW;
+    if (info->engine_given && strcmp(info->engine_arg, "auto") != 0 &&
+            (engine = engine_find(info->engine_arg)) == -1)
+        log_critx(EXIT_FAILURE, "invalid copy engine: '%s'", info->engine_arg);
+
+    /* auto starts from rw for the classes it finds nothing to time on */
+    for (i = 0; i < ENGINE_CLASSES; i++)
+        engines[i] = engine;
+
+    return info->engine_given && strcmp(info->engine_arg, "auto") == 0;
+}
+
+
+int parse_sync(const struct cmdline_info *info)
+{
+    int mode;
+
+    if (!info->sync_given)
+        return DURABLE_NONE;
+
+    if ((mode = durable_find(info->sync_arg)) == -1)
+        log_critx(EXIT_FAILURE, "invalid sync mode: '%s', expected none, "
+                "file, batch or fs", info->sync_arg);
+    return mode;
+}
+
+
+int parse_update(const struct cmdline_info *info)
+{
+    int mode;
+
+    if (!info->update_given)
+        return UPDATE_NONE;
+
+    if ((mode = update_find(info->update_arg)) == -1)
+        log_critx(EXIT_FAILURE, "invalid update mode: '%s', expected time or "
+                "digest", info->update_arg);
+    return mode;
+}
+
+
+void autotune(struct mainopts *opts)
+{
+    struct stat st;
+    char *dir;
+    char *slash;
+    void *buf;
+
+    /* engines are only used when there is no index to check against */
+    if (opts->inputs != NULL)
+    {
+        log_warnx("--engine is ignored with --input");
+        return;
+    }
+
+    /* nor when the bytes read are written to more than one destination */
+    if (opts->destcount > 0)
+    {
+        log_warnx("--engine is ignored with --dest");
+        return;
+    }
+
+    /* nor when the files are copied through io_uring */
+    if (opts->async > 0)
+    {
+        log_warnx("--engine is ignored with --async");
+        return;
+    }
+
+    dir = strdup(opts->dest);
+    buf = malloc(opts->cache_size);
+    if (dir == NULL || buf == NULL)
+    {
+        log_error("cannot time the copy engines");
+        free(dir);
+        free(buf);
+        return;
+    }
+
+    /* the copy goes into dest, or next to it when it does not exist yet */
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        if ((slash = strrchr(dir, '/')) == NULL)
+            strcpy(dir, ".");
+        else if (slash == dir)
+            slash[1] = '\0';
+        else
+            *slash = '\0';
+    }
+
+    if (engine_probe(opts->files, opts->filecount, dir, opts->digests, buf,
+            opts->cache_size, opts->engines) != 0)
+        log_warnx("cannot time the copy engines, copying with rw");
+
+    free(buf);
+    free(dir);
+}
+
+
+int engines_named(const struct mainopts *opts)
+{
+    int i;
+
+    /*
+     * the index and --update digest hash before copying, --dest writes what
+     * was read to every destination, --async and --tar have copies of their
+     * own
+     */
+    if (opts->inputs != NULL || opts->update == UPDATE_DIGEST ||
+            opts->destcount > 0 || opts->async > 0 || opts->tar != NULL)
+        return 0;
+
+    for (i = 0; i < ENGINE_CLASSES; i++)
+        if (opts->engines[i] != ENGINE_RW)
+            return 1;
+    return opts->autotune;
+}
+
+
+size_t parse_prefetch(const struct cmdline_info *info)
+{
+    if (!info->prefetch_given)
+        return 0;
+
+    if (info->prefetch_arg < 0)
+        log_critx(EXIT_FAILURE, "invalid prefetch count: '%d'",
+                info->prefetch_arg);
+
+    return info->prefetch_arg;
+}
+
+
+size_t parse_async(const struct cmdline_info *info)
+{
+    if (!info->async_given)
+        return 0;
+
+    if (info->async_arg < 0)
+        log_critx(EXIT_FAILURE, "invalid async file count: '%d'",
+                info->async_arg);
+
+    return info->async_arg;
+}
+
+
+size_t parse_meta_batch(const struct cmdline_info *info)
+{
+    if (!info->meta_batch_given)
+        return 0;
+
+    if (info->meta_batch_arg < 0)
+        log_critx(EXIT_FAILURE, "invalid metadata batch count: '%d'",
+                info->meta_batch_arg);
+
+    return info->meta_batch_arg;
+}
+
+
+size_t parse_jobs(const struct cmdline_info *info)
+{
+    if (!info->jobs_given)
+        return 0;
+
+    if (info->jobs_arg < 1)
+        log_critx(EXIT_FAILURE, "invalid thread count: '%d'", info->jobs_arg);
+
+    if (!info->two_phase_flag && !info->parallel_src_flag &&
+            !info->files_from_given)
+        log_warnx("--jobs has no effect without --two-phase, --parallel-src or "
+                "--files-from");
+
+    return info->jobs_arg;
+}
+
+
 int parse_digests(const struct cmdline_info *info)
 {
     int digests;
@@ -333,15 +631,82 @@ int mainopts_parse(struct mainopts *opts, const struct cmdline_info *info)
                 "missing destination file operand after '%s'", info->inputs[0]);
     opts->files          = (const char **) info->inputs;
     opts->dest           = opts->files[opts->filecount];
+    opts->dests          = (const char **) info->dest_arg;
+    opts->destcount      = info->dest_given;
     opts->digests        = parse_digests(info);
     opts->outputstream   = parse_outputstream(info, &opts->outfilename);
     opts->xattroutputstream = parse_xattroutputstream(info, &opts->xattroutfilename);
+    opts->copy_xattrs    = info->copy_xattrs_flag;
+    opts->xattr_filters  = (const char **) info->xattr_filter_arg;
+    opts->nxattr_filters = info->xattr_filter_given;
+    if (opts->nxattr_filters > 0 && !opts->copy_xattrs)
+        log_critx(EXIT_FAILURE, "--xattr-filter needs --copy-xattrs");
     opts->inputs         = (const char **) info->input_arg;
     opts->inputcount     = info->input_given;
+    opts->deleted        = info->deleted_flag;
     opts->uid            = parse_owner(info, &opts->username);
     opts->gid            = parse_group(info, &opts->groupname);
+    opts->preserve       = info->preserve_flag;
     opts->cache_size     = parse_cache_size(info);
+    opts->prefetch       = parse_prefetch(info);
+    opts->cached_first   = info->cached_first_flag;
+    opts->async          = parse_async(info);
+    opts->meta_batch     = parse_meta_batch(info);
+    opts->two_phase      = info->two_phase_flag;
+    opts->jobs           = parse_jobs(info);
+    opts->parallel_src   = info->parallel_src_flag;
+    opts->stream         = parse_stream(info);
+    parse_shard(info, &opts->shard, &opts->shards);
+    opts->files_from     = info->files_from_arg;
+    if (opts->files_from != NULL && opts->filecount != 1)
+        log_critx(EXIT_FAILURE, "--files-from takes a single source");
+    opts->watch          = info->watch_flag;
+    opts->watch_delay    = info->watch_delay_arg;
+    if (opts->watch && opts->filecount != 1)
+        log_critx(EXIT_FAILURE, "--watch takes a single source");
+    if (opts->watch && opts->files_from != NULL)
+        log_critx(EXIT_FAILURE, "--watch cannot be used with --files-from");
+    if (opts->watch_delay < 0)
+        log_critx(EXIT_FAILURE, "invalid watch delay: '%ld'",
+                opts->watch_delay);
+
+    /* only a walk of the whole source finds everything that is still there */
+    if (opts->deleted && opts->inputs == NULL)
+        log_critx(EXIT_FAILURE, "--deleted needs --input");
+    if (opts->deleted && (opts->shards > 0 || opts->files_from != NULL ||
+            opts->watch))
+        log_critx(EXIT_FAILURE, "--deleted cannot be used with --shard, "
+                "--files-from or --watch");
+    opts->autotune       = parse_engines(info, opts->engines);
+    opts->sync           = parse_sync(info);
+    opts->atomic         = info->atomic_flag;
+    opts->update         = parse_update(info);
     opts->verbose_mode   = info->verbose_flag;
+
+    /* the batch thread syncs a copy after it was named, a crash could leave
+     * the name on data that never made it to disk */
+    if (opts->atomic && opts->sync == DURABLE_BATCH)
+        log_critx(EXIT_FAILURE, "--atomic cannot be used with --sync=batch");
+
+    /* an archive is written along a single walk and nothing is created at
+     * the destination */
+    opts->tar            = info->tar_arg;
+    if (opts->tar != NULL && (opts->async > 0 || opts->meta_batch > 0 ||
+            opts->two_phase || opts->parallel_src || opts->stream > 0 ||
+            opts->cached_first || opts->shards > 0 ||
+            opts->files_from != NULL || opts->watch || info->engine_given))
+        log_critx(EXIT_FAILURE, "--tar cannot be used with --async, "
+                "--meta-batch, --two-phase, --parallel-src, --stream, "
+                "--cached-first, --shard, --files-from, --watch or --engine");
+    if (opts->tar != NULL && (opts->destcount > 0 ||
+            opts->sync != DURABLE_NONE || opts->atomic ||
+            opts->update != UPDATE_NONE || opts->copy_xattrs ||
+            opts->inputs != NULL))
+        log_critx(EXIT_FAILURE, "--tar cannot be used with --dest, --sync, "
+                "--atomic, --update, --copy-xattrs or --input");
+    if (opts->tar != NULL && strcmp(opts->tar, "-") == 0 &&
+            opts->verbose_mode)
+        log_critx(EXIT_FAILURE, "--verbose cannot be used with --tar=-");
     return 0;
 }
 
@@ -365,6 +730,14 @@ int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
     io_dcp_processor_ctx_t *ctx;
     struct dcp_options dcpopts;
     char *dest;
+    char **dests;
+    char **list;
+    size_t nlist;
+    size_t i;
+    int named;
+    watch_t *watch;
+    tar_t *tar;
+    int tarfd;
 
     /* initilaize the index */
     idx = NULL;
@@ -392,12 +765,44 @@ int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
     dcpopts.digests           = opts->digests;
     dcpopts.uid               = opts->uid;
     dcpopts.gid               = opts->gid;
+    dcpopts.preserve          = opts->preserve;
+
+    /* the sources' owners are kept unless one was asked for */
+    if (opts->preserve && opts->username == NULL)
+        dcpopts.uid = (uid_t) -1;
+    if (opts->preserve && opts->groupname == NULL)
+        dcpopts.gid = (gid_t) -1;
     dcpopts.index             = idx;
     dcpopts.verbose           = opts->verbose_mode;
+    dcpopts.prefetch          = opts->prefetch;
+    dcpopts.cached_first      = opts->cached_first;
+    dcpopts.async             = opts->async;
+    dcpopts.meta_batch        = opts->meta_batch;
+    dcpopts.two_phase         = opts->two_phase;
+    dcpopts.jobs              = opts->jobs;
+    dcpopts.parallel_src      = opts->parallel_src;
+    dcpopts.shard             = opts->shard;
+    dcpopts.shards            = opts->shards;
+    dcpopts.stream            = opts->stream;
+    memcpy(dcpopts.engines, opts->engines, sizeof(dcpopts.engines));
+
+    /* only what is listed is copied, nothing is walked */
+    list = NULL;
+    nlist = 0;
+    if (opts->files_from != NULL &&
+            io_list_read(opts->files_from, &list, &nlist) != 0)
+        log_critx(EXIT_FAILURE, "cannot read the list '%s'", opts->files_from);
+    dcpopts.list              = (const char **) list;
+    dcpopts.nlist             = nlist;
 
     /* quick check and dir creation if needed, will provide an updated dest
-     * path if needed */
-    if (prepare(opts->files, opts->filecount, opts->dest, &dest) != 0)
+     * path if needed. The shards of a single source and a list copy it to
+     * dest itself whether or not it exists, @see dcp */
+    named = (opts->shards > 0 || opts->files_from != NULL) &&
+            opts->filecount == 1;
+    dest = NULL;
+    if (!named && opts->tar == NULL &&
+            prepare(opts->files, opts->filecount, opts->dest, &dest) != 0)
         log_critx(EXIT_FAILURE, "cannot prepare destination");
 
     /* if prepare was successful and didn't need to alter dest it sets dest to
@@ -405,12 +810,87 @@ int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
     if (dest == NULL)
         dest = strdup(opts->dest);
 
+    /* each further destination is prepared the same way */
+    if ((dests = calloc(opts->destcount + 1, sizeof(char *))) == NULL)
+        log_critx(EXIT_FAILURE, "cannot prepare destinations");
+    for (i = 0; i < opts->destcount; i++)
+    {
+        if (!named && prepare(opts->files, opts->filecount, opts->dests[i],
+                &dests[i]) != 0)
+            log_critx(EXIT_FAILURE, "cannot prepare destination '%s'",
+                    opts->dests[i]);
+        if (dests[i] == NULL)
+            dests[i] = strdup(opts->dests[i]);
+    }
+    dcpopts.dests             = (const char **) dests;
+    dcpopts.ndests            = opts->destcount;
+
+    /* the walk of the first copy finds every directory to watch */
+    watch = NULL;
+    if (opts->watch && watch_create(&watch, opts->files[0]) != 0)
+        log_critx(EXIT_FAILURE, "cannot watch '%s'", opts->files[0]);
+    dcpopts.watch             = watch;
+    dcpopts.deleted           = opts->deleted;
+    dcpopts.read_xattrs       = 1;
+    dcpopts.copy_xattrs       = opts->copy_xattrs;
+    dcpopts.xattr_filters     = opts->xattr_filters;
+    dcpopts.nxattr_filters    = opts->nxattr_filters;
+    dcpopts.sync              = opts->sync;
+    dcpopts.atomic            = opts->atomic;
+    dcpopts.update            = opts->update;
+
+    /* the copy goes to an archive instead, dest only names its entries */
+    tar = NULL;
+    tarfd = -1;
+    if (opts->tar != NULL)
+    {
+        tarfd = STDOUT_FILENO;
+        if (strcmp(opts->tar, "-") == 0 && isatty(tarfd))
+            log_critx(EXIT_FAILURE, "refusing to write the archive to a "
+                    "terminal");
+        if (strcmp(opts->tar, "-") != 0 && (tarfd = open(opts->tar,
+                O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+            log_crit(EXIT_FAILURE, "cannot open the archive '%s'", opts->tar);
+        if (tar_create(&tar, tarfd) != 0)
+            log_critx(EXIT_FAILURE, "cannot start the archive '%s'",
+                    opts->tar);
+    }
+    dcpopts.tar               = tar;
+
     /* Start the copy */
     r = dcp(dest, opts->files, opts->filecount, &dcpopts,
             &io_dcp_processor, ctx);
 
+    /* the archive is only whole once it was ended */
+    if (tar != NULL && tar_finish(tar) != 0)
+        r = -1;
+    tar_free(tar);
+    if (tarfd > STDOUT_FILENO && close(tarfd) != 0)
+    {
+        log_error("cannot close the archive '%s'", opts->tar);
+        r = -1;
+    }
+
+    /* what the inputs have that the walk did not find is gone */
+    if (opts->deleted && io_index_deleted(idx, opts->inputs, opts->inputcount,
+            opts->outputstream) != 0)
+        r = -1;
+
+    /* a run that failed, a sync among others, marks nothing durable */
+    if (r == 0)
+        seal(opts);
+
+    /* then copy what changes till told to stop */
+    if (watch != NULL && follow(watch, opts, dest, &dcpopts, ctx) != 0)
+        r = -1;
+    watch_free(watch);
+
     /* cleanup */
     free(dest);
+    for (i = 0; i < opts->destcount; i++)
+        free(dests[i]);
+    free(dests);
+    io_list_free(list, nlist);
     if (idx   != NULL) index_free(idx);
 
     io_dcp_processor_ctx_free(ctx);
@@ -419,6 +899,94 @@ int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
 }
 
 
+int follow(watch_t *watch, const struct mainopts *opts, const char *dest,
+        struct dcp_options *dcpopts, io_dcp_processor_ctx_t *ctx)
+{
+    struct sigaction sa;
+    sigset_t block;
+    sigset_t orig;
+    sigset_t waiting;
+    const char **list;
+    size_t count;
+    int r;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* blocked while copying, taken only while waiting for changes */
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigprocmask(SIG_BLOCK, &block, &orig);
+    waiting = orig;
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+
+    /* what the first copy found is out before waiting, each batch is
+     * appended once copied. The batches are lists of what changed, copied
+     * into the copy the first one made */
+    r = 0;
+    dcpopts->watch = NULL;
+    do {
+        if (opts->outputstream != NULL)
+            fflush(opts->outputstream);
+        if (opts->xattroutputstream != NULL)
+            fflush(opts->xattroutputstream);
+
+        if (watch_wait(watch, opts->watch_delay, &waiting, &list, &count) != 0)
+        {
+            if (!STOPPED)
+                r = -1;
+            break;
+        }
+
+        dcpopts->list  = list;
+        dcpopts->nlist = count;
+        if (dcp(dest, opts->files, 1, dcpopts, &io_dcp_processor, ctx) != 0)
+            r = -1;
+        else
+            seal(opts);
+    } while (!STOPPED);
+
+    sigprocmask(SIG_SETMASK, &orig, NULL);
+    return r;
+}
+
+
+void stop(int sig)
+{
+    (void) sig;
+    STOPPED = 1;
+}
+
+
+void seal(const struct mainopts *opts)
+{
+    FILE *outs[2];
+    size_t i;
+
+    if (opts->sync == DURABLE_NONE)
+        return;
+
+    outs[0] = opts->outputstream;
+    outs[1] = opts->xattroutputstream;
+    for (i = 0; i < 2; i++)
+    {
+        if (outs[i] == NULL)
+            continue;
+
+        /* a pipe or terminal cannot be synced and needs not be */
+        io_metadata_put("durable    ", durable_name(opts->sync), outs[i]);
+        if (fflush(outs[i]) != 0 || (fsync(fileno(outs[i])) == -1 &&
+                errno != EINVAL))
+            log_error("cannot sync the output");
+    }
+}
+
+
 index_t *build_index(int digests, const char *paths[], size_t count)
 {
     index_t *idx;
@@ -516,6 +1084,10 @@ int print_metadata(FILE *out, const char *version, int argc,
     int dsize;
     char *cwd;
     char hostname[HOST_NAME_MAX + 1];
+    char engines[ENGINE_CLASSES][32];
+    char shard[64];
+    const char *names[ENGINE_CLASSES];
+    int i;
 
     if (out == NULL)
         return 0;
@@ -555,6 +1127,13 @@ int print_metadata(FILE *out, const char *version, int argc,
 
     io_metadata_put_json("sources    ", opts->filecount, opts->files, out);
     io_metadata_put_json("destination",1,(const char **) &opts->dest, out);
+    if (opts->destcount > 0)
+        io_metadata_put_json("dests      ", opts->destcount, opts->dests, out);
+    if (opts->files_from != NULL)
+        io_metadata_put_json("files_from ", 1,
+                (const char **) &opts->files_from, out);
+    if (opts->tar != NULL)
+        io_metadata_put_json("tar        ", 1, (const char **) &opts->tar, out);
     io_metadata_put_json("output     ",1,(const char**)&opts->outfilename,out);
 
     if (opts->username != NULL)
@@ -563,6 +1142,25 @@ int print_metadata(FILE *out, const char *version, int argc,
     if (opts->groupname != NULL)
         io_metadata_put( "data_group ", opts->groupname, out);
 
+    /* the copy engine used for each size class */
+    if (engines_named(opts))
+    {
+        for (i = 0; i < ENGINE_CLASSES; i++)
+        {
+            snprintf(engines[i], sizeof(engines[i]), "%s=%s",
+                    engine_class_name(i), engine_name(opts->engines[i]));
+            names[i] = engines[i];
+        }
+        io_metadata_put_strs("engines    ", ENGINE_CLASSES, names, ", ", out);
+    }
+
+    /* which share of the copy this output holds, dcp-merge reads it */
+    if (opts->shards > 0)
+    {
+        snprintf(shard, sizeof(shard), "%zu/%zu", opts->shard, opts->shards);
+        io_metadata_put("shard      ", shard, out);
+    }
+
     return 0;
 }
 
@@ -0,0 +1,230 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Entry point for dcp-merge. A copy split with `dcp --shard I/N` leaves one
+ * output per shard, dcp-merge combines them into the output a single run would
+ * have written. Every shard of the copy must be given exactly once, the
+ * metadata of shard 0 is kept followed by the entries of every shard in shard
+ * order. Each entry is reported by exactly one shard so nothing is dropped or
+ * repeated. Works the same on the --xattr outputs.
+ *
+ *      dcp-merge [-o FILE] OUTPUT...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io/io_metadata.h"
+#include "logging.h"
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * the metadata key dcp records the shard under, @see print_metadata
+ */
+#define SHARD_KEY   "#shard "
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * one of the outputs being merged
+ */
+struct part {
+    const char *path;
+    FILE *in;
+    size_t shard;       /**< which share it holds */
+    size_t shards;      /**< # of shares in the copy */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * open `part->path` and read its shard from the metadata
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int part_open(struct part *part);
+
+
+/**
+ * Copy the lines of `part` to `out`, either the metadata lines without the
+ * shard or the entries.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int part_copy(struct part *part, int metadata, FILE *out);
+
+
+/* Main ***********************************************************************/
+
+
+int main(int argc, char *argv[])
+{
+    struct part *parts;
+    struct part *byshard;
+    const char **paths;
+    const char *outpath;
+    FILE *out;
+    size_t count;
+    size_t i;
+    int c;
+
+    outpath = NULL;
+    while ((c = getopt(argc, argv, "o:D")) != -1)
+    {
+        switch (c)
+        {
+        case 'o': outpath = optarg;             break;
+        case 'D': logging_debug_mode = 1;       break;
+        default:
+            fprintf(stderr, "usage: dcp-merge [-o FILE] OUTPUT...\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    count = argc - optind;
+    if (count == 0)
+        log_critx(EXIT_FAILURE, "missing output operand");
+
+    parts = calloc(count, sizeof(struct part));
+    byshard = calloc(count, sizeof(struct part));
+    paths = calloc(count, sizeof(char *));
+    if (parts == NULL || byshard == NULL || paths == NULL)
+        log_critx(EXIT_FAILURE, "cannot allocate %zu outputs", count);
+
+    /* every shard of the same copy, each exactly once */
+    for (i = 0; i < count; i++)
+    {
+        parts[i].path = argv[optind + i];
+        if (part_open(&parts[i]) != 0)
+            return EXIT_FAILURE;
+
+        if (parts[i].shards != parts[0].shards)
+            log_critx(EXIT_FAILURE, "'%s' is a shard of %zu, '%s' of %zu",
+                    parts[i].path, parts[i].shards, parts[0].path,
+                    parts[0].shards);
+        if (parts[i].shards != count)
+            log_critx(EXIT_FAILURE, "%zu of %zu shards given", count,
+                    parts[i].shards);
+        if (byshard[parts[i].shard].path != NULL)
+            log_critx(EXIT_FAILURE, "'%s' and '%s' are both shard %zu",
+                    byshard[parts[i].shard].path, parts[i].path,
+                    parts[i].shard);
+        byshard[parts[i].shard] = parts[i];
+    }
+
+    out = stdout;
+    if (outpath != NULL && (out = fopen(outpath, "w")) == NULL)
+        log_crit(EXIT_FAILURE, "cannot open '%s'", outpath);
+
+    /* shard 0's view of the run and where the entries came from */
+    if (part_copy(&byshard[0], 1, out) != 0)
+        return EXIT_FAILURE;
+    for (i = 0; i < count; i++)
+        paths[i] = byshard[i].path;
+    io_metadata_put_json("merged     ", count, paths, out);
+
+    for (i = 0; i < count; i++)
+    {
+        if (part_copy(&byshard[i], 0, out) != 0)
+            return EXIT_FAILURE;
+        fclose(byshard[i].in);
+    }
+
+    if (fclose(out) != 0)
+        log_crit(EXIT_FAILURE, "cannot write '%s'",
+                outpath == NULL? "stdout" : outpath);
+
+    free(paths);
+    free(byshard);
+    free(parts);
+    return EXIT_SUCCESS;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int part_open(struct part *part)
+{
+    char *line;
+    size_t len;
+    char *val;
+    int found;
+
+    if ((part->in = fopen(part->path, "r")) == NULL)
+    {
+        log_error("cannot open '%s'", part->path);
+        return -1;
+    }
+
+    /* the metadata comes before the first entry */
+    line = NULL;
+    len = 0;
+    found = 0;
+    while (!found && getline(&line, &len, part->in) != -1 && line[0] == '#')
+    {
+        if (strncmp(line, SHARD_KEY, strlen(SHARD_KEY)) != 0 ||
+                (val = strchr(line, '\t')) == NULL)
+            continue;
+
+        if (sscanf(val + 1, "%zu/%zu", &part->shard, &part->shards) != 2 ||
+                part->shards == 0 || part->shard >= part->shards)
+            break;
+        found = 1;
+    }
+    free(line);
+
+    if (!found)
+    {
+        log_errorx("'%s' is not the output of a shard", part->path);
+        fclose(part->in);
+        return -1;
+    }
+    return 0;
+}
+
+
+int part_copy(struct part *part, int metadata, FILE *out)
+{
+    char *line;
+    size_t len;
+    ssize_t n;
+
+    rewind(part->in);
+
+    line = NULL;
+    len = 0;
+    while ((n = getline(&line, &len, part->in)) != -1)
+    {
+        if ((line[0] == '#') != metadata)
+            continue;
+        if (metadata && strncmp(line, SHARD_KEY, strlen(SHARD_KEY)) == 0)
+            continue;
+        if (fwrite(line, 1, n, out) != (size_t) n)
+        {
+            log_error("cannot write entries of '%s'", part->path);
+            free(line);
+            return -1;
+        }
+    }
+
+    free(line);
+    if (ferror(part->in))
+    {
+        log_error("cannot read '%s'", part->path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,613 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the uring.h API using the io_uring_setup(2),
+ * io_uring_enter(2) and io_uring_register(2) system calls directly. Only a
+ * single thread may use a ring, dcp's walk is the only submitter and reaper.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "config.h"     /* generated by autotools */
+#include "uring.h"
+#include "logging.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+
+/* Macros *********************************************************************/
+
+
+/**
+ * the ring's indexes are shared with the kernel, reads of indexes the kernel
+ * writes must acquire and writes of ours must release
+ */
+#define LOAD_ACQUIRE(_p)        __atomic_load_n((_p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(_p, _v)   __atomic_store_n((_p), (_v), __ATOMIC_RELEASE)
+
+
+/* Type Defs ******************************************************************/
+
+
+struct uring {
+    int fd;                         /**< the ring's file descriptor */
+
+    void *sqmap;                    /**< mapping of the submission ring */
+    size_t sqlen;                   /**< bytes mapped at sqmap */
+    void *cqmap;                    /**< mapping of the completion ring */
+    size_t cqlen;                   /**< bytes mapped at cqmap, 0 if shared */
+    struct io_uring_sqe *sqes;      /**< the submission queue entries */
+    size_t sqeslen;                 /**< bytes mapped at sqes */
+
+    unsigned *sqhead;               /**< kernel's consumer index */
+    unsigned *sqtail;               /**< our producer index */
+    unsigned *sqmask;
+    unsigned *sqarray;
+    unsigned *cqhead;               /**< our consumer index */
+    unsigned *cqtail;               /**< kernel's producer index */
+    unsigned *cqmask;
+    struct io_uring_cqe *cqes;
+
+    unsigned entries;               /**< size of the submission queue */
+    unsigned tail;                  /**< local tail, published on submit */
+    unsigned queued;                /**< entries queued but not submitted */
+    size_t pending;                 /**< requests not returned by wait */
+
+    unsigned char supported[IORING_OP_LAST]; /**< probe results by opcode */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * io_uring_enter(2) retrying on EINTR
+ */
+static int enter(struct uring *ring, unsigned submit, unsigned wait,
+        unsigned flags);
+
+
+/**
+ * fill `supported` with what opcodes the running kernel knows of
+ */
+static void probe(struct uring *ring);
+
+
+/**
+ * return a zeroed entry to describe the next request, submitting the queue
+ * first if it is full
+ */
+static struct io_uring_sqe *next_sqe(struct uring *ring);
+
+
+/**
+ * fill the fields common to every request
+ */
+static inline int prep(struct uring *ring, int op, int fd, uint64_t addr,
+        unsigned len, uint64_t off, uint64_t data);
+
+
+/* Public Impl ****************************************************************/
+
+
+int uring_create(uring_t **ring, unsigned entries)
+{
+    struct io_uring_params p;
+    struct uring *r;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    if ((fd = syscall(__NR_io_uring_setup, entries, &p)) == -1)
+        return -1;
+
+    if ((r = calloc(1, sizeof(*r))) == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    /* newer kernels map both rings with a single mmap */
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cqlen > r->sqlen)
+            r->sqlen = r->cqlen;
+        r->cqlen = 0;
+    }
+
+    r->sqmap = mmap(NULL, r->sqlen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sqmap == MAP_FAILED)
+        goto failed;
+
+    if (r->cqlen == 0)
+        r->cqmap = r->sqmap;
+    else if ((r->cqmap = mmap(NULL, r->cqlen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+        r->cqlen = 0;
+        goto failed;
+    }
+
+    r->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqeslen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        r->sqes = NULL;
+        goto failed;
+    }
+
+    r->sqhead  = (unsigned *) ((char *) r->sqmap + p.sq_off.head);
+    r->sqtail  = (unsigned *) ((char *) r->sqmap + p.sq_off.tail);
+    r->sqmask  = (unsigned *) ((char *) r->sqmap + p.sq_off.ring_mask);
+    r->sqarray = (unsigned *) ((char *) r->sqmap + p.sq_off.array);
+    r->cqhead  = (unsigned *) ((char *) r->cqmap + p.cq_off.head);
+    r->cqtail  = (unsigned *) ((char *) r->cqmap + p.cq_off.tail);
+    r->cqmask  = (unsigned *) ((char *) r->cqmap + p.cq_off.ring_mask);
+    r->cqes    = (struct io_uring_cqe *) ((char *) r->cqmap + p.cq_off.cqes);
+    r->tail    = *r->sqtail;
+
+    probe(r);
+    *ring = r;
+    return 0;
+
+failed:
+    if (r->sqmap != MAP_FAILED && r->sqmap != NULL)
+        munmap(r->sqmap, r->sqlen);
+    if (r->cqlen != 0)
+        munmap(r->cqmap, r->cqlen);
+    close(fd);
+    free(r);
+    return -1;
+}
+
+
+void uring_free(uring_t *ring)
+{
+    if (ring == NULL)
+        return;
+
+    munmap(ring->sqes, ring->sqeslen);
+    if (ring->cqlen != 0)
+        munmap(ring->cqmap, ring->cqlen);
+    munmap(ring->sqmap, ring->sqlen);
+    close(ring->fd);
+    free(ring);
+}
+
+
+int uring_supports(uring_t *ring, uring_op_t op)
+{
+    switch (op)
+    {
+    case URING_READ:        return ring->supported[IORING_OP_READ];
+    case URING_WRITE:       return ring->supported[IORING_OP_WRITE];
+    case URING_OPENAT:      return ring->supported[IORING_OP_OPENAT];
+    case URING_CLOSE:       return ring->supported[IORING_OP_CLOSE];
+#if HAVE_DECL_IORING_OP_STATX
+    case URING_STATX:       return ring->supported[IORING_OP_STATX];
+#endif
+#if HAVE_DECL_IORING_OP_MKDIRAT
+    case URING_MKDIRAT:     return ring->supported[IORING_OP_MKDIRAT];
+#endif
+#if HAVE_DECL_IORING_OP_SYMLINKAT
+    case URING_SYMLINKAT:   return ring->supported[IORING_OP_SYMLINKAT];
+#endif
+    case URING_FSYNC:       return ring->supported[IORING_OP_FSYNC];
+    default:                return 0;
+    }
+}
+
+
+int uring_openat(uring_t *ring, int dirfd, const char *path, int flags,
+        mode_t mode, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (prep(ring, IORING_OP_OPENAT, dirfd, (uintptr_t) path, mode, 0, data))
+        return -1;
+    sqe = &ring->sqes[(ring->tail - 1) & *ring->sqmask];
+    sqe->open_flags = flags;
+    return 0;
+}
+
+
+int uring_read(uring_t *ring, int fd, void *buf, size_t len, off_t offset,
+        uint64_t data)
+{
+    return prep(ring, IORING_OP_READ, fd, (uintptr_t) buf, len, offset, data);
+}
+
+
+int uring_write(uring_t *ring, int fd, const void *buf, size_t len,
+        off_t offset, uint64_t data)
+{
+    return prep(ring, IORING_OP_WRITE, fd, (uintptr_t) buf, len, offset, data);
+}
+
+
+int uring_close(uring_t *ring, int fd, uint64_t data)
+{
+    return prep(ring, IORING_OP_CLOSE, fd, 0, 0, 0, data);
+}
+
+
+int uring_fdatasync(uring_t *ring, int fd, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (prep(ring, IORING_OP_FSYNC, fd, 0, 0, 0, data))
+        return -1;
+    sqe = &ring->sqes[(ring->tail - 1) & *ring->sqmask];
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    return 0;
+}
+
+
+/*
+ * the headers the opcodes below first appear in are newer than the ones for
+ * the rest of the ring, without them the request is never supported
+ */
+
+
+int uring_statx(uring_t *ring, int dirfd, const char *path, int flags,
+        unsigned mask, void *stx, uint64_t data)
+{
+#if HAVE_DECL_IORING_OP_STATX
+    struct io_uring_sqe *sqe;
+
+    if (prep(ring, IORING_OP_STATX, dirfd, (uintptr_t) path, mask,
+            (uintptr_t) stx, data))
+        return -1;
+    sqe = &ring->sqes[(ring->tail - 1) & *ring->sqmask];
+    sqe->statx_flags = flags;
+    return 0;
+#else
+    (void) ring;
+    (void) dirfd;
+    (void) path;
+    (void) flags;
+    (void) mask;
+    (void) stx;
+    (void) data;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+int uring_mkdirat(uring_t *ring, int dirfd, const char *path, mode_t mode,
+        uint64_t data)
+{
+#if HAVE_DECL_IORING_OP_MKDIRAT
+    return prep(ring, IORING_OP_MKDIRAT, dirfd, (uintptr_t) path, mode, 0,
+            data);
+#else
+    (void) ring;
+    (void) dirfd;
+    (void) path;
+    (void) mode;
+    (void) data;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+int uring_symlinkat(uring_t *ring, const char *target, int dirfd,
+        const char *path, uint64_t data)
+{
+#if HAVE_DECL_IORING_OP_SYMLINKAT
+    return prep(ring, IORING_OP_SYMLINKAT, dirfd, (uintptr_t) target, 0,
+            (uintptr_t) path, data);
+#else
+    (void) ring;
+    (void) target;
+    (void) dirfd;
+    (void) path;
+    (void) data;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+int uring_submit(uring_t *ring)
+{
+    int r;
+
+    if (ring->queued == 0)
+        return 0;
+
+    STORE_RELEASE(ring->sqtail, ring->tail);
+    if ((r = enter(ring, ring->queued, 0, 0)) == -1)
+        return -1;
+
+    ring->queued -= r;
+    return 0;
+}
+
+
+int uring_wait(uring_t *ring, uint64_t *data, int *result)
+{
+    unsigned head;
+    struct io_uring_cqe *cqe;
+
+    if (uring_submit(ring) == -1)
+        return -1;
+
+    head = *ring->cqhead;
+    while (head == LOAD_ACQUIRE(ring->cqtail))
+    {
+        if (ring->pending == 0)
+        {
+            errno = EINVAL; /* nothing will ever complete */
+            return -1;
+        }
+        if (enter(ring, 0, 1, IORING_ENTER_GETEVENTS) == -1)
+            return -1;
+    }
+
+    cqe = &ring->cqes[head & *ring->cqmask];
+    *data = cqe->user_data;
+    *result = cqe->res;
+    STORE_RELEASE(ring->cqhead, head + 1);
+    ring->pending--;
+    return 0;
+}
+
+
+size_t uring_pending(const uring_t *ring)
+{
+    return ring->pending;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int enter(struct uring *ring, unsigned submit, unsigned wait, unsigned flags)
+{
+    int r;
+
+    if (wait > 0)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    while ((r = syscall(__NR_io_uring_enter, ring->fd, submit, wait, flags,
+            NULL, 0)) == -1 && errno == EINTR)
+        continue;
+
+    return r;
+}
+
+
+void probe(struct uring *ring)
+{
+    struct io_uring_probe *p;
+    size_t size;
+    unsigned i;
+
+    size = sizeof(*p) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    if ((p = calloc(1, size)) == NULL)
+        return;
+
+    /* kernels older than 5.6 cannot be probed, treat everything as missing */
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, p,
+            IORING_OP_LAST) == 0)
+    {
+        for (i = 0; i < p->ops_len && i < IORING_OP_LAST; i++)
+            ring->supported[i] = (p->ops[i].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    free(p);
+}
+
+
+struct io_uring_sqe *next_sqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    /* the kernel consumes submitted entries immediately, make room */
+    if (ring->tail - LOAD_ACQUIRE(ring->sqhead) >= ring->entries)
+        if (uring_submit(ring) == -1)
+            return NULL;
+
+    idx = ring->tail & *ring->sqmask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqarray[idx] = idx;
+    ring->tail++;
+    ring->queued++;
+    ring->pending++;
+    return sqe;
+}
+
+
+inline int prep(struct uring *ring, int op, int fd, uint64_t addr,
+        unsigned len, uint64_t off, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = next_sqe(ring)) == NULL)
+        return -1;
+
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = data;
+    return 0;
+}
+
+
+#else /* HAVE_LINUX_IO_URING_H */
+
+
+/*
+ * built without io_uring support, creating a ring always fails so nothing
+ * else can be called
+ */
+
+
+int uring_create(uring_t **ring, unsigned entries)
+{
+    (void) ring;
+    (void) entries;
+    errno = ENOSYS;
+    return -1;
+}
+
+
+void uring_free(uring_t *ring)
+{
+    (void) ring;
+}
+
+
+int uring_supports(uring_t *ring, uring_op_t op)
+{
+    (void) ring;
+    (void) op;
+    return 0;
+}
+
+
+int uring_openat(uring_t *ring, int dirfd, const char *path, int flags,
+        mode_t mode, uint64_t data)
+{
+    (void) ring;
+    (void) dirfd;
+    (void) path;
+    (void) flags;
+    (void) mode;
+    (void) data;
+    return -1;
+}
+
+
+int uring_read(uring_t *ring, int fd, void *buf, size_t len, off_t offset,
+        uint64_t data)
+{
+    (void) ring;
+    (void) fd;
+    (void) buf;
+    (void) len;
+    (void) offset;
+    (void) data;
+    return -1;
+}
+
+
+int uring_write(uring_t *ring, int fd, const void *buf, size_t len,
+        off_t offset, uint64_t data)
+{
+    (void) ring;
+    (void) fd;
+    (void) buf;
+    (void) len;
+    (void) offset;
+    (void) data;
+    return -1;
+}
+
+
+int uring_close(uring_t *ring, int fd, uint64_t data)
+{
+    (void) ring;
+    (void) fd;
+    (void) data;
+    return -1;
+}
+
+
+int uring_fdatasync(uring_t *ring, int fd, uint64_t data)
+{
+    (void) ring;
+    (void) fd;
+    (void) data;
+    return -1;
+}
+
+
+int uring_statx(uring_t *ring, int dirfd, const char *path, int flags,
+        unsigned mask, void *stx, uint64_t data)
+{
+    (void) ring;
+    (void) dirfd;
+    (void) path;
+    (void) flags;
+    (void) mask;
+    (void) stx;
+    (void) data;
+    return -1;
+}
+
+
+int uring_mkdirat(uring_t *ring, int dirfd, const char *path, mode_t mode,
+        uint64_t data)
+{
+    (void) ring;
+    (void) dirfd;
+    (void) path;
+    (void) mode;
+    (void) data;
+    return -1;
+}
+
+
+int uring_symlinkat(uring_t *ring, const char *target, int dirfd,
+        const char *path, uint64_t data)
+{
+    (void) ring;
+    (void) target;
+    (void) dirfd;
+    (void) path;
+    (void) data;
+    return -1;
+}
+
+
+int uring_submit(uring_t *ring)
+{
+    (void) ring;
+    return -1;
+}
+
+
+int uring_wait(uring_t *ring, uint64_t *data, int *result)
+{
+    (void) ring;
+    (void) data;
+    (void) result;
+    return -1;
+}
+
+
+size_t uring_pending(const uring_t *ring)
+{
+    (void) ring;
+    return 0;
+}
+
+
+#endif /* HAVE_LINUX_IO_URING_H */
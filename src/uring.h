@@ -0,0 +1,163 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Thin wrapper over the raw io_uring system calls. Each uring_<op> function
+ * queues one request tagged with `data`, requests are handed to the kernel by
+ * uring_submit or uring_wait and their results are collected by uring_wait.
+ * When the submission queue is full the queued requests are submitted first so
+ * queuing never fails for lack of room.
+ *
+ * Kernel headers are not exposed by this API. If dcp was built without
+ * linux/io_uring.h, or the kernel refuses to create a ring, uring_create fails
+ * and callers fall back to plain system calls.
+ */
+#ifndef URING_H__
+#define URING_H__
+
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * an io_uring instance with its mapped submission and completion queues
+ */
+typedef struct uring uring_t;
+
+
+/**
+ * operations that can be queued, used to ask if the kernel supports them
+ */
+typedef enum {
+    URING_READ,
+    URING_WRITE,
+    URING_OPENAT,
+    URING_CLOSE,
+    URING_STATX,
+    URING_MKDIRAT,
+    URING_SYMLINKAT,
+    URING_FSYNC
+} uring_op_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Create a ring able to hold `entries` requests before they must be submitted.
+ *
+ * @param ring      where to store the new ring
+ * @param entries   submission queue size, rounded up to a power of 2
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+int uring_create(uring_t **ring, unsigned entries);
+
+
+/**
+ * Unmap the queues and close the ring, NULL is ignored. Requests still in
+ * flight are left to the kernel.
+ */
+void uring_free(uring_t *ring);
+
+
+/**
+ * @return          1 if the kernel supports `op`, 0 otherwise
+ */
+int uring_supports(uring_t *ring, uring_op_t op);
+
+
+/**
+ * queue an openat(2) of `path`, the result is the new fd. `path` must stay
+ * valid until the request completes.
+ */
+int uring_openat(uring_t *ring, int dirfd, const char *path, int flags,
+        mode_t mode, uint64_t data);
+
+
+/**
+ * queue a pread(2) of up to `len` bytes, the result is the # of bytes read
+ */
+int uring_read(uring_t *ring, int fd, void *buf, size_t len, off_t offset,
+        uint64_t data);
+
+
+/**
+ * queue a pwrite(2) of up to `len` bytes, the result is the # of bytes written
+ */
+int uring_write(uring_t *ring, int fd, const void *buf, size_t len,
+        off_t offset, uint64_t data);
+
+
+/**
+ * queue a close(2) of `fd`
+ */
+int uring_close(uring_t *ring, int fd, uint64_t data);
+
+
+/**
+ * queue an fdatasync(2) of `fd`
+ */
+int uring_fdatasync(uring_t *ring, int fd, uint64_t data);
+
+
+/**
+ * queue a statx(2) of `path` storing the result in `stx`, which is a
+ * `struct statx`. Both must stay valid until the request completes.
+ */
+int uring_statx(uring_t *ring, int dirfd, const char *path, int flags,
+        unsigned mask, void *stx, uint64_t data);
+
+
+/**
+ * queue a mkdirat(2) of `path`
+ */
+int uring_mkdirat(uring_t *ring, int dirfd, const char *path, mode_t mode,
+        uint64_t data);
+
+
+/**
+ * queue a symlinkat(2) creating `path` pointing at `target`
+ */
+int uring_symlinkat(uring_t *ring, const char *target, int dirfd,
+        const char *path, uint64_t data);
+
+
+/**
+ * hand all queued requests to the kernel without waiting for any of them
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+int uring_submit(uring_t *ring);
+
+
+/**
+ * Submit the queued requests and wait for one to complete.
+ *
+ * @param ring      the ring to wait on
+ * @param data      set to the tag the request was queued with
+ * @param result    set to the request's result, -errno on failure
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+int uring_wait(uring_t *ring, uint64_t *data, int *result);
+
+
+/**
+ * @return          # of requests queued or in flight that have not been
+ *                  returned by uring_wait
+ */
+size_t uring_pending(const uring_t *ring);
+
+
+#endif
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# --watch copies a file created below directories made while watching, and
+# reports each directory once however many batches lead through it.
+#
+# DCP is the dcp to run, src/dcp of the build tree by default.
+
+DCP=${DCP:-src/dcp}
+
+dir=$(mktemp -d) || exit 99
+trap 'kill $pid 2>/dev/null; rm -rf "$dir"' EXIT
+
+# wait up to 5s for `$1` to exist
+await()
+{
+    i=0
+    while [ ! -e "$1" ]
+    do
+        [ $i -ge 50 ] && return 1
+        sleep 0.1
+        i=$((i + 1))
+    done
+}
+
+# # of records of the output with the path `$1`
+records()
+{
+    grep -c -e "\"path\":\"$1\"}" -e "\"path\":\"$1\"," "$dir/out"
+}
+
+fail()
+{
+    echo "FAIL: $*"
+    cat "$dir/err"
+    exit 1
+}
+
+mkdir "$dir/src" && echo old > "$dir/src/f" || exit 99
+
+"$DCP" --watch --watch-delay 100 -o "$dir/out" "$dir/src" "$dir/dst" \
+        2> "$dir/err" &
+pid=$!
+await "$dir/dst/f" || fail "the first copy was not made"
+
+# one batch creates the directories, the next only leads through them
+mkdir -p "$dir/src/a/b/c"
+await "$dir/dst/a/b/c" || fail "the new directories were not copied"
+sleep 0.5
+echo new > "$dir/src/a/b/c/new"
+await "$dir/dst/a/b/c/new" || fail "the nested file was not copied"
+echo more > "$dir/src/g"
+await "$dir/dst/g" || fail "the last file was not copied"
+
+kill -INT $pid
+wait $pid || fail "dcp exited with $?"
+pid=
+
+[ "$(cat "$dir/dst/a/b/c/new")" = new ] || fail "the nested copy differs"
+for path in / /a /a/b /a/b/c /a/b/c/new /f /g
+do
+    n=$(records "$path")
+    [ "$n" = 1 ] || fail "$n records of '$path'"
+done
+exit 0